@@ -0,0 +1,439 @@
+/**
+ * @file fpu.c
+ * @brief x87/SSE/AVX浮点上下文的保存与恢复
+ *
+ * 每个线程的浮点上下文保存在从slab内存池中分配的XSAVE（或FXSAVE）区域中，
+ * 线程第一次使用浮点单元时（#NM异常）才分配。
+ *
+ * 不变式：CR0.TS被置位时，所有进程的保存区域都是最新的；CR0.TS被清除时，
+ * 寄存器中是__fpu_owner[cpu]的上下文，并且可能比其保存区域更新。
+ *
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "fpu.h"
+#include <common/cpu.h>
+#include <common/kprint.h>
+#include <common/spinlock.h>
+#include <mm/slab.h>
+#include <process/process.h>
+#include <driver/multiboot2/multiboot2.h>
+
+#define CR0_TS (1UL << 3)
+#define CR4_OSXSAVE (1UL << 18)
+
+// CPUID.1:ECX
+#define CPUID_1_ECX_XSAVE (1U << 26)
+#define CPUID_1_ECX_AVX (1U << 28)
+// CPUID.(EAX=0xD,ECX=1):EAX
+#define CPUID_D_1_EAX_XSAVEOPT (1U << 0)
+
+// XSAVE区域中，xstate header（XSTATE_BV等）的偏移量与大小
+#define XSAVE_HEADER_OFFSET 512
+#define XSAVE_HEADER_SIZE 64
+
+// 浮点单元复位后FCW与MXCSR的值
+#define FPU_INIT_FCW 0x37f
+#define FPU_INIT_MXCSR 0x1f80
+
+int fpu_mode = FPU_MODE_LAZY;
+uint32_t fpu_state_size = FPU_FXSAVE_SIZE;
+
+static bool __fpu_initialized = false;
+static bool __fpu_use_xsave = false;
+static bool __fpu_use_xsaveopt = false;
+// 启用的状态组件（XCR0）
+static uint64_t __fpu_xfeatures = 0;
+
+// 浮点上下文保存区域的内存池（slab_create()不会初始化内存池的锁，由这里加锁）
+static struct slab *__fpu_state_pool = NULL;
+static spinlock_t __fpu_state_pool_lock;
+
+// 每个cpu的寄存器中保存的是哪个进程的浮点上下文
+static struct process_control_block *__fpu_owner[MAX_CPU_NUM];
+static struct fpu_stat_t __fpu_stat[MAX_CPU_NUM];
+
+static __always_inline void __fpu_clts()
+{
+    __asm__ __volatile__("clts" ::: "memory");
+}
+
+static __always_inline uint64_t __fpu_read_cr0()
+{
+    uint64_t cr0;
+    __asm__ __volatile__("movq %%cr0, %0" : "=r"(cr0)::"memory");
+    return cr0;
+}
+
+static __always_inline void __fpu_stts()
+{
+    __asm__ __volatile__("movq %0, %%cr0" ::"r"(__fpu_read_cr0() | CR0_TS) : "memory");
+}
+
+static __always_inline void __fpu_xsetbv(uint32_t index, uint64_t value)
+{
+    __asm__ __volatile__("xsetbv" ::"c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+/**
+ * @brief 将寄存器中的浮点上下文保存到area
+ *
+ * @param area 保存区域（64字节对齐）
+ */
+static __always_inline void __fpu_save(void *area)
+{
+    uint32_t lo = (uint32_t)__fpu_xfeatures, hi = (uint32_t)(__fpu_xfeatures >> 32);
+    if (__fpu_use_xsaveopt)
+        __asm__ __volatile__("xsaveopt64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else if (__fpu_use_xsave)
+        __asm__ __volatile__("xsave64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ __volatile__("fxsave64 (%0)" ::"r"(area) : "memory");
+}
+
+/**
+ * @brief 从area恢复浮点上下文
+ *
+ * @param area 保存区域（64字节对齐）
+ */
+static __always_inline void __fpu_restore(void *area)
+{
+    uint32_t lo = (uint32_t)__fpu_xfeatures, hi = (uint32_t)(__fpu_xfeatures >> 32);
+    if (__fpu_use_xsave)
+        __asm__ __volatile__("xrstor64 (%0)" ::"r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ __volatile__("fxrstor64 (%0)" ::"r"(area) : "memory");
+}
+
+/**
+ * @brief 将保存区域设置为浮点单元复位后的状态
+ *
+ * @param area 保存区域
+ */
+static void __fpu_init_state(void *area)
+{
+    memset(area, 0, fpu_state_size);
+    // FXSAVE区域中，FCW位于偏移量0处，MXCSR位于偏移量24处
+    *(uint16_t *)area = FPU_INIT_FCW;
+    *(uint32_t *)(area + 24) = FPU_INIT_MXCSR;
+    // XSAVE区域的xstate header全为0，表示所有状态组件都处于初始状态
+}
+
+/**
+ * @brief 分配浮点上下文保存区域（需要关闭中断）
+ *
+ * @return void* 保存区域的地址，失败时返回NULL
+ */
+static void *__fpu_alloc_state()
+{
+    spin_lock(&__fpu_state_pool_lock);
+    void *area = slab_malloc(__fpu_state_pool, 0);
+    spin_unlock(&__fpu_state_pool_lock);
+    if (likely(area != NULL))
+        ++__fpu_stat[proc_current_cpu_id].nr_allocs;
+    return area;
+}
+
+/**
+ * @brief 判断寄存器中是否为该进程的浮点上下文（需要关闭中断）
+ */
+static __always_inline bool __fpu_regs_owned(struct process_control_block *pcb, int cpu)
+{
+    return __fpu_owner[cpu] == pcb && pcb->thread->fpu_cpu == cpu;
+}
+
+/**
+ * @brief 判断寄存器中的浮点上下文是否属于该进程，并且可能比其保存区域更新（需要关闭中断）
+ */
+static __always_inline bool __fpu_live(struct process_control_block *pcb, int cpu)
+{
+    return !(__fpu_read_cr0() & CR0_TS) && __fpu_regs_owned(pcb, cpu);
+}
+
+/**
+ * @brief 从内核启动参数中解析"fpu=lazy"或"fpu=eager"
+ *
+ */
+static void __fpu_parse_cmdline()
+{
+    char cmdline[256] = {0};
+    unsigned int size = sizeof(cmdline);
+    multiboot2_iter(multiboot2_get_cmdline, cmdline, &size);
+
+    const char *key = "fpu=";
+    for (char *p = cmdline; *p != '\0'; ++p)
+    {
+        // 只匹配参数的开头
+        if (p != cmdline && *(p - 1) != ' ')
+            continue;
+        int i = 0;
+        while (key[i] != '\0' && p[i] == key[i])
+            ++i;
+        if (key[i] != '\0')
+            continue;
+
+        char *val = p + i;
+        int len = 0;
+        while (val[len] != '\0' && val[len] != ' ')
+            ++len;
+        if (len == 5 && val[0] == 'e' && val[1] == 'a' && val[2] == 'g' && val[3] == 'e' && val[4] == 'r')
+            fpu_mode = FPU_MODE_EAGER;
+        else if (len == 4 && val[0] == 'l' && val[1] == 'a' && val[2] == 'z' && val[3] == 'y')
+            fpu_mode = FPU_MODE_LAZY;
+        else
+            kwarn("Unknown fpu mode in kernel command line, using default.");
+    }
+}
+
+/**
+ * @brief 在当前cpu上启用XSAVE以及检测到的状态组件
+ *
+ */
+static void __fpu_enable_xsave()
+{
+    uint64_t cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4)::"memory");
+    __asm__ __volatile__("movq %0, %%cr4" ::"r"(cr4 | CR4_OSXSAVE) : "memory");
+    __fpu_xsetbv(0, __fpu_xfeatures);
+}
+
+/**
+ * @brief 初始化浮点单元（BSP），检测XSAVE的支持情况，并根据内核启动参数选择上下文切换的策略
+ *
+ */
+void fpu_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    __fpu_use_xsave = (ecx & CPUID_1_ECX_XSAVE) != 0;
+
+    if (__fpu_use_xsave)
+    {
+        // CPUID.(EAX=0xD,ECX=0):EAX为处理器支持的状态组件
+        cpu_cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
+        __fpu_xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+        if ((eax & XFEATURE_AVX) && (ecx & CPUID_1_ECX_AVX))
+            __fpu_xfeatures |= XFEATURE_AVX;
+        __fpu_enable_xsave();
+
+        // 启用状态组件后，EBX为XCR0中启用的组件所需的保存区域大小
+        cpu_cpuid(0xd, 0, &eax, &ebx, &ecx, &edx);
+        fpu_state_size = ebx;
+        cpu_cpuid(0xd, 1, &eax, &ebx, &ecx, &edx);
+        __fpu_use_xsaveopt = (eax & CPUID_D_1_EAX_XSAVEOPT) != 0;
+    }
+    // XSAVE区域需要64字节对齐，slab内存池中的对象紧密排列，因此将大小向上对齐到64字节
+    fpu_state_size = (fpu_state_size + 63) & ~63U;
+
+    __fpu_parse_cmdline();
+
+    spin_init(&__fpu_state_pool_lock);
+    __fpu_state_pool = slab_create(fpu_state_size, NULL, NULL, 0);
+    spin_init(&__fpu_state_pool->lock);
+    memset(__fpu_owner, 0, sizeof(__fpu_owner));
+    memset(__fpu_stat, 0, sizeof(__fpu_stat));
+    barrier();
+    __fpu_initialized = true;
+
+    kinfo("FPU: %s, xfeatures=%#lx, state size=%d bytes, %s switching", __fpu_use_xsaveopt ? "xsaveopt" : (__fpu_use_xsave ? "xsave" : "fxsave"),
+          __fpu_xfeatures, fpu_state_size, fpu_mode == FPU_MODE_EAGER ? "eager" : "lazy");
+}
+
+/**
+ * @brief 在AP上启用与BSP相同的浮点状态组件
+ *
+ */
+void fpu_init_ap()
+{
+    if (__fpu_use_xsave)
+        __fpu_enable_xsave();
+}
+
+/**
+ * @brief 切换进程时，保存上一个进程的浮点上下文（若需要），并根据策略恢复或者延迟恢复下一个进程的上下文
+ * 在__switch_to()中调用，此时中断已经关闭
+ *
+ * @param prev 上一个进程的pcb
+ * @param next 将要切换到的进程的pcb
+ */
+void fpu_switch(struct process_control_block *prev, struct process_control_block *next)
+{
+    if (unlikely(!__fpu_initialized))
+        return;
+
+    int cpu = proc_current_cpu_id;
+    struct fpu_stat_t *stat = &__fpu_stat[cpu];
+    ++stat->nr_switches;
+
+    // 只有在本次运行期间使用过浮点单元的进程才需要保存（否则保存区域已经是最新的）
+    if (__fpu_live(prev, cpu) && prev->thread->fpu_state != NULL)
+    {
+        __fpu_save(prev->thread->fpu_state);
+        ++stat->nr_saves;
+    }
+
+    if (fpu_mode == FPU_MODE_EAGER && next->thread->fpu_state != NULL)
+    {
+        __fpu_clts();
+        if (__fpu_regs_owned(next, cpu))
+            ++stat->nr_restore_skip;
+        else
+        {
+            __fpu_restore(next->thread->fpu_state);
+            ++stat->nr_restores;
+            __fpu_owner[cpu] = next;
+            next->thread->fpu_cpu = cpu;
+        }
+        return;
+    }
+
+    // 延迟到进程第一次使用浮点单元时再恢复（尚未使用过浮点单元的进程也在那时分配保存区域）
+    __fpu_stts();
+}
+
+/**
+ * @brief 处理#NM异常：为当前进程恢复（或者初始化）浮点上下文
+ *
+ * @return true 异常已经处理
+ * @return false 浮点单元尚未初始化，异常无法处理
+ */
+bool fpu_handle_dev_not_available()
+{
+    if (unlikely(!__fpu_initialized))
+        return false;
+
+    // 必须在执行任何可能使用SSE的代码之前清除TS，否则会再次触发#NM
+    __fpu_clts();
+    uint64_t rflags;
+    local_irq_save(rflags);
+
+    int cpu = proc_current_cpu_id;
+    struct process_control_block *pcb = current_pcb;
+    struct fpu_stat_t *stat = &__fpu_stat[cpu];
+    ++stat->nr_traps;
+
+    if (__fpu_regs_owned(pcb, cpu))
+    {
+        ++stat->nr_restore_skip;
+        local_irq_restore(rflags);
+        return true;
+    }
+
+    if (pcb->thread->fpu_state == NULL)
+    {
+        void *area = __fpu_alloc_state();
+        if (unlikely(area == NULL))
+        {
+            local_irq_restore(rflags);
+            kerror("Failed to allocate fpu state for pid %ld.", pcb->pid);
+            return false;
+        }
+        __fpu_init_state(area);
+        pcb->thread->fpu_state = area;
+    }
+
+    __fpu_restore(pcb->thread->fpu_state);
+    ++stat->nr_restores;
+    __fpu_owner[cpu] = pcb;
+    pcb->thread->fpu_cpu = cpu;
+
+    local_irq_restore(rflags);
+    return true;
+}
+
+/**
+ * @brief fork时为子进程拷贝当前进程的浮点上下文
+ *
+ * @param pcb 子进程的pcb
+ */
+void fpu_copy_thread(struct process_control_block *pcb)
+{
+    pcb->thread->fpu_state = NULL;
+    pcb->thread->fpu_cpu = -1;
+    if (unlikely(!__fpu_initialized) || current_pcb->thread->fpu_state == NULL)
+        return;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    // 寄存器中的上下文可能比保存区域更新，先将其保存下来
+    if (__fpu_live(current_pcb, proc_current_cpu_id))
+        __fpu_save(current_pcb->thread->fpu_state);
+
+    void *area = __fpu_alloc_state();
+    if (likely(area != NULL))
+    {
+        memcpy(area, current_pcb->thread->fpu_state, fpu_state_size);
+        pcb->thread->fpu_state = area;
+    }
+    local_irq_restore(rflags);
+}
+
+/**
+ * @brief 将当前进程的浮点上下文重置为初始状态（execve时调用）
+ *
+ */
+void fpu_reset_thread()
+{
+    struct process_control_block *pcb = current_pcb;
+    if (unlikely(!__fpu_initialized) || pcb->thread->fpu_state == NULL)
+        return;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    __fpu_init_state(pcb->thread->fpu_state);
+    if (__fpu_live(pcb, proc_current_cpu_id))
+        __fpu_restore(pcb->thread->fpu_state);
+    local_irq_restore(rflags);
+}
+
+/**
+ * @brief 释放进程的浮点上下文保存区域
+ * 进程退出后仍然可能在内核中使用SSE而重新分配保存区域，因此回收pcb之前需要再次调用
+ *
+ * @param pcb 进程的pcb
+ */
+void fpu_exit_thread(struct process_control_block *pcb)
+{
+    if (unlikely(!__fpu_initialized))
+        return;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    for (int cpu = 0; cpu < MAX_CPU_NUM; ++cpu)
+    {
+        if (__fpu_owner[cpu] == pcb)
+            __fpu_owner[cpu] = NULL;
+    }
+    pcb->thread->fpu_cpu = -1;
+    // 退出的进程是当前进程：寄存器中的上下文已经不属于任何进程，再次使用时重新触发#NM
+    if (pcb == current_pcb)
+        __fpu_stts();
+
+    void *area = pcb->thread->fpu_state;
+    pcb->thread->fpu_state = NULL;
+    if (area != NULL)
+    {
+        spin_lock(&__fpu_state_pool_lock);
+        slab_free(__fpu_state_pool, area, 0);
+        spin_unlock(&__fpu_state_pool_lock);
+    }
+    local_irq_restore(rflags);
+}
+
+/**
+ * @brief 获取cpu的浮点上下文切换统计信息
+ *
+ * @param cpu cpu编号
+ * @param stat 返回的统计信息
+ */
+void fpu_get_stat(int cpu, struct fpu_stat_t *stat)
+{
+    uint64_t rflags;
+    local_irq_save(rflags);
+    memcpy(stat, &__fpu_stat[cpu], sizeof(struct fpu_stat_t));
+    local_irq_restore(rflags);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file fpu.h
+ * @brief x87/SSE/AVX浮点上下文的保存与恢复（XSAVE/FXSAVE）
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#pragma once
+
+#include <common/glib.h>
+
+// 延迟恢复：切换进程时设置CR0.TS，进程第一次使用浮点单元时通过#NM异常恢复其上下文
+#define FPU_MODE_LAZY 0
+// 立即恢复：切换进程时使用XSAVEOPT保存上一个进程的上下文，并立即恢复下一个进程的上下文
+#define FPU_MODE_EAGER 1
+
+// XCR0中的状态组件
+#define XFEATURE_X87 (1UL << 0)
+#define XFEATURE_SSE (1UL << 1)
+#define XFEATURE_AVX (1UL << 2)
+
+// FXSAVE区域的大小
+#define FPU_FXSAVE_SIZE 512
+
+/**
+ * @brief 每个cpu的浮点上下文切换统计信息
+ *
+ */
+struct fpu_stat_t
+{
+    uint64_t nr_switches;     // 进程切换的次数
+    uint64_t nr_saves;        // 切换时需要保存浮点上下文的次数
+    uint64_t nr_restores;     // 恢复浮点上下文的次数
+    uint64_t nr_restore_skip; // 寄存器中仍然是该进程的上下文，因而不需要恢复的次数
+    uint64_t nr_traps;        // #NM异常的次数
+    uint64_t nr_allocs;       // 分配浮点上下文保存区域的次数
+};
+
+struct process_control_block;
+
+extern int fpu_mode;
+// 浮点上下文保存区域的大小
+extern uint32_t fpu_state_size;
+
+/**
+ * @brief 初始化浮点单元（BSP），检测XSAVE的支持情况，并根据内核启动参数选择上下文切换的策略
+ *
+ */
+void fpu_init();
+
+/**
+ * @brief 在AP上启用与BSP相同的浮点状态组件
+ *
+ */
+void fpu_init_ap();
+
+/**
+ * @brief 切换进程时，保存上一个进程的浮点上下文（若需要），并根据策略恢复或者延迟恢复下一个进程的上下文
+ * 在__switch_to()中调用，此时中断已经关闭
+ *
+ * @param prev 上一个进程的pcb
+ * @param next 将要切换到的进程的pcb
+ */
+void fpu_switch(struct process_control_block *prev, struct process_control_block *next);
+
+/**
+ * @brief 处理#NM异常：为当前进程恢复（或者初始化）浮点上下文
+ *
+ * @return true 异常已经处理
+ * @return false 浮点单元尚未初始化，异常无法处理
+ */
+bool fpu_handle_dev_not_available();
+
+/**
+ * @brief fork时为子进程拷贝当前进程的浮点上下文
+ *
+ * @param pcb 子进程的pcb
+ */
+void fpu_copy_thread(struct process_control_block *pcb);
+
+/**
+ * @brief 将当前进程的浮点上下文重置为初始状态（execve时调用）
+ *
+ */
+void fpu_reset_thread();
+
+/**
+ * @brief 释放进程的浮点上下文保存区域
+ *
+ * @param pcb 进程的pcb
+ */
+void fpu_exit_thread(struct process_control_block *pcb);
+
+/**
+ * @brief 获取cpu的浮点上下文切换统计信息
+ *
+ * @param cpu cpu编号
+ * @param stat 返回的统计信息
+ */
+void fpu_get_stat(int cpu, struct fpu_stat_t *stat);
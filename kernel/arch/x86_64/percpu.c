@@ -0,0 +1,82 @@
+/**
+ * @file percpu.c
+ * @brief per-cpu区域的分配以及GS base的设置
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "percpu.h"
+#include <common/kprint.h>
+#include <common/errno.h>
+#include <mm/slab.h>
+#include <sched/sched.h>
+
+// per-cpu区域的大小：struct cpu_local_t，以及紧跟其后的就绪队列
+#define CPU_LOCAL_AREA_SIZE (sizeof(struct cpu_local_t) + sizeof(struct sched_queue_t))
+
+struct cpu_local_t *cpu_local_area[MAX_CPU_NUM] = {0};
+
+// BSP的per-cpu区域（BSP在内存管理模块初始化之前就需要使用per-cpu变量）
+static uint8_t __bsp_cpu_local_area[CPU_LOCAL_AREA_SIZE] __attribute__((aligned(CPU_LOCAL_ALIGN)));
+
+/**
+ * @brief 初始化per-cpu区域，并将其加载到当前cpu的GS base
+ *
+ * @param area per-cpu区域
+ * @param cpu cpu编号
+ */
+static void __cpu_local_load(struct cpu_local_t *area, int cpu)
+{
+    area->self = area;
+    area->cpu_id = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t)area);
+    // 用户态的GS base，在第一次返回用户态时被swapgs换入
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+/**
+ * @brief 初始化BSP的per-cpu区域，并将其加载到GS base（必须在使用任何per-cpu变量之前调用）
+ *
+ */
+void cpu_local_init_bsp()
+{
+    struct cpu_local_t *area = (struct cpu_local_t *)__bsp_cpu_local_area;
+    memset(area, 0, CPU_LOCAL_AREA_SIZE);
+    cpu_local_area[0] = area;
+    __cpu_local_load(area, 0);
+}
+
+/**
+ * @brief 为AP分配per-cpu区域（在BSP上，启动该AP之前调用）
+ * AP在加载GS base之前无法使用自旋锁（需要访问preempt_count），因此不能在AP上分配
+ *
+ * @param cpu AP的cpu编号
+ * @return int 错误码
+ */
+int cpu_local_alloc(int cpu)
+{
+    if (cpu_local_area[cpu] != NULL)
+        return 0;
+
+    // 多分配一个cache line，保证per-cpu区域按照cache line对齐（不会被释放，因此不需要保存原始地址）
+    uint64_t addr = (uint64_t)kmalloc(CPU_LOCAL_AREA_SIZE + CPU_LOCAL_ALIGN, 0);
+    if (addr == 0)
+        return -ENOMEM;
+    addr = (addr + CPU_LOCAL_ALIGN - 1) & ~(uint64_t)(CPU_LOCAL_ALIGN - 1);
+    memset((void *)addr, 0, CPU_LOCAL_AREA_SIZE);
+    cpu_local_area[cpu] = (struct cpu_local_t *)addr;
+    return 0;
+}
+
+/**
+ * @brief 将AP的per-cpu区域加载到GS base（在smp_ap_start()中，使用任何per-cpu变量之前调用）
+ *
+ * @param cpu AP的cpu编号
+ */
+void cpu_local_init_ap(int cpu)
+{
+    __cpu_local_load(cpu_local_area[cpu], cpu);
+}
@@ -0,0 +1,140 @@
+/**
+ * @file percpu.h
+ * @brief 通过GS base访问的per-cpu数据区域
+ *
+ * 内核态下，IA32_GS_BASE指向当前cpu的per-cpu区域，IA32_KERNEL_GS_BASE保存用户态的GS base；
+ * 从用户态进入内核以及返回用户态时，由entry.S中的swapgs交换二者。
+ *
+ * per-cpu区域的布局：struct cpu_local_t（独占一个cache line），其后紧跟该cpu的就绪队列（见sched.h中的cpu_rq()）。
+ *
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#pragma once
+
+#include <common/glib.h>
+#include <common/cpu.h>
+
+#define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
+
+#define CPU_LOCAL_ALIGN 64
+
+/**
+ * @brief per-cpu区域中，经常被访问的数据
+ *
+ */
+struct cpu_local_t
+{
+    struct cpu_local_t *self; // 指向自身（per-cpu区域的起始地址），必须位于偏移量0处
+    int64_t cpu_id;           // 当前cpu的编号
+    int64_t preempt_count;    // 正在运行的进程持有的自旋锁的数量（切换进程时与pcb->preempt_count交换）
+    uint64_t softirq_pending; // 当前cpu上等待处理的软中断
+} __attribute__((aligned(CPU_LOCAL_ALIGN)));
+
+// 各个cpu的per-cpu区域（未启用的cpu为NULL）
+extern struct cpu_local_t *cpu_local_area[MAX_CPU_NUM];
+
+/**
+ * @brief 读取当前cpu的per-cpu变量
+ *
+ * @param field struct cpu_local_t中的成员
+ */
+#define this_cpu_read(field)                                                                    \
+    ({                                                                                          \
+        typeof(((struct cpu_local_t *)0)->field) __val;                                         \
+        __asm__ __volatile__("mov %%gs:%P1, %0"                                                 \
+                             : "=r"(__val)                                                      \
+                             : "i"(__builtin_offsetof(struct cpu_local_t, field)));             \
+        __val;                                                                                  \
+    })
+
+/**
+ * @brief 写入当前cpu的per-cpu变量
+ *
+ * @param field struct cpu_local_t中的成员
+ * @param val 要写入的值
+ */
+#define this_cpu_write(field, val)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        typeof(((struct cpu_local_t *)0)->field) __val = (val);                                 \
+        __asm__ __volatile__("mov %0, %%gs:%P1" ::"r"(__val),                                   \
+                             "i"(__builtin_offsetof(struct cpu_local_t, field))                 \
+                             : "memory");                                                       \
+    } while (0)
+
+/**
+ * @brief 将当前cpu的per-cpu变量加上val（单条指令，不会被本cpu上的中断打断）
+ *
+ * @param field struct cpu_local_t中的成员
+ * @param val 加数
+ */
+#define this_cpu_add(field, val)                                                                \
+    do                                                                                          \
+    {                                                                                           \
+        typeof(((struct cpu_local_t *)0)->field) __val = (val);                                 \
+        __asm__ __volatile__("add %0, %%gs:%P1" ::"r"(__val),                                   \
+                             "i"(__builtin_offsetof(struct cpu_local_t, field))                 \
+                             : "memory", "cc");                                                 \
+    } while (0)
+
+/**
+ * @brief 将当前cpu的per-cpu变量按位或上val（单条指令，不会被本cpu上的中断打断）
+ *
+ * @param field struct cpu_local_t中的成员
+ * @param val 掩码
+ */
+#define this_cpu_or(field, val)                                                                 \
+    do                                                                                          \
+    {                                                                                           \
+        typeof(((struct cpu_local_t *)0)->field) __val = (val);                                 \
+        __asm__ __volatile__("or %0, %%gs:%P1" ::"r"(__val),                                    \
+                             "i"(__builtin_offsetof(struct cpu_local_t, field))                 \
+                             : "memory", "cc");                                                 \
+    } while (0)
+
+/**
+ * @brief 将当前cpu的per-cpu变量按位与上val（单条指令，不会被本cpu上的中断打断）
+ *
+ * @param field struct cpu_local_t中的成员
+ * @param val 掩码
+ */
+#define this_cpu_and(field, val)                                                                \
+    do                                                                                          \
+    {                                                                                           \
+        typeof(((struct cpu_local_t *)0)->field) __val = (val);                                 \
+        __asm__ __volatile__("and %0, %%gs:%P1" ::"r"(__val),                                   \
+                             "i"(__builtin_offsetof(struct cpu_local_t, field))                 \
+                             : "memory", "cc");                                                 \
+    } while (0)
+
+// 当前cpu的per-cpu区域
+#define this_cpu_ptr() (this_cpu_read(self))
+// 指定cpu的per-cpu区域
+#define per_cpu_ptr(cpu) (cpu_local_area[(cpu)])
+
+/**
+ * @brief 初始化BSP的per-cpu区域，并将其加载到GS base（必须在使用任何per-cpu变量之前调用）
+ *
+ */
+void cpu_local_init_bsp();
+
+/**
+ * @brief 为AP分配per-cpu区域（在BSP上，启动该AP之前调用）
+ *
+ * @param cpu AP的cpu编号
+ * @return int 错误码
+ */
+int cpu_local_alloc(int cpu);
+
+/**
+ * @brief 将AP的per-cpu区域加载到GS base（在smp_ap_start()中，使用任何per-cpu变量之前调用）
+ *
+ * @param cpu AP的cpu编号
+ */
+void cpu_local_init_ap(int cpu);
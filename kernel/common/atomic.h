@@ -27,8 +27,8 @@ typedef struct
 inline void atomic_add(atomic_t *ato, long val)
 {
     asm volatile("lock addq %1, %0 \n\t"
-                 : "=m"(ato->value)
-                 : "m"(val)
+                 : "+m"(ato->value)
+                 : "r"(val)
                  : "memory");
 }
 
@@ -41,8 +41,8 @@ inline void atomic_add(atomic_t *ato, long val)
 inline void atomic_sub(atomic_t *ato, long val)
 {
     asm volatile("lock subq %1, %0  \n\t"
-                 : "=m"(ato->value)
-                 : "m"(val)
+                 : "+m"(ato->value)
+                 : "r"(val)
                  : "memory");
 }
 
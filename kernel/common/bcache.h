@@ -0,0 +1,152 @@
+/**
+ * @file bcache.h
+ * @brief 块设备的缓冲区缓存（bcache）
+ *
+ * 以(block_device, LBA)为键缓存磁盘上的数据块，使用哈希表索引、LRU淘汰，并采用写回策略：
+ * 被修改的缓冲区只标记为脏，由后台的刷写线程（或者bsync()）写回磁盘。
+ *
+ * 缓冲区可以设置镜像副本（bset_mirror()）：写回时同一份数据会被依次写入各个副本的位置，副本本身不会被缓存。
+ *
+ * 同一个扇区只能属于一种大小的缓冲区：文件系统在同一个区域内（例如FAT表、数据区）应当始终使用相同的扇区数访问。
+ *
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#pragma once
+
+#include <common/glib.h>
+#include "block.h"
+
+// 缓冲区的标志位
+#define BH_VALID (1 << 0) // 缓冲区中的数据与磁盘一致（或者更新）
+#define BH_DIRTY (1 << 1) // 缓冲区中的数据比磁盘上的新，需要写回
+
+// 哈希表的桶数（必须为2的n次幂）
+#define BCACHE_HASH_SIZE 256
+// 缓存的数据总量上限（超过时淘汰最久未使用的缓冲区）
+#define BCACHE_MAX_BYTES (4UL << 20)
+// 刷写线程写回脏缓冲区的周期（微秒）
+#define BCACHE_FLUSH_INTERVAL 500000
+
+/**
+ * @brief 缓冲区
+ *
+ */
+struct buffer_head
+{
+    struct block_device *blk; // 所属的块设备
+    uint64_t lba;             // 起始扇区号（磁盘上的绝对LBA）
+    uint32_t count;           // 扇区数
+    uint32_t size;            // 数据的字节数
+    void *data;               // 数据
+    uint32_t flags;           // 标志位（BH_VALID、BH_DIRTY）
+    int32_t refcount;         // 引用计数（不为0时不会被淘汰）
+    uint32_t nr_mirrors;      // 写回时额外写入的镜像副本的数量（例如FAT2）
+    uint64_t mirror_stride;   // 相邻两个副本之间相距的扇区数
+
+    struct buffer_head *hash_next; // 哈希桶中的下一个缓冲区
+    struct List lru_list;          // 在LRU链表中的节点（链表头部为最久未使用的缓冲区）
+};
+
+/**
+ * @brief 缓冲区缓存的统计信息
+ *
+ */
+struct bcache_stat_t
+{
+    uint64_t nr_buffers;  // 缓冲区的数量
+    uint64_t bytes;       // 缓冲区数据的总字节数
+    uint64_t dirty_bytes; // 脏缓冲区数据的总字节数
+    uint64_t hits;        // 命中次数
+    uint64_t misses;      // 未命中次数
+    uint64_t evictions;   // 淘汰缓冲区的次数
+    uint64_t writebacks;  // 写回脏缓冲区的次数
+};
+
+/**
+ * @brief 初始化缓冲区缓存，并创建刷写线程（需要在进程上下文中调用）
+ *
+ */
+void bcache_init();
+
+/**
+ * @brief 获取指定块的缓冲区，必要时从磁盘读取
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return struct buffer_head* 缓冲区（使用完毕后需要调用brelse()）。读取失败时返回NULL
+ */
+struct buffer_head *bread(struct block_device *blk, uint64_t lba, uint32_t count);
+
+/**
+ * @brief 获取指定块的缓冲区，但不从磁盘读取（调用者将会覆盖整个块）
+ * 若缓冲区中原本没有有效数据，则返回清零后的缓冲区
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return struct buffer_head* 缓冲区（使用完毕后需要调用brelse()）。失败时返回NULL
+ */
+struct buffer_head *bget(struct block_device *blk, uint64_t lba, uint32_t count);
+
+/**
+ * @brief 将缓冲区标记为脏（由刷写线程写回磁盘）
+ *
+ * @param bh 缓冲区
+ */
+void bmark_dirty(struct buffer_head *bh);
+
+/**
+ * @brief 设置缓冲区的镜像副本：写回时，数据还会被写入lba+i*stride处（1≤i≤nr_mirrors）
+ *
+ * @param bh 缓冲区
+ * @param nr_mirrors 镜像副本的数量
+ * @param stride 相邻两个副本之间相距的扇区数
+ */
+void bset_mirror(struct buffer_head *bh, uint32_t nr_mirrors, uint64_t stride);
+
+/**
+ * @brief 立即将缓冲区写回磁盘
+ *
+ * @param bh 缓冲区
+ * @return int 错误码
+ */
+int bwrite(struct buffer_head *bh);
+
+/**
+ * @brief 释放对缓冲区的引用
+ *
+ * @param bh 缓冲区
+ */
+void brelse(struct buffer_head *bh);
+
+/**
+ * @brief 将块设备上所有的脏缓冲区写回磁盘
+ *
+ * @param blk 块设备（为NULL时写回所有块设备的脏缓冲区）
+ * @return int 错误码
+ */
+int bsync(struct block_device *blk);
+
+/**
+ * @brief 将起始扇区位于[lba, lba+count)内的脏缓冲区写回磁盘
+ * 在绕过缓存直接读取磁盘之前调用（要求该区域的缓冲区与访问范围按照相同的粒度对齐，例如都以簇为单位）
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return int 错误码
+ */
+int bsync_range(struct block_device *blk, uint64_t lba, uint32_t count);
+
+/**
+ * @brief 获取缓冲区缓存的统计信息
+ *
+ * @param stat 返回的统计信息
+ */
+void bcache_get_stat(struct bcache_stat_t *stat);
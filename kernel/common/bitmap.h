@@ -0,0 +1,37 @@
+/**
+ * @file bitmap.h
+ * @brief 以uint64_t数组表示的位图的辅助函数
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief 在位图中查找[start, end)范围内第一个为0的位
+ *
+ * @param map 位图（第i位位于map[i / 64]的第(i % 64)位）
+ * @param start 起始位置
+ * @param end 结束位置
+ * @return uint64_t 第一个为0的位的下标。不存在时返回end
+ */
+static inline uint64_t bitmap_find_next_zero(const uint64_t *map, uint64_t start, uint64_t end)
+{
+    while (start < end)
+    {
+        // 对取反后的字使用ctz找到第一个为0的位，并屏蔽掉start之前的位
+        uint64_t word = ~map[start >> 6] & (~0UL << (start & 63));
+        if (word != 0)
+        {
+            uint64_t found = (start & ~63UL) + __builtin_ctzl(word);
+            return found < end ? found : end;
+        }
+        start = (start & ~63UL) + 64;
+    }
+    return end;
+}
@@ -3,6 +3,7 @@
 #include "glib.h"
 
 #define MAX_CPU_NUM 32 // 操作系统支持的最大处理器数量
+#define CPU_MASK_ALL ((1UL << MAX_CPU_NUM) - 1) // 包含所有处理器的cpu掩码
 
 // cpu支持的最大cpuid指令的基础主功能号
 extern uint32_t Cpu_cpuid_max_Basic_mop;
@@ -57,6 +58,7 @@ struct cpu_core_info_t
     uint64_t stack_start;     // 栈基地址
     uint64_t ist_stack_start; // IST栈基地址
     uint64_t tss_vaddr;       // tss地址
+    uint32_t apic_id;         // 处理器的local apic id（用于向指定的处理器发送IPI）
 };
 
 extern struct cpu_core_info_t cpu_core_info[MAX_CPU_NUM];
@@ -30,9 +30,9 @@ struct rbt_root_t *rbt_create_tree(struct rbt_node_t *node, int (*cmp)(void *a,
  * @brief Create a Nil object
  * 对叶子结点的初始化处理，先要执行该函数
  */
-static int rbt_createNil()
+int rbt_CreateNil()
 {
-    rbt_nil = (struct rbt_node_t *)malloc(sizeof(struct rbt_node_t));
+    rbt_nil = (struct rbt_node_t *)kmalloc(sizeof(struct rbt_node_t), 0);
     rbt_nil->left = rbt_nil;
     rbt_nil->right = rbt_nil;
     rbt_nil->color = black;
@@ -62,7 +62,7 @@ int rbt_query(struct rbt_root_t *root, void *value, uint64_t *ret_addr)
     // struct rbt_node_t tmp_node = {0};
     // tmp_node.value = value;
 
-    if (ret_addr == rbt_nil)
+    if (ret_addr == NULL)
         return -EINVAL;
 
     while (this_node != rbt_nil && !equal(root, this_node->value, value))
@@ -390,3 +390,338 @@ int rbt_delete(struct rbt_root_t *root, void *value)
 
 
 
+
+// ====== 侵入式红黑树 ======
+
+static __always_inline bool __rb_is_black(struct rb_node *node)
+{
+    return node == NULL || node->rb_color == RB_BLACK;
+}
+
+/**
+ * @brief 将结点的父结点中指向它的指针替换为new（node为根结点时替换树根）
+ *
+ */
+static __always_inline void __rb_change_child(struct rb_node *node, struct rb_node *new, struct rb_node *parent, struct rb_root *root)
+{
+    if (parent == NULL)
+        root->rb_node = new;
+    else if (parent->rb_left == node)
+        parent->rb_left = new;
+    else
+        parent->rb_right = new;
+}
+
+/**
+ * @brief 左旋。旋转前后以该位置为根的子树所包含的结点不变，因此只需要更新参与旋转的两个结点的增强信息
+ *
+ * @param node 待旋转的结点
+ * @param root 树根
+ * @param augment 增强信息的更新函数
+ */
+static void __rb_rotate_left(struct rb_node *node, struct rb_root *root, rb_augment_t augment)
+{
+    struct rb_node *right = node->rb_right;
+    struct rb_node *parent = node->rb_parent;
+
+    node->rb_right = right->rb_left;
+    if (right->rb_left != NULL)
+        right->rb_left->rb_parent = node;
+    right->rb_left = node;
+    right->rb_parent = parent;
+    __rb_change_child(node, right, parent, root);
+    node->rb_parent = right;
+
+    if (augment != NULL)
+    {
+        augment(node);
+        augment(right);
+    }
+}
+
+/**
+ * @brief 右旋
+ *
+ * @param node 待旋转的结点
+ * @param root 树根
+ * @param augment 增强信息的更新函数
+ */
+static void __rb_rotate_right(struct rb_node *node, struct rb_root *root, rb_augment_t augment)
+{
+    struct rb_node *left = node->rb_left;
+    struct rb_node *parent = node->rb_parent;
+
+    node->rb_left = left->rb_right;
+    if (left->rb_right != NULL)
+        left->rb_right->rb_parent = node;
+    left->rb_right = node;
+    left->rb_parent = parent;
+    __rb_change_child(node, left, parent, root);
+    node->rb_parent = left;
+
+    if (augment != NULL)
+    {
+        augment(node);
+        augment(left);
+    }
+}
+
+void rb_augment_propagate(struct rb_node *node, rb_augment_t augment)
+{
+    while (node != NULL)
+    {
+        augment(node);
+        node = node->rb_parent;
+    }
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_t augment)
+{
+    struct rb_node *parent, *gparent, *uncle;
+
+    // 新结点改变了其所有祖先的子树
+    if (augment != NULL)
+        rb_augment_propagate(node, augment);
+
+    while ((parent = node->rb_parent) != NULL && parent->rb_color == RB_RED)
+    {
+        gparent = parent->rb_parent;
+        if (parent == gparent->rb_left)
+        {
+            uncle = gparent->rb_right;
+            if (!__rb_is_black(uncle))
+            {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (parent->rb_right == node)
+            {
+                __rb_rotate_left(parent, root, augment);
+                struct rb_node *tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            __rb_rotate_right(gparent, root, augment);
+        }
+        else
+        {
+            uncle = gparent->rb_left;
+            if (!__rb_is_black(uncle))
+            {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (parent->rb_left == node)
+            {
+                __rb_rotate_right(parent, root, augment);
+                struct rb_node *tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            __rb_rotate_left(gparent, root, augment);
+        }
+    }
+    root->rb_node->rb_color = RB_BLACK;
+}
+
+/**
+ * @brief 删除黑色结点后，恢复红黑树的性质
+ *
+ * @param node 替代了被删除结点的位置的结点（可为NULL）
+ * @param parent node的父结点
+ * @param root 树根
+ * @param augment 增强信息的更新函数
+ */
+static void __rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root, rb_augment_t augment)
+{
+    struct rb_node *other;
+
+    while (__rb_is_black(node) && node != root->rb_node)
+    {
+        if (parent->rb_left == node)
+        {
+            other = parent->rb_right;
+            if (other->rb_color == RB_RED)
+            {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                __rb_rotate_left(parent, root, augment);
+                other = parent->rb_right;
+            }
+            if (__rb_is_black(other->rb_left) && __rb_is_black(other->rb_right))
+            {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            }
+            else
+            {
+                if (__rb_is_black(other->rb_right))
+                {
+                    other->rb_left->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    __rb_rotate_right(other, root, augment);
+                    other = parent->rb_right;
+                }
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_right->rb_color = RB_BLACK;
+                __rb_rotate_left(parent, root, augment);
+                node = root->rb_node;
+                break;
+            }
+        }
+        else
+        {
+            other = parent->rb_left;
+            if (other->rb_color == RB_RED)
+            {
+                other->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                __rb_rotate_right(parent, root, augment);
+                other = parent->rb_left;
+            }
+            if (__rb_is_black(other->rb_left) && __rb_is_black(other->rb_right))
+            {
+                other->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            }
+            else
+            {
+                if (__rb_is_black(other->rb_left))
+                {
+                    other->rb_right->rb_color = RB_BLACK;
+                    other->rb_color = RB_RED;
+                    __rb_rotate_left(other, root, augment);
+                    other = parent->rb_left;
+                }
+                other->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                other->rb_left->rb_color = RB_BLACK;
+                __rb_rotate_right(parent, root, augment);
+                node = root->rb_node;
+                break;
+            }
+        }
+    }
+    if (node != NULL)
+        node->rb_color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_t augment)
+{
+    struct rb_node *child, *parent;
+    int color;
+
+    if (node->rb_left == NULL)
+        child = node->rb_right;
+    else if (node->rb_right == NULL)
+        child = node->rb_left;
+    else
+    {
+        // 有两个子结点：用后继结点代替被删除的结点
+        struct rb_node *old = node;
+        node = node->rb_right;
+        while (node->rb_left != NULL)
+            node = node->rb_left;
+
+        __rb_change_child(old, node, old->rb_parent, root);
+
+        child = node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+
+        if (parent == old)
+            parent = node;
+        else
+        {
+            if (child != NULL)
+                child->rb_parent = parent;
+            parent->rb_left = child;
+            node->rb_right = old->rb_right;
+            old->rb_right->rb_parent = node;
+        }
+
+        node->rb_parent = old->rb_parent;
+        node->rb_color = old->rb_color;
+        node->rb_left = old->rb_left;
+        old->rb_left->rb_parent = node;
+        goto color;
+    }
+
+    parent = node->rb_parent;
+    color = node->rb_color;
+    if (child != NULL)
+        child->rb_parent = parent;
+    __rb_change_child(node, child, parent, root);
+
+color:;
+    // 从发生变化的最低位置开始，更新所有祖先的增强信息
+    if (augment != NULL)
+        rb_augment_propagate(parent, augment);
+    if (color == RB_BLACK)
+        __rb_erase_color(child, parent, root, augment);
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+    struct rb_node *node = root->rb_node;
+    if (node == NULL)
+        return NULL;
+    while (node->rb_left != NULL)
+        node = node->rb_left;
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+    struct rb_node *node = root->rb_node;
+    if (node == NULL)
+        return NULL;
+    while (node->rb_right != NULL)
+        node = node->rb_right;
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+    struct rb_node *parent;
+    if (node->rb_right != NULL)
+    {
+        node = node->rb_right;
+        while (node->rb_left != NULL)
+            node = node->rb_left;
+        return (struct rb_node *)node;
+    }
+    while ((parent = node->rb_parent) != NULL && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+    struct rb_node *parent;
+    if (node->rb_left != NULL)
+    {
+        node = node->rb_left;
+        while (node->rb_right != NULL)
+            node = node->rb_right;
+        return (struct rb_node *)node;
+    }
+    while ((parent = node->rb_parent) != NULL && node == parent->rb_left)
+        node = parent;
+    return parent;
+}
@@ -21,6 +21,8 @@ struct rbt_root_t
 };
 
 
+int rbt_CreateNil();
+
 struct rbt_root_t *rbt_create_tree(struct rbt_node_t *node, int (*cmp)(void *a, void *b), int (*release)(void *value));
 
 struct rbt_node_t *rbt_create_node(void *value);
@@ -30,3 +32,87 @@ int rbt_insert(struct rbt_root_t *root,void* value);
 int rbt_query(struct rbt_root_t *root,void *value,uint64_t *ret_addr);
 
 int rbt_delete(struct rbt_root_t *root,void* value);
+
+// ====== 侵入式红黑树 ======
+// 结点直接嵌入到宿主结构体中（通过rb_entry()取得宿主结构体），不需要额外申请内存。
+// 支持增强(augmented)：每当结点的子树发生变化时，调用者提供的augment回调会被调用，用于重新计算结点上的子树信息。
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node
+{
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    int rb_color;
+} __attribute__((aligned(sizeof(long))));
+
+struct rb_root
+{
+    struct rb_node *rb_node;
+};
+
+#define RB_ROOT \
+    (struct rb_root) { NULL }
+
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+// 将结点标记为不在任何红黑树中（结点的父指针指向自身）
+#define RB_CLEAR_NODE(node) ((node)->rb_parent = (node))
+// 判断结点是否不在任何红黑树中
+#define RB_EMPTY_NODE(node) ((node)->rb_parent == (node))
+
+/**
+ * @brief 根据结点的子结点，重新计算结点上的增强信息
+ *
+ */
+typedef void (*rb_augment_t)(struct rb_node *node);
+
+/**
+ * @brief 将新结点链接到查找到的位置上（插入后需要调用rb_insert_color()）
+ *
+ * @param node 新结点
+ * @param parent 父结点
+ * @param link 父结点中指向新结点的指针（&parent->rb_left或&parent->rb_right）
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link)
+{
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_color = RB_RED;
+    *link = node;
+}
+
+/**
+ * @brief 对刚被链接进树中的结点进行着色及旋转，恢复红黑树的性质
+ *
+ * @param node 新结点
+ * @param root 树根
+ * @param augment 增强信息的更新函数（可为NULL）
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_t augment);
+
+/**
+ * @brief 从树中删除结点
+ *
+ * @param node 要删除的结点
+ * @param root 树根
+ * @param augment 增强信息的更新函数（可为NULL）
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_t augment);
+
+/**
+ * @brief 从指定结点开始，向上更新到根结点的增强信息
+ *
+ * @param node 起始结点（可为NULL）
+ * @param augment 增强信息的更新函数
+ */
+void rb_augment_propagate(struct rb_node *node, rb_augment_t augment);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
@@ -0,0 +1,18 @@
+#pragma once
+#include <common/glib.h>
+
+#define RUSAGE_SELF 0 // 统计当前进程的资源使用情况
+
+#define PRIO_PROCESS 0 // getpriority/setpriority的对象为单个进程
+
+/**
+ * @brief 进程的资源使用情况
+ *
+ */
+struct rusage
+{
+    uint64_t ru_minflt; // 不需要进行I/O的缺页异常次数
+    uint64_t ru_majflt; // 需要从磁盘读取数据的缺页异常次数
+    uint64_t ru_nvcsw;  // 主动让出cpu的次数
+    uint64_t ru_nivcsw; // 被抢占的次数
+};
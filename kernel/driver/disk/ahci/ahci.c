@@ -168,7 +168,7 @@ void ahci_init()
     }
 
     // todo: 支持多个ahci控制器。
-    ahci_port_base_vaddr = (uint64_t)kmalloc(1048576, 0);
+    ahci_port_base_vaddr = (uint64_t)alloc_4k_frames(1048576 >> PAGE_4K_SHIFT, false); // DMA缓冲区，需要物理地址连续
     kdebug("ahci_port_base_vaddr=%#018lx", ahci_port_base_vaddr);
     ahci_probe_port(0);
     port_rebase(&ahci_devices[0].hba_mem->ports[0], 0);
@@ -356,7 +356,7 @@ static bool ahci_read(HBA_PORT *port, uint32_t startl, uint32_t starth, uint32_t
         cmdtbl->prdt_entry[i].dba = virt_2_phys(buf);
         cmdtbl->prdt_entry[i].dbc = 8 * 1024 - 1; // 8K bytes (this value should always be set to 1 less than the actual value)
         cmdtbl->prdt_entry[i].i = 1;
-        buf += 4 * 1024; // 4K uint16_ts
+        buf += 8 * 1024; // 8K bytes
         count -= 16;     // 16 sectors
     }
 
@@ -452,12 +452,12 @@ static bool ahci_write(HBA_PORT *port, uint32_t startl, uint32_t starth, uint32_
         cmdtbl->prdt_entry[i].dba = virt_2_phys(buf);
         cmdtbl->prdt_entry[i].dbc = 8 * 1024 - 1; // 8K bytes
         cmdtbl->prdt_entry[i].i = 0;
-        buf += 4 * 1024; // 4K words
+        buf += 8 * 1024; // 8K bytes
         count -= 16;     // 16 sectors
     }
     cmdtbl->prdt_entry[i].dba = virt_2_phys(buf);
 
-    cmdtbl->prdt_entry[i].dbc = count << 9; // 512 bytes per sector
+    cmdtbl->prdt_entry[i].dbc = (count << 9) - 1; // 512 bytes per sector
     cmdtbl->prdt_entry[i].i = 0;
     FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
     cmdfis->fis_type = FIS_TYPE_REG_H2D;
@@ -651,6 +651,12 @@ static long ahci_transfer(struct blk_gendisk *gd, long cmd, uint64_t base_addr,
 
     if (cmd == AHCI_CMD_READ_DMA_EXT || cmd == AHCI_CMD_WRITE_DMA_EXT)
     {
+        // 命令表中的PRDT表项数量有限
+        if (unlikely(count == 0 || count > AHCI_MAX_SECTORS_PER_CMD))
+        {
+            kerror("ahci: invalid sector count %ld", count);
+            return E_UNSUPPORTED_CMD;
+        }
         pack = ahci_make_request(cmd, base_addr, count, buf, pdata->ahci_ctrl_num, pdata->ahci_port_num);
         ahci_submit(pack);
     }
@@ -23,6 +23,12 @@
 #define AHCI_CMD_READ_DMA_EXT 0x25
 #define AHCI_CMD_WRITE_DMA_EXT 0x30
 
+// 每个命令表占用256字节（见port_rebase()），除去128字节的头部后，最多容纳8个PRDT表项
+#define AHCI_PRDT_MAX_ENTRIES 8
+#define AHCI_PRDT_MAX_SECTORS 16 // 每个PRDT表项传输8K字节
+// 单个命令最多能传输的扇区数
+#define AHCI_MAX_SECTORS_PER_CMD (AHCI_PRDT_MAX_ENTRIES * AHCI_PRDT_MAX_SECTORS)
+
 #define HBA_PxIS_TFES (1 << 30) /* TFES - Task File Error Status */
 
 #define AHCI_SUCCESS 0      // 请求成功
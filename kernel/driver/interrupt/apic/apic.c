@@ -451,10 +451,10 @@ void do_IRQ(struct pt_regs *rsp, ul number)
 
     // kdebug("after softirq");
     // 检测当前进程是否持有自旋锁，若持有自旋锁，则不进行抢占式的进程调度
-    if (current_pcb->preempt_count > 0)
+    if (preempt_count() > 0)
         return;
-    else if (current_pcb->preempt_count < 0)
-        kBUG("current_pcb->preempt_count<0! pid=%d", current_pcb->pid); // should not be here
+    else if (preempt_count() < 0)
+        kBUG("preempt_count<0! pid=%d", current_pcb->pid); // should not be here
 
     // 检测当前进程是否可被调度
     if (current_pcb->flags & PF_NEED_SCHED)
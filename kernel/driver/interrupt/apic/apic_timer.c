@@ -7,6 +7,10 @@
 // #pragma GCC push_options
 // #pragma GCC optimize("O0")
 uint64_t apic_timer_ticks_result = 0;
+// BSP是否已经注册了local apic定时器的中断
+static volatile bool apic_timer_registered = false;
+// 已经启动了local apic定时器的核心
+static atomic_t apic_timer_cpu_mask;
 
 void apic_timer_enable(uint64_t irq_num)
 {
@@ -47,6 +51,7 @@ uint64_t apic_timer_install(ul irq_num, void *arg)
     // 填写LVT
     apic_timer_set_LVT(APIC_TIMER_IRQ_NUM, 1, APIC_LVT_Timer_Periodic);
     io_mfence();
+    atomic_set_mask(&apic_timer_cpu_mask, 1UL << proc_current_cpu_id);
 }
 
 void apic_timer_uninstall(ul irq_num)
@@ -94,5 +99,58 @@ void apic_timer_init()
     io_mfence();
     irq_register(APIC_TIMER_IRQ_NUM, &apic_timer_ticks_result, &apic_timer_handler, 0, &apic_timer_intr_controller, "apic timer");
     io_mfence();
+    apic_timer_registered = true;
     kinfo("Successfully initialized apic timer for cpu %d", proc_current_cpu_id);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 在AP处理器上启动local APIC定时器（等待BSP完成定时器频率的测定及中断的注册）
+ *
+ */
+void apic_timer_ap_core_init()
+{
+    while (!apic_timer_registered)
+        pause();
+    io_mfence();
+    apic_timer_install(APIC_TIMER_IRQ_NUM, &apic_timer_ticks_result);
+    io_mfence();
+    apic_timer_enable(APIC_TIMER_IRQ_NUM);
+    io_mfence();
+    kinfo("Successfully initialized apic timer for cpu %d", proc_current_cpu_id);
+}
+
+/**
+ * @brief 将当前核心的local APIC定时器切换为单次触发模式（动态时钟）
+ *
+ * @param nr_ticks 经过多少个定时器周期（APIC_TIMER_INTERVAL毫秒）后产生中断
+ */
+void apic_timer_oneshot(uint64_t nr_ticks)
+{
+    // 当前核心的定时器尚未启动
+    if (!(atomic_read(&apic_timer_cpu_mask) & (1UL << proc_current_cpu_id)))
+        return;
+    uint64_t cnt = apic_timer_ticks_result * nr_ticks;
+    if (cnt > 0xffffffffUL)
+        cnt = 0xffffffffUL;
+    io_mfence();
+    apic_timer_set_LVT(APIC_TIMER_IRQ_NUM, 0, APIC_LVT_Timer_One_Shot);
+    io_mfence();
+    // 写入初始计数值后，定时器开始倒数
+    apic_timer_set_init_cnt(cnt);
+    io_mfence();
+}
+
+/**
+ * @brief 将当前核心的local APIC定时器恢复为周期模式
+ *
+ */
+void apic_timer_periodic()
+{
+    if (!(atomic_read(&apic_timer_cpu_mask) & (1UL << proc_current_cpu_id)))
+        return;
+    io_mfence();
+    apic_timer_set_LVT(APIC_TIMER_IRQ_NUM, 0, APIC_LVT_Timer_Periodic);
+    io_mfence();
+    apic_timer_set_init_cnt(apic_timer_ticks_result);
+    io_mfence();
+}
@@ -105,4 +105,23 @@ static __always_inline uint32_t apic_timer_get_current()
  */
 void apic_timer_init();
 
+/**
+ * @brief 在AP处理器上启动local APIC定时器（等待BSP完成定时器频率的测定及中断的注册）
+ *
+ */
+void apic_timer_ap_core_init();
+
+/**
+ * @brief 将当前核心的local APIC定时器切换为单次触发模式（动态时钟）
+ *
+ * @param nr_ticks 经过多少个定时器周期（APIC_TIMER_INTERVAL毫秒）后产生中断
+ */
+void apic_timer_oneshot(uint64_t nr_ticks);
+
+/**
+ * @brief 将当前核心的local APIC定时器恢复为周期模式
+ *
+ */
+void apic_timer_periodic();
+
 #pragma GCC pop_options
\ No newline at end of file
@@ -135,4 +135,23 @@ bool multiboot2_get_acpi_new_RSDP(const struct iter_data_t *_iter_data, void *da
         return false;
     *(struct multiboot_tag_new_acpi_t *)data = *(struct multiboot_tag_new_acpi_t *)_iter_data;
     return true;
-}
\ No newline at end of file
+}
+/**
+ * @brief 获取内核启动参数（命令行）
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回的字符串缓冲区
+ * @param size 缓冲区的大小
+ */
+bool multiboot2_get_cmdline(const struct iter_data_t *_iter_data, void *data, unsigned int *size)
+{
+    if (_iter_data->type != MULTIBOOT_TAG_TYPE_CMDLINE)
+        return false;
+    const char *src = ((struct multiboot_tag_string_t *)_iter_data)->string;
+    char *dst = (char *)data;
+    unsigned int i = 0;
+    for (; i + 1 < *size && src[i] != '\0'; ++i)
+        dst[i] = src[i];
+    dst[i] = '\0';
+    return true;
+}
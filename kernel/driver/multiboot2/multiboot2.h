@@ -471,4 +471,12 @@ bool multiboot2_get_acpi_old_RSDP(const struct iter_data_t *_iter_data, void *da
  * @param reserved
  * @return uint8_t*  struct multiboot_tag_old_acpi_t
  */
-bool multiboot2_get_acpi_new_RSDP(const struct iter_data_t *_iter_data, void *data, unsigned int *reserved);
\ No newline at end of file
+bool multiboot2_get_acpi_new_RSDP(const struct iter_data_t *_iter_data, void *data, unsigned int *reserved);
+/**
+ * @brief 获取内核启动参数（命令行）
+ *
+ * @param _iter_data 要被迭代的信息的结构体
+ * @param data 返回的字符串缓冲区
+ * @param size 缓冲区的大小
+ */
+bool multiboot2_get_cmdline(const struct iter_data_t *_iter_data, void *data, unsigned int *size);
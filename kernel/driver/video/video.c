@@ -39,7 +39,7 @@ void init_frame_buffer()
     video_frame_buffer_info.vaddr = SPECIAL_MEMOEY_MAPPING_VIRT_ADDR_BASE + FRAME_BUFFER_MAPPING_OFFSET;
     mm_map_proc_page_table(global_CR3, true, video_frame_buffer_info.vaddr, __fb_info.framebuffer_addr, video_frame_buffer_info.size, PAGE_KERNEL_PAGE | PAGE_PWT | PAGE_PCD, false, true, false);
 
-    flush_tlb();
+    flush_tlb_all();
     kinfo("VBE frame buffer successfully Re-mapped!");
 }
 
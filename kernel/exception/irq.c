@@ -17,7 +17,7 @@
 
 #pragma GCC push_options
 #pragma GCC optimize("O0")
-// 保存函数调用现场的寄存器
+// 保存函数调用现场的寄存器。从用户态进入时交换GS base，使其指向当前cpu的per-cpu区域
 #define SAVE_ALL_REGS       \
     "cld; \n\t"             \
     "pushq %rax;    \n\t"   \
@@ -43,7 +43,11 @@
     "pushq %r15;     \n\t"  \
     "movq $0x10, %rdx;\n\t" \
     "movq %rdx, %ds; \n\t"  \
-    "movq %rdx, %es; \n\t"
+    "movq %rdx, %es; \n\t"  \
+    "testl $3, 0xa0(%rsp);\n\t" \
+    "jz 1f;          \n\t"  \
+    "swapgs;         \n\t"  \
+    "1:              \n\t"
 
 // 定义IRQ处理函数的名字格式：IRQ+中断号+interrupt
 #define IRQ_NAME2(name1) name1##interrupt(void)
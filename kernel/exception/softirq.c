@@ -5,17 +5,18 @@
 #include <common/spinlock.h>
 
 static spinlock_t softirq_modify_lock; // 软中断状态（status）
-static volatile uint64_t softirq_pending = 0;
 static volatile uint64_t softirq_running = 0;
 
+// 等待处理的软中断保存在per-cpu区域中，由触发它的cpu在中断返回前处理
+
 void set_softirq_pending(uint64_t status)
 {
-    softirq_pending |= status;
+    this_cpu_or(softirq_pending, status);
 }
 
 uint64_t get_softirq_pending()
 {
-    return softirq_pending;
+    return this_cpu_read(softirq_pending);
 }
 
 #define get_softirq_running() (softirq_running)
@@ -45,7 +46,7 @@ uint64_t get_softirq_pending()
 #define softirq_ack(sirq_num)                  \
     do                                         \
     {                                          \
-        softirq_pending &= (~(1 << sirq_num)); \
+        this_cpu_and(softirq_pending, ~(1UL << sirq_num)); \
     } while (0);
 
 /**
@@ -80,9 +81,9 @@ void do_softirq()
 {
     sti();
 
-    for (uint32_t i = 0; i < MAX_SOFTIRQ_NUM && softirq_pending; ++i)
+    for (uint32_t i = 0; i < MAX_SOFTIRQ_NUM && get_softirq_pending(); ++i)
     {
-        if (softirq_pending & (1 << i) && softirq_vector[i].action != NULL && (!(get_softirq_running() & (1 << i))))
+        if (get_softirq_pending() & (1 << i) && softirq_vector[i].action != NULL && (!(get_softirq_running() & (1 << i))))
         {
             if (spin_trylock(&softirq_modify_lock))
             {
@@ -113,7 +114,7 @@ int clear_softirq_pending(uint32_t irq_num)
 
 void softirq_init()
 {
-    softirq_pending = 0;
+    this_cpu_write(softirq_pending, 0);
     memset(softirq_vector, 0, sizeof(struct softirq_t) * MAX_SOFTIRQ_NUM);
     spin_init(&softirq_modify_lock);
 }
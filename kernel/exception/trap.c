@@ -5,6 +5,7 @@
 #include <process/process.h>
 #include <debug/traceback/traceback.h>
 #include <sched/sched.h>
+#include <arch/x86_64/fpu.h>
 // 0 #DE 除法错误
 void do_divide_error(struct pt_regs *regs, unsigned long error_code)
 {
@@ -82,9 +83,12 @@ void do_undefined_opcode(struct pt_regs *regs, unsigned long error_code)
     sched();
 }
 
-// 7 #NM 设备异常（FPU不存在）
+// 7 #NM 设备异常（FPU不存在，或者CR0.TS被置位）
 void do_dev_not_avaliable(struct pt_regs *regs, unsigned long error_code)
 {
+    // 进程切换后第一次使用浮点单元，恢复其浮点上下文
+    if (fpu_handle_dev_not_available())
+        return;
 
     kerror("do_dev_not_avaliable(7),\tError Code:%#18lx,\tRSP:%#18lx,\tRIP:%#18lx\t CPU:%d\n", error_code, regs->rsp, regs->rip, proc_current_cpu_id);
 
@@ -199,6 +203,10 @@ void do_page_fault(struct pt_regs *regs, unsigned long error_code)
     __asm__ __volatile__("movq	%%cr2,	%0"
                          : "=r"(cr2)::"memory");
 
+    // 尝试处理用户地址空间中的缺页（如写时复制）
+    if (mm_do_page_fault(regs, error_code, cr2) == 0)
+        return;
+
     kerror("do_page_fault(14),Error code :%#018lx,RSP:%#018lx, RBP=%#018lx, RIP:%#018lx CPU:%d, pid=%d\n", error_code, regs->rsp, regs->rbp, regs->rip, proc_current_cpu_id, current_pcb->pid);
     kerror("regs->rax = %#018lx\n", regs->rax);
     if (!(error_code & 0x01))
@@ -285,27 +293,28 @@ void do_virtualization_exception(struct pt_regs *regs, unsigned long error_code)
 
 void sys_vector_init()
 {
-    set_trap_gate(0, 0, divide_error);
-    set_trap_gate(1, 0, debug);
+    // 异常都使用中断门：从用户态进入时，必须在执行swapgs之后才能响应中断（见entry.S中的Err_Code）
+    set_intr_gate(0, 0, divide_error);
+    set_intr_gate(1, 0, debug);
     set_intr_gate(2, 0, nmi);
-    set_system_trap_gate(3, 0, int3);
-    set_system_trap_gate(4, 0, overflow);
-    set_system_trap_gate(5, 0, bounds);
-    set_trap_gate(6, 0, undefined_opcode);
-    set_trap_gate(7, 0, dev_not_avaliable);
-    set_trap_gate(8, 0, double_fault);
-    set_trap_gate(9, 0, coprocessor_segment_overrun);
-    set_trap_gate(10, 0, invalid_TSS);
-    set_trap_gate(11, 0, segment_not_exists);
-    set_trap_gate(12, 0, stack_segment_fault);
-    set_trap_gate(13, 0, general_protection);
-    set_trap_gate(14, 0, page_fault);
+    set_system_intr_gate(3, 0, int3);
+    set_system_intr_gate(4, 0, overflow);
+    set_system_intr_gate(5, 0, bounds);
+    set_intr_gate(6, 0, undefined_opcode);
+    set_intr_gate(7, 0, dev_not_avaliable);
+    set_intr_gate(8, 0, double_fault);
+    set_intr_gate(9, 0, coprocessor_segment_overrun);
+    set_intr_gate(10, 0, invalid_TSS);
+    set_intr_gate(11, 0, segment_not_exists);
+    set_intr_gate(12, 0, stack_segment_fault);
+    set_intr_gate(13, 0, general_protection);
+    set_intr_gate(14, 0, page_fault);
     // 中断号15由Intel保留，不能使用
-    set_trap_gate(16, 0, x87_FPU_error);
-    set_trap_gate(17, 0, alignment_check);
-    set_trap_gate(18, 0, machine_check);
-    set_trap_gate(19, 0, SIMD_exception);
-    set_trap_gate(20, 0, virtualization_exception);
+    set_intr_gate(16, 0, x87_FPU_error);
+    set_intr_gate(17, 0, alignment_check);
+    set_intr_gate(18, 0, machine_check);
+    set_intr_gate(19, 0, SIMD_exception);
+    set_intr_gate(20, 0, virtualization_exception);
     // 中断号21-31由Intel保留，不能使用
 
     // 32-255为用户自定义中断内部
@@ -42,6 +42,8 @@ struct vfs_superblock_t *vfs_mount_fs(const char *path, char *name, struct block
         if (!strcmp(p->name, name)) // 存在符合的文件系统
         {
             struct vfs_superblock_t *sb = p->read_superblock(blk);
+            if (sb == NULL)
+                return NULL;
             if (strcmp(path, "/") == 0) // 如果挂载到的是'/'挂载点，则让其成为最顶层的文件系统
             {
                 vfs_root_sb = sb;
@@ -123,6 +123,7 @@ struct vfs_super_block_operations_t
     void (*write_superblock)(struct vfs_superblock_t *sb); // 将超级块信息写入磁盘
     void (*put_superblock)(struct vfs_superblock_t *sb);
     void (*write_inode)(struct vfs_index_node_t *inode); // 将inode信息写入磁盘
+    void (*release_inode)(struct vfs_index_node_t *inode); // 释放inode之前，释放文件系统为其私有信息分配的资源（可以为NULL）
 };
 
 /**
@@ -76,6 +76,8 @@ int vfs_free_inode(struct vfs_index_node_t *inode)
     BUG_ON(inode->ref_count < 0);
     if (inode->ref_count == 0)
     {
+        if (inode->sb != NULL && inode->sb->sb_ops != NULL && inode->sb->sb_ops->release_inode != NULL)
+            inode->sb->sb_ops->release_inode(inode);
         kfree(inode->private_inode_info);
         kfree(inode);
     }
@@ -0,0 +1,363 @@
+/**
+ * @file bcache.c
+ * @brief 块设备的缓冲区缓存：哈希索引、LRU淘汰、脏缓冲区的写回
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <common/bcache.h>
+#include <common/mutex.h>
+#include <common/kprint.h>
+#include <common/errno.h>
+#include <mm/slab.h>
+#include <driver/disk/ahci/ahci.h>
+#include <process/process.h>
+#include <time/sleep.h>
+
+// 保护哈希表、LRU链表、统计信息以及缓冲区的引用计数与标志位（磁盘读写期间也会持有，因此使用mutex）
+static mutex_t __bcache_lock;
+// 哈希表，每个桶是通过bh->hash_next连接的单链表
+static struct buffer_head *__bcache_hash[BCACHE_HASH_SIZE];
+// LRU链表：链表头部为最久未使用的缓冲区
+static struct List __bcache_lru;
+static struct bcache_stat_t __bcache_stat;
+
+#define __bcache_hashfn(blk, lba) ((((uint64_t)(blk) >> 6) ^ (lba)) & (BCACHE_HASH_SIZE - 1))
+
+/**
+ * @brief 将缓冲区写回磁盘（需要持有__bcache_lock）
+ *
+ * @param bh 缓冲区
+ * @return int 错误码
+ */
+static int __bcache_writeback(struct buffer_head *bh)
+{
+    struct blk_gendisk *gd = bh->blk->bd_disk;
+    // 依次写入缓冲区本身以及各个镜像副本
+    for (uint32_t i = 0; i <= bh->nr_mirrors; ++i)
+    {
+        uint64_t lba = bh->lba + i * bh->mirror_stride;
+        if (gd->fops->transfer(gd, AHCI_CMD_WRITE_DMA_EXT, lba, bh->count, (uint64_t)bh->data) != AHCI_SUCCESS)
+        {
+            kerror("bcache: failed to write back lba=%ld, count=%d", lba, bh->count);
+            return -EIO;
+        }
+    }
+    if (bh->flags & BH_DIRTY)
+    {
+        bh->flags &= ~BH_DIRTY;
+        __bcache_stat.dirty_bytes -= bh->size;
+    }
+    ++__bcache_stat.writebacks;
+    return 0;
+}
+
+/**
+ * @brief 将缓冲区从哈希表与LRU链表中删除，并释放其内存（需要持有__bcache_lock，且缓冲区不能是脏的）
+ *
+ * @param bh 缓冲区
+ */
+static void __bcache_remove(struct buffer_head *bh)
+{
+    struct buffer_head **link = &__bcache_hash[__bcache_hashfn(bh->blk, bh->lba)];
+    while (*link != NULL && *link != bh)
+        link = &(*link)->hash_next;
+    if (likely(*link != NULL))
+        *link = bh->hash_next;
+
+    list_del(&bh->lru_list);
+    --__bcache_stat.nr_buffers;
+    __bcache_stat.bytes -= bh->size;
+
+    kfree(bh->data);
+    kfree(bh);
+}
+
+/**
+ * @brief 从LRU链表头部开始淘汰未被引用的缓冲区，直到能够再容纳need字节（需要持有__bcache_lock）
+ *
+ * @param need 将要分配的字节数
+ */
+static void __bcache_shrink(uint64_t need)
+{
+    struct List *node = list_next(&__bcache_lru);
+    while (__bcache_stat.bytes + need > BCACHE_MAX_BYTES && node != &__bcache_lru)
+    {
+        struct buffer_head *bh = container_of(node, struct buffer_head, lru_list);
+        node = list_next(node);
+        if (bh->refcount > 0)
+            continue;
+        // 写回失败的脏缓冲区不能丢弃
+        if ((bh->flags & BH_DIRTY) && __bcache_writeback(bh) != 0)
+            continue;
+        __bcache_remove(bh);
+        ++__bcache_stat.evictions;
+    }
+}
+
+/**
+ * @brief 查找或者创建指定块的缓冲区，并增加其引用计数（需要持有__bcache_lock）
+ * 新创建的缓冲区中没有有效数据（未设置BH_VALID）
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号
+ * @param count 扇区数
+ * @return struct buffer_head* 缓冲区。失败时返回NULL
+ */
+static struct buffer_head *__bcache_getblk(struct block_device *blk, uint64_t lba, uint32_t count)
+{
+    struct buffer_head *bh = __bcache_hash[__bcache_hashfn(blk, lba)];
+    while (bh != NULL && !(bh->blk == blk && bh->lba == lba))
+        bh = bh->hash_next;
+
+    if (bh != NULL)
+    {
+        if (likely(bh->count == count))
+        {
+            ++__bcache_stat.hits;
+            ++bh->refcount;
+            // 移动到LRU链表的尾部
+            list_del(&bh->lru_list);
+            list_append(&__bcache_lru, &bh->lru_list);
+            return bh;
+        }
+
+        // 同一个扇区以不同的大小被访问：丢弃旧的缓冲区
+        if (bh->refcount > 0 || ((bh->flags & BH_DIRTY) && __bcache_writeback(bh) != 0))
+        {
+            kerror("bcache: lba=%ld is busy with count=%d, requested count=%d", lba, bh->count, count);
+            return NULL;
+        }
+        __bcache_remove(bh);
+    }
+
+    ++__bcache_stat.misses;
+    uint32_t size = count << 9;
+    __bcache_shrink(size);
+
+    bh = (struct buffer_head *)kzalloc(sizeof(struct buffer_head), 0);
+    if (unlikely(bh == NULL))
+        return NULL;
+    bh->data = kzalloc(size, 0);
+    if (unlikely(bh->data == NULL))
+    {
+        kfree(bh);
+        return NULL;
+    }
+
+    bh->blk = blk;
+    bh->lba = lba;
+    bh->count = count;
+    bh->size = size;
+    bh->refcount = 1;
+
+    bh->hash_next = __bcache_hash[__bcache_hashfn(blk, lba)];
+    __bcache_hash[__bcache_hashfn(blk, lba)] = bh;
+    list_append(&__bcache_lru, &bh->lru_list);
+
+    ++__bcache_stat.nr_buffers;
+    __bcache_stat.bytes += size;
+    return bh;
+}
+
+/**
+ * @brief 获取指定块的缓冲区，必要时从磁盘读取
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return struct buffer_head* 缓冲区（使用完毕后需要调用brelse()）。读取失败时返回NULL
+ */
+struct buffer_head *bread(struct block_device *blk, uint64_t lba, uint32_t count)
+{
+    mutex_lock(&__bcache_lock);
+    struct buffer_head *bh = __bcache_getblk(blk, lba, count);
+    if (bh != NULL && !(bh->flags & BH_VALID))
+    {
+        if (blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, lba, count, (uint64_t)bh->data) == AHCI_SUCCESS)
+            bh->flags |= BH_VALID;
+        else
+        {
+            kerror("bcache: failed to read lba=%ld, count=%d", lba, count);
+            __bcache_remove(bh);
+            bh = NULL;
+        }
+    }
+    mutex_unlock(&__bcache_lock);
+    return bh;
+}
+
+/**
+ * @brief 获取指定块的缓冲区，但不从磁盘读取（调用者将会覆盖整个块）
+ * 若缓冲区中原本没有有效数据，则返回清零后的缓冲区
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return struct buffer_head* 缓冲区（使用完毕后需要调用brelse()）。失败时返回NULL
+ */
+struct buffer_head *bget(struct block_device *blk, uint64_t lba, uint32_t count)
+{
+    mutex_lock(&__bcache_lock);
+    struct buffer_head *bh = __bcache_getblk(blk, lba, count);
+    if (bh != NULL)
+        bh->flags |= BH_VALID;
+    mutex_unlock(&__bcache_lock);
+    return bh;
+}
+
+/**
+ * @brief 将缓冲区标记为脏（由刷写线程写回磁盘）
+ *
+ * @param bh 缓冲区
+ */
+void bmark_dirty(struct buffer_head *bh)
+{
+    mutex_lock(&__bcache_lock);
+    if (!(bh->flags & BH_DIRTY))
+    {
+        bh->flags |= BH_DIRTY;
+        __bcache_stat.dirty_bytes += bh->size;
+    }
+    mutex_unlock(&__bcache_lock);
+}
+
+/**
+ * @brief 设置缓冲区的镜像副本：写回时，数据还会被写入lba+i*stride处（1≤i≤nr_mirrors）
+ *
+ * @param bh 缓冲区
+ * @param nr_mirrors 镜像副本的数量
+ * @param stride 相邻两个副本之间相距的扇区数
+ */
+void bset_mirror(struct buffer_head *bh, uint32_t nr_mirrors, uint64_t stride)
+{
+    mutex_lock(&__bcache_lock);
+    bh->nr_mirrors = nr_mirrors;
+    bh->mirror_stride = stride;
+    mutex_unlock(&__bcache_lock);
+}
+
+/**
+ * @brief 立即将缓冲区写回磁盘
+ *
+ * @param bh 缓冲区
+ * @return int 错误码
+ */
+int bwrite(struct buffer_head *bh)
+{
+    mutex_lock(&__bcache_lock);
+    int retval = __bcache_writeback(bh);
+    mutex_unlock(&__bcache_lock);
+    return retval;
+}
+
+/**
+ * @brief 释放对缓冲区的引用
+ *
+ * @param bh 缓冲区
+ */
+void brelse(struct buffer_head *bh)
+{
+    if (bh == NULL)
+        return;
+    mutex_lock(&__bcache_lock);
+    if (unlikely(bh->refcount <= 0))
+        kwarn("bcache: brelse on a free buffer, lba=%ld", bh->lba);
+    else
+        --bh->refcount;
+    mutex_unlock(&__bcache_lock);
+}
+
+/**
+ * @brief 将块设备上所有的脏缓冲区写回磁盘
+ *
+ * @param blk 块设备（为NULL时写回所有块设备的脏缓冲区）
+ * @return int 错误码
+ */
+int bsync(struct block_device *blk)
+{
+    int retval = 0;
+    mutex_lock(&__bcache_lock);
+    struct List *node = list_next(&__bcache_lru);
+    while (node != &__bcache_lru && __bcache_stat.dirty_bytes != 0)
+    {
+        struct buffer_head *bh = container_of(node, struct buffer_head, lru_list);
+        node = list_next(node);
+        if (!(bh->flags & BH_DIRTY) || (blk != NULL && bh->blk != blk))
+            continue;
+        if (__bcache_writeback(bh) != 0)
+            retval = -EIO;
+    }
+    mutex_unlock(&__bcache_lock);
+    return retval;
+}
+
+/**
+ * @brief 将起始扇区位于[lba, lba+count)内的脏缓冲区写回磁盘
+ * 在绕过缓存直接读取磁盘之前调用（要求该区域的缓冲区与访问范围按照相同的粒度对齐，例如都以簇为单位）
+ *
+ * @param blk 块设备
+ * @param lba 起始扇区号（磁盘上的绝对LBA）
+ * @param count 扇区数
+ * @return int 错误码
+ */
+int bsync_range(struct block_device *blk, uint64_t lba, uint32_t count)
+{
+    int retval = 0;
+    mutex_lock(&__bcache_lock);
+    for (uint64_t i = lba; i < lba + count && __bcache_stat.dirty_bytes != 0; ++i)
+    {
+        struct buffer_head *bh = __bcache_hash[__bcache_hashfn(blk, i)];
+        while (bh != NULL && !(bh->blk == blk && bh->lba == i))
+            bh = bh->hash_next;
+        if (bh != NULL && (bh->flags & BH_DIRTY) && __bcache_writeback(bh) != 0)
+            retval = -EIO;
+    }
+    mutex_unlock(&__bcache_lock);
+    return retval;
+}
+
+/**
+ * @brief 获取缓冲区缓存的统计信息(未上锁，不一定精准)
+ *
+ * @param stat 返回的统计信息
+ */
+void bcache_get_stat(struct bcache_stat_t *stat)
+{
+    *stat = __bcache_stat;
+}
+
+/**
+ * @brief 刷写线程：周期性地将脏缓冲区写回磁盘
+ *
+ * @param arg 无
+ * @return unsigned long
+ */
+static unsigned long __bcache_flush_thread(unsigned long arg)
+{
+    while (true)
+    {
+        usleep(BCACHE_FLUSH_INTERVAL);
+        if (__bcache_stat.dirty_bytes != 0)
+            bsync(NULL);
+    }
+    return 0;
+}
+
+/**
+ * @brief 初始化缓冲区缓存，并创建刷写线程（需要在进程上下文中调用）
+ *
+ */
+void bcache_init()
+{
+    mutex_init(&__bcache_lock);
+    memset(__bcache_hash, 0, sizeof(__bcache_hash));
+    memset(&__bcache_stat, 0, sizeof(__bcache_stat));
+    list_init(&__bcache_lru);
+
+    kernel_thread(__bcache_flush_thread, 0, 0);
+    kinfo("Block buffer cache initialized.");
+}
@@ -7,6 +7,7 @@
 #include <common/errno.h>
 #include <common/stdio.h>
 #include "fat_ent.h"
+#include "fat_cache.h"
 
 struct vfs_super_block_operations_t fat32_sb_ops;
 struct vfs_dir_entry_operations_t fat32_dEntry_ops;
@@ -63,7 +64,8 @@ struct vfs_dir_entry_t *fat32_lookup(struct vfs_index_node_t *parent_inode, stru
     fat32_sb_info_t *fsbi = (fat32_sb_info_t *)parent_inode->sb->private_sb_info;
     struct block_device *blk = parent_inode->sb->blk_device;
 
-    uint8_t *buf = kzalloc(fsbi->bytes_per_clus, 0);
+    struct buffer_head *bh = NULL;
+    uint8_t *buf = NULL;
 
     // 计算父目录项的起始簇号
     uint32_t cluster = finode->first_clus;
@@ -79,7 +81,10 @@ struct vfs_dir_entry_t *fat32_lookup(struct vfs_index_node_t *parent_inode, stru
         // kdebug("sector=%d",sector);
 
         // 读取父目录项的起始簇数据
-        blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)buf);
+        bh = bread(blk, sector, fsbi->sec_per_clus);
+        if (bh == NULL)
+            return NULL;
+        buf = (uint8_t *)bh->data;
 
         tmp_dEntry = (struct fat32_Directory_t *)buf;
 
@@ -278,13 +283,11 @@ struct vfs_dir_entry_t *fat32_lookup(struct vfs_index_node_t *parent_inode, stru
         }
 
         // 当前簇没有发现目标文件名，寻找下一个簇
+        brelse(bh);
         cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
 
         if (cluster >= 0x0ffffff7) // 寻找完父目录的所有簇，都没有找到目标文件名
-        {
-            kfree(buf);
             return NULL;
-        }
     }
 find_lookup_success:; // 找到目标dentry
     struct vfs_index_node_t *p = vfs_alloc_inode();
@@ -300,6 +303,7 @@ find_lookup_success:; // 找到目标dentry
     // 为inode的与文件系统相关的信息结构体分配空间
     p->private_inode_info = (void *)kzalloc(sizeof(fat32_inode_info_t), 0);
     finode = (fat32_inode_info_t *)p->private_inode_info;
+    mutex_init(&finode->extent_lock);
 
     finode->first_clus = ((tmp_dEntry->DIR_FstClusHI << 16) | tmp_dEntry->DIR_FstClusLO) & 0x0fffffff;
     finode->dEntry_location_clus = cluster;
@@ -321,7 +325,7 @@ find_lookup_success:; // 找到目标dentry
     list_init(&dest_dentry->child_node_list);
     list_init(&dest_dentry->subdirs_list);
 
-    kfree(buf);
+    brelse(bh);
     return dest_dentry;
 }
 
@@ -334,8 +338,12 @@ find_lookup_success:; // 找到目标dentry
 struct vfs_superblock_t *fat32_read_superblock(struct block_device *blk)
 {
     // 读取文件系统的boot扇区
-    uint8_t buf[512] = {0};
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, blk->bd_start_LBA, 1, (uint64_t)&buf);
+    struct buffer_head *bh = bread(blk, blk->bd_start_LBA, 1);
+    if (bh == NULL)
+    {
+        kerror("FAT32: failed to read the boot sector");
+        return NULL;
+    }
 
     // 分配超级块的空间
     struct vfs_superblock_t *sb_ptr = (struct vfs_superblock_t *)kzalloc(sizeof(struct vfs_superblock_t), 0);
@@ -345,7 +353,7 @@ struct vfs_superblock_t *fat32_read_superblock(struct block_device *blk)
     sb_ptr->private_sb_info = kzalloc(sizeof(fat32_sb_info_t), 0);
     sb_ptr->blk_device = blk;
 
-    struct fat32_BootSector_t *fbs = (struct fat32_BootSector_t *)buf;
+    struct fat32_BootSector_t *fbs = (struct fat32_BootSector_t *)bh->data;
 
     fat32_sb_info_t *fsbi = (fat32_sb_info_t *)(sb_ptr->private_sb_info);
 
@@ -361,12 +369,31 @@ struct vfs_superblock_t *fat32_read_superblock(struct block_device *blk)
     fsbi->NumFATs = fbs->BPB_NumFATs;
     fsbi->fsinfo_sector_addr_infat = fbs->BPB_FSInfo;
     fsbi->bootsector_bak_sector_addr_infat = fbs->BPB_BkBootSec;
+    // 数据区的簇号从2开始
+    fsbi->max_cluster = (fbs->BPB_TotSec32 - (fsbi->first_data_sector - blk->bd_start_LBA)) / fbs->BPB_SecPerClus + 1;
+    // 簇号不能超出FAT表所能表示的范围
+    fsbi->max_cluster = min(fsbi->max_cluster, fsbi->sec_per_FAT * (fsbi->bytes_per_sec >> 2) - 1);
+
+    if (fat32_fat_cache_init(fsbi) != 0)
+        kwarn("FAT32: failed to allocate the FAT cache");
 
     printk_color(ORANGE, BLACK, "FAT32 Boot Sector\n\tBPB_FSInfo:%#018lx\n\tBPB_BkBootSec:%#018lx\n\tBPB_TotSec32:%#018lx\n", fbs->BPB_FSInfo, fbs->BPB_BkBootSec, fbs->BPB_TotSec32);
 
     // fsinfo扇区的信息
     memset(&fsbi->fsinfo, 0, sizeof(struct fat32_FSInfo_t));
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, blk->bd_start_LBA + fsbi->fsinfo_sector_addr_infat, 1, (uint64_t)&fsbi->fsinfo);
+    struct buffer_head *fsinfo_bh = bread(blk, blk->bd_start_LBA + fsbi->fsinfo_sector_addr_infat, 1);
+    if (fsinfo_bh != NULL)
+    {
+        memcpy(&fsbi->fsinfo, fsinfo_bh->data, sizeof(struct fat32_FSInfo_t));
+        brelse(fsinfo_bh);
+    }
+
+    // 空闲簇位图在第一次分配簇时建立。FSI_Nxt_Free是分配簇时的起始查找位置
+    spin_init(&fsbi->alloc_lock);
+    fsbi->used_bitmap = NULL;
+    fsbi->next_free = 2;
+    if (fsbi->fsinfo.FSI_LeadSig == FAT32_FSINFO_LEAD_SIG && fsbi->fsinfo.FSI_Nxt_Free >= 2 && fsbi->fsinfo.FSI_Nxt_Free <= fsbi->max_cluster)
+        fsbi->next_free = fsbi->fsinfo.FSI_Nxt_Free;
 
     printk_color(BLUE, BLACK, "FAT32 FSInfo\n\tFSI_LeadSig:%#018lx\n\tFSI_StrucSig:%#018lx\n\tFSI_Free_Count:%#018lx\n", fsbi->fsinfo.FSI_LeadSig, fsbi->fsinfo.FSI_StrucSig, fsbi->fsinfo.FSI_Free_Count);
 
@@ -398,6 +425,7 @@ struct vfs_superblock_t *fat32_read_superblock(struct block_device *blk)
     sb_ptr->root->dir_inode->private_inode_info = kmalloc(sizeof(struct fat32_inode_info_t), 0);
     memset(sb_ptr->root->dir_inode->private_inode_info, 0, sizeof(struct fat32_inode_info_t));
     struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)sb_ptr->root->dir_inode->private_inode_info;
+    mutex_init(&finode->extent_lock);
 
     finode->first_clus = fbs->BPB_RootClus;
     finode->dEntry_location_clus = 0;
@@ -407,6 +435,7 @@ struct vfs_superblock_t *fat32_read_superblock(struct block_device *blk)
     finode->write_date = 0;
     finode->write_time;
 
+    brelse(bh);
     return sb_ptr;
 }
 
@@ -426,6 +455,10 @@ void fat32_write_superblock(struct vfs_superblock_t *sb)
  */
 void fat32_put_superblock(struct vfs_superblock_t *sb)
 {
+    fat32_fat_cache_destroy((fat32_sb_info_t *)sb->private_sb_info);
+    if (((fat32_sb_info_t *)sb->private_sb_info)->used_bitmap != NULL)
+        kfree(((fat32_sb_info_t *)sb->private_sb_info)->used_bitmap);
+    fat32_extent_invalidate((struct fat32_inode_info_t *)sb->root->dir_inode->private_inode_info);
     kfree(sb->private_sb_info);
     kfree(sb->root->dir_inode->private_inode_info);
     kfree(sb->root->dir_inode);
@@ -453,10 +486,13 @@ void fat32_write_inode(struct vfs_index_node_t *inode)
     // 计算目标inode对应数据区的LBA地址
     uint64_t fLBA = fsbi->first_data_sector + (finode->dEntry_location_clus - 2) * fsbi->sec_per_clus;
 
-    struct fat32_Directory_t *buf = (struct fat32_Directory_t *)kmalloc(fsbi->bytes_per_clus, 0);
-    memset(buf, 0, fsbi->bytes_per_clus);
-
-    inode->sb->blk_device->bd_disk->fops->transfer(inode->sb->blk_device->bd_disk, AHCI_CMD_READ_DMA_EXT, fLBA, fsbi->sec_per_clus, (uint64_t)buf);
+    struct buffer_head *bh = bread(inode->sb->blk_device, fLBA, fsbi->sec_per_clus);
+    if (bh == NULL)
+    {
+        kerror("FAT32 error: Failed to read the dentry of the inode");
+        return;
+    }
+    struct fat32_Directory_t *buf = (struct fat32_Directory_t *)bh->data;
     // 计算目标dEntry所在的位置
     struct fat32_Directory_t *fdEntry = buf + finode->dEntry_location_clus_offset;
 
@@ -465,9 +501,20 @@ void fat32_write_inode(struct vfs_index_node_t *inode)
     fdEntry->DIR_FstClusLO = finode->first_clus & 0xffff;
     fdEntry->DIR_FstClusHI = (finode->first_clus >> 16) | (fdEntry->DIR_FstClusHI & 0xf000);
 
-    // 将dir entry写回磁盘
-    inode->sb->blk_device->bd_disk->fops->transfer(inode->sb->blk_device->bd_disk, AHCI_CMD_WRITE_DMA_EXT, fLBA, fsbi->sec_per_clus, (uint64_t)buf);
-    kfree(buf);
+    // 将dir entry写回磁盘（由bcache写回）
+    bmark_dirty(bh);
+    brelse(bh);
+}
+
+/**
+ * @brief 释放inode之前，释放它的区段表
+ *
+ * @param inode 要被释放的inode
+ */
+void fat32_release_inode(struct vfs_index_node_t *inode)
+{
+    if (inode->private_inode_info != NULL)
+        fat32_extent_invalidate((struct fat32_inode_info_t *)inode->private_inode_info);
 }
 
 struct vfs_super_block_operations_t fat32_sb_ops =
@@ -475,6 +522,7 @@ struct vfs_super_block_operations_t fat32_sb_ops =
         .write_superblock = fat32_write_superblock,
         .put_superblock = fat32_put_superblock,
         .write_inode = fat32_write_inode,
+        .release_inode = fat32_release_inode,
 };
 
 // todo: compare
@@ -506,6 +554,24 @@ struct vfs_dir_entry_operations_t fat32_dEntry_ops =
         .iput = fat32_iput,
 };
 
+/**
+ * @brief 判断缓冲区能否直接作为DMA的目标
+ * 只有位于内核线性映射区域中的缓冲区在物理上是连续的（用户缓冲区可能由不连续的页面组成，且可能尚未映射）
+ *
+ * @param buf 缓冲区
+ * @param len 缓冲区长度
+ * @return true 可以
+ * @return false 不可以
+ */
+static bool __fat32_dma_capable(void *buf, uint64_t len)
+{
+    uint64_t addr = (uint64_t)buf;
+    // PRDT要求数据基地址按字对齐
+    if (addr < PAGE_OFFSET || (addr & 1))
+        return false;
+    return mm_is_2M_page(virt_2_phys(addr)) && mm_is_2M_page(virt_2_phys(addr + len - 1));
+}
+
 // todo: open
 long fat32_open(struct vfs_index_node_t *inode, struct vfs_file_t *file_ptr)
 {
@@ -548,10 +614,6 @@ long fat32_read(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *pos
     if (!cluster)
         return -EFAULT;
 
-    // find the actual cluster on disk of the specified position
-    for (int i = 0; i < clus_offset_in_file; ++i)
-        cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
-
     // 如果需要读取的数据边界大于文件大小
     if (*position + count > file_ptr->dEntry->dir_inode->file_size)
         count = file_ptr->dEntry->dir_inode->file_size - *position;
@@ -559,46 +621,65 @@ long fat32_read(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *pos
     // 剩余还需要传输的字节数量
     int64_t bytes_remain = count;
 
-    // alloc buffer memory space for ahci transfer
-    void *tmp_buffer = kmalloc(fsbi->bytes_per_clus, 0);
-
     int64_t retval = 0;
     do
     {
+        // 通过区段表找到当前位置所在的簇，以及从它开始物理上连续的簇的数量
+        uint32_t disk_clus, run;
+        if (fat32_extent_map(file_ptr->dEntry->dir_inode, clus_offset_in_file, &disk_clus, &run) != 0)
+            break;
+        uint64_t sector = fsbi->first_data_sector + (disk_clus - 2) * fsbi->sec_per_clus;
 
-        memset(tmp_buffer, 0, fsbi->bytes_per_clus);
-        uint64_t sector = fsbi->first_data_sector + (cluster - 2) * fsbi->sec_per_clus;
+        // 能够被完整读取的连续簇的数量（受单个磁盘命令的传输上限约束）
+        uint64_t nr_clus = min(run, bytes_remain / fsbi->bytes_per_clus);
+        nr_clus = min(nr_clus, AHCI_MAX_SECTORS_PER_CMD / fsbi->sec_per_clus);
 
-        // 读取一个簇的数据
-        int errno = blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)tmp_buffer);
-        if (errno != AHCI_SUCCESS)
+        int64_t step_trans_len = 0; // 当前循环传输的字节数
+        if (bytes_offset == 0 && nr_clus > 0 && __fat32_dma_capable(buf, nr_clus * fsbi->bytes_per_clus))
         {
-            kerror("FAT32 FS(read) error!");
-            retval = -EIO;
-            break;
+            // 将连续的簇合并为一次传输，直接读入目标缓冲区（需要先写回这些簇在bcache中的脏数据）
+            uint64_t nr_sec = nr_clus * fsbi->sec_per_clus;
+            if (bsync_range(blk, sector, nr_sec) != 0 ||
+                blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, nr_sec, (uint64_t)buf) != AHCI_SUCCESS)
+            {
+                kerror("FAT32 FS(read) error!");
+                retval = -EIO;
+                break;
+            }
+            step_trans_len = nr_clus * fsbi->bytes_per_clus;
+            clus_offset_in_file += nr_clus;
         }
-
-        int64_t step_trans_len = 0; // 当前循环传输的字节数
-        if (bytes_remain > (fsbi->bytes_per_clus - bytes_offset))
-            step_trans_len = (fsbi->bytes_per_clus - bytes_offset);
-        else
-            step_trans_len = bytes_remain;
-
-        if (((uint64_t)buf) < USER_MAX_LINEAR_ADDR)
-            copy_to_user(buf, tmp_buffer + bytes_offset, step_trans_len);
         else
-            memcpy(buf, tmp_buffer + bytes_offset, step_trans_len);
+        {
+            // 通过bcache读取一个簇的数据
+            struct buffer_head *bh = bread(blk, sector, fsbi->sec_per_clus);
+            if (bh == NULL)
+            {
+                kerror("FAT32 FS(read) error!");
+                retval = -EIO;
+                break;
+            }
+            void *tmp_buffer = bh->data;
+
+            if (bytes_remain > (fsbi->bytes_per_clus - bytes_offset))
+                step_trans_len = (fsbi->bytes_per_clus - bytes_offset);
+            else
+                step_trans_len = bytes_remain;
+
+            if (((uint64_t)buf) < USER_MAX_LINEAR_ADDR)
+                copy_to_user(buf, tmp_buffer + bytes_offset, step_trans_len);
+            else
+                memcpy(buf, tmp_buffer + bytes_offset, step_trans_len);
+            brelse(bh);
+            ++clus_offset_in_file;
+        }
 
         bytes_remain -= step_trans_len;
         buf += step_trans_len;
-        bytes_offset -= bytes_offset;
+        bytes_offset = 0;
 
         *position += step_trans_len; // 更新文件指针
-
-        cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
-    } while (bytes_remain && (cluster < 0x0ffffff8) && cluster != 0);
-
-    kfree(tmp_buffer);
+    } while (bytes_remain);
 
     if (!bytes_remain)
         retval = count;
@@ -634,12 +715,17 @@ long fat32_write(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *po
         // 分配空闲簇
         if (fat32_alloc_clusters(file_ptr->dEntry->dir_inode, &cluster, 1) != 0)
             return -ENOSPC;
+        flags = 1;
     }
-    else
+    else if (fat32_extent_map(file_ptr->dEntry->dir_inode, clus_offset_in_file, &cluster, NULL) == -ENOENT)
     {
-        // 跳转到position所在的簇
-        for (uint64_t i = 0; i < clus_offset_in_file; ++i)
-            cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
+        // position恰好位于簇链的末尾，需要分配新簇
+        uint32_t tmp;
+        if (clus_offset_in_file == 0 || fat32_extent_map(file_ptr->dEntry->dir_inode, clus_offset_in_file - 1, &tmp, NULL) != 0)
+            return -EINVAL;
+        if (fat32_alloc_clusters(file_ptr->dEntry->dir_inode, &cluster, 1) != 0)
+            return -ENOSPC;
+        flags = 1;
     }
     // kdebug("cluster(start)=%d", cluster);
     //  没有可用的磁盘空间
@@ -654,23 +740,9 @@ long fat32_write(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *po
     uint64_t sector;
     int64_t retval = 0;
 
-    void *tmp_buffer = kmalloc(fsbi->bytes_per_clus, 0);
     do
     {
-        memset(tmp_buffer, 0, fsbi->bytes_per_clus);
         sector = fsbi->first_data_sector + (cluster - 2) * fsbi->sec_per_clus; // 计算对应的扇区
-        if (!flags)                                                            // 当前簇已分配
-        {
-            // kdebug("read existed sec=%ld", sector);
-            //  读取一个簇的数据
-            int errno = blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)tmp_buffer);
-            if (errno != AHCI_SUCCESS)
-            {
-                // kerror("FAT32 FS(write)  read disk error!");
-                retval = -EIO;
-                break;
-            }
-        }
 
         int64_t step_trans_len = 0; // 当前循环传输的字节数
         if (bytes_remain > (fsbi->bytes_per_clus - bytes_offset))
@@ -678,20 +750,36 @@ long fat32_write(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *po
         else
             step_trans_len = bytes_remain;
 
+        struct buffer_head *bh = NULL;
+        if (!flags && step_trans_len < fsbi->bytes_per_clus) // 当前簇已分配，且只覆盖其中的一部分
+        {
+            // kdebug("read existed sec=%ld", sector);
+            //  读取一个簇的数据
+            bh = bread(blk, sector, fsbi->sec_per_clus);
+        }
+        else // 新分配的簇，或者整个簇都会被覆盖，不需要读取磁盘
+        {
+            bh = bget(blk, sector, fsbi->sec_per_clus);
+            if (bh != NULL && flags)
+                memset(bh->data, 0, bh->size);
+        }
+        if (bh == NULL)
+        {
+            // kerror("FAT32 FS(write)  read disk error!");
+            retval = -EIO;
+            break;
+        }
+        void *tmp_buffer = bh->data;
+
         // kdebug("step_trans_len=%d, bytes_offset=%d", step_trans_len, bytes_offset);
         if (((uint64_t)buf) < USER_MAX_LINEAR_ADDR)
             copy_from_user(tmp_buffer + bytes_offset, buf, step_trans_len);
         else
             memcpy(tmp_buffer + bytes_offset, buf, step_trans_len);
 
-        // 写入数据到对应的簇
-        int errno = blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)tmp_buffer);
-        if (errno != AHCI_SUCCESS)
-        {
-            kerror("FAT32 FS(write)  write disk error!");
-            retval = -EIO;
-            break;
-        }
+        // 写入数据到对应的簇（由bcache写回磁盘）
+        bmark_dirty(bh);
+        brelse(bh);
 
         bytes_remain -= step_trans_len;
         buf += step_trans_len;
@@ -700,23 +788,21 @@ long fat32_write(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *po
         *position += step_trans_len; // 更新文件指针
         // kdebug("step_trans_len=%d", step_trans_len);
 
-        int next_clus = 0;
-        if (bytes_remain)
-            next_clus = fat32_read_FAT_entry(blk, fsbi, cluster);
-        else
+        if (!bytes_remain)
             break;
-        if (next_clus >= 0x0ffffff8) // 已经到达了最后一个簇，需要分配新簇
+        // 通过区段表找到下一个簇
+        ++clus_offset_in_file;
+        uint32_t next_clus = 0;
+        if (fat32_extent_map(file_ptr->dEntry->dir_inode, clus_offset_in_file, &next_clus, NULL) != 0) // 已经到达了最后一个簇，需要分配新簇
         {
             if (fat32_alloc_clusters(file_ptr->dEntry->dir_inode, &next_clus, 1) != 0)
             {
                 // 没有空闲簇
-                kfree(tmp_buffer);
                 return -ENOSPC;
             }
-
-            cluster = next_clus; // 切换当前簇
-            flags = 1;           // 标记当前簇是新分配的簇
+            flags = 1; // 标记当前簇是新分配的簇
         }
+        cluster = next_clus; // 切换当前簇
 
     } while (bytes_remain);
 
@@ -728,7 +814,6 @@ long fat32_write(struct vfs_file_t *file_ptr, char *buf, int64_t count, long *po
         // kdebug("new file size=%ld", *position);
     }
 
-    kfree(tmp_buffer);
     if (!bytes_remain)
         retval = count;
     // kdebug("retval=%lld", retval);
@@ -821,6 +906,7 @@ long fat32_create(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_t
     dest_dEntry->dir_ops = &fat32_dEntry_ops;
 
     struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)kzalloc(sizeof(struct fat32_inode_info_t), 0);
+    mutex_init(&finode->extent_lock);
     inode->attribute = VFS_IF_FILE;
     inode->file_ops = &fat32_file_ops;
     inode->file_size = 0;
@@ -839,16 +925,21 @@ long fat32_create(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_t
 
     // 空闲dentry所在的扇区号
     uint32_t tmp_dentry_sector = 0;
-    // 空闲dentry所在的缓冲区的基地址
-    uint64_t tmp_dentry_clus_buf_addr = 0;
+    // 空闲dentry所在簇的缓冲区
+    struct buffer_head *tmp_dentry_bh = NULL;
     uint64_t tmp_parent_dentry_clus = 0;
     // 寻找空闲目录项
-    struct fat32_Directory_t *empty_fat32_dentry = fat32_find_empty_dentry(parent_inode, cnt_longname + 1, 0, &tmp_dentry_sector, &tmp_parent_dentry_clus, &tmp_dentry_clus_buf_addr);
+    struct fat32_Directory_t *empty_fat32_dentry = fat32_find_empty_dentry(parent_inode, cnt_longname + 1, 0, &tmp_dentry_sector, &tmp_parent_dentry_clus, &tmp_dentry_bh);
     // kdebug("found empty dentry, cnt_longname=%ld", cnt_longname);
+    if (empty_fat32_dentry == NULL)
+    {
+        retval = -EIO;
+        goto fail;
+    }
 
     finode->first_clus = 0;
     finode->dEntry_location_clus = tmp_parent_dentry_clus;
-    finode->dEntry_location_clus_offset = empty_fat32_dentry - (struct fat32_Directory_t *)tmp_dentry_clus_buf_addr;
+    finode->dEntry_location_clus_offset = empty_fat32_dentry - (struct fat32_Directory_t *)tmp_dentry_bh->data;
 
     // ====== 为新的文件分配一个簇 =======
     uint32_t new_dir_clus;
@@ -873,16 +964,16 @@ long fat32_create(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_t
 
     // ====== 将目录项写回磁盘
     // kdebug("tmp_dentry_sector=%ld", tmp_dentry_sector);
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, tmp_dentry_sector, fsbi->sec_per_clus, tmp_dentry_clus_buf_addr);
+    bmark_dirty(tmp_dentry_bh);
 
     // 注意：parent字段需要在调用函数的地方进行设置
 
-    // 释放在find empty dentry中动态申请的缓冲区
-    kfree((void *)tmp_dentry_clus_buf_addr);
+    // 释放在find empty dentry中获取的缓冲区
+    brelse(tmp_dentry_bh);
     return 0;
 fail:;
-    // 释放在find empty dentry中动态申请的缓冲区
-    kfree((void *)tmp_dentry_clus_buf_addr);
+    // 释放在find empty dentry中获取的缓冲区
+    brelse(tmp_dentry_bh);
     dest_dEntry->dir_inode = NULL;
     dest_dEntry->dir_ops = NULL;
     kfree(finode);
@@ -919,11 +1010,13 @@ int64_t fat32_mkdir(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_
 
     // 空闲dentry所在的扇区号
     uint32_t tmp_dentry_sector = 0;
-    // 空闲dentry所在的缓冲区的基地址
-    uint64_t tmp_dentry_clus_buf_addr = 0;
+    // 空闲dentry所在簇的缓冲区
+    struct buffer_head *tmp_dentry_bh = NULL;
     uint64_t tmp_parent_dentry_clus = 0;
     // 寻找空闲目录项
-    struct fat32_Directory_t *empty_fat32_dentry = fat32_find_empty_dentry(parent_inode, cnt_longname + 1, 0, &tmp_dentry_sector, &tmp_parent_dentry_clus, &tmp_dentry_clus_buf_addr);
+    struct fat32_Directory_t *empty_fat32_dentry = fat32_find_empty_dentry(parent_inode, cnt_longname + 1, 0, &tmp_dentry_sector, &tmp_parent_dentry_clus, &tmp_dentry_bh);
+    if (empty_fat32_dentry == NULL)
+        return -EIO;
 
     // ====== 初始化inode =======
     struct vfs_index_node_t *inode = vfs_alloc_inode();
@@ -941,9 +1034,10 @@ int64_t fat32_mkdir(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_
     inode->private_inode_info = (fat32_inode_info_t *)kmalloc(sizeof(fat32_inode_info_t), 0);
     memset(inode->private_inode_info, 0, sizeof(fat32_inode_info_t));
     fat32_inode_info_t *p = (fat32_inode_info_t *)inode->private_inode_info;
+    mutex_init(&p->extent_lock);
     p->first_clus = 0;
     p->dEntry_location_clus = tmp_parent_dentry_clus;
-    p->dEntry_location_clus_offset = empty_fat32_dentry - (struct fat32_Directory_t *)tmp_dentry_clus_buf_addr;
+    p->dEntry_location_clus_offset = empty_fat32_dentry - (struct fat32_Directory_t *)tmp_dentry_bh->data;
     // kdebug(" p->dEntry_location_clus_offset=%d", p->dEntry_location_clus_offset);
     // todo: 填写完全fat32_inode_info的信息
 
@@ -974,12 +1068,18 @@ int64_t fat32_mkdir(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_
 
     // ====== 将目录项写回磁盘
     // kdebug("tmp_dentry_sector=%ld", tmp_dentry_sector);
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, tmp_dentry_sector, fsbi->sec_per_clus, tmp_dentry_clus_buf_addr);
+    bmark_dirty(tmp_dentry_bh);
     // ====== 初始化新的文件夹的目录项 =====
     {
         // kdebug("to create dot and dot dot.");
-        void *buf = kmalloc(fsbi->bytes_per_clus, 0);
-        struct fat32_Directory_t *new_dir_dentries = (struct fat32_Directory_t *)buf;
+        uint64_t sector = fsbi->first_data_sector + (new_dir_clus - 2) * fsbi->sec_per_clus;
+        struct buffer_head *bh = bget(blk, sector, fsbi->sec_per_clus);
+        if (bh == NULL)
+        {
+            retval = -EIO;
+            goto fail;
+        }
+        struct fat32_Directory_t *new_dir_dentries = (struct fat32_Directory_t *)bh->data;
         memset((void *)new_dir_dentries, 0, fsbi->bytes_per_clus);
 
         // 新增 . 目录项
@@ -1003,23 +1103,22 @@ int64_t fat32_mkdir(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_
         new_dir_dentries->DIR_FstClusHI = (unsigned short)(parent_inode_info->first_clus >> 16) & 0x0fff;
         new_dir_dentries->DIR_FstClusLO = (unsigned short)(parent_inode_info->first_clus) & 0xffff;
 
-        // 写入磁盘
-
-        uint64_t sector = fsbi->first_data_sector + (new_dir_clus - 2) * fsbi->sec_per_clus;
+        // 写入磁盘（由bcache写回）
         // kdebug("add dot and dot dot: sector=%ld", sector);
-        blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)buf);
+        bmark_dirty(bh);
+        brelse(bh);
     }
 
     // 注意：parent字段需要在调用函数的地方进行设置
     // 注意：需要将当前dentry加入父目录的subdirs_list
 
-    // 释放在find empty dentry中动态申请的缓冲区
-    kfree((void *)tmp_dentry_clus_buf_addr);
+    // 释放在find empty dentry中获取的缓冲区
+    brelse(tmp_dentry_bh);
 
     return 0;
 fail:;
-    // 释放在find empty dentry中动态申请的缓冲区
-    kfree((void *)tmp_dentry_clus_buf_addr);
+    // 释放在find empty dentry中获取的缓冲区
+    brelse(tmp_dentry_bh);
     return retval;
 }
 
@@ -1056,21 +1155,18 @@ int64_t fat32_readdir(struct vfs_file_t *file_ptr, void *dirent, vfs_filldir_t f
     fat32_sb_info_t *fsbi = (fat32_sb_info_t *)file_ptr->dEntry->dir_inode->sb->private_sb_info;
     struct block_device *blk = file_ptr->dEntry->dir_inode->sb->blk_device;
 
-    unsigned char *buf = (unsigned char *)kzalloc(fsbi->bytes_per_clus, 0);
+    struct buffer_head *bh = NULL;
+    unsigned char *buf = NULL;
     uint32_t cluster = finode->first_clus;
 
     // 当前文件指针所在位置的簇号（文件内偏移量）
     int clus_num = file_ptr->position / fsbi->bytes_per_clus;
 
-    // 循环读取fat entry，直到读取到文件当前位置的所在簇号
-    for (int i = 0; i < clus_num; ++i)
+    // 通过区段表找到文件当前位置的所在簇号
+    if (fat32_extent_map(file_ptr->dEntry->dir_inode, clus_num, &cluster, NULL) != 0) // 文件结尾
     {
-        cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
-        if (cluster > 0x0ffffff7) // 文件结尾
-        {
-            kerror("file position out of range! (cluster not exists)");
-            return NULL;
-        }
+        kerror("file position out of range! (cluster not exists)");
+        return NULL;
     }
 
     uint64_t dentry_type = 0; // 传递给filler的dentry类型数据
@@ -1084,13 +1180,14 @@ int64_t fat32_readdir(struct vfs_file_t *file_ptr, void *dirent, vfs_filldir_t f
         uint64_t sector = fsbi->first_data_sector + (cluster - 2) * fsbi->sec_per_clus;
         // 读取文件夹目录项当前位置起始扇区的数据
 
-        if (AHCI_SUCCESS != blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)buf))
+        bh = bread(blk, sector, fsbi->sec_per_clus);
+        if (bh == NULL)
         {
             // 读取失败
             kerror("Failed to read the file's first sector.");
-            kfree(buf);
             return NULL;
         }
+        buf = (unsigned char *)bh->data;
 
         struct fat32_Directory_t *dentry = NULL;
         struct fat32_LongDirectory_t *long_dentry = NULL;
@@ -1212,14 +1309,15 @@ int64_t fat32_readdir(struct vfs_file_t *file_ptr, void *dirent, vfs_filldir_t f
         }
 
         // 当前簇不存在目录项
+        brelse(bh);
         cluster = fat32_read_FAT_entry(blk, fsbi, cluster);
     }
 
-    kfree(buf);
     // 在上面的循环中读取到目录项结尾了，仍没有找到
     return NULL;
 
 find_dir_success:;
+    brelse(bh);
     // 将文件夹位置坐标加32（即指向下一个目录项）
     file_ptr->position += 32;
     // todo: 计算ino_t
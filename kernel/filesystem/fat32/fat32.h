@@ -13,9 +13,14 @@
 
 #include <filesystem/MBR.h>
 #include <filesystem/VFS/VFS.h>
+#include <common/spinlock.h>
+#include <common/mutex.h>
 
 #define FAT32_MAX_PARTITION_NUM 128 // 系统支持的最大的fat32分区数量
 
+#define FAT32_FAT_WINDOW_SECTORS 8      // FAT缓存中每个窗口包含的扇区数
+#define FAT32_FAT_CACHE_MAX_WINDOWS 256 // 同时载入内存的FAT窗口数量的上限
+
 /**
  * @brief fat32文件系统引导扇区结构体
  *
@@ -72,6 +77,9 @@ struct fat32_FSInfo_t
     uint32_t FSI_TrailSig;      // 结束标志，数值为0xaa550000
 } __attribute__((packed));
 
+#define FAT32_FSINFO_LEAD_SIG 0x41615252
+#define FAT32_FSINFO_STRUC_SIG 0x61417272
+
 #define ATTR_READ_ONLY (1 << 0)
 #define ATTR_HIDDEN (1 << 1)
 #define ATTR_SYSTEM (1 << 2)
@@ -121,6 +129,21 @@ struct fat32_LongDirectory_t
     unsigned short LDIR_Name3[2];  // 长文件名的12-13个字符，每个字符占2bytes
 } __attribute__((packed));
 
+/**
+ * @brief FAT表的内存缓存（见fat_cache.h）
+ *
+ */
+struct fat32_fat_cache_t
+{
+    spinlock_t lock;          // 保护窗口数组与gen
+    uint32_t **windows;       // 每个窗口的FAT表项（未载入的窗口为NULL）
+    uint32_t nr_windows;      // 窗口的总数
+    uint32_t nr_resident;     // 已载入的窗口数量
+    uint32_t ents_per_window; // 每个窗口包含的FAT表项数
+    uint32_t clock;           // 淘汰窗口时的时钟指针
+    uint64_t gen;             // 每次修改FAT表项时加1（用于检测载入窗口期间发生的修改）
+};
+
 /**
  * @brief fat32文件系统的超级块信息结构体
  *
@@ -146,10 +169,30 @@ struct fat32_partition_info_t
     uint64_t FAT2_base_sector;  // FAT2表的起始簇号
     uint64_t sec_per_FAT;       // 每FAT表扇区数
     uint64_t NumFATs;           // FAT表数
+    uint64_t max_cluster;       // 数据区最大的簇号
+
+    struct fat32_fat_cache_t fat_cache; // FAT表的内存缓存
+
+    spinlock_t alloc_lock;  // 保护used_bitmap、free_count与next_free
+    uint64_t *used_bitmap;  // 簇的使用情况位图（第i位为1表示簇i已被使用），为NULL时表示尚未建立
+    uint32_t free_count;    // 空闲簇的数量
+    uint32_t next_free;     // 下一次分配簇时开始查找的位置（会写回FSInfo扇区的FSI_Nxt_Free）
+    uint64_t free_gen;      // 位图尚未建立时，每次释放簇都加1（用于检测建立位图期间发生的释放）
 };
 
 typedef struct fat32_partition_info_t fat32_sb_info_t;
 
+/**
+ * @brief 文件簇链中物理上连续的一段簇
+ *
+ */
+struct fat32_extent_t
+{
+    uint32_t file_clus; // 第一个簇在文件中的序号
+    uint32_t disk_clus; // 第一个簇在磁盘上的簇号
+    uint32_t len;       // 簇的数量
+};
+
 struct fat32_inode_info_t
 {
     uint32_t first_clus;                  // 文件的起始簇号
@@ -160,6 +203,12 @@ struct fat32_inode_info_t
     uint16_t create_time;
     uint16_t write_time;
     uint16_t write_date;
+
+    struct fat32_extent_t *extents; // 簇链的区段表（按file_clus升序排列）
+    uint32_t nr_extents;            // 区段的数量
+    uint32_t max_extents;           // extents数组的容量
+    bool extent_valid;              // 区段表是否已经建立
+    mutex_t extent_lock;            // 保护区段表（建立区段表时需要读取FAT表，可能会睡眠，因此使用mutex）
 };
 
 typedef struct fat32_inode_info_t fat32_inode_info_t;
@@ -0,0 +1,409 @@
+/**
+ * @file fat_cache.c
+ * @brief FAT表的内存缓存，以及文件簇链的区段表（extent map）
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "fat_cache.h"
+#include "fat_ent.h"
+#include <common/bcache.h>
+#include <common/kprint.h>
+#include <common/errno.h>
+#include <mm/slab.h>
+
+/**
+ * @brief 初始化超级块的FAT缓存（在读取超级块时调用，不会预先载入任何窗口）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @return int 错误码
+ */
+int fat32_fat_cache_init(fat32_sb_info_t *fsbi)
+{
+    struct fat32_fat_cache_t *fc = &fsbi->fat_cache;
+    spin_init(&fc->lock);
+    fc->ents_per_window = FAT32_FAT_WINDOW_SECTORS * (fsbi->bytes_per_sec >> 2);
+    fc->nr_windows = (fsbi->sec_per_FAT + FAT32_FAT_WINDOW_SECTORS - 1) / FAT32_FAT_WINDOW_SECTORS;
+    fc->nr_resident = 0;
+    fc->clock = 0;
+    fc->gen = 0;
+    fc->windows = (uint32_t **)kzalloc(fc->nr_windows * sizeof(uint32_t *), 0);
+    if (fc->windows == NULL)
+        return -ENOMEM;
+    return 0;
+}
+
+/**
+ * @brief 释放超级块的FAT缓存
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ */
+void fat32_fat_cache_destroy(fat32_sb_info_t *fsbi)
+{
+    struct fat32_fat_cache_t *fc = &fsbi->fat_cache;
+    if (fc->windows == NULL)
+        return;
+    for (uint32_t i = 0; i < fc->nr_windows; ++i)
+    {
+        if (fc->windows[i] != NULL)
+            kfree(fc->windows[i]);
+    }
+    kfree(fc->windows);
+    fc->windows = NULL;
+    fc->nr_resident = 0;
+}
+
+/**
+ * @brief 从bcache载入FAT1的指定窗口
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @param win 窗口编号
+ * @return uint32_t* 窗口的FAT表项（失败时返回NULL）
+ */
+static uint32_t *__fat32_fat_window_load(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t win)
+{
+    uint32_t *ents = (uint32_t *)kzalloc(FAT32_FAT_WINDOW_SECTORS * fsbi->bytes_per_sec, 0);
+    if (ents == NULL)
+        return NULL;
+
+    uint64_t first_sec = (uint64_t)win * FAT32_FAT_WINDOW_SECTORS;
+    uint64_t nr_sec = min(FAT32_FAT_WINDOW_SECTORS, fsbi->sec_per_FAT - first_sec);
+    for (uint64_t i = 0; i < nr_sec; ++i)
+    {
+        struct buffer_head *bh = bread(blk, fsbi->FAT1_base_sector + first_sec + i, 1);
+        if (bh == NULL)
+        {
+            kfree(ents);
+            return NULL;
+        }
+        memcpy((uint8_t *)ents + i * fsbi->bytes_per_sec, bh->data, fsbi->bytes_per_sec);
+        brelse(bh);
+    }
+    return ents;
+}
+
+/**
+ * @brief 将载入的窗口加入FAT缓存，必要时淘汰另一个窗口（需要持有fc->lock）
+ *
+ * @param fc FAT缓存
+ * @param win 窗口编号
+ * @param ents 窗口的FAT表项
+ */
+static void __fat32_fat_window_install(struct fat32_fat_cache_t *fc, uint32_t win, uint32_t *ents)
+{
+    // 使用时钟算法选出被淘汰的窗口（窗口中的数据与bcache一致，直接丢弃即可）
+    while (fc->nr_resident >= FAT32_FAT_CACHE_MAX_WINDOWS)
+    {
+        fc->clock = (fc->clock + 1) % fc->nr_windows;
+        if (fc->windows[fc->clock] != NULL && fc->clock != win)
+        {
+            kfree(fc->windows[fc->clock]);
+            fc->windows[fc->clock] = NULL;
+            --fc->nr_resident;
+        }
+    }
+    fc->windows[win] = ents;
+    ++fc->nr_resident;
+}
+
+/**
+ * @brief 从FAT缓存中读取指定簇的FAT表项（窗口未载入时从bcache载入）
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @param cluster 指定簇
+ * @param value 返回的FAT表项的值（包含高4bit）
+ * @return int 错误码
+ */
+int fat32_fat_cache_get(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t cluster, uint32_t *value)
+{
+    struct fat32_fat_cache_t *fc = &fsbi->fat_cache;
+    uint32_t win = cluster / fc->ents_per_window;
+    uint32_t idx = cluster % fc->ents_per_window;
+    if (unlikely(win >= fc->nr_windows))
+        return -EINVAL;
+
+    while (true)
+    {
+        spin_lock(&fc->lock);
+        if (likely(fc->windows[win] != NULL))
+        {
+            *value = fc->windows[win][idx];
+            spin_unlock(&fc->lock);
+            return 0;
+        }
+        uint64_t gen = fc->gen;
+        spin_unlock(&fc->lock);
+
+        // 载入窗口需要读取磁盘，不能持有自旋锁
+        uint32_t *ents = __fat32_fat_window_load(blk, fsbi, win);
+        if (ents == NULL)
+            return -EIO;
+
+        spin_lock(&fc->lock);
+        // 载入期间FAT表被修改过，窗口中的数据可能已经过时，重新载入
+        if (unlikely(fc->gen != gen))
+        {
+            spin_unlock(&fc->lock);
+            kfree(ents);
+            continue;
+        }
+        if (fc->windows[win] == NULL)
+            __fat32_fat_window_install(fc, win, ents);
+        else
+            kfree(ents);
+        *value = fc->windows[win][idx];
+        spin_unlock(&fc->lock);
+        return 0;
+    }
+}
+
+/**
+ * @brief FAT表项被修改后，更新FAT缓存中的对应表项（窗口未载入时不做任何事）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @param cluster 指定簇
+ * @param value FAT表项的新值（包含高4bit）
+ */
+void fat32_fat_cache_update(fat32_sb_info_t *fsbi, uint32_t cluster, uint32_t value)
+{
+    struct fat32_fat_cache_t *fc = &fsbi->fat_cache;
+    uint32_t win = cluster / fc->ents_per_window;
+    if (unlikely(win >= fc->nr_windows))
+        return;
+
+    spin_lock(&fc->lock);
+    ++fc->gen;
+    if (fc->windows[win] != NULL)
+        fc->windows[win][cluster % fc->ents_per_window] = value;
+    spin_unlock(&fc->lock);
+}
+
+/**
+ * @brief 释放区段表（需要持有extent_lock）
+ *
+ * @param finode 文件的inode私有信息
+ */
+static void __fat32_extent_drop(struct fat32_inode_info_t *finode)
+{
+    if (finode->extents != NULL)
+        kfree(finode->extents);
+    finode->extents = NULL;
+    finode->nr_extents = 0;
+    finode->max_extents = 0;
+    finode->extent_valid = false;
+}
+
+/**
+ * @brief 在区段表的末尾加入文件的第file_clus个簇（需要持有extent_lock）（与最后一个区段连续时直接合并）
+ *
+ * @param finode 文件的inode私有信息
+ * @param file_clus 簇在文件中的序号
+ * @param disk_clus 簇号
+ * @return int 错误码
+ */
+static int __fat32_extent_push(struct fat32_inode_info_t *finode, uint32_t file_clus, uint32_t disk_clus)
+{
+    if (finode->nr_extents > 0)
+    {
+        struct fat32_extent_t *last = &finode->extents[finode->nr_extents - 1];
+        if (last->file_clus + last->len == file_clus && last->disk_clus + last->len == disk_clus)
+        {
+            ++last->len;
+            return 0;
+        }
+    }
+
+    // 扩容
+    if (finode->nr_extents == finode->max_extents)
+    {
+        uint32_t new_max = finode->max_extents ? finode->max_extents * 2 : 8;
+        struct fat32_extent_t *new_extents = (struct fat32_extent_t *)kmalloc(new_max * sizeof(struct fat32_extent_t), 0);
+        if (new_extents == NULL)
+            return -ENOMEM;
+        if (finode->extents != NULL)
+        {
+            memcpy(new_extents, finode->extents, finode->nr_extents * sizeof(struct fat32_extent_t));
+            kfree(finode->extents);
+        }
+        finode->extents = new_extents;
+        finode->max_extents = new_max;
+    }
+
+    struct fat32_extent_t *ext = &finode->extents[finode->nr_extents++];
+    ext->file_clus = file_clus;
+    ext->disk_clus = disk_clus;
+    ext->len = 1;
+    return 0;
+}
+
+/**
+ * @brief 遍历文件的簇链，建立区段表（需要持有extent_lock）
+ *
+ * @param inode 文件的inode
+ * @return int 错误码
+ */
+static int __fat32_extent_build(struct vfs_index_node_t *inode)
+{
+    struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)inode->private_inode_info;
+    fat32_sb_info_t *fsbi = (fat32_sb_info_t *)inode->sb->private_sb_info;
+    struct block_device *blk = inode->sb->blk_device;
+
+    __fat32_extent_drop(finode);
+
+    uint32_t cluster = finode->first_clus;
+    uint32_t file_clus = 0;
+    while (cluster >= 2 && cluster <= fsbi->max_cluster)
+    {
+        // 簇链的长度不可能超过簇的总数，否则说明簇链中存在环
+        if (unlikely(file_clus >= fsbi->max_cluster))
+        {
+            kerror("FAT32: cluster chain starting at %d is corrupted", finode->first_clus);
+            __fat32_extent_drop(finode);
+            return -EIO;
+        }
+        int retval = __fat32_extent_push(finode, file_clus, cluster);
+        if (retval != 0)
+        {
+            __fat32_extent_drop(finode);
+            return retval;
+        }
+        ++file_clus;
+        // 读取失败时不能把当前簇当作簇链的末尾，否则之后追加簇时会截断文件
+        uint32_t value;
+        retval = fat32_fat_cache_get(blk, fsbi, cluster, &value);
+        if (retval != 0)
+        {
+            kerror("FAT32: failed to read the FAT entry of cluster %d", cluster);
+            __fat32_extent_drop(finode);
+            return retval;
+        }
+        cluster = value & 0x0fffffff;
+    }
+    finode->extent_valid = true;
+    return 0;
+}
+
+/**
+ * @brief 查找文件中第file_clus个簇在磁盘上的簇号（区段表尚未建立时，遍历簇链建立区段表）
+ *
+ * @param inode 文件的inode
+ * @param file_clus 簇在文件中的序号
+ * @param disk_clus 返回的簇号
+ * @param run 返回从该簇开始，物理上连续的簇的数量（可以为NULL）
+ * @return int 错误码（file_clus超出文件的簇链时返回-ENOENT）
+ */
+int fat32_extent_map(struct vfs_index_node_t *inode, uint32_t file_clus, uint32_t *disk_clus, uint32_t *run)
+{
+    struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)inode->private_inode_info;
+    int retval = 0;
+    mutex_lock(&finode->extent_lock);
+    if (!finode->extent_valid)
+    {
+        retval = __fat32_extent_build(inode);
+        if (retval != 0)
+            goto out;
+    }
+
+    if (finode->nr_extents == 0)
+    {
+        retval = -ENOENT;
+        goto out;
+    }
+    struct fat32_extent_t *last = &finode->extents[finode->nr_extents - 1];
+    if (file_clus >= last->file_clus + last->len)
+    {
+        retval = -ENOENT;
+        goto out;
+    }
+
+    // 二分查找最后一个file_clus不大于目标的区段
+    uint32_t lo = 0, hi = finode->nr_extents - 1;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi + 1) >> 1;
+        if (finode->extents[mid].file_clus <= file_clus)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    struct fat32_extent_t *ext = &finode->extents[lo];
+    *disk_clus = ext->disk_clus + (file_clus - ext->file_clus);
+    if (run != NULL)
+        *run = ext->len - (file_clus - ext->file_clus);
+out:;
+    mutex_unlock(&finode->extent_lock);
+    return retval;
+}
+
+/**
+ * @brief 获取文件簇链的最后一个簇（区段表尚未建立时，遍历簇链建立区段表）
+ *
+ * @param inode 文件的inode
+ * @param disk_clus 返回的簇号
+ * @return int 错误码（文件没有任何簇时返回-ENOENT）
+ */
+int fat32_extent_last(struct vfs_index_node_t *inode, uint32_t *disk_clus)
+{
+    struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)inode->private_inode_info;
+    int retval = 0;
+    mutex_lock(&finode->extent_lock);
+    if (!finode->extent_valid)
+    {
+        retval = __fat32_extent_build(inode);
+        if (retval != 0)
+            goto out;
+    }
+
+    if (finode->nr_extents == 0)
+    {
+        retval = -ENOENT;
+        goto out;
+    }
+    struct fat32_extent_t *last = &finode->extents[finode->nr_extents - 1];
+    *disk_clus = last->disk_clus + last->len - 1;
+out:;
+    mutex_unlock(&finode->extent_lock);
+    return retval;
+}
+
+/**
+ * @brief 簇链末尾追加了新的簇后，将其加入区段表（区段表尚未建立时不做任何事）
+ *
+ * @param finode 文件的inode私有信息
+ * @param disk_clus 新的簇的簇号
+ */
+void fat32_extent_append(struct fat32_inode_info_t *finode, uint32_t disk_clus)
+{
+    mutex_lock(&finode->extent_lock);
+    if (finode->extent_valid)
+    {
+        uint32_t file_clus = 0;
+        if (finode->nr_extents > 0)
+        {
+            struct fat32_extent_t *last = &finode->extents[finode->nr_extents - 1];
+            file_clus = last->file_clus + last->len;
+        }
+        // 内存不足时丢弃区段表，下次访问时重新建立
+        if (__fat32_extent_push(finode, file_clus, disk_clus) != 0)
+            __fat32_extent_drop(finode);
+    }
+    mutex_unlock(&finode->extent_lock);
+}
+
+/**
+ * @brief 丢弃区段表（簇链被修改后调用），下次访问时重新建立
+ *
+ * @param finode 文件的inode私有信息
+ */
+void fat32_extent_invalidate(struct fat32_inode_info_t *finode)
+{
+    mutex_lock(&finode->extent_lock);
+    __fat32_extent_drop(finode);
+    mutex_unlock(&finode->extent_lock);
+}
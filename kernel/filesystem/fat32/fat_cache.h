@@ -0,0 +1,92 @@
+/**
+ * @file fat_cache.h
+ * @brief FAT表的内存缓存，以及文件簇链的区段表（extent map）
+ *
+ * FAT1被划分为若干个窗口（每个窗口FAT32_FAT_WINDOW_SECTORS个扇区），窗口在第一次被访问时从bcache载入，
+ * 此后读取FAT表项不再需要访问bcache。FAT表项只能通过fat32_write_FAT_entry()或者FAT表事务（fat32_fat_trans_set()）修改，它们会同时更新已载入的窗口。
+ *
+ * 每个inode的区段表记录文件簇链中物理上连续的簇（file_clus -> disk_clus, len），第一次访问时遍历簇链建立，
+ * 此后定位文件中的任意簇只需要在区段表中二分查找，而区段表的最后一个区段也就是文件当前的末尾簇。
+ * 区段表由inode的extent_lock保护，本文件中的区段表接口都会自行加锁。
+ *
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#pragma once
+
+#include "fat32.h"
+#include <filesystem/VFS/VFS.h>
+
+/**
+ * @brief 初始化超级块的FAT缓存（在读取超级块时调用，不会预先载入任何窗口）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @return int 错误码
+ */
+int fat32_fat_cache_init(fat32_sb_info_t *fsbi);
+
+/**
+ * @brief 释放超级块的FAT缓存
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ */
+void fat32_fat_cache_destroy(fat32_sb_info_t *fsbi);
+
+/**
+ * @brief 从FAT缓存中读取指定簇的FAT表项（窗口未载入时从bcache载入）
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @param cluster 指定簇
+ * @param value 返回的FAT表项的值（包含高4bit）
+ * @return int 错误码
+ */
+int fat32_fat_cache_get(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t cluster, uint32_t *value);
+
+/**
+ * @brief FAT表项被修改后，更新FAT缓存中的对应表项（窗口未载入时不做任何事）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @param cluster 指定簇
+ * @param value FAT表项的新值（包含高4bit）
+ */
+void fat32_fat_cache_update(fat32_sb_info_t *fsbi, uint32_t cluster, uint32_t value);
+
+/**
+ * @brief 查找文件中第file_clus个簇在磁盘上的簇号（区段表尚未建立时，遍历簇链建立区段表）
+ *
+ * @param inode 文件的inode
+ * @param file_clus 簇在文件中的序号
+ * @param disk_clus 返回的簇号
+ * @param run 返回从该簇开始，物理上连续的簇的数量（可以为NULL）
+ * @return int 错误码（file_clus超出文件的簇链时返回-ENOENT）
+ */
+int fat32_extent_map(struct vfs_index_node_t *inode, uint32_t file_clus, uint32_t *disk_clus, uint32_t *run);
+
+/**
+ * @brief 获取文件簇链的最后一个簇（区段表尚未建立时，遍历簇链建立区段表）
+ *
+ * @param inode 文件的inode
+ * @param disk_clus 返回的簇号
+ * @return int 错误码（文件没有任何簇时返回-ENOENT）
+ */
+int fat32_extent_last(struct vfs_index_node_t *inode, uint32_t *disk_clus);
+
+/**
+ * @brief 簇链末尾追加了新的簇后，将其加入区段表（区段表尚未建立时不做任何事）
+ *
+ * @param finode 文件的inode私有信息
+ * @param disk_clus 新的簇的簇号
+ */
+void fat32_extent_append(struct fat32_inode_info_t *finode, uint32_t disk_clus);
+
+/**
+ * @brief 丢弃区段表（簇链被修改后调用），下次访问时重新建立
+ *
+ * @param finode 文件的inode私有信息
+ */
+void fat32_extent_invalidate(struct fat32_inode_info_t *finode);
@@ -1,11 +1,228 @@
 #include "fat_ent.h"
+#include "fat_cache.h"
 #include <driver/disk/ahci/ahci.h>
 #include <common/errno.h>
 #include <mm/slab.h>
+#include <common/bitmap.h>
 
 static const char unavailable_character_in_short_name[] = {0x22, 0x2a, 0x2b, 0x2c, 0x2e, 0x2f, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x5b, 0x5c, 0x5d, 0x7c};
+#define __fat32_clus_used(fsbi, c) ((fsbi)->used_bitmap[(c) >> 6] & (1UL << ((c)&63)))
+#define __fat32_set_clus_used(fsbi, c) ((fsbi)->used_bitmap[(c) >> 6] |= (1UL << ((c)&63)))
+#define __fat32_clear_clus_used(fsbi, c) ((fsbi)->used_bitmap[(c) >> 6] &= ~(1UL << ((c)&63)))
+
+/**
+ * @brief 扫描FAT表，建立空闲簇位图
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @return int 错误码
+ */
+static int __fat32_build_used_bitmap(struct block_device *blk, fat32_sb_info_t *fsbi)
+{
+    // 位图覆盖簇0~max_cluster，簇0、1以及超出max_cluster的位都视为已使用
+    uint64_t nr_words = (fsbi->max_cluster + 64) / 64;
+    uint64_t *bitmap = (uint64_t *)kmalloc(nr_words * sizeof(uint64_t), 0);
+    if (bitmap == NULL)
+        return -ENOMEM;
+
+retry:;
+    // 扫描期间被释放的簇可能已经被当作已使用，此时需要重新扫描
+    spin_lock(&fsbi->alloc_lock);
+    uint64_t gen = fsbi->free_gen;
+    spin_unlock(&fsbi->alloc_lock);
+
+    memset(bitmap, 0, nr_words * sizeof(uint64_t));
+    bitmap[0] |= 3;
+    if ((fsbi->max_cluster + 1) & 63)
+        bitmap[nr_words - 1] |= ~0UL << ((fsbi->max_cluster + 1) & 63);
+
+    uint32_t free_count = 0;
+    for (uint64_t c = 2; c <= fsbi->max_cluster; ++c)
+    {
+        uint32_t value;
+        if (fat32_fat_cache_get(blk, fsbi, c, &value) != 0)
+        {
+            kfree(bitmap);
+            return -EIO;
+        }
+        if ((value & 0x0fffffff) != 0)
+            bitmap[c >> 6] |= (1UL << (c & 63));
+        else
+            ++free_count;
+    }
+
+    spin_lock(&fsbi->alloc_lock);
+    // 其他进程已经建立了位图
+    if (fsbi->used_bitmap != NULL)
+    {
+        spin_unlock(&fsbi->alloc_lock);
+        kfree(bitmap);
+        return 0;
+    }
+    if (fsbi->free_gen != gen)
+    {
+        spin_unlock(&fsbi->alloc_lock);
+        goto retry;
+    }
+    fsbi->used_bitmap = bitmap;
+    fsbi->free_count = free_count;
+    spin_unlock(&fsbi->alloc_lock);
+    return 0;
+}
+
+/**
+ * @brief 在位图中查找[start, end)内的第一个空闲簇（需要持有alloc_lock）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @param start 起始簇号
+ * @param end 结束簇号
+ * @return int64_t 空闲簇的簇号。没有空闲簇时返回-1
+ */
+static int64_t __fat32_find_free_clus(fat32_sb_info_t *fsbi, uint64_t start, uint64_t end)
+{
+    uint64_t found = bitmap_find_next_zero(fsbi->used_bitmap, start, end);
+    return found < end ? (int64_t)found : -1;
+}
+
+/**
+ * @brief 在位图中查找一段连续num个空闲簇（需要持有alloc_lock）
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @param start 起始簇号
+ * @param end 结束簇号
+ * @param num 簇的数量
+ * @return int64_t 第一个簇的簇号。没有足够长的连续空闲簇时返回-1
+ */
+static int64_t __fat32_find_free_run(fat32_sb_info_t *fsbi, uint64_t start, uint64_t end, uint32_t num)
+{
+    uint64_t c = start;
+    while (c < end)
+    {
+        int64_t found = __fat32_find_free_clus(fsbi, c, end);
+        if (found < 0)
+            return -1;
+        uint64_t len = 1;
+        while (len < num && found + len < end && !__fat32_clus_used(fsbi, found + len))
+            ++len;
+        if (len == num)
+            return found;
+        // found+len处的簇已被使用，从它之后继续查找
+        c = found + len + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief 从位图中选取num个空闲簇，并将它们标记为已使用
+ * 优先选取从goal开始的一段连续空闲簇；找不到时，再从goal开始依次选取空闲簇
+ *
+ * @param fsbi fat32超级块私有信息结构体
+ * @param goal 期望的起始簇号
+ * @param clusters 返回的簇号数组
+ * @param num 簇的数量
+ * @return int 错误码
+ */
+static int __fat32_pick_clusters(fat32_sb_info_t *fsbi, uint32_t goal, uint32_t *clusters, int32_t num)
+{
+    uint64_t end = fsbi->max_cluster + 1;
+    if (goal < 2 || goal >= end)
+        goal = 2;
+
+    spin_lock(&fsbi->alloc_lock);
+    if (fsbi->free_count < num)
+    {
+        spin_unlock(&fsbi->alloc_lock);
+        return -ENOSPC;
+    }
+
+    int64_t run = __fat32_find_free_run(fsbi, goal, end, num);
+    if (run < 0)
+        run = __fat32_find_free_run(fsbi, 2, end, num);
+
+    if (run >= 0)
+    {
+        for (int i = 0; i < num; ++i)
+        {
+            clusters[i] = run + i;
+            __fat32_set_clus_used(fsbi, clusters[i]);
+        }
+    }
+    else
+    {
+        // 空闲空间过于零碎，从goal开始依次选取（free_count保证一定能找到）
+        uint64_t c = goal;
+        for (int i = 0; i < num; ++i)
+        {
+            int64_t found = __fat32_find_free_clus(fsbi, c, end);
+            if (found < 0)
+                found = __fat32_find_free_clus(fsbi, 2, end);
+            clusters[i] = found;
+            __fat32_set_clus_used(fsbi, clusters[i]);
+            c = found + 1;
+        }
+    }
+
+    fsbi->free_count -= num;
+    fsbi->next_free = clusters[num - 1] + 1;
+    if (fsbi->next_free >= end)
+        fsbi->next_free = 2;
+    spin_unlock(&fsbi->alloc_lock);
+    return 0;
+}
+
 /**
- * @brief 请求分配指定数量的簇
+ * @brief 将空闲簇数量与下一个空闲簇的位置写入FSInfo扇区（修改缓存中的扇区，由bcache写回磁盘）
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ */
+static void __fat32_update_fsinfo(struct block_device *blk, fat32_sb_info_t *fsbi)
+{
+    // 分区没有有效的FSInfo扇区；或者位图尚未建立，free_count还不是有效值
+    if (fsbi->fsinfo.FSI_LeadSig != FAT32_FSINFO_LEAD_SIG || fsbi->used_bitmap == NULL)
+        return;
+
+    struct buffer_head *bh = bread(blk, fsbi->starting_sector + fsbi->fsinfo_sector_addr_infat, 1);
+    if (bh == NULL)
+        return;
+    struct fat32_FSInfo_t *fsinfo = (struct fat32_FSInfo_t *)bh->data;
+    fsinfo->FSI_Free_Count = fsbi->fsinfo.FSI_Free_Count = fsbi->free_count;
+    fsinfo->FSI_Nxt_Free = fsbi->fsinfo.FSI_Nxt_Free = fsbi->next_free;
+    bmark_dirty(bh);
+    brelse(bh);
+}
+
+/**
+ * @brief 写入FAT表失败后，撤销一次簇的分配：尽量恢复已被修改的FAT表项，并将簇归还给位图
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @param tail 分配之前文件的最后一个簇（空文件为0）
+ * @param clusters 被分配的簇
+ * @param num 簇的数量
+ */
+static void __fat32_undo_alloc(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t tail, uint32_t *clusters, int32_t num)
+{
+    // FAT表中的部分表项可能已经被修改，尽力将它们恢复（失败时也只能放弃）
+    struct fat32_fat_trans_t trans;
+    fat32_fat_trans_begin(&trans, blk, fsbi);
+    if (tail != 0)
+        fat32_fat_trans_set(&trans, tail, 0x0ffffff8);
+    for (int i = 0; i < num; ++i)
+        fat32_fat_trans_set(&trans, clusters[i], 0);
+    fat32_fat_trans_commit(&trans);
+
+    spin_lock(&fsbi->alloc_lock);
+    for (int i = 0; i < num; ++i)
+        __fat32_clear_clus_used(fsbi, clusters[i]);
+    fsbi->free_count += num;
+    spin_unlock(&fsbi->alloc_lock);
+}
+
+/**
+ * @brief 请求分配指定数量的簇，并将它们链接到inode的簇链末尾
+ * 空闲簇从内存中的位图里选取（第一次分配时扫描FAT表建立），簇链的末尾从区段表中获取，
+ * 因此除第一次分配外，不需要为了查找空闲簇或者簇链末尾而访问磁盘。
  *
  * @param inode 要分配簇的inode
  * @param clusters 返回的被分配的簇的簇号结构体
@@ -14,96 +231,76 @@ static const char unavailable_character_in_short_name[] = {0x22, 0x2a, 0x2b, 0x2
  */
 int fat32_alloc_clusters(struct vfs_index_node_t *inode, uint32_t *clusters, int32_t num_clusters)
 {
-    int retval = 0;
-
     fat32_sb_info_t *fsbi = (fat32_sb_info_t *)inode->sb->private_sb_info;
     struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)inode->private_inode_info;
     struct block_device *blk = inode->sb->blk_device;
-    uint64_t sec_per_fat = fsbi->sec_per_FAT;
 
-    // todo: 对alloc的过程加锁
+    if (num_clusters <= 0)
+        return -EINVAL;
 
-    // 申请1扇区的缓冲区
-    uint32_t *buf = (uint32_t *)kmalloc(fsbi->bytes_per_sec, 0);
-    int ent_per_sec = (fsbi->bytes_per_sec >> 2);
-    int clus_idx = 0;
-    for (int i = 0; i < sec_per_fat; ++i)
+    int retval = 0;
+    if (fsbi->used_bitmap == NULL)
     {
-        if (clus_idx >= num_clusters)
-            goto done;
-        memset(buf, 0, fsbi->bytes_per_sec);
-        blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, fsbi->FAT1_base_sector + i, 1, (uint64_t)buf);
-        // 依次检查簇是否空闲
-        for (int j = 0; j < ent_per_sec; ++j)
-        {
-            if (clus_idx >= num_clusters)
-                goto done;
-            // 找到空闲簇
-            if ((buf[j] & 0x0fffffff) == 0)
-            {
-                // kdebug("clus[%d] = %d", clus_idx, i * ent_per_sec + j);
-                clusters[clus_idx] = i * ent_per_sec + j;
-                ++clus_idx;
-            }
-        }
+        retval = __fat32_build_used_bitmap(blk, fsbi);
+        if (retval != 0)
+            goto failed;
     }
-    // 空间不足
-    retval = -ENOSPC;
 
-done:;
-    kfree(buf);
-    if (retval == 0) // 成功
+    // 获取文件当前的最后一个簇，新的簇优先紧接在它之后分配，使文件保持连续
+    uint32_t tail = 0;
+    if (finode->first_clus != 0)
     {
-        int cluster, idx;
-        if (finode->first_clus == 0)
-        {
-            // 空文件
-            finode->first_clus = clusters[0];
-            cluster = finode->first_clus;
-            // 写入inode到磁盘
-            inode->sb->sb_ops->write_inode(inode);
-            idx = 1;
-        }
-        else
-        {
-            // todo: 跳转到文件当前的最后一个簇
-            idx = 0;
-            int tmp_clus = finode->first_clus;
-            cluster = tmp_clus;
-            while (true)
-            {
-                tmp_clus = fat32_read_FAT_entry(blk, fsbi, cluster);
-                if (tmp_clus <= 0x0ffffff7)
-                    cluster = tmp_clus;
-                else
-                    break;
-            }
-        }
+        retval = fat32_extent_last(inode, &tail);
+        if (retval != 0)
+            goto failed;
+    }
 
-        // 写入fat表
-        for (int i = idx; i < num_clusters; ++i)
-        {
-            // kdebug("write cluster i=%d : cluster=%d, value= %d", i, cluster, clusters[i]);
-            fat32_write_FAT_entry(blk, fsbi, cluster, clusters[i]);
-            cluster = clusters[i];
-        }
-        fat32_write_FAT_entry(blk, fsbi, cluster, 0x0ffffff8);
+    retval = __fat32_pick_clusters(fsbi, (tail != 0) ? tail + 1 : fsbi->next_free, clusters, num_clusters);
+    if (retval != 0)
+        goto failed;
 
-        return 0;
+    // 写入fat表（同一个扇区中的表项只会被写回一次）
+    uint32_t cluster = (tail != 0) ? tail : clusters[0];
+    struct fat32_fat_trans_t trans;
+    fat32_fat_trans_begin(&trans, blk, fsbi);
+    for (int i = (tail != 0) ? 0 : 1; i < num_clusters; ++i)
+    {
+        // kdebug("write cluster i=%d : cluster=%d, value= %d", i, cluster, clusters[i]);
+        fat32_fat_trans_set(&trans, cluster, clusters[i]);
+        cluster = clusters[i];
     }
-    else // 出现错误
+    fat32_fat_trans_set(&trans, cluster, 0x0ffffff8);
+    retval = fat32_fat_trans_commit(&trans);
+    if (retval != 0)
     {
-        kwarn("err in alloc clusters");
-        if (clus_idx < num_clusters)
-            fat32_free_clusters(inode, clusters[0]);
-        return retval;
+        kerror("FAT32: failed to write the FAT entries of the new clusters");
+        __fat32_undo_alloc(blk, fsbi, tail, clusters, num_clusters);
+        goto failed;
     }
 
+    if (finode->first_clus == 0)
+    {
+        // 空文件
+        finode->first_clus = clusters[0];
+        // 写入inode到磁盘
+        inode->sb->sb_ops->write_inode(inode);
+    }
+
+    // 将新的簇加入区段表
+    for (int i = 0; i < num_clusters; ++i)
+        fat32_extent_append(finode, clusters[i]);
+
+    __fat32_update_fsinfo(blk, fsbi);
     return 0;
+
+failed:;
+    kwarn("err in alloc clusters");
+    return retval;
 }
 
 /**
  * @brief 释放从属于inode的，从cluster开始的所有簇
+ * 调用者负责将cluster的前一个簇的FAT表项改为簇链结束标志（释放整个簇链时，文件变为空文件）
  *
  * @param inode 指定的文件的inode
  * @param cluster 指定簇
@@ -111,33 +308,158 @@ done:;
  */
 int fat32_free_clusters(struct vfs_index_node_t *inode, int32_t cluster)
 {
-    // todo: 释放簇
-    return 0;
+    fat32_sb_info_t *fsbi = (fat32_sb_info_t *)inode->sb->private_sb_info;
+    struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)inode->private_inode_info;
+    struct block_device *blk = inode->sb->blk_device;
+
+    struct fat32_fat_trans_t trans;
+    fat32_fat_trans_begin(&trans, blk, fsbi);
+
+    // 沿着簇链依次将FAT表项清零（最多遍历max_cluster次，防止簇链成环）
+    uint32_t clus = cluster;
+    for (uint64_t i = 0; clus >= 2 && clus <= fsbi->max_cluster && i < fsbi->max_cluster; ++i)
+    {
+        uint32_t next = fat32_read_FAT_entry(blk, fsbi, clus);
+        if (fat32_fat_trans_set(&trans, clus, 0) != 0)
+            break;
+
+        spin_lock(&fsbi->alloc_lock);
+        if (fsbi->used_bitmap != NULL && __fat32_clus_used(fsbi, clus))
+        {
+            __fat32_clear_clus_used(fsbi, clus);
+            ++fsbi->free_count;
+        }
+        else if (fsbi->used_bitmap == NULL)
+            ++fsbi->free_gen; // 正在建立的位图可能错过这次释放
+        spin_unlock(&fsbi->alloc_lock);
+        clus = next;
+    }
+    int retval = fat32_fat_trans_commit(&trans);
+
+    if (cluster == finode->first_clus)
+    {
+        finode->first_clus = 0;
+        inode->sb->sb_ops->write_inode(inode);
+    }
+    fat32_extent_invalidate(finode);
+    __fat32_update_fsinfo(blk, fsbi);
+    return retval;
 }
 
 /**
- * @brief 读取指定簇的FAT表项
+ * @brief 开始一个修改FAT表的事务
  *
+ * @param trans 事务
  * @param blk 块设备结构体
  * @param fsbi fat32超级块私有信息结构体
+ */
+void fat32_fat_trans_begin(struct fat32_fat_trans_t *trans, struct block_device *blk, fat32_sb_info_t *fsbi)
+{
+    trans->blk = blk;
+    trans->fsbi = fsbi;
+    trans->nr_bhs = 0;
+    trans->retval = 0;
+}
+
+/**
+ * @brief 将事务持有的扇区标记为脏，并释放它们
+ *
+ * @param trans 事务
+ */
+static void __fat32_fat_trans_release(struct fat32_fat_trans_t *trans)
+{
+    for (uint32_t i = 0; i < trans->nr_bhs; ++i)
+    {
+        bmark_dirty(trans->bhs[i]);
+        brelse(trans->bhs[i]);
+    }
+    trans->nr_bhs = 0;
+}
+
+/**
+ * @brief 在事务中修改指定簇的FAT表项
+ *
+ * @param trans 事务
  * @param cluster 指定簇
- * @return uint32_t 下一个簇的簇号
+ * @param value 要写入该fat表项的值
+ * @return int 错误码
  */
-uint32_t fat32_read_FAT_entry(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t cluster)
+int fat32_fat_trans_set(struct fat32_fat_trans_t *trans, uint32_t cluster, uint32_t value)
 {
+    if (trans->retval != 0)
+        return trans->retval;
+
+    fat32_sb_info_t *fsbi = trans->fsbi;
     // 计算每个扇区内含有的FAT表项数
     // FAT每项4bytes
     uint32_t fat_ent_per_sec = (fsbi->bytes_per_sec >> 2); // 该值应为2的n次幂
+    uint64_t lba = fsbi->FAT1_base_sector + (cluster / fat_ent_per_sec);
+
+    // 簇链中相邻的簇通常位于同一个扇区，因此从最近加入的扇区开始查找
+    struct buffer_head *bh = NULL;
+    for (int i = (int)trans->nr_bhs - 1; i >= 0; --i)
+    {
+        if (trans->bhs[i]->lba == lba)
+        {
+            bh = trans->bhs[i];
+            break;
+        }
+    }
 
-    uint32_t buf[256];
-    memset(buf, 0, fsbi->bytes_per_sec);
+    if (bh == NULL)
+    {
+        if (trans->nr_bhs == FAT32_FAT_TRANS_MAX_BHS)
+            __fat32_fat_trans_release(trans);
+        bh = bread(trans->blk, lba, 1);
+        if (bh == NULL)
+        {
+            trans->retval = -EIO;
+            return -EIO;
+        }
+        // 其余的FAT表作为镜像副本，在写回时由bcache一并写入
+        bset_mirror(bh, fsbi->NumFATs - 1, fsbi->sec_per_FAT);
+        trans->bhs[trans->nr_bhs++] = bh;
+    }
 
-    // 读取一个sector的数据，
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, fsbi->FAT1_base_sector + (cluster / fat_ent_per_sec), 1,
-                                 (uint64_t)&buf);
+    uint32_t *buf = (uint32_t *)bh->data;
+    uint32_t idx = cluster & (fat_ent_per_sec - 1);
+    buf[idx] = (buf[idx] & 0xf0000000) | (value & 0x0fffffff);
+    fat32_fat_cache_update(fsbi, cluster, buf[idx]);
+    return 0;
+}
+
+/**
+ * @brief 提交事务：将被修改的扇区标记为脏，并释放它们
+ *
+ * @param trans 事务
+ * @return int 事务中第一个错误的错误码
+ */
+int fat32_fat_trans_commit(struct fat32_fat_trans_t *trans)
+{
+    __fat32_fat_trans_release(trans);
+    return trans->retval;
+}
+
+/**
+ * @brief 读取指定簇的FAT表项
+ *
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ * @param cluster 指定簇
+ * @return uint32_t 下一个簇的簇号（读取磁盘失败时返回簇链结束标志）
+ */
+uint32_t fat32_read_FAT_entry(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t cluster)
+{
+    // 从FAT缓存中读取
+    uint32_t value;
+    if (fat32_fat_cache_get(blk, fsbi, cluster, &value) != 0)
+    {
+        kerror("FAT32: failed to read the FAT entry of cluster %d", cluster);
+        return 0x0fffffff;
+    }
 
     // 返回下一个fat表项的值（也就是下一个cluster）
-    return buf[cluster & (fat_ent_per_sec - 1)] & 0x0fffffff;
+    return value & 0x0fffffff;
 }
 
 /**
@@ -151,23 +473,11 @@ uint32_t fat32_read_FAT_entry(struct block_device *blk, fat32_sb_info_t *fsbi, u
  */
 uint32_t fat32_write_FAT_entry(struct block_device *blk, fat32_sb_info_t *fsbi, uint32_t cluster, uint32_t value)
 {
-    // 计算每个扇区内含有的FAT表项数
-    // FAT每项4bytes
-    uint32_t fat_ent_per_sec = (fsbi->bytes_per_sec >> 2); // 该值应为2的n次幂
-    uint32_t *buf = kzalloc(fsbi->bytes_per_sec, 0);
-
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, fsbi->FAT1_base_sector + (cluster / fat_ent_per_sec), 1,
-                                 (uint64_t)buf);
-
-    buf[cluster & (fat_ent_per_sec - 1)] = (buf[cluster & (fat_ent_per_sec - 1)] & 0xf0000000) | (value & 0x0fffffff);
-    // 向FAT1和FAT2写入数据
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, fsbi->FAT1_base_sector + (cluster / fat_ent_per_sec), 1,
-                                 (uint64_t)buf);
-    blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, fsbi->FAT2_base_sector + (cluster / fat_ent_per_sec), 1,
-                                 (uint64_t)buf);
-
-    kfree(buf);
-    return 0;
+    // 只修改缓存中的FAT1扇区，FAT2由bcache在写回时同步
+    struct fat32_fat_trans_t trans;
+    fat32_fat_trans_begin(&trans, blk, fsbi);
+    fat32_fat_trans_set(&trans, cluster, value);
+    return fat32_fat_trans_commit(&trans);
 }
 
 /**
@@ -178,17 +488,15 @@ uint32_t fat32_write_FAT_entry(struct block_device *blk, fat32_sb_info_t *fsbi,
  * @param mode 操作模式
  * @param res_sector 返回信息：缓冲区对应的扇区号
  * @param res_cluster 返回信息：缓冲区对应的簇号
- * @param res_data_buf_base 返回信息：缓冲区的内存基地址（记得要释放缓冲区内存！！！！）
- * @return struct fat32_Directory_t* 符合要求的entry的指针（指向地址高处的空目录项，也就是说，有连续num个≤这个指针的空目录项）
+ * @param res_bh 返回信息：目录项所在簇的缓冲区（修改后需要调用bmark_dirty()，并使用brelse()释放）
+ * @return struct fat32_Directory_t* 符合要求的entry的指针（指向地址高处的空目录项，也就是说，有连续num个≤这个指针的空目录项）。读取磁盘失败时返回NULL
  */
-struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *parent_inode, uint32_t num, uint32_t mode, uint32_t *res_sector, uint64_t *res_cluster, uint64_t *res_data_buf_base)
+struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *parent_inode, uint32_t num, uint32_t mode, uint32_t *res_sector, uint64_t *res_cluster, struct buffer_head **res_bh)
 {
     // kdebug("find empty_dentry");
     struct fat32_inode_info_t *finode = (struct fat32_inode_info_t *)parent_inode->private_inode_info;
     fat32_sb_info_t *fsbi = (fat32_sb_info_t *)parent_inode->sb->private_sb_info;
 
-    uint8_t *buf = kzalloc(fsbi->bytes_per_clus, 0);
-
     struct block_device *blk = parent_inode->sb->blk_device;
 
     // 计算父目录项的起始簇号
@@ -204,8 +512,10 @@ struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *paren
         uint64_t sector = fsbi->first_data_sector + (cluster - 2) * fsbi->sec_per_clus;
 
         // 读取父目录项的起始簇数据
-        blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_READ_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)buf);
-        tmp_dEntry = (struct fat32_Directory_t *)buf;
+        struct buffer_head *bh = bread(blk, sector, fsbi->sec_per_clus);
+        if (bh == NULL)
+            return NULL;
+        tmp_dEntry = (struct fat32_Directory_t *)bh->data;
         // 计数连续的空目录项
         uint32_t count_continuity = 0;
 
@@ -228,10 +538,11 @@ struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *paren
         {
             result_dEntry += (num - 1);
             *res_sector = sector;
-            *res_data_buf_base = (uint64_t)buf;
+            *res_bh = bh;
             *res_cluster = cluster;
             return result_dEntry;
         }
+        brelse(bh);
 
         // 当前簇没有发现符合条件的空闲目录项，寻找下一个簇
         uint64_t old_cluster = cluster;
@@ -250,9 +561,12 @@ struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *paren
 
             // 将这个新的簇清空
             sector = fsbi->first_data_sector + (cluster - 2) * fsbi->sec_per_clus;
-            void *tmp_buf = kzalloc(fsbi->bytes_per_clus, 0);
-            blk->bd_disk->fops->transfer(blk->bd_disk, AHCI_CMD_WRITE_DMA_EXT, sector, fsbi->sec_per_clus, (uint64_t)tmp_buf);
-            kfree(tmp_buf);
+            bh = bget(blk, sector, fsbi->sec_per_clus);
+            if (bh == NULL)
+                return NULL;
+            memset(bh->data, 0, bh->size);
+            bmark_dirty(bh);
+            brelse(bh);
         }
     }
 }
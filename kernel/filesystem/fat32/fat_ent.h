@@ -2,8 +2,54 @@
 
 #include "fat32.h"
 #include <filesystem/VFS/VFS.h>
+#include <common/bcache.h>
 #include <stdbool.h>
 
+// 一个FAT表事务最多同时持有的FAT扇区缓冲区数量（超出时提前提交已持有的扇区）
+#define FAT32_FAT_TRANS_MAX_BHS 8
+
+/**
+ * @brief 修改FAT表的事务
+ *
+ * 事务中对FAT表项的修改直接作用于bcache中FAT1的扇区，每个被修改的扇区只在提交时标记一次脏；
+ * FAT2等镜像副本由bcache在写回该扇区时一并写入。
+ */
+struct fat32_fat_trans_t
+{
+    struct block_device *blk;
+    fat32_sb_info_t *fsbi;
+    uint32_t nr_bhs;                                  // 已持有的扇区缓冲区数量
+    struct buffer_head *bhs[FAT32_FAT_TRANS_MAX_BHS]; // 被修改的FAT1扇区的缓冲区
+    int retval;                                       // 事务中第一个错误的错误码
+};
+
+/**
+ * @brief 开始一个修改FAT表的事务
+ *
+ * @param trans 事务
+ * @param blk 块设备结构体
+ * @param fsbi fat32超级块私有信息结构体
+ */
+void fat32_fat_trans_begin(struct fat32_fat_trans_t *trans, struct block_device *blk, fat32_sb_info_t *fsbi);
+
+/**
+ * @brief 在事务中修改指定簇的FAT表项
+ *
+ * @param trans 事务
+ * @param cluster 指定簇
+ * @param value 要写入该fat表项的值
+ * @return int 错误码
+ */
+int fat32_fat_trans_set(struct fat32_fat_trans_t *trans, uint32_t cluster, uint32_t value);
+
+/**
+ * @brief 提交事务：将被修改的扇区标记为脏，并释放它们
+ *
+ * @param trans 事务
+ * @return int 事务中第一个错误的错误码
+ */
+int fat32_fat_trans_commit(struct fat32_fat_trans_t *trans);
+
 /**
  * @brief 请求分配指定数量的簇
  *
@@ -16,6 +62,7 @@ int fat32_alloc_clusters(struct vfs_index_node_t *inode, uint32_t *clusters, int
 
 /**
  * @brief 释放从属于inode的，从cluster开始的所有簇
+ * 调用者负责将cluster的前一个簇的FAT表项改为簇链结束标志（释放整个簇链时，文件变为空文件）
  *
  * @param inode 指定的文件的inode
  * @param cluster 指定簇
@@ -52,10 +99,10 @@ uint32_t fat32_write_FAT_entry(struct block_device * blk, fat32_sb_info_t *fsbi,
  * @param mode 操作模式
  * @param res_sector 返回信息：缓冲区对应的扇区号
  * @param res_cluster 返回信息：缓冲区对应的簇号
- * @param res_data_buf_base 返回信息：缓冲区的内存基地址（记得要释放缓冲区内存！！！！）
- * @return struct fat32_Directory_t* 符合要求的entry的指针（指向地址高处的空目录项，也就是说，有连续num个≤这个指针的空目录项）
+ * @param res_bh 返回信息：目录项所在簇的缓冲区（修改后需要调用bmark_dirty()，并使用brelse()释放）
+ * @return struct fat32_Directory_t* 符合要求的entry的指针（指向地址高处的空目录项，也就是说，有连续num个≤这个指针的空目录项）。读取磁盘失败时返回NULL
  */
-struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *parent_inode, uint32_t num, uint32_t mode, uint32_t *res_sector, uint64_t *res_cluster, uint64_t *res_data_buf_base);
+struct fat32_Directory_t *fat32_find_empty_dentry(struct vfs_index_node_t *parent_inode, uint32_t num, uint32_t mode, uint32_t *res_sector, uint64_t *res_cluster, struct buffer_head **res_bh);
 
 /**
  * @brief 检查文件名是否合法
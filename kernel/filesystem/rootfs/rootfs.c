@@ -21,6 +21,7 @@ struct vfs_super_block_operations_t rootfs_sb_ops = {
     .put_superblock = NULL,
     .write_inode = NULL,
     .write_superblock = NULL,
+    .release_inode = NULL,
 };
 
 static struct vfs_dir_entry_t *rootfs_lookup(struct vfs_index_node_t *parent_inode, struct vfs_dir_entry_t *dest_dEntry)
@@ -82,8 +82,86 @@ static long ktest_rbtree_case1(uint64_t arg0, uint64_t arg1)
     return 0;
 }
 
+struct test_rb_value_t
+{
+    struct rb_node node;
+    uint64_t tv;
+    uint64_t subtree_size; // 增强信息：子树的结点数量
+};
+
+static void test_rb_augment(struct rb_node *node)
+{
+    uint64_t size = 1;
+    if (node->rb_left != NULL)
+        size += rb_entry(node->rb_left, struct test_rb_value_t, node)->subtree_size;
+    if (node->rb_right != NULL)
+        size += rb_entry(node->rb_right, struct test_rb_value_t, node)->subtree_size;
+    rb_entry(node, struct test_rb_value_t, node)->subtree_size = size;
+}
+
+static void test_rb_insert(struct rb_root *root, struct test_rb_value_t *val)
+{
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+    while (*link != NULL)
+    {
+        parent = *link;
+        if (val->tv < rb_entry(parent, struct test_rb_value_t, node)->tv)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_link_node(&val->node, parent, link);
+    rb_insert_color(&val->node, root, test_rb_augment);
+}
+
+/**
+ * @brief 测试侵入式红黑树的插入、删除、遍历以及增强信息的维护
+ *
+ * @return int
+ */
+static long ktest_rbtree_case2(uint64_t arg0, uint64_t arg1)
+{
+    const int count = 64;
+    struct test_rb_value_t *vals = (struct test_rb_value_t *)kzalloc(sizeof(struct test_rb_value_t) * count, 0);
+    struct rb_root root = RB_ROOT;
+
+    // 乱序插入
+    for (int i = 0; i < count; ++i)
+    {
+        vals[i].tv = (i * 37) % count;
+        test_rb_insert(&root, &vals[i]);
+    }
+    assert(rb_entry(root.rb_node, struct test_rb_value_t, node)->subtree_size == count);
+    assert(root.rb_node->rb_color == RB_BLACK);
+
+    // 中序遍历的结果应当是有序的
+    uint64_t expect = 0;
+    for (struct rb_node *node = rb_first(&root); node != NULL; node = rb_next(node))
+        assert(rb_entry(node, struct test_rb_value_t, node)->tv == expect++);
+    assert(expect == count);
+
+    // 删除值为偶数的结点
+    for (int i = 0; i < count; ++i)
+    {
+        if ((vals[i].tv & 1) == 0)
+            rb_erase(&vals[i].node, &root, test_rb_augment);
+    }
+    assert(rb_entry(root.rb_node, struct test_rb_value_t, node)->subtree_size == count / 2);
+
+    expect = count - 1;
+    for (struct rb_node *node = rb_last(&root); node != NULL; node = rb_prev(node))
+    {
+        assert(rb_entry(node, struct test_rb_value_t, node)->tv == expect);
+        expect -= 2;
+    }
+
+    kfree(vals);
+    return 0;
+}
+
 static ktest_case_table kt_bitree_func_table[] = {
     ktest_rbtree_case1,
+    ktest_rbtree_case2,
 };
 
 uint64_t ktest_test_rbtree(uint64_t arg)
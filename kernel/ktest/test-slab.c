@@ -0,0 +1,109 @@
+#include "ktest.h"
+#include "ktest_utils.h"
+#include <common/kprint.h>
+#include <mm/slab.h>
+
+// 每个size class最多同时申请的内存对象数量
+#define KTEST_SLAB_MAX_OBJS 256
+// 每个size class最多占用的内存（字节），防止大对象的测试占用过多内存
+#define KTEST_SLAB_MAX_BYTES (8UL << 20)
+// 性能测试的轮数
+#define KTEST_SLAB_BENCH_ROUNDS 8
+
+static void *objs[KTEST_SLAB_MAX_OBJS];
+
+/**
+ * @brief 计算指定size class在测试中申请的对象数量
+ *
+ * @param size 对象大小
+ * @return int 对象数量
+ */
+static int ktest_slab_obj_count(uint64_t size)
+{
+    uint64_t cnt = KTEST_SLAB_MAX_BYTES / size;
+    if (cnt > KTEST_SLAB_MAX_OBJS)
+        cnt = KTEST_SLAB_MAX_OBJS;
+    if (cnt < 2)
+        cnt = 2;
+    return cnt;
+}
+
+/**
+ * @brief 测试kmalloc申请的对象互不重叠，并且ksize()返回所属内存池的对象大小
+ *
+ */
+static long ktest_slab_case0(uint64_t arg0, uint64_t arg1)
+{
+    for (uint64_t size = 32; size <= 1048576; size <<= 1)
+    {
+        int cnt = ktest_slab_obj_count(size);
+        for (int i = 0; i < cnt; ++i)
+        {
+            objs[i] = kmalloc(size, 0);
+            assert(objs[i] != NULL);
+            assert(ksize(objs[i]) == size);
+            // 填充对象的首尾，用于检测对象之间是否有重叠
+            *(uint8_t *)objs[i] = (uint8_t)i;
+            *((uint8_t *)objs[i] + size - 1) = (uint8_t)i;
+        }
+
+        for (int i = 0; i < cnt; ++i)
+        {
+            assert(*(uint8_t *)objs[i] == (uint8_t)i);
+            assert(*((uint8_t *)objs[i] + size - 1) == (uint8_t)i);
+            assert(kfree(objs[i]) == 0);
+        }
+    }
+    // 不是由kmalloc申请的地址
+    assert(ksize(NULL) == 0);
+    assert(ksize((void *)0x1000) == 0);
+    return 0;
+}
+
+/**
+ * @brief 测量每个size class中，kmalloc()与kfree()平均每次操作所需的时钟周期数
+ *
+ */
+static long ktest_slab_case1(uint64_t arg0, uint64_t arg1)
+{
+    for (uint64_t size = 32; size <= 1048576; size <<= 1)
+    {
+        int cnt = ktest_slab_obj_count(size);
+        uint64_t alloc_cycles = 0, free_cycles = 0;
+
+        for (int round = 0; round < KTEST_SLAB_BENCH_ROUNDS; ++round)
+        {
+            uint64_t t0 = rdtsc();
+            for (int i = 0; i < cnt; ++i)
+                objs[i] = kmalloc(size, 0);
+            uint64_t t1 = rdtsc();
+            for (int i = 0; i < cnt; ++i)
+                kfree(objs[i]);
+            uint64_t t2 = rdtsc();
+
+            alloc_cycles += t1 - t0;
+            free_cycles += t2 - t1;
+        }
+
+        kTEST("kmalloc size=%ld\tobjs=%d\talloc=%ld cycles/op\tfree=%ld cycles/op", size, cnt,
+              alloc_cycles / (cnt * KTEST_SLAB_BENCH_ROUNDS), free_cycles / (cnt * KTEST_SLAB_BENCH_ROUNDS));
+    }
+    return 0;
+}
+
+static ktest_case_table kt_slab_func_table[] = {
+    ktest_slab_case0,
+    ktest_slab_case1,
+};
+
+uint64_t ktest_test_slab(uint64_t arg)
+{
+    kTEST("Testing slab...");
+    for (int i = 0; i < sizeof(kt_slab_func_table) / sizeof(ktest_case_table); ++i)
+    {
+        kTEST("Testing case %d", i);
+        kt_slab_func_table[i](i, 0);
+    }
+    kTEST("slab Test done.");
+    return 0;
+}
@@ -18,6 +18,8 @@
 #include "smp/smp.h"
 #include <smp/ipi.h>
 #include <sched/sched.h>
+#include <arch/x86_64/fpu.h>
+#include <arch/x86_64/percpu.h>
 
 #include <filesystem/fat32/fat32.h>
 #include <filesystem/VFS/VFS.h>
@@ -119,6 +121,9 @@ void system_initialize()
     initial_tss[0].ist7 = (ul)ptr;
     // ===========================
 
+    // 初始化浮点单元，选择浮点上下文切换的策略
+    fpu_init();
+
     acpi_init();
 
     // 初始化中断模块
@@ -127,7 +132,7 @@ void system_initialize()
 
     softirq_init();
     current_pcb->cpu_id = 0;
-    current_pcb->preempt_count = 0;
+    this_cpu_write(preempt_count, 0);
     // 先初始化系统调用模块
     syscall_init();
     io_mfence();
@@ -194,6 +199,8 @@ void Start_Kernel(void)
                          : "=r"(mb2_info), "=r"(mb2_magic), "=r"(bsp_gdt_size), "=r"(bsp_idt_size)::"memory");
     reload_gdt();
     reload_idt();
+    // 设置BSP的per-cpu区域，之后才能使用自旋锁
+    cpu_local_init_bsp();
 
     // 重新设置TSS描述符
     set_tss_descriptor(10, (void *)(&initial_tss[0]));
@@ -206,8 +213,9 @@ void Start_Kernel(void)
     system_initialize();
     io_mfence();
 
+    // BSP的idle进程：空闲时停机，等待中断
     while (1)
-        pause();
+        hlt();
 }
 
 void ignore_int()
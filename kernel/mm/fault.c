@@ -0,0 +1,515 @@
+/**
+ * @file fault.c
+ * @brief 用户地址空间的缺页异常处理，以及fork时基于写时复制的地址空间拷贝
+ *
+ */
+#include "internal.h"
+#include "slab.h"
+#include <common/compiler.h>
+#include <common/errno.h>
+#include <common/string.h>
+#include <process/process.h>
+#include <filesystem/VFS/VFS.h>
+
+// 页表项中物理地址以外的部分（标志位）
+#define __PTE_FLAGS_2M(pte) ((pte) & ~(PAGE_2M_MASK & ~PAGE_XD))
+#define __PTE_FLAGS_4K(pte) ((pte) & ~(PAGE_4K_MASK & ~PAGE_XD))
+// 页表项中的物理地址
+#define __PTE_ADDR_2M(pte) ((pte) & PAGE_2M_MASK & ~PAGE_XD)
+#define __PTE_ADDR_4K(pte) ((pte) & PAGE_4K_MASK & ~PAGE_XD)
+
+struct mm_thp_stat_t mm_thp_stat = {0};
+
+/**
+ * @brief 检查vma能否以写时复制的方式被拷贝
+ * 2M页只能通过anon_vma的引用计数来统计共享者，因此映射了2M页的vma必须恰好对应其anon_vma所绑定的那个2M页。
+ * 4K页则必须来自4K页框分配器。尚未映射任何物理页的vma只需拷贝vma本身
+ *
+ * @param vma 待检查的vma
+ * @return true 可以
+ * @return false 不可以
+ */
+static bool __mm_vma_cow_capable(struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & (VM_IO | VM_SHARED))
+        return false;
+    // 尚未映射任何物理页的vma（按需分配）
+    if (vma->anon_vma == NULL)
+        return true;
+
+    for (uint64_t vaddr = vma->vm_start; vaddr < vma->vm_end;)
+    {
+        bool is_2m;
+        uint64_t *pte = __mm_get_pte(vma->vm_mm, vaddr, &is_2m);
+        if (pte == NULL)
+        {
+            vaddr = PAGE_2M_ALIGN(vaddr + 1);
+            continue;
+        }
+        if (is_2m)
+        {
+            if (vma->vm_start != vaddr || vma->vm_end - vma->vm_start != PAGE_2M_SIZE || vma->anon_vma->page != Phy_to_2M_Page(__PTE_ADDR_2M(*pte)))
+                return false;
+            vaddr += PAGE_2M_SIZE;
+            continue;
+        }
+        if ((*pte & PAGE_PRESENT) && !is_4k_frame(phys_2_virt(__PTE_ADDR_4K(*pte))))
+            return false;
+        vaddr += PAGE_4K_SIZE;
+    }
+    return true;
+}
+
+/**
+ * @brief 将父进程的vma以写时复制的方式拷贝到新的地址空间中：
+ * 双方的页表项均指向原有的物理页并被设置为只读，在其中一方第一次写入时才真正复制页面
+ * (调用者需要在拷贝完成后刷新当前地址空间的TLB)
+ *
+ * @param dst_mm 新的地址空间
+ * @param vma 父进程的vma
+ * @return int 错误码。vma不支持写时复制时返回-EOPNOTSUPP，此时调用者应直接拷贝内存
+ */
+int mm_cow_copy_vma(struct mm_struct *dst_mm, struct vm_area_struct *vma)
+{
+    if (!__mm_vma_cow_capable(vma))
+        return -EOPNOTSUPP;
+
+    struct vm_area_struct *new_vma = NULL;
+    int retval = mm_create_vma(dst_mm, vma->vm_start, vma->vm_end - vma->vm_start, vma->vm_flags, vma->vm_ops, &new_vma);
+    if (unlikely(retval != 0 || new_vma == NULL))
+        return retval ? retval : -EEXIST;
+    new_vma->page_offset = vma->page_offset;
+    new_vma->vm_file = vma->vm_file;
+    new_vma->vm_file_start = vma->vm_file_start;
+    new_vma->vm_file_offset = vma->vm_file_offset;
+    new_vma->vm_file_len = vma->vm_file_len;
+    if (vma->anon_vma == NULL)
+        return 0;
+
+    for (uint64_t vaddr = vma->vm_start; vaddr < vma->vm_end;)
+    {
+        bool is_2m;
+        uint64_t *pte = __mm_get_pte(vma->vm_mm, vaddr, &is_2m);
+        if (pte == NULL)
+        {
+            vaddr = PAGE_2M_ALIGN(vaddr + 1);
+            continue;
+        }
+        uint64_t size = is_2m ? PAGE_2M_SIZE : PAGE_4K_SIZE;
+        if (!(*pte & PAGE_PRESENT))
+        {
+            vaddr += size;
+            continue;
+        }
+
+        if (!is_2m)
+            frame_4k_share(phys_2_virt(__PTE_ADDR_4K(*pte)));
+        else if (vma->vm_flags & VM_USER)
+            atomic_add(&mm_thp_stat.mapped, PAGE_2M_SIZE);
+
+        // 双方均只读地共享同一个物理页
+        if (vma->vm_flags & VM_WRITE)
+            *pte &= ~PAGE_R_W;
+
+        // 先建立新的地址空间中的各级页表，再直接拷贝最后一级页表项
+        uint64_t paddr = is_2m ? __PTE_ADDR_2M(*pte) : __PTE_ADDR_4K(*pte);
+        mm_map_proc_page_table((uint64_t)dst_mm->pgd, true, vaddr, paddr, size, PAGE_U_S, true, false, !is_2m);
+        bool dst_is_2m;
+        uint64_t *dst_pte = __mm_get_pte(dst_mm, vaddr, &dst_is_2m);
+        *dst_pte = *pte;
+
+        vaddr += size;
+    }
+
+    // 新的vma与父进程的vma共用anon_vma，anon_vma的引用计数即为2M页的共享者数量
+    __anon_vma_add(vma->anon_vma, new_vma);
+    return 0;
+}
+
+/**
+ * @brief 写时复制：处理对共享的2M页的写入
+ *
+ * @param vma 发生缺页的vma
+ * @param pte 2M页对应的pde
+ * @return int 错误码
+ */
+static int __mm_cow_2m_page(struct vm_area_struct *vma, uint64_t *pte)
+{
+    struct anon_vma_t *anon = vma->anon_vma;
+    uint64_t old_paddr = __PTE_ADDR_2M(*pte);
+    if (unlikely(anon == NULL || anon->page != Phy_to_2M_Page(old_paddr)))
+        return -EFAULT;
+
+    // anon_vma的信号量保证了共享者的数量在此期间不会改变
+    semaphore_down(&anon->sem);
+    if (atomic_read(&anon->ref_count) == 1) // 只剩下当前vma在使用该页面，无需复制
+    {
+        *pte |= PAGE_R_W;
+        semaphore_up(&anon->sem);
+        return 0;
+    }
+
+    struct Page *new_page = alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED);
+    if (unlikely(new_page == NULL))
+    {
+        semaphore_up(&anon->sem);
+        return -ENOMEM;
+    }
+    memcpy(phys_2_virt(new_page->addr_phys), phys_2_virt(old_paddr), PAGE_2M_SIZE);
+    // 其他共享者仍在使用原来的页面，因此这里不会释放它
+    __anon_vma_del(vma);
+    semaphore_up(&anon->sem);
+
+    __anon_vma_create_alloc(new_page, false);
+    __anon_vma_add(new_page->anon_vma, vma);
+    *pte = new_page->addr_phys | __PTE_FLAGS_2M(*pte) | PAGE_R_W;
+    return 0;
+}
+
+/**
+ * @brief 写时复制：处理对共享的4K页框的写入
+ *
+ * @param pte 4K页对应的pte
+ * @return int 错误码
+ */
+static int __mm_cow_4k_page(uint64_t *pte)
+{
+    void *frame = phys_2_virt(__PTE_ADDR_4K(*pte));
+    if (unlikely(!is_4k_frame(frame)))
+        return -EFAULT;
+
+    if (!frame_4k_shared(frame)) // 只剩下当前进程在使用该页框，无需复制
+    {
+        *pte |= PAGE_R_W;
+        return 0;
+    }
+
+    void *new_frame = alloc_4k_frames(1, false);
+    if (unlikely(new_frame == NULL))
+        return -ENOMEM;
+    memcpy(new_frame, frame, PAGE_4K_SIZE);
+    *pte = virt_2_phys(new_frame) | __PTE_FLAGS_4K(*pte) | PAGE_R_W;
+    // 减少原页框的共享计数
+    free_4k_frames(frame, 1);
+    return 0;
+}
+
+/**
+ * @brief 判断vma中以base开始的2M区域能否被一个2M页映射：区域必须完全位于vma之内。
+ * vma首尾不足2M的部分总是使用4K页框映射
+ */
+static __always_inline bool __mm_thp_region_ok(struct vm_area_struct *vma, uint64_t base)
+{
+    return !(vma->vm_flags & (VM_IO | VM_SHARED)) && base >= vma->vm_start && base + PAGE_2M_SIZE <= vma->vm_end;
+}
+
+/**
+ * @brief 判断vma能否绑定一个新的2M页。vma只能通过anon_vma管理一个2M页，
+ * 因此只有尚未绑定物理页、或者只绑定了4K页框所在的2M页（仅用于生命周期管理）的vma才可以
+ */
+static __always_inline bool __mm_thp_anon_ok(struct vm_area_struct *vma)
+{
+    struct anon_vma_t *anon = vma->anon_vma;
+    return anon == NULL || anon->page == NULL || (anon->page->attr & PAGE_4K_FRAMES);
+}
+
+/**
+ * @brief 解除vma与4K页框所在的2M页的anon_vma之间的绑定，以便为其绑定新的2M页
+ */
+static void __mm_thp_drop_frames_anon(struct vm_area_struct *vma)
+{
+    struct anon_vma_t *anon = vma->anon_vma;
+    if (anon == NULL)
+        return;
+    semaphore_down(&anon->sem);
+    // 当前vma是最后一个使用者时，anon_vma会在__anon_vma_del()中被释放
+    bool last = (atomic_read(&anon->ref_count) == 1);
+    __anon_vma_del(vma);
+    if (!last)
+        semaphore_up(&anon->sem);
+}
+
+/**
+ * @brief 透明大页的合并：vaddr所在的2M区域已经使用4K页表映射时，将其中的页框复制到一个新的2M页中，
+ * 并以2M页重新映射该区域。只有区域中所有已映射的页面都是未被共享的4K页框时才会进行合并
+ *
+ * @param vma 发生缺页的vma
+ * @param vaddr 发生缺页的地址
+ * @return int 错误码。无法合并时返回-EAGAIN，此时调用者应继续使用4K页框
+ */
+static int __mm_thp_collapse(struct vm_area_struct *vma, uint64_t vaddr)
+{
+    struct mm_struct *mm = vma->vm_mm;
+    uint64_t base = vaddr & PAGE_2M_MASK;
+    if (!__mm_thp_region_ok(vma, base) || !__mm_thp_anon_ok(vma))
+        return -EAGAIN;
+
+    uint64_t *pde = __mm_get_pde(mm, base);
+    if (pde == NULL || *pde == 0 || (*pde & PAGE_PS))
+        return -EAGAIN;
+
+    uint64_t *pt = phys_2_virt(__PTE_ADDR_4K(*pde));
+    for (int i = 0; i < PAGE_2M_SIZE / PAGE_4K_SIZE; ++i)
+    {
+        if (!(pt[i] & PAGE_PRESENT))
+            continue;
+        void *frame = phys_2_virt(__PTE_ADDR_4K(pt[i]));
+        if (!is_4k_frame(frame) || frame_4k_shared(frame))
+            return -EAGAIN;
+    }
+
+    struct Page *page = alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED);
+    if (unlikely(page == NULL))
+        return -EAGAIN;
+    uint8_t *kaddr = (uint8_t *)phys_2_virt(page->addr_phys);
+
+    // 先解除整个区域的映射并刷新TLB，避免其他cpu在复制期间写入原有的页框
+    *pde = 0;
+    mm_tlb_flush_range(mm, base, PAGE_2M_SIZE);
+
+    for (int i = 0; i < PAGE_2M_SIZE / PAGE_4K_SIZE; ++i)
+    {
+        if (pt[i] & PAGE_PRESENT)
+        {
+            void *frame = phys_2_virt(__PTE_ADDR_4K(pt[i]));
+            memcpy(kaddr + i * PAGE_4K_SIZE, frame, PAGE_4K_SIZE);
+            free_4k_frames(frame, 1);
+        }
+        else
+            memset(kaddr + i * PAGE_4K_SIZE, 0, PAGE_4K_SIZE);
+    }
+    if (likely(is_4k_frame(pt)))
+        free_4k_frames(pt, 1);
+    else
+        kfree(pt);
+
+    __mm_thp_drop_frames_anon(vma);
+    int retval = mm_map_vma(vma, page->addr_phys, base - vma->vm_start, PAGE_2M_SIZE);
+    if (unlikely(retval != 0))
+    {
+        kerror("Failed to remap collapsed 2M page at %#018lx, retval=%d", base, retval);
+        return retval;
+    }
+    atomic_inc(&mm_thp_stat.promoted);
+    return 0;
+}
+
+/**
+ * @brief 为vma中发生缺页的地址申请一个清零的物理页（尚未映射到页表）
+ * 缺页地址所在的、按2M对齐的区域完全位于vma之内且尚未建立页表时，使用2M页，否则使用4K页框
+ *
+ * @param vma 发生缺页的vma
+ * @param vaddr 发生缺页的地址
+ * @param page_start 返回物理页将要被映射到的虚拟地址
+ * @param page_size 返回物理页的大小
+ * @return void* 物理页在内核中的虚拟地址。申请失败时返回NULL
+ */
+static void *__mm_fault_alloc_page(struct vm_area_struct *vma, uint64_t vaddr, uint64_t *page_start, uint64_t *page_size)
+{
+    void *kaddr = NULL;
+    uint64_t base = vaddr & PAGE_2M_MASK;
+    if (__mm_thp_region_ok(vma, base))
+    {
+        bool is_2m;
+        struct Page *page = NULL;
+        // 区域中已经存在4K页表时，不能再直接映射2M页
+        if (__mm_thp_anon_ok(vma) && __mm_get_pte(vma->vm_mm, base, &is_2m) == NULL)
+            page = alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED);
+        if (likely(page != NULL))
+        {
+            kaddr = phys_2_virt(page->addr_phys);
+            memset(kaddr, 0, PAGE_2M_SIZE);
+            *page_start = base;
+            *page_size = PAGE_2M_SIZE;
+            return kaddr;
+        }
+        atomic_inc(&mm_thp_stat.fallback);
+    }
+
+    kaddr = alloc_4k_frames(1, true);
+    *page_start = vaddr & PAGE_4K_MASK;
+    *page_size = PAGE_4K_SIZE;
+    return kaddr;
+}
+
+/**
+ * @brief 释放__mm_fault_alloc_page()申请的、未能成功映射的物理页
+ */
+static void __mm_fault_free_page(void *kaddr, uint64_t page_size)
+{
+    if (page_size == PAGE_2M_SIZE)
+        free_pages(Virt_To_2M_Page(kaddr), 1);
+    else
+        free_4k_frames(kaddr, 1);
+}
+
+/**
+ * @brief 将__mm_fault_alloc_page()申请的物理页映射到vma中
+ *
+ * @param vma 发生缺页的vma
+ * @param page_start 物理页将要被映射到的虚拟地址
+ * @param kaddr 物理页在内核中的虚拟地址
+ * @param page_size 物理页的大小
+ * @return int 错误码
+ */
+static int __mm_fault_map_page(struct vm_area_struct *vma, uint64_t page_start, void *kaddr, uint64_t page_size)
+{
+    if (page_size == PAGE_2M_SIZE)
+    {
+        __mm_thp_drop_frames_anon(vma);
+        return mm_map_vma(vma, virt_2_phys(kaddr), page_start - vma->vm_start, PAGE_2M_SIZE);
+    }
+
+    // 4K页框所在的2M页的anon_vma只用于满足vma的生命周期管理，页框的共享计数由4K页框分配器负责
+    if (vma->anon_vma == NULL)
+    {
+        struct Page *page = Virt_To_2M_Page(kaddr);
+        spin_lock(&page->op_lock);
+        if (page->anon_vma == NULL)
+            __anon_vma_create_alloc(page, false);
+        spin_unlock(&page->op_lock);
+        __anon_vma_add(page->anon_vma, vma);
+    }
+    uint64_t flags = (vma->vm_flags & VM_USER) ? PAGE_U_S : 0;
+    return mm_map_proc_page_table((uint64_t)vma->vm_mm->pgd, true, page_start, virt_2_phys(kaddr), PAGE_4K_SIZE, flags, false, false, true);
+}
+
+/**
+ * @brief 匿名映射的缺页处理：映射一个清零的页面
+ *
+ * @param vma 发生缺页的vma
+ * @param vaddr 发生缺页的地址
+ * @return int 0 => 次要缺页， 负数 => 错误码
+ */
+static int __mm_do_anonymous_page(struct vm_area_struct *vma, uint64_t vaddr)
+{
+    // 缺页地址所在的2M区域已经使用4K页表映射时，尝试将其合并为2M页
+    int retval = __mm_thp_collapse(vma, vaddr);
+    if (retval != -EAGAIN)
+        return retval;
+
+    uint64_t page_start, page_size;
+    void *kaddr = __mm_fault_alloc_page(vma, vaddr, &page_start, &page_size);
+    if (unlikely(kaddr == NULL))
+        return -ENOMEM;
+
+    retval = __mm_fault_map_page(vma, page_start, kaddr, page_size);
+    if (unlikely(retval != 0))
+        __mm_fault_free_page(kaddr, page_size);
+    return retval;
+}
+
+/**
+ * @brief 文件映射的缺页处理：将页面所覆盖的文件内容读入清零的页面，再进行映射
+ *
+ * @param vma 发生缺页的vma
+ * @param vaddr 发生缺页的地址
+ * @return int VM_FAULT_MAJOR => 从文件中读取了数据， 0 => 页面不包含文件内容， 负数 => 错误码
+ */
+static int __mm_filemap_fault(struct vm_area_struct *vma, uint64_t vaddr)
+{
+    uint64_t page_start, page_size;
+    void *kaddr = __mm_fault_alloc_page(vma, vaddr, &page_start, &page_size);
+    if (unlikely(kaddr == NULL))
+        return -ENOMEM;
+
+    int retval = 0;
+    // 计算页面与文件内容所在区域的交集
+    uint64_t start = (page_start > vma->vm_file_start) ? page_start : vma->vm_file_start;
+    uint64_t end = page_start + page_size;
+    if (end > vma->vm_file_start + vma->vm_file_len)
+        end = vma->vm_file_start + vma->vm_file_len;
+
+    if (vma->vm_file != NULL && start < end)
+    {
+        long pos = vma->vm_file_offset + (start - vma->vm_file_start);
+        long val = vma->vm_file->file_ops->read(vma->vm_file, (char *)kaddr + (start - page_start), end - start, &pos);
+        if (unlikely(val < 0))
+        {
+            retval = val;
+            goto failed;
+        }
+        retval = VM_FAULT_MAJOR;
+    }
+
+    int ret = __mm_fault_map_page(vma, page_start, kaddr, page_size);
+    if (unlikely(ret != 0))
+    {
+        retval = ret;
+        goto failed;
+    }
+    return retval;
+failed:;
+    __mm_fault_free_page(kaddr, page_size);
+    return retval;
+}
+
+struct vm_operations_t mm_file_vm_ops = {
+    .open = NULL,
+    .close = NULL,
+    .fault = __mm_filemap_fault,
+};
+
+/**
+ * @brief 处理用户地址空间中的缺页异常
+ *
+ * @param regs 异常发生时的寄存器
+ * @param error_code 缺页异常的错误码
+ * @param vaddr 触发异常的虚拟地址
+ * @return int 成功处理时返回0，否则说明这是一次非法的访问
+ */
+int mm_do_page_fault(struct pt_regs *regs, uint64_t error_code, uint64_t vaddr)
+{
+    struct mm_struct *mm = current_pcb->mm;
+    if (vaddr > USER_MAX_LINEAR_ADDR || mm == NULL || mm->pgd == NULL)
+        return -EFAULT;
+
+    struct vm_area_struct *vma = vma_find(mm, vaddr);
+    if (vma == NULL || vma->vm_start > vaddr)
+        return -EFAULT;
+
+    int retval = -EFAULT;
+    bool is_2m;
+    uint64_t *pte = __mm_get_pte(mm, vaddr, &is_2m);
+
+    if (!(error_code & PF_ERR_PRESENT))
+    {
+        if (pte != NULL && (*pte & PAGE_PRESENT)) // 其他cpu已经处理了这个异常
+            retval = 0;
+        else if (vma->vm_ops != NULL && vma->vm_ops->fault != NULL) // 由vma提供页面（例如文件映射）
+            retval = vma->vm_ops->fault(vma, vaddr);
+        else // 匿名映射，按需分配清零的页面
+            retval = __mm_do_anonymous_page(vma, vaddr);
+    }
+    else if ((error_code & PF_ERR_WRITE) && (vma->vm_flags & VM_WRITE)) // 写入了只读的页面：写时复制
+    {
+        if (unlikely(pte == NULL || !(*pte & PAGE_PRESENT)))
+            return -EFAULT;
+
+        if (*pte & PAGE_R_W) // 其他cpu已经处理了这个异常
+            retval = 0;
+        else if (is_2m)
+            retval = __mm_cow_2m_page(vma, pte);
+        else
+            retval = __mm_cow_4k_page(pte);
+
+        // 页表项指向了新的页面，其他正在使用该地址空间的cpu也需要刷新
+        if (retval == 0)
+        {
+            ++current_pcb->min_flt;
+            mm_tlb_flush_range(mm, vaddr & (is_2m ? PAGE_2M_MASK : PAGE_4K_MASK), PAGE_4K_SIZE);
+            return 0;
+        }
+    }
+
+    if (retval < 0)
+        return retval;
+
+    // 统计缺页次数
+    if (retval == VM_FAULT_MAJOR)
+        ++current_pcb->maj_flt;
+    else
+        ++current_pcb->min_flt;
+    flush_tlb_one(vaddr);
+    return 0;
+}
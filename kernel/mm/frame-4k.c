@@ -0,0 +1,396 @@
+/**
+ * @file frame-4k.c
+ * @brief 4K页框分配器：将buddy系统中的2M页拆分为512个4K页框进行管理，
+ * 为页表、用户态的小块内存映射以及DMA缓冲区提供以4K为粒度的物理内存
+ *
+ */
+#include "mm.h"
+#include "slab.h"
+#include <common/compiler.h>
+#include <common/bitmap.h>
+#include <common/errno.h>
+#include <common/string.h>
+
+// 每个2M页能拆分出的4K页框数量
+#define FRAME_4K_PER_BLOCK (PAGE_2M_SIZE / PAGE_4K_SIZE)
+// 完全空闲时仍被保留的块的数量（避免在边界处反复向buddy申请、释放2M页）
+#define FRAME_4K_MAX_EMPTY_BLOCKS 1
+
+/**
+ * @brief 被拆分为4K页框的2M页
+ *
+ */
+struct frame_4k_block
+{
+    struct List list;                        // 在分配器的partial/full链表中的结点
+    struct Page *page;                       // 被拆分的2M页
+    uint64_t vaddr;                          // 2M页的起始虚拟地址
+    uint64_t bmp[FRAME_4K_PER_BLOCK / 64];   // 页框位图（置位表示已使用）
+    uint32_t count_free;                     // 空闲的页框数量
+    uint32_t hint;                           // 下一次查找空闲页框的起始位置
+    uint16_t share[FRAME_4K_PER_BLOCK];      // 每个页框除第一个使用者以外的共享者数量（用于写时复制）
+};
+
+/**
+ * @brief 4K页框分配器
+ *
+ */
+static struct
+{
+    struct List partial_list; // 存在空闲页框的块
+    struct List full_list;    // 页框已全部分配的块
+    uint64_t count_blocks;    // 拆分出来的2M页的数量
+    uint64_t count_empty;     // 完全空闲的块的数量
+    uint64_t frames_using;    // 已分配的4K页框的数量
+    spinlock_t lock;
+} frame_4k_allocator;
+
+/**
+ * @brief 判断块中的第idx个页框是否已被使用
+ */
+static __always_inline bool __frame_4k_test(struct frame_4k_block *block, uint32_t idx)
+{
+    return (block->bmp[idx >> 6] >> (idx & 63)) & 1;
+}
+
+/**
+ * @brief 在块中查找从start开始的第一个空闲页框
+ *
+ * @return uint32_t 页框下标。不存在时返回FRAME_4K_PER_BLOCK
+ */
+static uint32_t __frame_4k_next_free(struct frame_4k_block *block, uint32_t start)
+{
+    return bitmap_find_next_zero(block->bmp, start, FRAME_4K_PER_BLOCK);
+}
+
+/**
+ * @brief 在块中查找count个连续的空闲页框
+ *
+ * @param block 页框块
+ * @param count 页框数量
+ * @return uint32_t 起始页框的下标。不存在时返回FRAME_4K_PER_BLOCK
+ */
+static uint32_t __frame_4k_find_range(struct frame_4k_block *block, uint32_t count)
+{
+    if (block->count_free < count)
+        return FRAME_4K_PER_BLOCK;
+
+    // 单个页框，直接从hint处开始查找，找不到再从头查找
+    if (count == 1)
+    {
+        uint32_t idx = __frame_4k_next_free(block, block->hint);
+        if (idx == FRAME_4K_PER_BLOCK)
+            idx = __frame_4k_next_free(block, 0);
+        return idx;
+    }
+
+    uint32_t start = __frame_4k_next_free(block, 0);
+    while (start + count <= FRAME_4K_PER_BLOCK)
+    {
+        uint32_t end = start + 1;
+        while (end < start + count && !__frame_4k_test(block, end))
+            ++end;
+        if (end == start + count)
+            return start;
+        // [start, end)不够长，跳过被占用的页框继续查找
+        start = __frame_4k_next_free(block, end + 1);
+    }
+    return FRAME_4K_PER_BLOCK;
+}
+
+/**
+ * @brief 设置/清除块中[start, start+count)范围内的页框位图
+ */
+static void __frame_4k_set_range(struct frame_4k_block *block, uint32_t start, uint32_t count, bool used)
+{
+    for (uint32_t i = start; i < start + count; ++i)
+    {
+        if (used)
+            block->bmp[i >> 6] |= (1UL << (i & 63));
+        else
+            block->bmp[i >> 6] &= ~(1UL << (i & 63));
+    }
+}
+
+/**
+ * @brief 从buddy系统中申请一个2M页，并将其拆分为4K页框（需要在未持有分配器锁的情况下调用）
+ *
+ * @return struct frame_4k_block* 新的页框块
+ */
+static struct frame_4k_block *__frame_4k_block_create()
+{
+    struct frame_4k_block *block = (struct frame_4k_block *)kzalloc(sizeof(struct frame_4k_block), 0);
+    if (unlikely(block == NULL))
+        return NULL;
+
+    struct Page *page = alloc_pages(ZONE_NORMAL, 1, PAGE_KERNEL | PAGE_4K_FRAMES);
+    if (unlikely(page == NULL))
+    {
+        kfree(block);
+        return NULL;
+    }
+
+    list_init(&block->list);
+    block->page = page;
+    block->vaddr = (uint64_t)phys_2_virt(page->addr_phys);
+    block->count_free = FRAME_4K_PER_BLOCK;
+    block->hint = 0;
+    page->frame_block = block;
+    return block;
+}
+
+/**
+ * @brief 将完全空闲的页框块对应的2M页归还给buddy系统（需要在未持有分配器锁的情况下调用）
+ *
+ * @param block 页框块
+ */
+static void __frame_4k_block_destroy(struct frame_4k_block *block)
+{
+    struct Page *page = block->page;
+    page->frame_block = NULL;
+    // 解除与anon_vma的绑定，防止2M页被重新分配后沿用旧的anon_vma
+    spin_lock(&page->op_lock);
+    if (page->anon_vma != NULL)
+    {
+        page->anon_vma->page = NULL;
+        page->anon_vma = NULL;
+    }
+    spin_unlock(&page->op_lock);
+    page->attr &= ~PAGE_4K_FRAMES;
+    free_pages(page, 1);
+    kfree(block);
+}
+
+/**
+ * @brief 申请count个连续的4K页框
+ *
+ * @param count 页框数量 0<count<=512
+ * @param zero 是否将页框清零
+ * @return void* 页框的起始虚拟地址。申请失败时返回NULL
+ */
+void *alloc_4k_frames(uint32_t count, bool zero)
+{
+    if (unlikely(count == 0 || count > FRAME_4K_PER_BLOCK))
+    {
+        kerror("alloc_4k_frames(): count=%d is invalid.", count);
+        return NULL;
+    }
+
+    uint64_t rflags;
+    struct frame_4k_block *block = NULL;
+    struct frame_4k_block *new_block = NULL;
+    uint32_t idx = FRAME_4K_PER_BLOCK;
+
+retry:;
+    spin_lock_irqsave(&frame_4k_allocator.lock, rflags);
+    struct List *ptr = list_next(&frame_4k_allocator.partial_list);
+    while (ptr != &frame_4k_allocator.partial_list)
+    {
+        block = container_of(ptr, struct frame_4k_block, list);
+        idx = __frame_4k_find_range(block, count);
+        if (idx != FRAME_4K_PER_BLOCK)
+            break;
+        ptr = list_next(ptr);
+    }
+
+    if (idx == FRAME_4K_PER_BLOCK)
+    {
+        // 现有的块中没有足够的连续页框，需要拆分新的2M页
+        if (new_block == NULL)
+        {
+            spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+            new_block = __frame_4k_block_create();
+            if (unlikely(new_block == NULL))
+            {
+                kerror("alloc_4k_frames(): Cannot alloc 2M page.");
+                return NULL;
+            }
+            goto retry;
+        }
+        block = new_block;
+        new_block = NULL;
+        list_add(&frame_4k_allocator.partial_list, &block->list);
+        ++frame_4k_allocator.count_blocks;
+        ++frame_4k_allocator.count_empty;
+        idx = 0;
+    }
+
+    if (block->count_free == FRAME_4K_PER_BLOCK)
+        --frame_4k_allocator.count_empty;
+    __frame_4k_set_range(block, idx, count, true);
+    block->count_free -= count;
+    block->hint = idx + count;
+    frame_4k_allocator.frames_using += count;
+
+    if (block->count_free == 0)
+    {
+        list_del(&block->list);
+        list_add(&frame_4k_allocator.full_list, &block->list);
+    }
+    spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+
+    // 在重试的过程中，其他cpu释放了页框，因此预先申请的块没有被使用
+    if (unlikely(new_block != NULL))
+        __frame_4k_block_destroy(new_block);
+
+    void *vaddr = (void *)(block->vaddr + ((uint64_t)idx << PAGE_4K_SHIFT));
+    if (zero)
+        memset(vaddr, 0, (uint64_t)count << PAGE_4K_SHIFT);
+    return vaddr;
+}
+
+/**
+ * @brief 释放count个连续的4K页框。块中的页框全部空闲后，对应的2M页将被归还给buddy系统
+ *
+ * @param vaddr 要释放的第一个页框的虚拟地址（位于某次alloc_4k_frames()申请到的范围之内，4K对齐）
+ * @param count 页框数量（不能超出申请到的范围）
+ */
+void free_4k_frames(void *vaddr, uint32_t count)
+{
+    if (unlikely(vaddr == NULL))
+        return;
+    if (unlikely(!is_4k_frame(vaddr) || ((uint64_t)vaddr & (PAGE_4K_SIZE - 1)) || count == 0))
+    {
+        kerror("free_4k_frames(): Invalid frame: vaddr=%#018lx, count=%d", vaddr, count);
+        return;
+    }
+
+    uint64_t rflags;
+    struct frame_4k_block *to_destroy = NULL;
+    spin_lock_irqsave(&frame_4k_allocator.lock, rflags);
+
+    struct frame_4k_block *block = Virt_To_2M_Page(vaddr)->frame_block;
+    uint32_t idx = ((uint64_t)vaddr - block->vaddr) >> PAGE_4K_SHIFT;
+    if (unlikely(idx + count > FRAME_4K_PER_BLOCK))
+    {
+        spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+        kerror("free_4k_frames(): Range out of block: vaddr=%#018lx, count=%d", vaddr, count);
+        return;
+    }
+    for (uint32_t i = idx; i < idx + count; ++i)
+    {
+        if (unlikely(!__frame_4k_test(block, i)))
+        {
+            spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+            kBUG("free_4k_frames(): Double free: vaddr=%#018lx", block->vaddr + ((uint64_t)i << PAGE_4K_SHIFT));
+            return;
+        }
+    }
+
+    // 仍被其他使用者共享的页框只减少共享计数，其余的页框被真正释放
+    uint32_t freed = 0;
+    for (uint32_t i = idx; i < idx + count; ++i)
+    {
+        if (block->share[i] > 0)
+        {
+            --block->share[i];
+            continue;
+        }
+        __frame_4k_set_range(block, i, 1, false);
+        ++freed;
+        if (i < block->hint)
+            block->hint = i;
+    }
+
+    if (block->count_free == 0 && freed > 0)
+    {
+        list_del(&block->list);
+        list_add(&frame_4k_allocator.partial_list, &block->list);
+    }
+    block->count_free += freed;
+    frame_4k_allocator.frames_using -= freed;
+
+    if (freed > 0 && block->count_free == FRAME_4K_PER_BLOCK)
+    {
+        if (frame_4k_allocator.count_empty >= FRAME_4K_MAX_EMPTY_BLOCKS)
+        {
+            list_del(&block->list);
+            --frame_4k_allocator.count_blocks;
+            to_destroy = block;
+        }
+        else
+            ++frame_4k_allocator.count_empty;
+    }
+    spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+
+    if (to_destroy != NULL)
+        __frame_4k_block_destroy(to_destroy);
+}
+
+/**
+ * @brief 增加页框的共享者（共享者调用free_4k_frames()时只会减少共享计数）
+ *
+ * @param vaddr 页框的虚拟地址
+ * @return int 错误码
+ */
+int frame_4k_share(void *vaddr)
+{
+    if (unlikely(!is_4k_frame(vaddr)))
+        return -EINVAL;
+
+    uint64_t rflags;
+    int retval = 0;
+    spin_lock_irqsave(&frame_4k_allocator.lock, rflags);
+    struct frame_4k_block *block = Virt_To_2M_Page(vaddr)->frame_block;
+    uint32_t idx = ((uint64_t)vaddr - block->vaddr) >> PAGE_4K_SHIFT;
+    if (unlikely(!__frame_4k_test(block, idx) || block->share[idx] == (uint16_t)(~0U)))
+        retval = -EINVAL;
+    else
+        ++block->share[idx];
+    spin_unlock_irqrestore(&frame_4k_allocator.lock, rflags);
+    return retval;
+}
+
+/**
+ * @brief 判断页框是否正在被多个使用者共享(未上锁，调用者应保证页框不会被并发地释放)
+ *
+ * @param vaddr 页框的虚拟地址
+ * @return true 正在被共享
+ * @return false 只有一个使用者
+ */
+bool frame_4k_shared(void *vaddr)
+{
+    struct frame_4k_block *block = Virt_To_2M_Page(vaddr)->frame_block;
+    return block->share[((uint64_t)vaddr - block->vaddr) >> PAGE_4K_SHIFT] > 0;
+}
+
+/**
+ * @brief 判断虚拟地址是否属于4K页框分配器
+ *
+ * @param vaddr 虚拟地址
+ * @return true 属于
+ * @return false 不属于
+ */
+bool is_4k_frame(void *vaddr)
+{
+    if (unlikely((uint64_t)vaddr < PAGE_OFFSET || (virt_2_phys(vaddr) >> PAGE_2M_SHIFT) >= memory_management_struct.count_pages))
+        return false;
+    return (Virt_To_2M_Page(vaddr)->attr & PAGE_4K_FRAMES) != 0;
+}
+
+/**
+ * @brief 获取4K页框分配器的统计信息(未上锁，不一定精准)
+ *
+ * @param total 返回的页框总数
+ * @param using 返回的已分配的页框数量
+ */
+void frame_4k_stat(uint64_t *total, uint64_t *using)
+{
+    *total = frame_4k_allocator.count_blocks * FRAME_4K_PER_BLOCK;
+    *using = frame_4k_allocator.frames_using;
+}
+
+/**
+ * @brief 初始化4K页框分配器
+ *
+ */
+void frame_4k_init()
+{
+    list_init(&frame_4k_allocator.partial_list);
+    list_init(&frame_4k_allocator.full_list);
+    frame_4k_allocator.count_blocks = 0;
+    frame_4k_allocator.count_empty = 0;
+    frame_4k_allocator.frames_using = 0;
+    spin_init(&frame_4k_allocator.lock);
+    kinfo("4K frame allocator initialized.");
+}
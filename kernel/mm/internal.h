@@ -32,6 +32,25 @@ void __vma_unlink_list(struct mm_struct *mm, struct vm_area_struct *vma);
  */
 uint64_t __mm_get_paddr(struct mm_struct *mm, uint64_t vaddr);
 
+/**
+ * @brief 获取指定虚拟地址在页表中对应的pde
+ *
+ * @param mm 内存空间分布结构体
+ * @param vaddr 虚拟地址
+ * @return uint64_t* pde的指针。pde所在的页表不存在时返回NULL
+ */
+uint64_t *__mm_get_pde(struct mm_struct *mm, uint64_t vaddr);
+
+/**
+ * @brief 获取指定虚拟地址在页表中对应的最后一级页表项（2M页的pde或4K页的pte）
+ *
+ * @param mm 内存空间分布结构体
+ * @param vaddr 虚拟地址
+ * @param is_2m 返回该页表项是否映射了2M页
+ * @return uint64_t* 页表项的指针。页表项所在的页表不存在时返回NULL
+ */
+uint64_t *__mm_get_pte(struct mm_struct *mm, uint64_t vaddr, bool *is_2m);
+
 /**
  * @brief 创建anon_vma，并将其与页面结构体进行绑定
  * 若提供的页面结构体指针为NULL，则只创建，不绑定
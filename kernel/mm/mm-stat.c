@@ -13,6 +13,7 @@
 #include "slab.h"
 #include <common/errno.h>
 #include <process/ptrace.h>
+#include <common/bcache.h>
 
 extern const struct slab kmalloc_cache_group[16];
 
@@ -21,6 +22,7 @@ static int __count_in_using_2m_pages(int zone);
 static uint64_t __count_kmalloc_free();
 static uint64_t __count_kmalloc_using();
 static uint64_t __count_kmalloc_total();
+static int __count_buddy_free_blocks(int zone, uint64_t *free_blocks);
 uint64_t sys_mm_stat(struct pt_regs *regs);
 
 /**
@@ -111,6 +113,45 @@ static int __count_in_using_2m_pages(int zone)
     return result;
 }
 
+/**
+ * @brief 统计指定zone中，buddy系统每一阶的空闲块数量
+ *
+ * @param zone 内存zone号
+ * @param free_blocks 返回的每一阶空闲块数量的数组（长度为MM_BUDDY_MAX_ORDER）
+ * @return int 错误码
+ */
+static int __count_buddy_free_blocks(int zone, uint64_t *free_blocks)
+{
+    int zone_start = 0, zone_end = 0;
+    switch (zone)
+    {
+    case ZONE_DMA:
+        zone_start = 0;
+        zone_end = ZONE_DMA_INDEX;
+        break;
+    case ZONE_NORMAL:
+        zone_start = ZONE_DMA_INDEX;
+        zone_end = ZONE_NORMAL_INDEX;
+        break;
+    case ZONE_UNMAPPED_IN_PGT:
+        zone_start = ZONE_NORMAL_INDEX;
+        zone_end = ZONE_UNMAPPED_INDEX;
+        break;
+    default:
+        kerror("In __count_buddy_free_blocks: param: zone invalid.");
+        return -EINVAL;
+        break;
+    }
+
+    for (int i = zone_start; i <= zone_end; ++i)
+    {
+        struct Zone *z = memory_management_struct.zones_struct + i;
+        for (int order = 0; order < MM_BUDDY_MAX_ORDER; ++order)
+            free_blocks[order] += z->free_area[order].num_free;
+    }
+    return 0;
+}
+
 /**
  * @brief 计算kmalloc缓冲区中的空闲内存
  *
@@ -121,7 +162,8 @@ static uint64_t __count_kmalloc_free()
     uint64_t result = 0;
     for (int i = 0; i < sizeof(kmalloc_cache_group) / sizeof(struct slab); ++i)
     {
-        result += kmalloc_cache_group[i].size * kmalloc_cache_group[i].count_total_free;
+        // magazine中缓存的对象在内存池看来是已分配的，但实际上是空闲的
+        result += kmalloc_cache_group[i].size * (kmalloc_cache_group[i].count_total_free + kmalloc_count_magazine_objs(i));
     }
     return result;
 }
@@ -136,7 +178,7 @@ static uint64_t __count_kmalloc_using()
     uint64_t result = 0;
     for (int i = 0; i < sizeof(kmalloc_cache_group) / sizeof(struct slab); ++i)
     {
-        result += kmalloc_cache_group[i].size * kmalloc_cache_group[i].count_total_using;
+        result += kmalloc_cache_group[i].size * (kmalloc_cache_group[i].count_total_using - kmalloc_count_magazine_objs(i));
     }
     return result;
 }
@@ -172,7 +214,25 @@ struct mm_stat_t mm_stat()
     // 统计kmalloc slab中的信息
     tmp.cache_free = __count_kmalloc_free();
     tmp.cache_used = __count_kmalloc_using();
-    tmp.available = tmp.free + tmp.cache_free;
+    // 统计4K页框分配器中的信息（其占用的2M页已被计入used中）
+    uint64_t frame_total = 0, frame_using = 0;
+    frame_4k_stat(&frame_total, &frame_using);
+    tmp.frame_total = frame_total * PAGE_4K_SIZE;
+    tmp.frame_used = frame_using * PAGE_4K_SIZE;
+    tmp.available = tmp.free + tmp.cache_free + (tmp.frame_total - tmp.frame_used);
+    // 统计buddy系统中每一阶的空闲块数量，用于观察物理内存的碎片化程度
+    __count_buddy_free_blocks(ZONE_NORMAL, tmp.free_blocks);
+    // 统计透明大页的信息
+    tmp.huge_mapped = atomic_read(&mm_thp_stat.mapped);
+    tmp.thp_promoted = atomic_read(&mm_thp_stat.promoted);
+    tmp.thp_fallback = atomic_read(&mm_thp_stat.fallback);
+    // 统计块设备缓冲区缓存的信息
+    struct bcache_stat_t bstat;
+    bcache_get_stat(&bstat);
+    tmp.bcache_used = bstat.bytes;
+    tmp.bcache_dirty = bstat.dirty_bytes;
+    tmp.bcache_hits = bstat.hits;
+    tmp.bcache_misses = bstat.misses;
     return tmp;
 }
 
@@ -3,11 +3,19 @@
 #include <common/semaphore.h>
 #include <common/spinlock.h>
 #include <common/atomic.h>
+#include <common/rbtree.h>
 
 struct mm_struct;
 struct anon_vma_t;
+struct slab;
+struct slab_obj;
+struct frame_4k_block;
+struct vfs_file_t;
 typedef uint64_t vm_flags_t;
 
+// buddy系统中空闲块的阶数上限（最大的空闲块由2^(MM_BUDDY_MAX_ORDER-1)个连续的2M页组成）
+#define MM_BUDDY_MAX_ORDER 11
+
 /**
  * @brief 内存页表结构体
  *
@@ -68,6 +76,16 @@ struct memory_desc
     ul end_of_struct; // 内存页管理结构的结束地址
 };
 
+/**
+ * @brief buddy系统中，某一阶的空闲块链表
+ *
+ */
+struct buddy_free_area
+{
+    struct List list_head; // 空闲块链表（链接的是空闲块首页的buddy_list）
+    ul num_free;           // 空闲块的数量
+};
+
 struct Zone
 {
     // 指向内存页的指针
@@ -90,6 +108,10 @@ struct Zone
 
     // 物理页被引用次数
     ul total_pages_link;
+
+    // buddy系统的空闲块链表，第i个元素管理由2^i个连续2M页组成的空闲块
+    struct buddy_free_area free_area[MM_BUDDY_MAX_ORDER];
+    spinlock_t buddy_lock; // buddy系统的操作锁
 };
 
 struct Page
@@ -109,6 +131,15 @@ struct Page
 
     spinlock_t op_lock; // 页面操作锁
 
+    struct List buddy_list; // 本页作为空闲块首页时，在buddy空闲链表中的结点
+    uint32_t buddy_order;   // 本页作为空闲块首页时，空闲块的阶数
+
+    // 本页被kmalloc用作slab时，所属的内存池及管理本页的slab_obj（用于kfree()快速定位）
+    struct slab *slab_cache;
+    struct slab_obj *slab_obj;
+
+    // 本页被拆分为4K页框时，管理这些页框的结构体
+    struct frame_4k_block *frame_block;
 };
 
 /**
@@ -118,6 +149,7 @@ struct Page
 struct vm_area_struct
 {
     struct vm_area_struct *vm_prev, *vm_next;
+    struct rb_node vm_rb;    // 在mm的vma红黑树中的结点（以vm_start为键）
 
     // 虚拟内存区域的范围是一个左闭右开的区间：[vm_start, vm_end)
     uint64_t vm_start;       // 区域的起始地址
@@ -133,6 +165,12 @@ struct vm_area_struct
     atomic_t ref_count;             // 引用计数
     pgoff_t page_offset;    // 起始地址在当前VMA所占的2M物理页中的偏移量
     void *private_data;
+
+    // 文件映射：vma中[vm_file_start, vm_file_start+vm_file_len)的内容来自文件中vm_file_offset处，其余部分为0
+    struct vfs_file_t *vm_file; // 映射的文件（匿名映射为NULL）
+    uint64_t vm_file_start;     // 由文件内容填充的区域的起始地址
+    uint64_t vm_file_offset;    // 该区域在文件中的偏移量
+    uint64_t vm_file_len;       // 该区域的长度
 };
 
 /**
@@ -142,7 +180,8 @@ struct vm_area_struct
 struct mm_struct
 {
     pml4t_t *pgd;                // 内存页表指针
-    struct vm_area_struct *vmas; // VMA列表
+    struct vm_area_struct *vmas; // VMA列表（按地址从小到大排列）
+    struct rb_root vma_tree;     // VMA红黑树，用于快速查找
     // 代码段空间
     uint64_t code_addr_start, code_addr_end;
     // 数据段空间
@@ -155,6 +194,12 @@ struct mm_struct
     uint64_t brk_start, brk_end;
     // 应用层栈基地址
     uint64_t stack_start;
+
+    // ==== TLB管理 ====
+    uint16_t pcid;            // 地址空间的PCID（为0时表示未分配，每次切换到该地址空间时都会刷新TLB）
+    atomic_t cpu_active_mask; // 当前正在使用该地址空间的cpu
+    atomic_t tlb_valid_mask;  // TLB中该PCID的缓存与页表保持一致的cpu（切换到该地址空间时无需刷新TLB）
+    spinlock_t tlb_lock;      // 保证切换地址空间与刷新TLB之间的顺序
 };
 
 /**
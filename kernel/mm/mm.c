@@ -27,6 +27,8 @@ struct memory_desc memory_management_struct = {{0}, 0};
  */
 uint64_t mm_get_PDE(ul proc_page_table_addr, bool is_phys, ul virt_addr, bool clear);
 
+static void __buddy_init_free_areas();
+
 /**
  * @brief 检查页表是否存在不为0的页表项
  *
@@ -164,6 +166,14 @@ void mm_init()
         z->count_pages = (addr_end - addr_start) >> PAGE_2M_SHIFT;
         z->pages_group = (struct Page *)(memory_management_struct.pages_struct + (addr_start >> PAGE_2M_SHIFT));
 
+        // 初始化buddy系统的空闲链表（空闲块在slab初始化完成后才加入）
+        for (int j = 0; j < MM_BUDDY_MAX_ORDER; ++j)
+        {
+            list_init(&z->free_area[j].list_head);
+            z->free_area[j].num_free = 0;
+        }
+        spin_init(&z->buddy_lock);
+
         // 初始化页
         struct Page *p = z->pages_group;
 
@@ -228,6 +238,9 @@ void mm_init()
     // todo: 在这里增加代码，暂时停止视频输出，否则可能会导致图像数据写入slab的区域，从而造成异常
     // 初始化slab内存池
     slab_init();
+    // 内核所需的物理页均已预留，将剩余的空闲页交给buddy系统管理
+    __buddy_init_free_areas();
+    frame_4k_init();
     page_table_init();
 
     initial_mm.pgd = (pml4t_t *)get_CR3();
@@ -248,7 +261,9 @@ void mm_init()
 
     initial_mm.stack_start = _stack_start;
     initial_mm.vmas = NULL;
-    
+    // 页表已经初始化完毕，启用PCID
+    mm_tlb_init();
+
     mmio_init();
 }
 
@@ -278,17 +293,170 @@ unsigned long page_init(struct Page *page, ul flags)
 }
 
 /**
- * @brief 从已初始化的页结构中搜索符合申请条件的、连续num个struct page
+ * @brief 计算能够容纳num个连续页的最小的buddy阶数
+ *
+ * @param num 页面数量
+ * @return int 阶数
+ */
+static __always_inline int __buddy_order_of(ul num)
+{
+    int order = 0;
+    while ((1UL << order) < num)
+        ++order;
+    return order;
+}
+
+/**
+ * @brief 将以page为首页的、大小为2^order的空闲块加入zone的空闲链表
+ *
+ * @param z 内存区域
+ * @param page 空闲块的首页
+ * @param order 空闲块的阶数
+ */
+static __always_inline void __buddy_add_block(struct Zone *z, struct Page *page, int order)
+{
+    page->attr |= PAGE_BUDDY_FREE;
+    page->buddy_order = order;
+    list_init(&page->buddy_list);
+    list_add(&z->free_area[order].list_head, &page->buddy_list);
+    ++z->free_area[order].num_free;
+}
+
+/**
+ * @brief 将以page为首页的空闲块从zone的空闲链表中删除
+ *
+ * @param z 内存区域
+ * @param page 空闲块的首页
+ * @param order 空闲块的阶数
+ */
+static __always_inline void __buddy_del_block(struct Zone *z, struct Page *page, int order)
+{
+    list_del(&page->buddy_list);
+    page->attr &= ~PAGE_BUDDY_FREE;
+    page->buddy_order = 0;
+    --z->free_area[order].num_free;
+}
+
+/**
+ * @brief 将zone中第idx个页开始的、大小为2^order的块还给buddy，并逐级与伙伴块合并
+ *
+ * @param z 内存区域
+ * @param idx 块的首页在zone中的序号（按照2^order对齐）
+ * @param order 块的阶数
+ */
+static void __buddy_free_block(struct Zone *z, ul idx, int order)
+{
+    while (order < MM_BUDDY_MAX_ORDER - 1)
+    {
+        ul buddy_idx = idx ^ (1UL << order);
+        // 伙伴块超出了zone的范围
+        if (buddy_idx + (1UL << order) > z->count_pages)
+            break;
+
+        struct Page *buddy = z->pages_group + buddy_idx;
+        // 伙伴块不是同阶的空闲块，无法合并
+        if (!(buddy->attr & PAGE_BUDDY_FREE) || buddy->buddy_order != order)
+            break;
+
+        __buddy_del_block(z, buddy, order);
+        idx &= ~(1UL << order);
+        ++order;
+    }
+    __buddy_add_block(z, z->pages_group + idx, order);
+}
+
+/**
+ * @brief 将zone中从第idx个页开始的、连续count个页还给buddy
+ * 区间会被拆分为若干个按阶对齐的块，再分别进行合并
+ *
+ * @param z 内存区域
+ * @param idx 起始页在zone中的序号
+ * @param count 页的数量
+ */
+static void __buddy_free_range(struct Zone *z, ul idx, ul count)
+{
+    while (count)
+    {
+        int order = 0;
+        while (order + 1 < MM_BUDDY_MAX_ORDER && !(idx & ((1UL << (order + 1)) - 1)) && (1UL << (order + 1)) <= count)
+            ++order;
+        __buddy_free_block(z, idx, order);
+        idx += (1UL << order);
+        count -= (1UL << order);
+    }
+}
+
+/**
+ * @brief 从zone中取出一个大小为2^order的空闲块，必要时拆分更大的块
+ *
+ * @param z 内存区域
+ * @param order 要申请的块的阶数
+ * @return struct Page* 空闲块的首页。没有满足要求的块时，返回NULL
+ */
+static struct Page *__buddy_alloc_block(struct Zone *z, int order)
+{
+    for (int cur_order = order; cur_order < MM_BUDDY_MAX_ORDER; ++cur_order)
+    {
+        if (list_empty(&z->free_area[cur_order].list_head))
+            continue;
+
+        struct Page *page = container_of(list_next(&z->free_area[cur_order].list_head), struct Page, buddy_list);
+        __buddy_del_block(z, page, cur_order);
+
+        // 逐级向下拆分，把后半部分放回低一阶的链表
+        while (cur_order > order)
+        {
+            --cur_order;
+            __buddy_add_block(z, page + (1UL << cur_order), cur_order);
+        }
+        return page;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 根据bmp，将各个zone中的空闲页加入buddy系统
+ * 在mm_init()与slab_init()预留完内核所需的物理页后调用
+ */
+static void __buddy_init_free_areas()
+{
+    for (int i = 0; i < memory_management_struct.count_zones; ++i)
+    {
+        struct Zone *z = memory_management_struct.zones_struct + i;
+        ul run_start = 0, run_len = 0;
+
+        for (ul j = 0; j < z->count_pages; ++j)
+        {
+            ul page_num = z->pages_group[j].addr_phys >> PAGE_2M_SHIFT;
+            if (*(memory_management_struct.bmp + (page_num >> 6)) & (1UL << (page_num % 64)))
+            {
+                // 当前页已被使用，把之前连续的空闲页还给buddy
+                if (run_len)
+                    __buddy_free_range(z, run_start, run_len);
+                run_len = 0;
+                continue;
+            }
+            if (run_len == 0)
+                run_start = j;
+            ++run_len;
+        }
+        if (run_len)
+            __buddy_free_range(z, run_start, run_len);
+    }
+}
+
+/**
+ * @brief 从buddy系统中申请连续num个struct page
  *
  * @param zone_select 选择内存区域, 可选项：dma, mapped in pgt(normal), unmapped in pgt
- * @param num 需要申请的连续内存页的数量 num<64
+ * @param num 需要申请的连续内存页的数量 0<num<=2^(MM_BUDDY_MAX_ORDER-1)
  * @param flags 将页面属性设置成flag
  * @return struct Page*
  */
 struct Page *alloc_pages(unsigned int zone_select, int num, ul flags)
 {
     ul zone_start = 0, zone_end = 0;
-    if (num >= 64 && num <= 0)
+    if (num <= 0 || num > (1 << (MM_BUDDY_MAX_ORDER - 1)))
     {
         kerror("alloc_pages(): num is invalid.");
         return NULL;
@@ -321,49 +489,42 @@ struct Page *alloc_pages(unsigned int zone_select, int num, ul flags)
         break;
     }
 
+    int order = __buddy_order_of(num);
+    uint64_t rflags;
     for (int i = zone_start; i <= zone_end; ++i)
     {
         if ((memory_management_struct.zones_struct + i)->count_pages_free < num)
             continue;
 
         struct Zone *z = memory_management_struct.zones_struct + i;
-        // 区域对应的起止页号
-        ul page_start = (z->zone_addr_start >> PAGE_2M_SHIFT);
-        ul page_end = (z->zone_addr_end >> PAGE_2M_SHIFT);
 
-        ul tmp = 64 - page_start % 64;
-        for (ul j = page_start; j < page_end; j += ((j % 64) ? tmp : 64))
+        spin_lock_irqsave(&z->buddy_lock, rflags);
+        struct Page *page = __buddy_alloc_block(z, order);
+        if (page == NULL)
         {
-            // 按照bmp中的每一个元素进行查找
-            // 先将p定位到bmp的起始元素
-            ul *p = memory_management_struct.bmp + (j >> 6);
+            spin_unlock_irqrestore(&z->buddy_lock, rflags);
+            continue;
+        }
 
-            ul shift = j % 64;
-            ul tmp_num = ((1UL << num) - 1);
-            for (ul k = shift; k < 64; ++k)
-            {
-                // 寻找连续num个空页
-                if (!((k ? ((*p >> k) | (*(p + 1) << (64 - k))) : *p) & tmp_num))
+        // 申请的页数不是2的幂时，将块尾部多余的页还给buddy
+        ul start_idx = page - z->pages_group;
+        if ((1UL << order) > num)
+            __buddy_free_range(z, start_idx + num, (1UL << order) - num);
 
-                {
-                    ul start_page_num = j + k - shift; // 计算得到要开始获取的内存页的页号
-                    for (ul l = 0; l < num; ++l)
-                    {
-                        struct Page *x = memory_management_struct.pages_struct + start_page_num + l;
-
-                        // 分配页面，手动配置属性及计数器
-                        // 置位bmp
-                        *(memory_management_struct.bmp + ((x->addr_phys >> PAGE_2M_SHIFT) >> 6)) |= (1UL << (x->addr_phys >> PAGE_2M_SHIFT) % 64);
-                        ++(z->count_pages_using);
-                        --(z->count_pages_free);
-                        page_init(x, attr);
-                    }
-                    // 成功分配了页面，返回第一个页面的指针
-                    // kwarn("start page num=%d\n", start_page_num);
-                    return (struct Page *)(memory_management_struct.pages_struct + start_page_num);
-                }
-            }
+        for (ul l = 0; l < num; ++l)
+        {
+            struct Page *x = page + l;
+
+            // 分配页面，手动配置属性及计数器
+            // 置位bmp
+            *(memory_management_struct.bmp + ((x->addr_phys >> PAGE_2M_SHIFT) >> 6)) |= (1UL << (x->addr_phys >> PAGE_2M_SHIFT) % 64);
+            ++(z->count_pages_using);
+            --(z->count_pages_free);
+            page_init(x, attr);
         }
+        spin_unlock_irqrestore(&z->buddy_lock, rflags);
+        // 成功分配了页面，返回第一个页面的指针
+        return page;
     }
     kBUG("Cannot alloc page, ZONE=%d\tnums=%d, mm_total_2M_pages=%d", zone_select, num, mm_total_2M_pages);
     return NULL;
@@ -426,12 +587,11 @@ ul set_page_attr(struct Page *page, ul flags)
     }
 }
 /**
- * @brief 释放连续number个内存页
+ * @brief 释放连续number个内存页，并与buddy系统中的伙伴块进行合并
  *
  * @param page 第一个要被释放的页面的结构体
- * @param number 要释放的内存页数量 number<64
+ * @param number 要释放的内存页数量
  */
-
 void free_pages(struct Page *page, int number)
 {
     if (page == NULL)
@@ -440,25 +600,46 @@ void free_pages(struct Page *page, int number)
         return;
     }
 
-    if (number >= 64 || number <= 0)
+    struct Zone *z = page->zone;
+    if (z == NULL || page < z->pages_group || number <= 0 || (page - z->pages_group) + number > z->count_pages)
     {
         kerror("free_pages(): number %d is invalid.", number);
         return;
     }
 
+    uint64_t rflags;
     ul page_num;
-    for (int i = 0; i < number; ++i, ++page)
+    ul idx = page - z->pages_group;
+    ul run_start = idx, run_len = 0;
+
+    spin_lock_irqsave(&z->buddy_lock, rflags);
+    for (int i = 0; i < number; ++i, ++page, ++idx)
     {
         page_num = page->addr_phys >> PAGE_2M_SHIFT;
+        // 页面本来就是空闲的，不能重复释放
+        if (unlikely(!(*(memory_management_struct.bmp + (page_num >> 6)) & (1UL << (page_num % 64)))))
+        {
+            kerror("free_pages(): page %#018lx is already free.", page->addr_phys);
+            if (run_len)
+                __buddy_free_range(z, run_start, run_len);
+            run_len = 0;
+            continue;
+        }
+
         // 复位bmp
         *(memory_management_struct.bmp + (page_num >> 6)) &= ~(1UL << (page_num % 64));
         // 更新计数器
-        --page->zone->count_pages_using;
-        ++page->zone->count_pages_free;
+        --z->count_pages_using;
+        ++z->count_pages_free;
         page->attr = 0;
-    }
 
-    return;
+        if (run_len == 0)
+            run_start = idx;
+        ++run_len;
+    }
+    if (run_len)
+        __buddy_free_range(z, run_start, run_len);
+    spin_unlock_irqrestore(&z->buddy_lock, rflags);
 }
 
 /**
@@ -613,34 +794,18 @@ uint64_t mm_do_brk(uint64_t old_brk_end_addr, int64_t offset)
     {
         for (uint64_t i = old_brk_end_addr; i < end_addr; i += PAGE_2M_SIZE)
         {
+            // 只创建vma，物理页在第一次被访问时才分配
             struct vm_area_struct *vma = NULL;
             mm_create_vma(current_pcb->mm, i, PAGE_2M_SIZE, VM_USER | VM_ACCESS_FLAGS, NULL, &vma);
-            mm_map(current_pcb->mm, i, PAGE_2M_SIZE, alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED)->addr_phys);
-            // mm_map_vma(vma, alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED)->addr_phys, 0, PAGE_2M_SIZE);
         }
         current_pcb->mm->brk_end = end_addr;
     }
     else
     {
 
-        // 释放堆内存
-        for (uint64_t i = end_addr; i < old_brk_end_addr; i += PAGE_2M_SIZE)
-        {
-            uint64_t phys = mm_get_PDE((uint64_t)phys_2_virt((uint64_t)current_pcb->mm->pgd), false, i, true);
-
-            // 找到对应的页
-            struct Page *p = mm_find_page(phys, ZONE_NORMAL);
-            if (p == NULL)
-            {
-                kerror("cannot find page addr=%#018lx", phys);
-                return end_addr;
-            }
-
-            free_pages(p, 1);
-        }
-
-        mm_unmap_proc_table((uint64_t)phys_2_virt((uint64_t)current_pcb->mm->pgd), false, end_addr, PAGE_2M_ALIGN(ABS(offset)));
-        // 在页表中取消映射
+        // 取消映射并释放堆内存（与其他进程共享的页面只会减少其引用计数）
+        mm_unmap(current_pcb->mm, end_addr, old_brk_end_addr - end_addr, true);
+        current_pcb->mm->brk_end = end_addr;
     }
     return end_addr;
 }
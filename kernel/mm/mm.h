@@ -74,6 +74,12 @@
 // 共享的页 shared=1 single-use=0
 #define PAGE_SHARED (1 << 4)
 
+// 页面是buddy系统中某个空闲块的首页 free-block-head=1 other=0
+#define PAGE_BUDDY_FREE (1 << 5)
+
+// 页面已被拆分为4K页框，由4K页框分配器管理 split=1 other=0
+#define PAGE_4K_FRAMES (1 << 6)
+
 // =========== 页表项权限 ========
 
 //	bit 63	Execution Disable:
@@ -157,6 +163,157 @@
                                     \
     } while (0);
 
+/**
+ * @brief 刷新TLB中指定虚拟地址所在的页
+ *
+ */
+#define flush_tlb_one(addr) \
+    __asm__ __volatile__("invlpg (%0)" ::"r"(addr) : "memory")
+
+// ============ TLB管理 ============
+// TLB批量刷新时，逐页刷新的页数上限（超过后改为刷新整个地址空间）
+#define MM_TLB_BATCH_SIZE 32
+// 跨核心刷新TLB的IPI中断向量号
+#define MM_TLB_SHOOTDOWN_IPI_VECTOR 0xc9
+
+/**
+ * @brief TLB批量刷新结构体
+ * 修改页表的一方先将需要刷新的虚拟地址以及需要在刷新之后才能释放的4K页框收集起来，最后调用mm_tlb_batch_flush()统一刷新一次
+ */
+struct mm_tlb_batch_t
+{
+    struct mm_struct *mm;               // 页表被修改的地址空间（为NULL或&initial_mm时，表示修改了内核空间的映射）
+    bool full;                          // 需要刷新整个地址空间
+    uint32_t count;                     // addrs中的地址数量
+    uint32_t nr_frames;                 // frames中的页框数量
+    uint64_t addrs[MM_TLB_BATCH_SIZE];  // 需要刷新的虚拟地址
+    void *frames[MM_TLB_BATCH_SIZE];    // 在TLB刷新之后才能释放的4K页框
+};
+
+/**
+ * @brief 是否启用了PCID
+ *
+ */
+extern bool mm_pcid_enabled;
+
+/**
+ * @brief 初始化TLB管理模块（检测并启用PCID）。在BSP上调用
+ *
+ */
+void mm_tlb_init();
+
+/**
+ * @brief 在AP处理器上启用PCID
+ *
+ */
+void mm_tlb_init_ap();
+
+/**
+ * @brief 初始化新的地址空间的TLB管理信息
+ *
+ * @param mm 新的地址空间
+ */
+void mm_tlb_mm_init(struct mm_struct *mm);
+
+/**
+ * @brief 释放地址空间的PCID（地址空间被销毁前调用）
+ *
+ * @param mm 地址空间
+ */
+void mm_tlb_mm_release(struct mm_struct *mm);
+
+/**
+ * @brief 将当前cpu切换到指定的地址空间。若该地址空间在当前cpu上的TLB缓存仍然有效，则不刷新TLB
+ *
+ * @param next 要切换到的地址空间
+ */
+void mm_switch_mm(struct mm_struct *next);
+
+/**
+ * @brief 刷新当前cpu上所有PCID的TLB（用于内核空间映射发生变化时）
+ *
+ */
+void flush_tlb_all();
+
+/**
+ * @brief 初始化TLB批量刷新结构体
+ *
+ * @param batch 批量刷新结构体
+ * @param mm 页表将被修改的地址空间
+ */
+static inline void mm_tlb_batch_init(struct mm_tlb_batch_t *batch, struct mm_struct *mm)
+{
+    batch->mm = mm;
+    batch->full = false;
+    batch->count = 0;
+    batch->nr_frames = 0;
+}
+
+/**
+ * @brief 将需要刷新的虚拟地址加入批量刷新结构体（2M页只需要加入一次）
+ *
+ * @param batch 批量刷新结构体
+ * @param vaddr 虚拟地址
+ */
+static inline void mm_tlb_batch_add(struct mm_tlb_batch_t *batch, uint64_t vaddr)
+{
+    if (batch->full)
+        return;
+    if (batch->count == MM_TLB_BATCH_SIZE)
+        batch->full = true;
+    else
+        batch->addrs[batch->count++] = vaddr;
+}
+
+/**
+ * @brief 刷新批量刷新结构体中收集的地址（包括其他正在使用该地址空间的cpu），然后释放收集的页框
+ *
+ * @param batch 批量刷新结构体
+ */
+void mm_tlb_batch_flush(struct mm_tlb_batch_t *batch);
+
+/**
+ * @brief 将在TLB刷新之后才能释放的4K页框加入批量刷新结构体（结构体已满时会先进行一次刷新）
+ *
+ * @param batch 批量刷新结构体
+ * @param frame 页框的虚拟地址
+ */
+void mm_tlb_batch_add_frame(struct mm_tlb_batch_t *batch, void *frame);
+
+/**
+ * @brief 刷新地址空间中一段虚拟地址在所有cpu上的TLB
+ *
+ * @param mm 地址空间
+ * @param vaddr 起始虚拟地址
+ * @param length 长度（字节）
+ */
+void mm_tlb_flush_range(struct mm_struct *mm, uint64_t vaddr, uint64_t length);
+
+/**
+ * @brief 刷新整个地址空间在所有cpu上的TLB
+ *
+ * @param mm 地址空间
+ */
+void mm_tlb_flush_mm(struct mm_struct *mm);
+
+/**
+ * @brief 跨核心刷新TLB的IPI处理函数
+ *
+ */
+void mm_tlb_shootdown_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs);
+
+// =========== 缺页异常的错误码 ========
+// 0:页面不存在 1:页面存在（访问权限不足）
+#define PF_ERR_PRESENT (1UL << 0)
+// 0:读取 1:写入
+#define PF_ERR_WRITE (1UL << 1)
+// 0:内核态 1:用户态
+#define PF_ERR_USER (1UL << 2)
+// 页表项的保留位被置位
+#define PF_ERR_RSVD (1UL << 3)
+// 取指令时发生的异常
+#define PF_ERR_INSTR (1UL << 4)
+
 /**
  * @brief 系统内存信息结构体（单位：字节）
  *
@@ -170,8 +327,30 @@ struct mm_stat_t
     uint64_t cache_used; // 位于slab缓冲区中的已使用的内存大小
     uint64_t cache_free; // 位于slab缓冲区中的空闲的内存大小
     uint64_t available;  // 系统总空闲内存大小（包括kmalloc缓冲区）
+    uint64_t free_blocks[MM_BUDDY_MAX_ORDER]; // buddy系统中每一阶的空闲块数量（用于观察碎片化程度）
+    uint64_t frame_total; // 4K页框分配器占用的内存大小
+    uint64_t frame_used;  // 4K页框分配器中已分配的内存大小
+    uint64_t huge_mapped;  // 用户地址空间中以2M页映射的内存大小
+    uint64_t thp_promoted; // 由4K页框合并为2M页的次数
+    uint64_t thp_fallback; // 满足2M对齐却只能使用4K页框映射的次数
+    uint64_t bcache_used;   // 块设备缓冲区缓存占用的内存大小
+    uint64_t bcache_dirty;  // 块设备缓冲区缓存中尚未写回的数据大小
+    uint64_t bcache_hits;   // 块设备缓冲区缓存的命中次数
+    uint64_t bcache_misses; // 块设备缓冲区缓存的未命中次数
 };
 
+/**
+ * @brief 透明大页的统计信息
+ *
+ */
+struct mm_thp_stat_t
+{
+    atomic_t mapped;   // 用户地址空间中以2M页映射的内存大小（字节）
+    atomic_t promoted; // 由4K页框合并为2M页的次数
+    atomic_t fallback; // 满足2M对齐却只能使用4K页框映射的次数
+};
+extern struct mm_thp_stat_t mm_thp_stat;
+
 /**
  * @brief 虚拟内存区域的操作方法的结构体
  *
@@ -188,8 +367,19 @@ struct vm_operations_t
      *
      */
     void (*close)(struct vm_area_struct *area);
+    /**
+     * @brief 访问vma中尚未映射物理页的地址时，将会调用该回调函数来填充页面
+     * 返回值：0 => 次要缺页(无需I/O)，VM_FAULT_MAJOR => 主要缺页(需要从设备读取数据)，负数 => 错误码
+     */
+    int (*fault)(struct vm_area_struct *area, uint64_t vaddr);
 };
 
+// 缺页处理需要从设备中读取数据（主要缺页）
+#define VM_FAULT_MAJOR 1
+
+// 由文件内容填充的vma的操作方法
+extern struct vm_operations_t mm_file_vm_ops;
+
 extern struct memory_desc memory_management_struct;
 
 // 导出内核程序的几个段的起止地址
@@ -238,10 +428,10 @@ unsigned long *get_CR3()
 }
 
 /**
- * @brief 从已初始化的页结构中搜索符合申请条件的、连续num个struct page
+ * @brief 从buddy系统中申请连续num个struct page
  *
  * @param zone_select 选择内存区域, 可选项：dma, mapped in pgt(normal), unmapped in pgt
- * @param num 需要申请的内存页的数量 num<64
+ * @param num 需要申请的内存页的数量 0<num<=2^(MM_BUDDY_MAX_ORDER-1)
  * @param flags 将页面属性设置成flag
  * @return struct Page*
  */
@@ -256,13 +446,70 @@ struct Page *alloc_pages(unsigned int zone_select, int num, ul flags);
 unsigned long page_clean(struct Page *page);
 
 /**
- * @brief 释放连续number个内存页
+ * @brief 释放连续number个内存页，并与buddy系统中的伙伴块进行合并
  *
  * @param page 第一个要被释放的页面的结构体
- * @param number 要释放的内存页数量 number<64
+ * @param number 要释放的内存页数量
  */
 void free_pages(struct Page *page, int number);
 
+/**
+ * @brief 初始化4K页框分配器
+ *
+ */
+void frame_4k_init();
+
+/**
+ * @brief 申请count个连续的4K页框（页框来自被拆分的2M页，适用于页表、小块的用户内存映射及DMA缓冲区）
+ *
+ * @param count 页框数量 0<count<=512
+ * @param zero 是否将页框清零
+ * @return void* 页框的起始虚拟地址。申请失败时返回NULL
+ */
+void *alloc_4k_frames(uint32_t count, bool zero);
+
+/**
+ * @brief 释放count个连续的4K页框（可以只释放alloc_4k_frames()申请到的页框中的一部分）
+ *
+ * @param vaddr 要释放的第一个页框的虚拟地址（位于某次alloc_4k_frames()申请到的范围之内，4K对齐）
+ * @param count 页框数量（不能超出申请到的范围）
+ */
+void free_4k_frames(void *vaddr, uint32_t count);
+
+/**
+ * @brief 增加页框的共享者（共享者调用free_4k_frames()时只会减少共享计数）
+ *
+ * @param vaddr 页框的虚拟地址
+ * @return int 错误码
+ */
+int frame_4k_share(void *vaddr);
+
+/**
+ * @brief 判断页框是否正在被多个使用者共享
+ *
+ * @param vaddr 页框的虚拟地址
+ * @return true 正在被共享
+ * @return false 只有一个使用者
+ */
+bool frame_4k_shared(void *vaddr);
+
+/**
+ * @brief 判断虚拟地址是否属于4K页框分配器
+ *
+ * @param vaddr 虚拟地址
+ * @return true 属于
+ * @return false 不属于
+ */
+bool is_4k_frame(void *vaddr);
+
+/**
+ * @brief 获取4K页框分配器的统计信息
+ *
+ * @param total 返回的页框总数
+ * @param using 返回的已分配的页框数量
+ */
+void frame_4k_stat(uint64_t *total, uint64_t *using);
+
 /**
  * @brief Get the page's attr
  *
@@ -543,4 +790,24 @@ struct mm_stat_t mm_stat();
  * @return true 已经被映射
  * @return false
  */
-bool mm_check_mapped(ul page_table_phys_addr, uint64_t virt_addr);
\ No newline at end of file
+bool mm_check_mapped(ul page_table_phys_addr, uint64_t virt_addr);
+
+/**
+ * @brief 将父进程的vma以写时复制的方式拷贝到新的地址空间中
+ * (调用者需要在拷贝完成后刷新当前地址空间的TLB)
+ *
+ * @param dst_mm 新的地址空间
+ * @param vma 父进程的vma
+ * @return int 错误码。vma不支持写时复制时返回-EOPNOTSUPP，此时调用者应直接拷贝内存
+ */
+int mm_cow_copy_vma(struct mm_struct *dst_mm, struct vm_area_struct *vma);
+
+/**
+ * @brief 处理用户地址空间中的缺页异常
+ *
+ * @param regs 异常发生时的寄存器
+ * @param error_code 缺页异常的错误码
+ * @param vaddr 触发异常的虚拟地址
+ * @return int 成功处理时返回0，否则说明这是一次非法的访问
+ */
+int mm_do_page_fault(struct pt_regs *regs, uint64_t error_code, uint64_t vaddr);
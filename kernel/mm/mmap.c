@@ -102,8 +102,7 @@ int mm_map_proc_page_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_s
         // 创建新的二级页表
         if (*pml4e_ptr == 0)
         {
-            ul *virt_addr = kmalloc(PAGE_4K_SIZE, 0);
-            memset(virt_addr, 0, PAGE_4K_SIZE);
+            ul *virt_addr = alloc_4k_frames(1, true);
             set_pml4t(pml4e_ptr, mk_pml4t(virt_2_phys(virt_addr), (user ? PAGE_USER_PGT : PAGE_KERNEL_PGT)));
         }
 
@@ -119,8 +118,7 @@ int mm_map_proc_page_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_s
             // 创建新的三级页表
             if (*pdpte_ptr == 0)
             {
-                ul *virt_addr = kmalloc(PAGE_4K_SIZE, 0);
-                memset(virt_addr, 0, PAGE_4K_SIZE);
+                ul *virt_addr = alloc_4k_frames(1, true);
                 set_pdpt(pdpte_ptr, mk_pdpt(virt_2_phys(virt_addr), (user ? PAGE_USER_DIR : PAGE_KERNEL_DIR)));
             }
 
@@ -140,8 +138,7 @@ int mm_map_proc_page_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_s
                     if (*pde_ptr == 0)
                     {
                         // 创建四级页表
-                        uint64_t *vaddr = kmalloc(PAGE_4K_SIZE, 0);
-                        memset(vaddr, 0, PAGE_4K_SIZE);
+                        uint64_t *vaddr = alloc_4k_frames(1, true);
                         set_pdt(pde_ptr, mk_pdt(virt_2_phys(vaddr), (user ? PAGE_USER_PDE : PAGE_KERNEL_PDE)));
                     }
                     else if (unlikely(*pde_ptr & (1 << 7)))
@@ -185,7 +182,7 @@ int mm_map_proc_page_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_s
         }
     }
     if (likely(flush))
-        flush_tlb();
+        flush_tlb_all();
     return 0;
 failed:;
     kerror("Map memory failed. use4k=%d, vaddr=%#018lx, paddr=%#018lx", use4k, virt_addr_start, phys_addr_start);
@@ -193,99 +190,105 @@ failed:;
 }
 
 /**
- * @brief 从页表中清除虚拟地址的映射
+ * @brief 释放页表所占用的4K页
+ * (页表由4K页框分配器分配，但在其初始化之前创建的页表来自kmalloc)
+ * 页框在TLB刷新之后才会被释放，避免其他cpu的分页结构缓存仍在使用它们
  *
- * @param proc_page_table_addr 页表的地址
- * @param is_phys 页表地址是否为物理地址
- * @param virt_addr_start 要清除的虚拟地址的起始地址
- * @param length 要清除的区域的长度
+ * @param table 页表的虚拟地址
+ * @param batch TLB批量刷新结构体
  */
-void mm_unmap_proc_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_start, ul length)
+static __always_inline void __mm_free_page_table(void *table, struct mm_tlb_batch_t *batch)
 {
-
-    // 计算线性地址对应的pml4页表项的地址
-    mm_pgt_entry_num_t pgt_num;
-    mm_calculate_entry_num(length, &pgt_num);
-    // 已取消映射的内存大小
-    uint64_t length_unmapped = 0;
-
-    uint64_t pml4e_id = ((virt_addr_start >> PAGE_GDT_SHIFT) & 0x1ff);
-    uint64_t *pml4_ptr;
-    if (is_phys)
-        pml4_ptr = phys_2_virt((ul *)((ul)proc_page_table_addr & (~0xfffUL)));
+    if (likely(is_4k_frame(table)))
+        mm_tlb_batch_add_frame(batch, table);
     else
-        pml4_ptr = (ul *)((ul)proc_page_table_addr & (~0xfffUL));
+        kfree(table);
+}
 
-    // 循环填写顶层页表
-    for (; (pgt_num.num_PML4E > 0) && pml4e_id < 512; ++pml4e_id)
-    {
-        // 剩余需要处理的pml4E -1
-        --(pgt_num.num_PML4E);
+/**
+ * @brief 计算下一个按size对齐的地址（不超过end）
+ *
+ */
+static __always_inline uint64_t __mm_next_boundary(uint64_t vaddr, uint64_t size, uint64_t end)
+{
+    uint64_t next = (vaddr | (size - 1)) + 1;
+    return (next == 0 || next > end) ? end : next;
+}
 
-        ul *pml4e_ptr = NULL;
-        pml4e_ptr = pml4_ptr + pml4e_id;
+/**
+ * @brief 从页表中清除虚拟地址的映射，并将需要刷新的地址收集到batch中
+ *
+ * @param pml4_ptr 顶层页表的虚拟地址
+ * @param virt_addr_start 要清除的虚拟地址的起始地址
+ * @param length 要清除的区域的长度
+ * @param batch TLB批量刷新结构体
+ */
+static void __mm_unmap_proc_table(uint64_t *pml4_ptr, uint64_t virt_addr_start, uint64_t length, struct mm_tlb_batch_t *batch)
+{
+    uint64_t vaddr = virt_addr_start;
+    uint64_t end = virt_addr_start + length;
 
+    // 循环处理顶层页表
+    while (vaddr < end)
+    {
+        uint64_t *pml4e_ptr = pml4_ptr + ((vaddr >> PAGE_GDT_SHIFT) & 0x1ff);
+        uint64_t pml4e_end = __mm_next_boundary(vaddr, 1UL << PAGE_GDT_SHIFT, end);
         // 二级页表不存在
         if (*pml4e_ptr == 0)
         {
+            vaddr = pml4e_end;
             continue;
         }
-
-        uint64_t pdpte_id = (((virt_addr_start + length_unmapped) >> PAGE_1G_SHIFT) & 0x1ff);
         uint64_t *pdpt_ptr = (uint64_t *)phys_2_virt(*pml4e_ptr & (~0xfffUL));
-        // kdebug("pdpt_ptr=%#018lx", pdpt_ptr);
 
         // 循环处理二级页表
-        for (; (pgt_num.num_PDPTE > 0) && pdpte_id < 512; ++pdpte_id)
+        while (vaddr < pml4e_end)
         {
-            --pgt_num.num_PDPTE;
-            uint64_t *pdpte_ptr = (pdpt_ptr + pdpte_id);
-            // kdebug("pgt_num.num_PDPTE=%ld pdpte_ptr=%#018lx", pgt_num.num_PDPTE, pdpte_ptr);
-
+            uint64_t *pdpte_ptr = pdpt_ptr + ((vaddr >> PAGE_1G_SHIFT) & 0x1ff);
+            uint64_t pdpte_end = __mm_next_boundary(vaddr, PAGE_1G_SIZE, pml4e_end);
             // 三级页表为空
             if (*pdpte_ptr == 0)
             {
+                vaddr = pdpte_end;
                 continue;
             }
-
-            uint64_t pde_id = (((virt_addr_start + length_unmapped) >> PAGE_2M_SHIFT) & 0x1ff);
             uint64_t *pd_ptr = (uint64_t *)phys_2_virt(*pdpte_ptr & (~0xfffUL));
-            // kdebug("pd_ptr=%#018lx, *pd_ptr=%#018lx", pd_ptr, *pd_ptr);
 
             // 循环处理三级页表
-            for (; (pgt_num.num_PDE > 0) && pde_id < 512; ++pde_id)
+            while (vaddr < pdpte_end)
             {
-                --pgt_num.num_PDE;
-                // 计算当前2M物理页对应的pdt的页表项的物理地址
-                ul *pde_ptr = pd_ptr + pde_id;
+                uint64_t *pde_ptr = pd_ptr + ((vaddr >> PAGE_2M_SHIFT) & 0x1ff);
+                uint64_t pde_end = __mm_next_boundary(vaddr, PAGE_2M_SIZE, pdpte_end);
+                if (*pde_ptr == 0)
+                {
+                    vaddr = pde_end;
+                    continue;
+                }
 
-                // 存在4级页表
-                if (((*pde_ptr) & (1 << 7)) == 0)
+                // 2M页
+                if (*pde_ptr & PAGE_PS)
                 {
-                    // 存在4K页
-                    uint64_t pte_id = (((virt_addr_start + length_unmapped) >> PAGE_4K_SHIFT) & 0x1ff);
-                    uint64_t *pt_ptr = (uint64_t *)phys_2_virt(*pde_ptr & (~0xfffUL));
-                    // 循环处理4K页表
-                    for (; pgt_num.num_PTE > 0 && pte_id < 512; ++pte_id)
-                    {
-                        uint64_t *pte_ptr = pt_ptr + pte_id;
-                        --pgt_num.num_PTE;
-                        *pte_ptr = 0;
-                        length_unmapped += PAGE_4K_SIZE;
-                    }
+                    *pde_ptr = 0;
+                    mm_tlb_batch_add(batch, vaddr);
+                    vaddr = pde_end;
+                    continue;
+                }
 
-                    // 4级页表已经空了，释放页表
-                    if (unlikely(mm_check_page_table(pt_ptr)) == 0)
-                    {
-                        *pde_ptr = 0;
-                        kfree(pt_ptr);
-                    }
+                // 循环处理4K页表
+                uint64_t *pt_ptr = (uint64_t *)phys_2_virt(*pde_ptr & (~0xfffUL));
+                for (; vaddr < pde_end; vaddr += PAGE_4K_SIZE)
+                {
+                    uint64_t *pte_ptr = pt_ptr + ((vaddr >> PAGE_4K_SHIFT) & 0x1ff);
+                    if (*pte_ptr & PAGE_PRESENT)
+                        mm_tlb_batch_add(batch, vaddr);
+                    *pte_ptr = 0;
                 }
-                else
+
+                // 4级页表已经空了，释放页表
+                if (unlikely(mm_check_page_table(pt_ptr)) == 0)
                 {
                     *pde_ptr = 0;
-                    length_unmapped += PAGE_2M_SIZE;
-                    pgt_num.num_PTE -= 512;
+                    __mm_free_page_table(pt_ptr, batch);
                 }
             }
 
@@ -293,17 +296,39 @@ void mm_unmap_proc_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_sta
             if (unlikely(mm_check_page_table(pd_ptr)) == 0)
             {
                 *pdpte_ptr = 0;
-                kfree(pd_ptr);
+                __mm_free_page_table(pd_ptr, batch);
             }
         }
-        // 2级页表已经空了，释放页表
-        if (unlikely(mm_check_page_table(pdpt_ptr)) == 0)
+        // 2级页表已经空了，释放页表（内核空间的2级页表被所有进程的顶层页表共享，不能释放）
+        if (unlikely(mm_check_page_table(pdpt_ptr)) == 0 && pml4e_ptr < pml4_ptr + 256)
         {
             *pml4e_ptr = 0;
-            kfree(pdpt_ptr);
+            __mm_free_page_table(pdpt_ptr, batch);
         }
     }
-    flush_tlb();
+}
+
+/**
+ * @brief 从页表中清除虚拟地址的映射
+ *
+ * @param proc_page_table_addr 页表的地址
+ * @param is_phys 页表地址是否为物理地址
+ * @param virt_addr_start 要清除的虚拟地址的起始地址
+ * @param length 要清除的区域的长度
+ */
+void mm_unmap_proc_table(ul proc_page_table_addr, bool is_phys, ul virt_addr_start, ul length)
+{
+    uint64_t *pml4_ptr;
+    if (is_phys)
+        pml4_ptr = phys_2_virt((ul *)((ul)proc_page_table_addr & (~0xfffUL)));
+    else
+        pml4_ptr = (ul *)((ul)proc_page_table_addr & (~0xfffUL));
+
+    // 不知道页表属于哪个地址空间，按照内核空间的方式在所有cpu上刷新
+    struct mm_tlb_batch_t batch;
+    mm_tlb_batch_init(&batch, NULL);
+    __mm_unmap_proc_table(pml4_ptr, virt_addr_start, length, &batch);
+    mm_tlb_batch_flush(&batch);
 }
 
 /**
@@ -428,11 +453,14 @@ int mm_map_vma(struct vm_area_struct *vma, uint64_t paddr, uint64_t offset, uint
         else
             page_flags |= PAGE_KERNEL_PAGE;
         // 这里直接设置user标志位为false，因为该函数内部会对其进行自动校正
-        retval = mm_map_proc_page_table((uint64_t)vma->vm_mm->pgd, true, vma->vm_start + offset + mapped, paddr + mapped, len_2m, page_flags, false, false, false);
+        retval = mm_map_proc_page_table((uint64_t)vma->vm_mm->pgd, true, vma->vm_start + offset + mapped, paddr + mapped, len_2m * PAGE_2M_SIZE, page_flags, false, false, false);
 
         if (unlikely(retval != 0))
             goto failed;
-        mapped += len_2m;
+        mapped += len_2m * PAGE_2M_SIZE;
+        // 统计用户地址空间中以2M页映射的内存
+        if ((vma->vm_flags & (VM_USER | VM_IO)) == VM_USER)
+            atomic_add(&mm_thp_stat.mapped, len_2m * PAGE_2M_SIZE);
     }
     // 最后再使用4K页填补
     if (likely(len_4k > 0))
@@ -454,7 +482,7 @@ int mm_map_vma(struct vm_area_struct *vma, uint64_t paddr, uint64_t offset, uint
     if (vma->vm_flags & VM_IO)
         vma->page_offset = 0;
 
-    flush_tlb();
+    mm_tlb_flush_range(vma->vm_mm, vma->vm_start + offset, mapped);
     return 0;
 failed:;
     kdebug("map VMA failed.");
@@ -505,6 +533,41 @@ failed:;
     return retval;
 }
 
+/**
+ * @brief 取消vma中来自4K页框分配器的页框的映射，并在TLB刷新后释放它们（被共享的页框只减少其共享计数）。
+ * 同时统计被取消映射的用户2M页
+ *
+ * @param mm 内存空间分布结构体
+ * @param vma 虚拟内存区域
+ * @param batch TLB批量刷新结构体
+ */
+static void __mm_release_4k_frames(struct mm_struct *mm, struct vm_area_struct *vma, struct mm_tlb_batch_t *batch)
+{
+    for (uint64_t vaddr = vma->vm_start; vaddr < vma->vm_end;)
+    {
+        bool is_2m;
+        uint64_t *pte = __mm_get_pte(mm, vaddr, &is_2m);
+        if (pte == NULL || is_2m) // 跳过未映射的区域以及2M页
+        {
+            if (is_2m && (*pte & PAGE_PRESENT) && (vma->vm_flags & VM_USER))
+                atomic_sub(&mm_thp_stat.mapped, PAGE_2M_SIZE);
+            vaddr = PAGE_2M_ALIGN(vaddr + 1);
+            continue;
+        }
+        if (*pte & PAGE_PRESENT)
+        {
+            void *frame = phys_2_virt(*pte & PAGE_4K_MASK & (~PAGE_XD));
+            if (is_4k_frame(frame))
+            {
+                *pte = 0;
+                mm_tlb_batch_add(batch, vaddr);
+                mm_tlb_batch_add_frame(batch, frame);
+            }
+        }
+        vaddr += PAGE_4K_SIZE;
+    }
+}
+
 /**
  * @brief 在页表中取消指定的vma的映射
  *
@@ -521,11 +584,25 @@ int mm_unmap_vma(struct mm_struct *mm, struct vm_area_struct *vma, uint64_t *pad
     struct anon_vma_t *anon = vma->anon_vma;
     if (paddr != NULL)
         *paddr = __mm_get_paddr(mm, vma->vm_start);
-    if (anon == NULL)
-        kwarn("anon is NULL");
+
+    struct mm_tlb_batch_t batch;
+    mm_tlb_batch_init(&batch, mm);
+
+    // 释放vma中映射的4K页框（2M页由anon_vma负责释放）
+    if (!(vma->vm_flags & VM_IO))
+        __mm_release_4k_frames(mm, vma, &batch);
+
+    if (anon == NULL) // vma还没有映射过物理页
+    {
+        __mm_unmap_proc_table(phys_2_virt(mm->pgd), vma->vm_start, vma->vm_end - vma->vm_start, &batch);
+        mm_tlb_batch_flush(&batch);
+        return 0;
+    }
     semaphore_down(&anon->sem);
 
-    mm_unmap_proc_table((uint64_t)mm->pgd, true, vma->vm_start, vma->vm_end - vma->vm_start);
+    __mm_unmap_proc_table(phys_2_virt(mm->pgd), vma->vm_start, vma->vm_end - vma->vm_start, &batch);
+    // 先刷新TLB，再释放物理页
+    mm_tlb_batch_flush(&batch);
     __anon_vma_del(vma);
     /** todo: 这里应该会存在bug，应修复。
      * 若anon_vma的等待队列上有其他的进程，由于anon_vma被释放
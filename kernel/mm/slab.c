@@ -21,6 +21,96 @@ struct slab kmalloc_cache_group[16] =
         {1048576, 0, 0, NULL, NULL, NULL, NULL}, // 1MB
 };
 
+// 每个cpu上，前SLAB_MAGAZINE_CLASSES个kmalloc内存池的对象缓存
+static struct slab_magazine kmalloc_magazines[MAX_CPU_NUM][SLAB_MAGAZINE_CLASSES];
+
+/**
+ * @brief 通过内存对象所在的物理页，获取管理它的kmalloc内存池以及slab_obj
+ *
+ * @param address 内存对象的地址
+ * @param index 返回的内存池下标
+ * @return struct slab_obj* 管理该地址的slab_obj。地址不属于kmalloc时返回NULL
+ */
+static __always_inline struct slab_obj *__kmalloc_get_slab_obj(void *address, int *index)
+{
+    // 只有内核线性映射区内的地址才可能是kmalloc分配的
+    if (unlikely((ul)address < PAGE_OFFSET || (virt_2_phys(address) >> PAGE_2M_SHIFT) >= memory_management_struct.count_pages))
+        return NULL;
+
+    struct Page *page = Virt_To_2M_Page(address);
+    if (unlikely(page->slab_obj == NULL))
+        return NULL;
+
+    *index = page->slab_cache - kmalloc_cache_group;
+    return page->slab_obj;
+}
+
+/**
+ * @brief 在物理页结构体中记录管理它的kmalloc内存池及slab_obj
+ *
+ * @param slab_obj_ptr slab_obj
+ * @param index 内存池下标
+ */
+static __always_inline void __kmalloc_bind_page(struct slab_obj *slab_obj_ptr, int index)
+{
+    slab_obj_ptr->page->slab_cache = &kmalloc_cache_group[index];
+    slab_obj_ptr->page->slab_obj = slab_obj_ptr;
+}
+
+/**
+ * @brief 清除物理页结构体中记录的kmalloc内存池及slab_obj
+ *
+ * @param slab_obj_ptr slab_obj
+ */
+static __always_inline void __kmalloc_unbind_page(struct slab_obj *slab_obj_ptr)
+{
+    slab_obj_ptr->page->slab_cache = NULL;
+    slab_obj_ptr->page->slab_obj = NULL;
+}
+
+/**
+ * @brief 在slab_obj的位图中查找并占用一个空闲的内存对象
+ * 从hint指向的位图字开始，对取反后的字使用bsf找到第一个为0的位（hint之前的字都已被占满）
+ *
+ * @param slab_obj_ptr slab_obj
+ * @return int 内存对象的序号。没有空闲对象时返回-1
+ */
+static __always_inline int __slab_obj_take_free(struct slab_obj *slab_obj_ptr)
+{
+    ul words = (slab_obj_ptr->bmp_count + 63) >> 6;
+    for (ul w = slab_obj_ptr->hint; w < words; ++w)
+    {
+        ul inv = ~(*(slab_obj_ptr->bmp + w));
+        // 当前bmp对应的内存对象都已经被分配
+        if (inv == 0)
+            continue;
+
+        ul i = (w << 6) + __builtin_ctzl(inv);
+        // 位图末尾不存在对应内存对象的位
+        if (unlikely(i >= slab_obj_ptr->bmp_count))
+            break;
+
+        *(slab_obj_ptr->bmp + w) |= (1UL << (i & 63));
+        slab_obj_ptr->hint = w;
+        return i;
+    }
+    slab_obj_ptr->hint = words;
+    return -1;
+}
+
+/**
+ * @brief 在slab_obj的位图中复位指定内存对象对应的位，并回退hint
+ *
+ * @param slab_obj_ptr slab_obj
+ * @param index 内存对象的序号
+ */
+static __always_inline void __slab_obj_put_free(struct slab_obj *slab_obj_ptr, int index)
+{
+    *(slab_obj_ptr->bmp + (index >> 6)) &= ~(1UL << (index & 63));
+    if ((index >> 6) < slab_obj_ptr->hint)
+        slab_obj_ptr->hint = index >> 6;
+}
+
 /**
  * @brief 创建一个内存池
  *
@@ -217,48 +307,30 @@ void *slab_malloc(struct slab *slab_pool, ul arg)
     }
 
     // 扩容完毕或无需扩容，开始分配内存对象
-    int tmp_md;
+    int obj_index;
     do
     {
-        if (slab_obj_ptr->count_free == 0)
+        if (slab_obj_ptr->count_free == 0 || (obj_index = __slab_obj_take_free(slab_obj_ptr)) < 0)
         {
             slab_obj_ptr = container_of(list_next(&slab_obj_ptr->list), struct slab_obj, list);
             continue;
         }
 
-        for (int i = 0; i < slab_obj_ptr->bmp_count; ++i)
+        // 更新当前slab对象的计数器
+        ++(slab_obj_ptr->count_using);
+        --(slab_obj_ptr->count_free);
+        // 更新slab内存池的计数器
+        ++(slab_pool->count_total_using);
+        --(slab_pool->count_total_free);
+
+        if (slab_pool->constructor != NULL)
         {
-            // 当前bmp对应的内存对象都已经被分配
-            if (*(slab_obj_ptr->bmp + (i >> 6)) == 0xffffffffffffffffUL)
-            {
-                i += 63;
-                continue;
-            }
-
-            // 第i个内存对象是空闲的
-            tmp_md = i % 64;
-            if ((*(slab_obj_ptr->bmp + (i >> 6)) & (1UL << tmp_md)) == 0)
-            {
-                // 置位bmp
-                *(slab_obj_ptr->bmp + (i >> 6)) |= (1UL << tmp_md);
-
-                // 更新当前slab对象的计数器
-                ++(slab_obj_ptr->count_using);
-                --(slab_obj_ptr->count_free);
-                // 更新slab内存池的计数器
-                ++(slab_pool->count_total_using);
-                --(slab_pool->count_total_free);
-
-                if (slab_pool->constructor != NULL)
-                {
-                    // 返回内存对象指针（要求构造函数返回内存对象指针）
-                    return slab_pool->constructor((char *)slab_obj_ptr->vaddr + slab_pool->size * i, arg);
-                }
-                // 返回内存对象指针
-                else
-                    return (void *)((char *)slab_obj_ptr->vaddr + slab_pool->size * i);
-            }
+            // 返回内存对象指针（要求构造函数返回内存对象指针）
+            return slab_pool->constructor((char *)slab_obj_ptr->vaddr + slab_pool->size * obj_index, arg);
         }
+        // 返回内存对象指针
+        else
+            return (void *)((char *)slab_obj_ptr->vaddr + slab_pool->size * obj_index);
 
     } while (slab_obj_ptr != slab_pool->cache_pool_entry);
 
@@ -293,42 +365,40 @@ ul slab_free(struct slab *slab_pool, void *addr, ul arg)
     do
     {
         // 虚拟地址不在当前内存池对象的管理范围内
-        if (!(slab_obj_ptr->vaddr <= addr && addr <= (slab_obj_ptr->vaddr + PAGE_2M_SIZE)))
+        if (!(slab_obj_ptr->vaddr <= addr && addr < (slab_obj_ptr->vaddr + PAGE_2M_SIZE)))
         {
             slab_obj_ptr = container_of(list_next(&slab_obj_ptr->list), struct slab_obj, list);
+            continue;
         }
-        else
-        {
 
-            // 计算出给定内存对象是第几个
-            int index = (addr - slab_obj_ptr->vaddr) / slab_pool->size;
+        // 计算出给定内存对象是第几个
+        int index = (addr - slab_obj_ptr->vaddr) / slab_pool->size;
 
-            // 复位位图中对应的位
-            *(slab_obj_ptr->bmp + (index >> 6)) ^= (1UL << index % 64);
+        // 复位位图中对应的位
+        __slab_obj_put_free(slab_obj_ptr, index);
 
-            ++(slab_obj_ptr->count_free);
-            --(slab_obj_ptr->count_using);
+        ++(slab_obj_ptr->count_free);
+        --(slab_obj_ptr->count_using);
 
-            ++(slab_pool->count_total_free);
-            --(slab_pool->count_total_using);
+        ++(slab_pool->count_total_free);
+        --(slab_pool->count_total_using);
 
-            // 有对应的析构函数，调用析构函数
-            if (slab_pool->destructor != NULL)
-                slab_pool->destructor((char *)slab_obj_ptr->vaddr + slab_pool->size * index, arg);
+        // 有对应的析构函数，调用析构函数
+        if (slab_pool->destructor != NULL)
+            slab_pool->destructor((char *)slab_obj_ptr->vaddr + slab_pool->size * index, arg);
 
-            // 当前内存对象池的正在使用的内存对象为0，且内存池的空闲对象大于当前对象池的2倍，则销毁当前对象池，以减轻系统内存压力
-            if ((slab_obj_ptr->count_using == 0) && ((slab_pool->count_total_free >> 1) >= slab_obj_ptr->count_free) && (slab_obj_ptr != slab_pool->cache_pool_entry))
-            {
+        // 当前内存对象池的正在使用的内存对象为0，且内存池的空闲对象大于当前对象池的2倍，则销毁当前对象池，以减轻系统内存压力
+        if ((slab_obj_ptr->count_using == 0) && ((slab_pool->count_total_free >> 1) >= slab_obj_ptr->count_free) && (slab_obj_ptr != slab_pool->cache_pool_entry))
+        {
 
-                list_del(&slab_obj_ptr->list);
-                slab_pool->count_total_free -= slab_obj_ptr->count_free;
+            list_del(&slab_obj_ptr->list);
+            slab_pool->count_total_free -= slab_obj_ptr->count_free;
 
-                kfree(slab_obj_ptr->bmp);
-                page_clean(slab_obj_ptr->page);
-                free_pages(slab_obj_ptr->page, 1);
+            kfree(slab_obj_ptr->bmp);
+            page_clean(slab_obj_ptr->page);
+            free_pages(slab_obj_ptr->page, 1);
 
-                kfree(slab_obj_ptr);
-            }
+            kfree(slab_obj_ptr);
         }
 
         return 0;
@@ -364,6 +434,7 @@ ul slab_init()
         kmalloc_cache_group[i].cache_pool_entry->count_free = PAGE_2M_SIZE / kmalloc_cache_group[i].size;
         kmalloc_cache_group[i].cache_pool_entry->bmp_len = (((kmalloc_cache_group[i].cache_pool_entry->count_free + sizeof(ul) * 8 - 1) >> 6) << 3);
         kmalloc_cache_group[i].cache_pool_entry->bmp_count = kmalloc_cache_group[i].cache_pool_entry->count_free;
+        kmalloc_cache_group[i].cache_pool_entry->hint = 0;
 
         // 在slab对象后方放置bmp
         kmalloc_cache_group[i].cache_pool_entry->bmp = (ul *)memory_management_struct.end_of_struct;
@@ -419,6 +490,7 @@ ul slab_init()
         page_init(page, PAGE_PGT_MAPPED | PAGE_KERNEL | PAGE_KERNEL_INIT);
 
         kmalloc_cache_group[i].cache_pool_entry->page = page;
+        __kmalloc_bind_page(kmalloc_cache_group[i].cache_pool_entry, i);
 
         kmalloc_cache_group[i].cache_pool_entry->vaddr = virt;
     }
@@ -473,6 +545,7 @@ struct slab_obj *kmalloc_create_slab_obj(ul size)
         slab_obj_ptr->count_free = (PAGE_2M_SIZE - struct_size) / size;
         slab_obj_ptr->count_using = 0;
         slab_obj_ptr->bmp_count = slab_obj_ptr->count_free;
+        slab_obj_ptr->hint = 0;
         slab_obj_ptr->vaddr = vaddr;
         slab_obj_ptr->page = page;
 
@@ -505,6 +578,7 @@ struct slab_obj *kmalloc_create_slab_obj(ul size)
         slab_obj_ptr->count_free = PAGE_2M_SIZE / size;
         slab_obj_ptr->count_using = 0;
         slab_obj_ptr->bmp_count = slab_obj_ptr->count_free;
+        slab_obj_ptr->hint = 0;
 
         slab_obj_ptr->bmp_len = ((slab_obj_ptr->bmp_count + sizeof(ul) * 8 - 1) >> 6) << 3;
 
@@ -531,21 +605,14 @@ struct slab_obj *kmalloc_create_slab_obj(ul size)
 }
 
 /**
- * @brief 通用内存分配函数
+ * @brief 计算给定大小的内存对象所属的kmalloc内存池的下标
  *
- * @param size 要分配的内存大小
- * @param gfp 内存的flag
- * @return void* 内核内存虚拟地址
+ * @param size 内存对象大小(不超过1MB)
+ * @return int 内存池下标
  */
-void *kmalloc(unsigned long size, gfp_t gfp)
+static __always_inline int __kmalloc_size_index(unsigned long size)
 {
-    void *result = NULL;
-    if (size > 1048576)
-    {
-        kwarn("kmalloc(): Can't alloc such memory: %ld bytes, because it is too large.", size);
-        return NULL;
-    }
-    int index;
+    int index = 15;
     for (int i = 0; i < 16; ++i)
     {
         if (kmalloc_cache_group[i].size >= size)
@@ -554,9 +621,17 @@ void *kmalloc(unsigned long size, gfp_t gfp)
             break;
         }
     }
-    // 对当前内存池加锁
-    spin_lock(&kmalloc_cache_group[index].lock);
+    return index;
+}
 
+/**
+ * @brief 从kmalloc的第index个内存池中分配一个内存对象（调用前需要对内存池加锁）
+ *
+ * @param index 内存池下标
+ * @return void* 内存对象的地址。分配失败时返回NULL
+ */
+static void *__kmalloc_alloc_obj(int index)
+{
     struct slab_obj *slab_obj_ptr = kmalloc_cache_group[index].cache_pool_entry;
 
     // 内存池没有可用的内存对象，需要进行扩容
@@ -569,11 +644,13 @@ void *kmalloc(unsigned long size, gfp_t gfp)
         if (unlikely(slab_obj_ptr == NULL))
         {
             kBUG("kmalloc()->kmalloc_create_slab_obj()=>slab == NULL");
-            goto failed;
+            return NULL;
         }
 
         kmalloc_cache_group[index].count_total_free += slab_obj_ptr->count_free;
         list_add(&kmalloc_cache_group[index].cache_pool_entry->list, &slab_obj_ptr->list);
+        // 记录页面所属的slab_obj，以便kfree()能在常数时间内找到它
+        __kmalloc_bind_page(slab_obj_ptr, index);
     }
     else // 内存对象充足
     {
@@ -587,40 +664,208 @@ void *kmalloc(unsigned long size, gfp_t gfp)
         } while (slab_obj_ptr != kmalloc_cache_group[index].cache_pool_entry);
     }
     // 寻找一块可用的内存对象
-    int md;
-    for (int i = 0; i < slab_obj_ptr->bmp_count; ++i)
-    {
+    int obj_index = __slab_obj_take_free(slab_obj_ptr);
+    if (unlikely(obj_index < 0))
+        return NULL;
 
-        // 当前bmp全部被使用
-        if (*(slab_obj_ptr->bmp + (i >> 6)) == 0xffffffffffffffffUL)
-        {
-            i += 63;
-            continue;
-        }
-        md = i % 64;
-        // 找到相应的内存对象
-        if ((*(slab_obj_ptr->bmp + (i >> 6)) & (1UL << md)) == 0)
+    ++(slab_obj_ptr->count_using);
+    --(slab_obj_ptr->count_free);
+
+    --kmalloc_cache_group[index].count_total_free;
+    ++kmalloc_cache_group[index].count_total_using;
+    // 返回内存对象
+    return (void *)((char *)slab_obj_ptr->vaddr + kmalloc_cache_group[index].size * obj_index);
+}
+
+/**
+ * @brief 将内存对象归还到kmalloc的第index个内存池中（调用前需要对内存池加锁）
+ *
+ * @param index 内存池下标
+ * @param slab_obj_ptr 管理该内存对象的slab_obj
+ * @param address 内存对象的地址
+ */
+static void __kfree_obj(int index, struct slab_obj *slab_obj_ptr, void *address)
+{
+    // 计算地址属于哪一个内存对象
+    int obj_index = (address - slab_obj_ptr->vaddr) / kmalloc_cache_group[index].size;
+
+    // 复位bmp
+    __slab_obj_put_free(slab_obj_ptr, obj_index);
+
+    ++(slab_obj_ptr->count_free);
+    --(slab_obj_ptr->count_using);
+    ++kmalloc_cache_group[index].count_total_free;
+    --kmalloc_cache_group[index].count_total_using;
+
+    // 回收空闲的slab_obj
+    // 条件：当前slab_obj_ptr的使用为0、总空闲内存对象>=当前slab_obj的总对象的2倍 且当前slab_pool不为起始slab_obj
+    if ((slab_obj_ptr->count_using == 0) && (kmalloc_cache_group[index].count_total_free >= ((slab_obj_ptr->bmp_count) << 1)) && (kmalloc_cache_group[index].cache_pool_entry != slab_obj_ptr))
+    {
+        switch (kmalloc_cache_group[index].size)
         {
-            *(slab_obj_ptr->bmp + (i >> 6)) |= (1UL << md);
-            ++(slab_obj_ptr->count_using);
-            --(slab_obj_ptr->count_free);
-
-            --kmalloc_cache_group[index].count_total_free;
-            ++kmalloc_cache_group[index].count_total_using;
-            // 放锁
-            spin_unlock(&kmalloc_cache_group[index].lock);
-            // 返回内存对象
-            result = (void *)((char *)slab_obj_ptr->vaddr + kmalloc_cache_group[index].size * i);
-            goto done;
+        case 32:
+        case 64:
+        case 128:
+        case 256:
+        case 512:
+            // 在这种情况下，slab_obj是被安放在page内部的
+            list_del(&slab_obj_ptr->list);
+            __kmalloc_unbind_page(slab_obj_ptr);
+
+            kmalloc_cache_group[index].count_total_free -= slab_obj_ptr->bmp_count;
+            page_clean(slab_obj_ptr->page);
+            free_pages(slab_obj_ptr->page, 1);
+            break;
+
+        default:
+            // 在这种情况下，slab_obj是被安放在额外获取的内存对象中的
+            list_del(&slab_obj_ptr->list);
+            __kmalloc_unbind_page(slab_obj_ptr);
+            kmalloc_cache_group[index].count_total_free -= slab_obj_ptr->bmp_count;
+
+            kfree(slab_obj_ptr->bmp);
+
+            page_clean(slab_obj_ptr->page);
+            free_pages(slab_obj_ptr->page, 1);
+
+            kfree(slab_obj_ptr);
+            break;
         }
     }
-    goto failed;
-done:;
+}
+
+/**
+ * @brief 从共享内存池中批量取出内存对象，补充到magazine中
+ *
+ * @param index 内存池下标
+ * @param mag 当前cpu的magazine
+ */
+static void __kmalloc_magazine_refill(int index, struct slab_magazine *mag)
+{
+    spin_lock(&kmalloc_cache_group[index].lock);
+    while (mag->count < SLAB_MAGAZINE_BATCH)
+    {
+        void *obj = __kmalloc_alloc_obj(index);
+        if (unlikely(obj == NULL))
+            break;
+        mag->objs[mag->count++] = obj;
+    }
+    spin_unlock(&kmalloc_cache_group[index].lock);
+}
+
+/**
+ * @brief 将magazine中最早放入的num个内存对象批量归还到共享内存池
+ * 最近释放的对象仍留在magazine中，它们更可能还在cache里
+ *
+ * @param index 内存池下标
+ * @param mag 当前cpu的magazine
+ * @param num 要归还的对象数量
+ */
+static void __kfree_magazine_flush(int index, struct slab_magazine *mag, uint32_t num)
+{
+    if (num > mag->count)
+        num = mag->count;
+
+    int obj_index;
+    spin_lock(&kmalloc_cache_group[index].lock);
+    for (uint32_t i = 0; i < num; ++i)
+        __kfree_obj(index, __kmalloc_get_slab_obj(mag->objs[i], &obj_index), mag->objs[i]);
+    spin_unlock(&kmalloc_cache_group[index].lock);
+
+    for (uint32_t i = num; i < mag->count; ++i)
+        mag->objs[i - num] = mag->objs[i];
+    mag->count -= num;
+}
+
+/**
+ * @brief 从当前cpu的magazine中取出一个内存对象，magazine为空时从共享内存池批量补充
+ *
+ * @param index 内存池下标
+ * @return void* 内存对象的地址。分配失败时返回NULL
+ */
+static __always_inline void *__kmalloc_magazine_pop(int index)
+{
+    void *result = NULL;
+    uint64_t rflags;
+    // 关中断以保证访问的是当前cpu的magazine，且不会被同一cpu上的中断处理程序打断
+    local_irq_save(rflags);
+    struct slab_magazine *mag = &kmalloc_magazines[proc_current_cpu_id][index];
+    if (unlikely(mag->count == 0))
+        __kmalloc_magazine_refill(index, mag);
+    if (likely(mag->count != 0))
+        result = mag->objs[--mag->count];
+    local_irq_restore(rflags);
+    return result;
+}
+
+/**
+ * @brief 将内存对象放入当前cpu的magazine，magazine已满时先批量归还到共享内存池
+ *
+ * @param index 内存池下标
+ * @param address 内存对象的地址
+ */
+static __always_inline void __kfree_magazine_push(int index, void *address)
+{
+    uint64_t rflags;
+    local_irq_save(rflags);
+    struct slab_magazine *mag = &kmalloc_magazines[proc_current_cpu_id][index];
+    if (unlikely(mag->count == SLAB_MAGAZINE_SIZE))
+        __kfree_magazine_flush(index, mag, SLAB_MAGAZINE_BATCH);
+    mag->objs[mag->count++] = address;
+    local_irq_restore(rflags);
+}
+
+/**
+ * @brief 统计所有cpu的magazine中，缓存的第index个内存池的对象数量(未上锁，不一定精准)
+ *
+ * @param index 内存池下标
+ * @return uint64_t 对象数量
+ */
+uint64_t kmalloc_count_magazine_objs(int index)
+{
+    if (index >= SLAB_MAGAZINE_CLASSES)
+        return 0;
+    uint64_t result = 0;
+    for (int cpu = 0; cpu < MAX_CPU_NUM; ++cpu)
+        result += kmalloc_magazines[cpu][index].count;
+    return result;
+}
+
+/**
+ * @brief 通用内存分配函数
+ *
+ * @param size 要分配的内存大小
+ * @param gfp 内存的flag
+ * @return void* 内核内存虚拟地址
+ */
+void *kmalloc(unsigned long size, gfp_t gfp)
+{
+    void *result = NULL;
+    if (size > 1048576)
+    {
+        kwarn("kmalloc(): Can't alloc such memory: %ld bytes, because it is too large.", size);
+        return NULL;
+    }
+    int index = __kmalloc_size_index(size);
+
+    if (index < SLAB_MAGAZINE_CLASSES) // 小对象优先从当前cpu的magazine中分配，无需加锁
+        result = __kmalloc_magazine_pop(index);
+    else
+    {
+        // 对当前内存池加锁
+        spin_lock(&kmalloc_cache_group[index].lock);
+        result = __kmalloc_alloc_obj(index);
+        // 放锁
+        spin_unlock(&kmalloc_cache_group[index].lock);
+    }
+
+    if (unlikely(result == NULL))
+        goto failed;
+
     if (gfp & __GFP_ZERO)
         memset(result, 0, size);
     return result;
 failed:;
-    spin_unlock(&kmalloc_cache_group[index].lock);
     kerror("kmalloc(): Cannot alloc more memory: %d bytes", size);
     return NULL;
 }
@@ -635,79 +880,42 @@ unsigned long kfree(void *address)
 {
     if (unlikely(address == NULL))
         return 0;
-    struct slab_obj *slab_obj_ptr = NULL;
-
-    // 将线性地址按照2M物理页对齐, 获得所在物理页的起始线性地址
-    void *page_base_addr = (void *)((ul)address & PAGE_2M_MASK);
 
     int index;
-
-    for (int i = 0; i < 16; ++i)
+    struct slab_obj *slab_obj_ptr = __kmalloc_get_slab_obj(address, &index);
+    if (unlikely(slab_obj_ptr == NULL))
     {
-        slab_obj_ptr = kmalloc_cache_group[i].cache_pool_entry;
+        kBUG("kfree(): Can't free memory. address=%#018lx", address);
+        return ECANNOT_FREE_MEM;
+    }
 
-        do
-        {
-            // 不属于当前slab_obj的管理范围
-            if (likely(slab_obj_ptr->vaddr != page_base_addr))
-            {
-                slab_obj_ptr = container_of(list_next(&slab_obj_ptr->list), struct slab_obj, list);
-            }
-            else
-            {
-                // 对当前内存池加锁
-                spin_lock(&kmalloc_cache_group[i].lock);
-                // 计算地址属于哪一个内存对象
-                index = (address - slab_obj_ptr->vaddr) / kmalloc_cache_group[i].size;
-
-                // 复位bmp
-                *(slab_obj_ptr->bmp + (index >> 6)) ^= 1UL << (index % 64);
-
-                ++(slab_obj_ptr->count_free);
-                --(slab_obj_ptr->count_using);
-                ++kmalloc_cache_group[i].count_total_free;
-                --kmalloc_cache_group[i].count_total_using;
-
-                // 回收空闲的slab_obj
-                // 条件：当前slab_obj_ptr的使用为0、总空闲内存对象>=当前slab_obj的总对象的2倍 且当前slab_pool不为起始slab_obj
-                if ((slab_obj_ptr->count_using == 0) && (kmalloc_cache_group[i].count_total_free >= ((slab_obj_ptr->bmp_count) << 1)) && (kmalloc_cache_group[i].cache_pool_entry != slab_obj_ptr))
-                {
-                    switch (kmalloc_cache_group[i].size)
-                    {
-                    case 32:
-                    case 64:
-                    case 128:
-                    case 256:
-                    case 512:
-                        // 在这种情况下，slab_obj是被安放在page内部的
-                        list_del(&slab_obj_ptr->list);
-
-                        kmalloc_cache_group[i].count_total_free -= slab_obj_ptr->bmp_count;
-                        page_clean(slab_obj_ptr->page);
-                        free_pages(slab_obj_ptr->page, 1);
-                        break;
-
-                    default:
-                        // 在这种情况下，slab_obj是被安放在额外获取的内存对象中的
-                        list_del(&slab_obj_ptr->list);
-                        kmalloc_cache_group[i].count_total_free -= slab_obj_ptr->bmp_count;
-
-                        kfree(slab_obj_ptr->bmp);
-
-                        page_clean(slab_obj_ptr->page);
-                        free_pages(slab_obj_ptr->page, 1);
-
-                        kfree(slab_obj_ptr);
-                        break;
-                    }
-                }
-                // 放锁
-                spin_unlock(&kmalloc_cache_group[i].lock);
-                return 0;
-            }
-
-        } while (slab_obj_ptr != kmalloc_cache_group[i].cache_pool_entry);
+    if (index < SLAB_MAGAZINE_CLASSES) // 小对象放回当前cpu的magazine，无需加锁
+    {
+        __kfree_magazine_push(index, address);
+        return 0;
     }
-    kBUG("kfree(): Can't free memory. address=%#018lx", address);
-    return ECANNOT_FREE_MEM;
-}
\ No newline at end of file
+
+    // 对当前内存池加锁
+    spin_lock(&kmalloc_cache_group[index].lock);
+    __kfree_obj(index, slab_obj_ptr, address);
+    // 放锁
+    spin_unlock(&kmalloc_cache_group[index].lock);
+    return 0;
+}
+
+/**
+ * @brief 获取kmalloc分配的内存对象的实际可用大小
+ *
+ * @param address 内存对象的地址
+ * @return size_t 内存对象所属内存池的对象大小。地址不是由kmalloc分配时，返回0
+ */
+size_t ksize(void *address)
+{
+    if (unlikely(address == NULL))
+        return 0;
+
+    int index;
+    if (unlikely(__kmalloc_get_slab_obj(address, &index) == NULL))
+        return 0;
+    return kmalloc_cache_group[index].size;
+}
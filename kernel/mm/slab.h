@@ -5,6 +5,7 @@
 #include <common/printk.h>
 #include <common/kprint.h>
 #include <common/spinlock.h>
+#include <common/cpu.h>
 
 #define SIZEOF_LONG_ALIGN(size) ((size + sizeof(long) - 1) & ~(sizeof(long) - 1))
 #define SIZEOF_INT_ALIGN(size) ((size + sizeof(int) - 1) & ~(sizeof(int) - 1))
@@ -30,6 +31,7 @@ struct slab_obj
     ul bmp_len;   // 位图的长度（字节）
     ul bmp_count; // 位图的有效位数
     ul *bmp;
+    ul hint; // 下一次从位图的第几个字开始查找空闲对象（在它之前的字都已被占满）
 };
 
 // slab内存池
@@ -50,6 +52,32 @@ struct slab
     void *(*destructor)(void *vaddr, ul arg);
 };
 
+// 使用per-cpu magazine的kmalloc内存池数量（对象大小为32B~4KB的内存池）
+#define SLAB_MAGAZINE_CLASSES 8
+// 每个magazine最多缓存的内存对象数量
+#define SLAB_MAGAZINE_SIZE 32
+// magazine与共享内存池之间，每次批量补充/归还的内存对象数量
+#define SLAB_MAGAZINE_BATCH 16
+
+/**
+ * @brief per-cpu的内存对象缓存
+ * kmalloc()/kfree()优先在当前cpu的magazine中存取对象，只有在magazine为空或已满时，
+ * 才对共享的内存池加锁，并批量地补充或归还对象
+ */
+struct slab_magazine
+{
+    uint32_t count;                 // 当前缓存的对象数量
+    void *objs[SLAB_MAGAZINE_SIZE]; // 缓存的对象（栈顶为最近释放的对象）
+} __attribute__((aligned(64)));
+
+/**
+ * @brief 统计所有cpu的magazine中，缓存的第index个内存池的对象数量(未上锁，不一定精准)
+ *
+ * @param index 内存池下标
+ * @return uint64_t 对象数量
+ */
+uint64_t kmalloc_count_magazine_objs(int index);
+
 /**
  * @brief 通用内存分配函数
  *
@@ -79,6 +107,14 @@ static __always_inline void *kzalloc(size_t size, gfp_t gfp)
  */
 unsigned long kfree(void *address);
 
+/**
+ * @brief 获取kmalloc分配的内存对象的实际可用大小
+ *
+ * @param address 内存对象的地址
+ * @return size_t 内存对象所属内存池的对象大小。地址不是由kmalloc分配时，返回0
+ */
+size_t ksize(void *address);
+
 /**
  * @brief 创建一个内存池
  *
@@ -0,0 +1,330 @@
+#include "mm.h"
+#include "internal.h"
+#include <common/cpu.h>
+#include <common/spinlock.h>
+#include <process/process.h>
+#include <smp/ipi.h>
+
+#define CR4_PGE (1UL << 7)
+#define CR4_PCIDE (1UL << 17)
+// 写入cr3时保留该PCID在TLB中的缓存
+#define CR3_NOFLUSH (1UL << 63)
+// PCID的数量（PCID 0保留给内核地址空间以及未分配到PCID的地址空间）
+#define MM_PCID_NUM 4096
+
+bool mm_pcid_enabled = false;
+
+static uint64_t __pcid_bmp[MM_PCID_NUM / 64];
+static uint32_t __pcid_hint = 1;
+static spinlock_t __pcid_lock;
+
+// 每个cpu当前加载的地址空间
+static struct mm_struct *__cpu_loaded_mm[MAX_CPU_NUM];
+// 已经初始化了TLB管理模块的cpu
+static atomic_t __tlb_online_mask;
+
+/**
+ * @brief 跨核心刷新TLB的请求（同一时间只有一个请求）
+ *
+ */
+static struct
+{
+    spinlock_t lock;
+    struct mm_struct *mm; // 为NULL时表示刷新内核空间（所有PCID）
+    bool full;
+    uint32_t count;
+    uint64_t addrs[MM_TLB_BATCH_SIZE];
+    atomic_t pending_mask; // 尚未完成刷新的cpu
+} __tlb_shootdown;
+
+static __always_inline uint64_t __read_cr4()
+{
+    uint64_t cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4)::"memory");
+    return cr4;
+}
+
+static __always_inline void __write_cr4(uint64_t cr4)
+{
+    __asm__ __volatile__("movq %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
+static __always_inline void __write_cr3(uint64_t cr3)
+{
+    __asm__ __volatile__("movq %0, %%cr3" ::"r"(cr3) : "memory");
+}
+
+/**
+ * @brief 在当前cpu上启用TLB管理（必须在cr3的低12位为0时调用）
+ *
+ */
+static void __mm_tlb_init_cpu()
+{
+    if (mm_pcid_enabled)
+        __write_cr4(__read_cr4() | CR4_PCIDE);
+    __cpu_loaded_mm[proc_current_cpu_id] = &initial_mm;
+    atomic_set_mask(&initial_mm.cpu_active_mask, 1UL << proc_current_cpu_id);
+    atomic_set_mask(&__tlb_online_mask, 1UL << proc_current_cpu_id);
+}
+
+void mm_tlb_init()
+{
+    spin_init(&__pcid_lock);
+    spin_init(&__tlb_shootdown.lock);
+    mm_tlb_mm_init(&initial_mm);
+    // PCID 0 保留
+    __pcid_bmp[0] = 1;
+
+    uint32_t a, b, c, d;
+    cpu_cpuid(1, 0, &a, &b, &c, &d);
+    mm_pcid_enabled = (c & (1 << 17)) != 0;
+    __mm_tlb_init_cpu();
+    kinfo("TLB: PCID %s.", mm_pcid_enabled ? "enabled" : "not supported");
+}
+
+void mm_tlb_init_ap()
+{
+    __mm_tlb_init_cpu();
+}
+
+void mm_tlb_mm_init(struct mm_struct *mm)
+{
+    mm->pcid = 0;
+    atomic_set(&mm->cpu_active_mask, 0);
+    atomic_set(&mm->tlb_valid_mask, 0);
+    spin_init(&mm->tlb_lock);
+}
+
+/**
+ * @brief 为地址空间分配PCID。PCID用完时，该地址空间将继续使用PCID 0
+ *
+ * @param mm 地址空间
+ */
+static void __mm_pcid_alloc(struct mm_struct *mm)
+{
+    spin_lock(&__pcid_lock);
+    for (uint32_t i = 0; i < MM_PCID_NUM; ++i)
+    {
+        uint32_t id = (__pcid_hint + i) % MM_PCID_NUM;
+        if (!(__pcid_bmp[id >> 6] & (1UL << (id & 63))))
+        {
+            __pcid_bmp[id >> 6] |= (1UL << (id & 63));
+            __pcid_hint = id + 1;
+            mm->pcid = id;
+            // 该PCID可能仍缓存着之前的地址空间的数据，因此每个cpu第一次加载它时都需要刷新
+            atomic_set(&mm->tlb_valid_mask, 0);
+            break;
+        }
+    }
+    spin_unlock(&__pcid_lock);
+}
+
+void mm_tlb_mm_release(struct mm_struct *mm)
+{
+    if (mm->pcid == 0)
+        return;
+    spin_lock(&__pcid_lock);
+    __pcid_bmp[mm->pcid >> 6] &= ~(1UL << (mm->pcid & 63));
+    spin_unlock(&__pcid_lock);
+    mm->pcid = 0;
+}
+
+void mm_switch_mm(struct mm_struct *next)
+{
+    uint64_t cpu_bit = 1UL << proc_current_cpu_id;
+    struct mm_struct *prev = __cpu_loaded_mm[proc_current_cpu_id];
+    if (prev != next && prev != NULL)
+        atomic_clear_mask(&prev->cpu_active_mask, cpu_bit);
+    __cpu_loaded_mm[proc_current_cpu_id] = next;
+
+    if (!mm_pcid_enabled)
+    {
+        atomic_set_mask(&next->cpu_active_mask, cpu_bit);
+        __write_cr3((uint64_t)next->pgd);
+        return;
+    }
+
+    if (next->pcid == 0 && next != &initial_mm)
+        __mm_pcid_alloc(next);
+
+    // 与mm_tlb_batch_flush()互斥：要么在其检查cpu_active_mask之前被标记为活跃（从而收到IPI），要么看到被清除的tlb_valid_mask
+    spin_lock(&next->tlb_lock);
+    atomic_set_mask(&next->cpu_active_mask, cpu_bit);
+    uint64_t cr3 = (uint64_t)next->pgd | next->pcid;
+    // PCID 0由多个地址空间共用，因此总是刷新
+    if (next->pcid != 0 && (atomic_read(&next->tlb_valid_mask) & cpu_bit))
+        cr3 |= CR3_NOFLUSH;
+    else
+        atomic_set_mask(&next->tlb_valid_mask, cpu_bit);
+    __write_cr3(cr3);
+    spin_unlock(&next->tlb_lock);
+}
+
+void flush_tlb_all()
+{
+    if (!mm_pcid_enabled)
+    {
+        flush_tlb();
+        return;
+    }
+    // 修改CR4.PGE会刷新所有PCID的TLB（包括全局页）
+    uint64_t flags;
+    local_irq_save(flags);
+    uint64_t cr4 = __read_cr4();
+    __write_cr4(cr4 ^ CR4_PGE);
+    __write_cr4(cr4);
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief 在当前cpu上刷新TLB
+ *
+ * @param mm 地址空间（为NULL时表示刷新内核空间）
+ * @param full 是否刷新整个地址空间
+ * @param addrs 需要刷新的地址
+ * @param count 地址的数量
+ */
+static void __mm_tlb_flush_local(struct mm_struct *mm, bool full, uint64_t *addrs, uint32_t count)
+{
+    // 内核页不是全局页，在启用了PCID时，invlpg只能刷新当前PCID中的缓存
+    if (mm == NULL && mm_pcid_enabled)
+    {
+        flush_tlb_all();
+        return;
+    }
+    if (full)
+    {
+        flush_tlb();
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+        flush_tlb_one(addrs[i]);
+}
+
+/**
+ * @brief 处理发送给当前cpu的跨核心TLB刷新请求
+ *
+ */
+static void __mm_tlb_shootdown_do()
+{
+    uint64_t cpu_bit = 1UL << proc_current_cpu_id;
+    if (!(atomic_read(&__tlb_shootdown.pending_mask) & cpu_bit))
+        return;
+
+    struct mm_struct *mm = __tlb_shootdown.mm;
+    if (mm == NULL || __cpu_loaded_mm[proc_current_cpu_id] == mm)
+        __mm_tlb_flush_local(mm, __tlb_shootdown.full, __tlb_shootdown.addrs, __tlb_shootdown.count);
+    else // 在收到请求之前已经切换到了其他的地址空间，下次切换回来时再刷新
+        atomic_clear_mask(&mm->tlb_valid_mask, cpu_bit);
+
+    atomic_clear_mask(&__tlb_shootdown.pending_mask, cpu_bit);
+}
+
+void mm_tlb_shootdown_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs)
+{
+    __mm_tlb_shootdown_do();
+}
+
+/**
+ * @brief 请求其他cpu刷新TLB，并等待它们完成
+ *
+ * @param mm 地址空间（为NULL时表示刷新内核空间）
+ * @param batch 需要刷新的地址
+ * @param targets 需要进行刷新的cpu
+ */
+static void __mm_tlb_shootdown(struct mm_struct *mm, struct mm_tlb_batch_t *batch, uint64_t targets)
+{
+    targets &= atomic_read(&__tlb_online_mask);
+    if (targets == 0)
+        return;
+
+    // 等待锁时，若当前cpu的中断被关闭，则需要主动处理发送给自己的请求，否则持有锁的cpu将永远等不到回应
+    while (!spin_trylock(&__tlb_shootdown.lock))
+    {
+        __mm_tlb_shootdown_do();
+        pause();
+    }
+
+    __tlb_shootdown.mm = mm;
+    __tlb_shootdown.full = batch->full;
+    __tlb_shootdown.count = batch->count;
+    memcpy(__tlb_shootdown.addrs, batch->addrs, sizeof(uint64_t) * batch->count);
+    barrier();
+    atomic_set(&__tlb_shootdown.pending_mask, targets);
+    io_mfence();
+
+    // 广播IPI，由各个cpu根据pending_mask判断是否需要处理
+    ipi_send_IPI(DEST_PHYSICAL, IDLE, ICR_LEVEL_DE_ASSERT, EDGE_TRIGGER, MM_TLB_SHOOTDOWN_IPI_VECTOR, ICR_APIC_FIXED, ICR_ALL_EXCLUDE_Self, 0);
+    while (atomic_read(&__tlb_shootdown.pending_mask) != 0)
+        pause();
+
+    spin_unlock(&__tlb_shootdown.lock);
+}
+
+void mm_tlb_batch_flush(struct mm_tlb_batch_t *batch)
+{
+    if (batch->full || batch->count > 0)
+    {
+        uint64_t cpu_bit = 1UL << proc_current_cpu_id;
+        struct mm_struct *mm = batch->mm;
+        if (mm == &initial_mm)
+            mm = NULL;
+
+        if (mm == NULL) // 内核空间被所有地址空间共享，需要刷新所有cpu
+        {
+            __mm_tlb_flush_local(NULL, batch->full, batch->addrs, batch->count);
+            __mm_tlb_shootdown(NULL, batch, ~cpu_bit);
+        }
+        else
+        {
+            uint64_t flags;
+            spin_lock_irqsave(&mm->tlb_lock, flags);
+            uint64_t active = atomic_read(&mm->cpu_active_mask);
+            // 没有在使用该地址空间的cpu，在下次切换到该地址空间时再刷新
+            atomic_clear_mask(&mm->tlb_valid_mask, ~active);
+            spin_unlock_irqrestore(&mm->tlb_lock, flags);
+
+            if (active & cpu_bit)
+                __mm_tlb_flush_local(mm, batch->full, batch->addrs, batch->count);
+            if (active & ~cpu_bit)
+                __mm_tlb_shootdown(mm, batch, active & ~cpu_bit);
+        }
+    }
+
+    // 所有cpu都已经不再缓存这些页框的映射，可以安全地释放它们
+    for (uint32_t i = 0; i < batch->nr_frames; ++i)
+        free_4k_frames(batch->frames[i], 1);
+
+    batch->full = false;
+    batch->count = 0;
+    batch->nr_frames = 0;
+}
+
+void mm_tlb_batch_add_frame(struct mm_tlb_batch_t *batch, void *frame)
+{
+    if (batch->nr_frames == MM_TLB_BATCH_SIZE)
+        mm_tlb_batch_flush(batch);
+    batch->frames[batch->nr_frames++] = frame;
+}
+
+void mm_tlb_flush_range(struct mm_struct *mm, uint64_t vaddr, uint64_t length)
+{
+    struct mm_tlb_batch_t batch;
+    mm_tlb_batch_init(&batch, mm);
+    if (length > MM_TLB_BATCH_SIZE * PAGE_4K_SIZE)
+        batch.full = true;
+    else
+    {
+        for (uint64_t off = 0; off < length; off += PAGE_4K_SIZE)
+            mm_tlb_batch_add(&batch, vaddr + off);
+    }
+    mm_tlb_batch_flush(&batch);
+}
+
+void mm_tlb_flush_mm(struct mm_struct *mm)
+{
+    struct mm_tlb_batch_t batch;
+    mm_tlb_batch_init(&batch, mm);
+    batch.full = true;
+    mm_tlb_batch_flush(&batch);
+}
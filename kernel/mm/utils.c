@@ -42,10 +42,62 @@ uint64_t __mm_get_paddr(struct mm_struct *mm, uint64_t vaddr)
         // 存在4级页表
         tmp = phys_2_virt(((ul *)(*tmp & (~0xfffUL)) + (((ul)(vaddr) >> PAGE_4K_SHIFT) & 0x1ff)));
 
-        return (*tmp) & (~0x1ffUL);
+        return (*tmp) & PAGE_4K_MASK & (~PAGE_XD);
     }
 }
 
+/**
+ * @brief 获取指定虚拟地址在页表中对应的pde
+ *
+ * @param mm 内存空间分布结构体
+ * @param vaddr 虚拟地址
+ * @return uint64_t* pde的指针。pde所在的页表不存在时返回NULL
+ */
+uint64_t *__mm_get_pde(struct mm_struct *mm, uint64_t vaddr)
+{
+    ul *tmp;
+
+    tmp = phys_2_virt((ul *)(((ul)mm->pgd) & (~0xfffUL)) + ((vaddr >> PAGE_GDT_SHIFT) & 0x1ff));
+
+    // pml4页表项为0
+    if (*tmp == 0)
+        return NULL;
+
+    tmp = phys_2_virt((ul *)(*tmp & (~0xfffUL)) + ((vaddr >> PAGE_1G_SHIFT) & 0x1ff));
+
+    // pdpt页表项为0
+    if (*tmp == 0)
+        return NULL;
+
+    return phys_2_virt(((ul *)(*tmp & (~0xfffUL)) + (((ul)(vaddr) >> PAGE_2M_SHIFT) & 0x1ff)));
+}
+
+/**
+ * @brief 获取指定虚拟地址在页表中对应的最后一级页表项（2M页的pde或4K页的pte）
+ *
+ * @param mm 内存空间分布结构体
+ * @param vaddr 虚拟地址
+ * @param is_2m 返回该页表项是否映射了2M页
+ * @return uint64_t* 页表项的指针。页表项所在的页表不存在时返回NULL
+ */
+uint64_t *__mm_get_pte(struct mm_struct *mm, uint64_t vaddr, bool *is_2m)
+{
+    ul *tmp = __mm_get_pde(mm, vaddr);
+
+    *is_2m = false;
+    if (tmp == NULL || *tmp == 0)
+        return NULL;
+
+    // pde映射了2M页
+    if (*tmp & PAGE_PS)
+    {
+        *is_2m = true;
+        return tmp;
+    }
+
+    return phys_2_virt(((ul *)(*tmp & (~0xfffUL)) + (((ul)(vaddr) >> PAGE_4K_SHIFT) & 0x1ff)));
+}
+
 /**
  * @brief 检测指定地址是否已经被映射
  *
@@ -66,6 +66,19 @@ void __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma, struct vm
 
     if (next != NULL)
         next->vm_prev = vma;
+
+    // 加入红黑树
+    struct rb_node **link = &mm->vma_tree.rb_node, *parent = NULL;
+    while (*link != NULL)
+    {
+        parent = *link;
+        if (vma->vm_start < rb_entry(parent, struct vm_area_struct, vm_rb)->vm_start)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_link_node(&vma->vm_rb, parent, link);
+    rb_insert_color(&vma->vm_rb, &mm->vma_tree, NULL);
 }
 
 /**
@@ -86,6 +99,8 @@ void __vma_unlink_list(struct mm_struct *mm, struct vm_area_struct *vma)
 
     if (next)
         next->vm_prev = prev;
+
+    rb_erase(&vma->vm_rb, &mm->vma_tree, NULL);
 }
 
 /**
@@ -97,16 +112,21 @@ void __vma_unlink_list(struct mm_struct *mm, struct vm_area_struct *vma)
  */
 struct vm_area_struct *vma_find(struct mm_struct *mm, uint64_t addr)
 {
-    struct vm_area_struct *vma = mm->vmas;
+    // vma之间互不重叠，因此vm_end与vm_start的顺序一致，可以直接在树上二分查找
+    struct rb_node *node = mm->vma_tree.rb_node;
     struct vm_area_struct *result = NULL;
-    while (vma != NULL)
+    while (node != NULL)
     {
+        struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
         if (vma->vm_end > addr)
         {
             result = vma;
-            break;
+            if (vma->vm_start <= addr)
+                break;
+            node = node->rb_left;
         }
-        vma = vma->vm_next;
+        else
+            node = node->rb_right;
     }
     return result;
 }
@@ -120,53 +140,44 @@ struct vm_area_struct *vma_find(struct mm_struct *mm, uint64_t addr)
  */
 int vma_insert(struct mm_struct *mm, struct vm_area_struct *vma)
 {
+    // 第一个与vma重叠的vma（若存在）
+    struct vm_area_struct *next = vma_find(mm, vma->vm_start);
 
-    struct vm_area_struct *prev;
-
-    prev = vma_find(mm, vma->vm_start);
-    
-    if (prev && prev->vm_start <= vma->vm_start && prev->vm_end >= vma->vm_end)
+    if (next && next->vm_start <= vma->vm_start && next->vm_end >= vma->vm_end)
     {
         // 已经存在了相同的vma
         return -EEXIST;
     }
-    // todo: bugfix: 这里的第二种情况貌似从来不会满足
-    else if (prev && ((vma->vm_start >= prev->vm_start && vma->vm_start <= prev->vm_end) || (prev->vm_start <= vma->vm_end && prev->vm_start >= vma->vm_start)))    
+    else if (next && next->vm_start < vma->vm_end)
     {
         //部分重叠
-        if ((!CROSS_2M_BOUND(vma->vm_start, prev->vm_start)) && (!CROSS_2M_BOUND(vma->vm_end, prev->vm_end))&& vma->vm_end)
+        if ((!CROSS_2M_BOUND(vma->vm_start, next->vm_start)) && (!CROSS_2M_BOUND(vma->vm_end, next->vm_end)) && vma->vm_end)
         {
-            //合并vma 并改变链表vma的范围
-            kdebug("before combining vma:vm_start = %#018lx, vm_end = %#018lx\n", vma->vm_start, vma->vm_end);
+            uint64_t start = (vma->vm_start < next->vm_start) ? vma->vm_start : next->vm_start;
+            uint64_t end = (vma->vm_end > next->vm_end) ? vma->vm_end : next->vm_end;
+            // 合并后不能与相邻的vma重叠
+            if ((next->vm_prev && next->vm_prev->vm_end > start) || (next->vm_next && next->vm_next->vm_start < end))
+                return -EEXIST;
 
-            prev->vm_start = (vma->vm_start < prev->vm_start )? vma->vm_start : prev->vm_start;
-            prev->vm_end = (vma->vm_end > prev->vm_end) ? vma->vm_end : prev->vm_end;
+            //合并vma 并改变vma的范围。由于不与相邻的vma重叠，因此vma在树中的顺序不变
+            kdebug("before combining vma:vm_start = %#018lx, vm_end = %#018lx\n", vma->vm_start, vma->vm_end);
+            next->vm_start = start;
+            next->vm_end = end;
             // 计算page_offset
-            prev->page_offset = prev->vm_start - (prev->vm_start & PAGE_2M_MASK);
-            kdebug("combined vma:vm_start = %#018lx, vm_end = %#018lx\nprev:vm_start = %018lx, vm_end = %018lx\n", vma->vm_start, vma->vm_end, prev->vm_start, prev->vm_end);
+            next->page_offset = next->vm_start - (next->vm_start & PAGE_2M_MASK);
+            kdebug("combined vma:vm_start = %#018lx, vm_end = %#018lx\nprev:vm_start = %018lx, vm_end = %018lx\n", vma->vm_start, vma->vm_end, next->vm_start, next->vm_end);
             kinfo("vma has same part\n");
             return __VMA_MERGED;
         }
+        return -EEXIST;
     }
 
-    // prev = vma_find(mm, vma->vm_start);
-
-    if (prev == NULL) // 要将当前vma插入到链表的尾部
-    {
-        struct vm_area_struct *ptr = mm->vmas;
-        while (ptr)
-        {
-            if (ptr->vm_next)
-                ptr = ptr->vm_next;
-            else
-            {
-                prev = ptr;
-                break;
-            }
-        }
-    }
-    else
-        prev = prev->vm_prev;
+    // vma应当被插入到next之前（next为NULL时，插入到链表的尾部）
+    struct vm_area_struct *prev = NULL;
+    if (next != NULL)
+        prev = next->vm_prev;
+    else if (!RB_EMPTY_ROOT(&mm->vma_tree))
+        prev = rb_entry(rb_last(&mm->vma_tree), struct vm_area_struct, vm_rb);
     __vma_link_list(mm, vma, prev);
     return 0;
 }
@@ -261,11 +272,12 @@ int __anon_vma_del(struct vm_area_struct *vma)
     // 若当前anon_vma的引用计数归零，则意味着可以释放内存页
     if (unlikely(atomic_read(&vma->anon_vma->ref_count) == 0)) // 应当释放该anon_vma
     {
-        // 若页面结构体是mmio创建的，则释放页面结构体
-        if (vma->anon_vma->page->attr & PAGE_DEVICE)
-            kfree(vma->anon_vma->page);
-        else
-            free_pages(vma->anon_vma->page, 1);
+        struct Page *page = vma->anon_vma->page;
+        // 若页面结构体是mmio创建的，则释放页面结构体（page为NULL说明页面已经与anon_vma解除绑定）
+        if (page != NULL && (page->attr & PAGE_DEVICE))
+            kfree(page);
+        else if (page != NULL && !(page->attr & PAGE_4K_FRAMES)) // 4K页框由其使用者自行释放
+            free_pages(page, 1);
         __anon_vma_free(vma->anon_vma);
     }
 
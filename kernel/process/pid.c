@@ -0,0 +1,168 @@
+/**
+ * @file pid.c
+ * @brief pid的分配与回收、pid到pcb的哈希表，以及进程树（父进程的子进程链表）的维护
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "process.h"
+#include <common/spinlock.h>
+#include <common/bitmap.h>
+
+// 保护pid位图、pid哈希表与进程树的锁
+spinlock_t process_tree_lock;
+
+// 已分配的pid的位图（第i位为1表示pid i已被使用）
+static uint64_t __pid_bitmap[PROC_MAX_PID / 64];
+// 最近一次分配的pid：从它之后开始查找空闲的pid，避免刚释放的pid立即被重新使用
+static long __pid_last = 0;
+// pid哈希表，每个桶是通过pcb->pid_hash_next连接的单链表
+static struct process_control_block *__pid_hash[PROC_PID_HASH_SIZE];
+
+#define __pid_hashfn(pid) ((pid) & (PROC_PID_HASH_SIZE - 1))
+
+/**
+ * @brief 在[start, end)范围内查找空闲的pid（需要持有process_tree_lock）
+ *
+ * @return long 空闲的pid，不存在时返回-1
+ */
+static long __pid_find_free(long start, long end)
+{
+    uint64_t found = bitmap_find_next_zero(__pid_bitmap, start, end);
+    return found < end ? (long)found : -1;
+}
+
+/**
+ * @brief 初始化pid分配器（pid 0属于初始进程）
+ *
+ */
+void process_pid_init()
+{
+    spin_init(&process_tree_lock);
+    memset(__pid_bitmap, 0, sizeof(__pid_bitmap));
+    memset(__pid_hash, 0, sizeof(__pid_hash));
+    __pid_bitmap[0] = 1;
+    __pid_last = 0;
+
+    list_init(&initial_proc_union.pcb.children);
+    list_init(&initial_proc_union.pcb.sibling);
+    initial_proc_union.pcb.pid_hash_next = NULL;
+    __pid_hash[__pid_hashfn(0)] = &initial_proc_union.pcb;
+}
+
+/**
+ * @brief 为新的进程分配pid，将其加入pid哈希表，并加入父进程的子进程链表
+ *
+ * @param pcb 新进程的pcb（parent_pcb已经设置好）
+ * @return long 分配到的pid。pid耗尽时返回-EAGAIN
+ */
+long process_link_pcb(struct process_control_block *pcb)
+{
+    spin_lock(&process_tree_lock);
+    long pid = __pid_find_free(__pid_last + 1, PROC_MAX_PID);
+    if (pid < 0)
+        pid = __pid_find_free(1, __pid_last + 1);
+    if (unlikely(pid < 0))
+    {
+        spin_unlock(&process_tree_lock);
+        return -EAGAIN;
+    }
+
+    __pid_bitmap[pid >> 6] |= (1UL << (pid & 63));
+    __pid_last = pid;
+    pcb->pid = pid;
+
+    pcb->pid_hash_next = __pid_hash[__pid_hashfn(pid)];
+    __pid_hash[__pid_hashfn(pid)] = pcb;
+
+    list_append(&pcb->parent_pcb->children, &pcb->sibling);
+    spin_unlock(&process_tree_lock);
+    return pid;
+}
+
+/**
+ * @brief 将进程从pid哈希表与父进程的子进程链表中删除，并回收其pid（需要持有process_tree_lock）
+ *
+ * @param pcb 进程的pcb
+ */
+void __process_unlink_pcb(struct process_control_block *pcb)
+{
+    struct process_control_block **link = &__pid_hash[__pid_hashfn(pcb->pid)];
+    while (*link != NULL && *link != pcb)
+        link = &(*link)->pid_hash_next;
+    if (likely(*link != NULL))
+        *link = pcb->pid_hash_next;
+    pcb->pid_hash_next = NULL;
+
+    list_del(&pcb->sibling);
+    list_init(&pcb->sibling);
+    __pid_bitmap[pcb->pid >> 6] &= ~(1UL << (pcb->pid & 63));
+}
+
+/**
+ * @brief 将进程从pid哈希表与父进程的子进程链表中删除，并回收其pid
+ *
+ * @param pcb 进程的pcb
+ */
+void process_unlink_pcb(struct process_control_block *pcb)
+{
+    spin_lock(&process_tree_lock);
+    __process_unlink_pcb(pcb);
+    spin_unlock(&process_tree_lock);
+}
+
+/**
+ * @brief 将退出的进程的所有子进程托付给初始进程
+ *
+ * @param pcb 退出的进程的pcb
+ */
+void process_reparent_children(struct process_control_block *pcb)
+{
+    struct process_control_block *reaper = &initial_proc_union.pcb;
+    spin_lock(&process_tree_lock);
+    if (list_empty(&pcb->children))
+    {
+        spin_unlock(&process_tree_lock);
+        return;
+    }
+
+    struct List *node = list_next(&pcb->children);
+    while (node != &pcb->children)
+    {
+        container_of(node, struct process_control_block, sibling)->parent_pcb = reaper;
+        node = list_next(node);
+    }
+
+    // 将整个子进程链表拼接到初始进程的子进程链表的末尾
+    struct List *first = pcb->children.next, *last = pcb->children.prev;
+    struct List *tail = reaper->children.prev;
+    tail->next = first;
+    first->prev = tail;
+    last->next = &reaper->children;
+    reaper->children.prev = last;
+    list_init(&pcb->children);
+
+    spin_unlock(&process_tree_lock);
+}
+
+/**
+ * @brief 根据pid获取进程的pcb
+ *
+ * @param pid
+ * @return struct process_control_block*
+ */
+struct process_control_block *process_get_pcb(long pid)
+{
+    if (pid < 0 || pid >= PROC_MAX_PID)
+        return NULL;
+
+    spin_lock(&process_tree_lock);
+    struct process_control_block *pcb = __pid_hash[__pid_hashfn(pid)];
+    while (pcb != NULL && pcb->pid != pid)
+        pcb = pcb->pid_hash_next;
+    spin_unlock(&process_tree_lock);
+    return pcb;
+}
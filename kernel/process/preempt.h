@@ -6,23 +6,22 @@
 #error Unsupported architecture!
 #endif
 #include "proc-types.h"
+#include <arch/x86_64/percpu.h>
 
 /**
  * @brief 增加自旋锁计数变量
- * 
+ * 自旋锁计数保存在per-cpu区域中，切换进程时才与pcb->preempt_count交换
  */
-#define preempt_disable()   \
-do  \
-{   \
-    ++(current_pcb->preempt_count);\
-} while (0)
+#define preempt_disable() this_cpu_add(preempt_count, 1)
 
 /**
  * @brief 减少自旋锁计数变量
  * 
  */
-#define preempt_enable()   \
-do  \
-{   \
-    --(current_pcb->preempt_count);\
-}while(0)
+#define preempt_enable() this_cpu_add(preempt_count, -1)
+
+/**
+ * @brief 获取当前进程持有的自旋锁的数量
+ *
+ */
+#define preempt_count() this_cpu_read(preempt_count)
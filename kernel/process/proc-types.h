@@ -1,9 +1,14 @@
 #pragma once
 
 #include <common/wait_queue.h>
+#include <common/rbtree.h>
 
 // 进程最大可拥有的文件描述符数量
 #define PROC_MAX_FD_NUM 16
+// 系统中pid的最大值（不含）
+#define PROC_MAX_PID 32768
+// pid哈希表的桶的数量（必须为2的幂）
+#define PROC_PID_HASH_SIZE 1024
 
 // 进程的内核栈大小 32K
 #define STACK_SIZE 32768
@@ -50,6 +55,11 @@ struct thread_struct
 	ul trap_num;
 	// 错误码
 	ul err_code;
+
+	// 浮点上下文保存区域（第一次使用浮点单元时才分配）
+	void *fpu_state;
+	// 最近一次将浮点上下文加载到寄存器中的cpu（-1表示不在任何cpu的寄存器中）
+	long fpu_cpu;
 };
 
 // ========= pcb->flags =========
@@ -59,6 +69,12 @@ struct thread_struct
 #define PF_VFORK (1UL << 2)		 // 标志进程是否由于vfork而存在资源共享
 #define PF_KFORK (1UL << 3)		 // 标志在内核态下调用fork（临时标记，do_fork()结束后会将其复位）
 
+// ========= pcb->policy =========
+// 进程的调度策略
+#define SCHED_NORMAL 0 // 普通进程，由cfs调度
+#define SCHED_FIFO 1   // 实时进程，先进先出，直到主动让出cpu或被更高优先级的进程抢占
+#define SCHED_RR 2	   // 实时进程，相同优先级的进程按时间片轮转
+
 /**
  * @brief 进程控制块
  *
@@ -69,9 +85,10 @@ struct process_control_block
 	volatile long state;
 	// 进程标志：进程、线程、内核线程
 	unsigned long flags;
-	int64_t preempt_count; // 持有的自旋锁的数量
+	int64_t preempt_count; // 持有的自旋锁的数量（运行时以per-cpu区域中的计数为准，被切换出去时保存在这里）
 	long signal;
 	long cpu_id; // 当前进程在哪个CPU核心上运行
+	uint64_t cpus_allowed; // 允许进程运行的cpu的掩码（第i位对应cpu i）
 	// 内存空间分布结构体， 记录内存页表和程序段信息
 	struct mm_struct *mm;
 
@@ -87,20 +104,37 @@ struct process_control_block
 	uint64_t addr_limit;
 
 	long pid;
-	long priority;			 // 优先级
-	int64_t virtual_runtime; // 虚拟运行时间
+	long nice;				 // nice值（-20~19），决定了进程在cfs中的权重
+	int64_t virtual_runtime; // 虚拟运行时间（纳秒，按照权重进行缩放）
+	uint64_t exec_start;	 // 上一次统计运行时间时的时间戳（纳秒）
+	uint64_t sum_exec_runtime; // 累计运行时间（纳秒）
+	struct rb_node run_node; // 在cfs就绪队列的红黑树中的结点
+	long policy;			 // 调度策略
+	long rt_priority;		 // 实时优先级（1~99，数值越大优先级越高），普通进程为0
+	struct List rt_list;	 // 在实时进程就绪队列的优先级链表中的结点
+	uint64_t nvcsw;			 // 主动让出cpu（进入睡眠或退出）的次数
+	uint64_t nivcsw;		 // 被抢占的次数
+	uint64_t run_delay;		 // 在就绪队列中等待运行的累计时间（纳秒）
+	uint64_t nr_runs;		 // 被调度运行的次数
+	uint64_t last_queued;	 // 最近一次加入就绪队列的时间戳（纳秒）
 
 	// 进程拥有的文件描述符的指针数组
 	// todo: 改用动态指针数组
 	struct vfs_file_t *fds[PROC_MAX_FD_NUM];
 
-	// 链表中的下一个pcb
-	struct process_control_block *next_pcb;
+	// pid哈希表的同一个桶中的下一个pcb
+	struct process_control_block *pid_hash_next;
 	// 父进程的pcb
 	struct process_control_block *parent_pcb;
+	struct List children; // 子进程链表
+	struct List sibling;  // 在父进程的子进程链表中的结点
 
 	int32_t exit_code;						// 进程退出时的返回码
+	volatile int32_t on_cpu;				// 进程正在cpu上运行，或者被切换出去后尚未离开它的内核栈（为0时才能释放pcb）
 	wait_queue_node_t wait_child_proc_exit; // 子进程退出等待队列
+
+	uint64_t min_flt; // 次要缺页（无需I/O）的次数
+	uint64_t maj_flt; // 主要缺页（需要从设备读取数据）的次数
 };
 
 // 将进程的pcb和内核栈融合到一起,8字节对齐
@@ -14,6 +14,7 @@
 #include <filesystem/fat32/fat32.h>
 #include <filesystem/devfs/devfs.h>
 #include <filesystem/rootfs/rootfs.h>
+#include <common/bcache.h>
 #include <mm/slab.h>
 #include <common/spinlock.h>
 #include <syscall/syscall.h>
@@ -28,12 +29,11 @@
 #include <mm/mmio.h>
 
 #include <common/lz4.h>
+#include <arch/x86_64/fpu.h>
 
 // #pragma GCC push_options
 // #pragma GCC optimize("O0")
 
-spinlock_t process_global_pid_write_lock; // 增加pid的写锁
-long process_global_pid = 1;              // 系统中最大的pid
 
 extern void system_call(void);
 extern void kernel_thread_func(void);
@@ -48,7 +48,9 @@ struct thread_struct initial_thread =
         .gs = KERNEL_DS,
         .cr2 = 0,
         .trap_num = 0,
-        .err_code = 0};
+        .err_code = 0,
+        .fpu_state = NULL,
+        .fpu_cpu = -1};
 
 // 初始化 初始进程的union ，并将其链接到.data.init_proc段内
 union proc_union initial_proc_union __attribute__((__section__(".data.init_proc_union"))) = {INITIAL_PROC(initial_proc_union.pcb)};
@@ -118,7 +120,7 @@ void process_exit_thread(struct process_control_block *pcb);
  * @param prev 上一个进程的pcb
  * @param next 将要切换到的进程的pcb
  * 由于程序在进入内核的时候已经保存了寄存器，因此这里不需要保存寄存器。
- * 这里切换fs和gs寄存器
+ * 这里切换fs寄存器以及自旋锁计数
  */
 #pragma GCC push_options
 #pragma GCC optimize("O0")
@@ -131,11 +133,18 @@ void __switch_to(struct process_control_block *prev, struct process_control_bloc
 
     __asm__ __volatile__("movq	%%fs,	%0 \n\t"
                          : "=a"(prev->thread->fs));
-    __asm__ __volatile__("movq	%%gs,	%0 \n\t"
-                         : "=a"(prev->thread->gs));
-
     __asm__ __volatile__("movq	%0,	%%fs \n\t" ::"a"(next->thread->fs));
-    __asm__ __volatile__("movq	%0,	%%gs \n\t" ::"a"(next->thread->gs));
+    // 内核态下GS base指向per-cpu区域，不能重新加载gs（加载选择子会清除GS base）
+
+    // 自旋锁计数保存在per-cpu区域中，跟随进程一起切换
+    prev->preempt_count = this_cpu_read(preempt_count);
+    this_cpu_write(preempt_count, next->preempt_count);
+
+    fpu_switch(prev, next);
+
+    // 此后不再使用prev的内核栈与页表，其他cpu上的父进程可以回收它
+    barrier();
+    prev->on_cpu = 0;
 }
 #pragma GCC pop_options
 
@@ -254,76 +263,61 @@ static int process_load_elf_file(struct pt_regs *regs, char *path)
         if (phdr->p_type != PT_LOAD)
             continue;
 
-        int64_t remain_mem_size = phdr->p_memsz;
-        int64_t remain_file_size = phdr->p_filesz;
-        pos = phdr->p_offset;
-
+        uint64_t seg_file_end = phdr->p_vaddr + phdr->p_filesz;
+        uint64_t seg_mem_end = phdr->p_vaddr + phdr->p_memsz;
         uint64_t virt_base = 0;
-        uint64_t beginning_offset = 0; // 由于页表映射导致的virtbase与实际的p_vaddr之间的偏移量
 
-        if (remain_mem_size >= PAGE_2M_SIZE) // 接下来存在映射2M页的情况，因此将vaddr按2M向下对齐
+        if (phdr->p_memsz >= PAGE_2M_SIZE) // 接下来存在映射2M页的情况，因此将vaddr按2M向下对齐
             virt_base = phdr->p_vaddr & PAGE_2M_MASK;
         else // 接下来只有4K页的映射
             virt_base = phdr->p_vaddr & PAGE_4K_MASK;
 
-        beginning_offset = phdr->p_vaddr - virt_base;
-        remain_mem_size += beginning_offset;
-
-        while (remain_mem_size > 0)
+        // 为段创建vma（剩余部分不足2M时，使用4K大小的vma）。页面在第一次被访问时才从文件中读取或清零
+        while (virt_base < seg_mem_end)
         {
-            // kdebug("loading...");
-            int64_t map_size = 0;
-            if (remain_mem_size >= PAGE_2M_SIZE)
+            uint64_t map_size = (!(virt_base & (PAGE_2M_SIZE - 1)) && seg_mem_end - virt_base >= PAGE_2M_SIZE) ? PAGE_2M_SIZE : PAGE_4K_SIZE;
+
+            // 当前vma中由文件内容填充的区域
+            uint64_t file_start = (virt_base > phdr->p_vaddr) ? virt_base : phdr->p_vaddr;
+            uint64_t file_end = (virt_base + map_size < seg_file_end) ? virt_base + map_size : seg_file_end;
+            uint64_t file_len = (file_end > file_start) ? file_end - file_start : 0;
+            uint64_t file_offset = phdr->p_offset + (file_start - phdr->p_vaddr);
+
+            struct vm_area_struct *vma = NULL;
+            int ret = mm_create_vma(current_pcb->mm, virt_base, map_size, VM_USER | VM_ACCESS_FLAGS, NULL, &vma);
+            if (ret == 0 && vma->vm_start == virt_base && vma->vm_end == virt_base + map_size)
             {
-                uint64_t pa = alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED)->addr_phys;
-                struct vm_area_struct *vma = NULL;
-                int ret = mm_create_vma(current_pcb->mm, virt_base, PAGE_2M_SIZE, VM_USER | VM_ACCESS_FLAGS, NULL, &vma);
-                
-                // 防止内存泄露
-                if (ret == -EEXIST)
-                    free_pages(Phy_to_2M_Page(pa), 1);
-                else
-                    mm_map(current_pcb->mm, virt_base, PAGE_2M_SIZE, pa);
-                // mm_map_vma(vma, pa, 0, PAGE_2M_SIZE);
-                io_mfence();
-                memset((void *)virt_base, 0, PAGE_2M_SIZE);
-                map_size = PAGE_2M_SIZE;
+                if (file_len > 0)
+                {
+                    // 可执行文件在进程的生命周期内不会被关闭，因此vma可以直接引用它
+                    vma->vm_ops = &mm_file_vm_ops;
+                    vma->vm_file = filp;
+                    vma->vm_file_start = file_start;
+                    vma->vm_file_offset = file_offset;
+                    vma->vm_file_len = file_len;
+                }
             }
-            else
+            else if (ret == 0 || ret == -EEXIST)
             {
-                // todo: 使用4K、8K、32K大小内存块混合进行分配，提高空间利用率（减少了bmp的大小）
-                map_size = ALIGN(remain_mem_size, PAGE_4K_SIZE);
-                // 循环分配4K大小内存块
-                for (uint64_t off = 0; off < map_size; off += PAGE_4K_SIZE)
+                // 该区域与其他段共用了同一个vma，只能立即加载（写入时由原有的vma提供页面）
+                uint64_t zero_start = (virt_base > phdr->p_vaddr) ? virt_base : phdr->p_vaddr;
+                uint64_t zero_end = (virt_base + map_size < seg_mem_end) ? virt_base + map_size : seg_mem_end;
+                memset((void *)zero_start, 0, zero_end - zero_start);
+                if (file_len > 0)
                 {
-                    uint64_t paddr = virt_2_phys((uint64_t)kmalloc(PAGE_4K_SIZE, 0));
-
-                    struct vm_area_struct *vma = NULL;
-                    int val = mm_create_vma(current_pcb->mm, virt_base + off, PAGE_4K_SIZE, VM_USER | VM_ACCESS_FLAGS, NULL, &vma);
-                    // kdebug("virt_base=%#018lx", virt_base + off);
-                    if (val == -EEXIST)
-                        kfree(phys_2_virt(paddr));
-                    else
-                        mm_map(current_pcb->mm, virt_base + off, PAGE_4K_SIZE, paddr);
-                    // mm_map_vma(vma, paddr, 0, PAGE_4K_SIZE);
-                    io_mfence();
-                    memset((void *)(virt_base + off), 0, PAGE_4K_SIZE);
+                    long file_pos = file_offset;
+                    if (filp->file_ops->read(filp, (char *)file_start, file_len, &file_pos) < 0)
+                    {
+                        retval = -EIO;
+                        goto load_elf_failed;
+                    }
                 }
             }
-
-            pos = filp->file_ops->lseek(filp, pos, SEEK_SET);
-            int64_t val = 0;
-            if (remain_file_size > 0)
+            else
             {
-                int64_t to_trans = (remain_file_size > PAGE_2M_SIZE) ? PAGE_2M_SIZE : remain_file_size;
-                val = filp->file_ops->read(filp, (char *)(virt_base + beginning_offset), to_trans, &pos);
-            }
-
-            if (val < 0)
+                retval = ret;
                 goto load_elf_failed;
-
-            remain_mem_size -= map_size;
-            remain_file_size -= val;
+            }
             virt_base += map_size;
         }
     }
@@ -333,18 +327,14 @@ static int process_load_elf_file(struct pt_regs *regs, char *path)
     regs->rbp = current_pcb->mm->stack_start;
 
     {
+        // 栈的物理页在第一次被访问时才分配
         struct vm_area_struct *vma = NULL;
-        uint64_t pa = alloc_pages(ZONE_NORMAL, 1, PAGE_PGT_MAPPED)->addr_phys;
         int val = mm_create_vma(current_pcb->mm, current_pcb->mm->stack_start - PAGE_2M_SIZE, PAGE_2M_SIZE, VM_USER | VM_ACCESS_FLAGS, NULL, &vma);
+        // 沿用了原有的栈，需要清空栈空间
         if (val == -EEXIST)
-            free_pages(Phy_to_2M_Page(pa), 1);
-        else
-            mm_map_vma(vma, pa, 0, PAGE_2M_SIZE);
+            memset((void *)(current_pcb->mm->stack_start - PAGE_2M_SIZE), 0, PAGE_2M_SIZE);
     }
 
-    // 清空栈空间
-    memset((void *)(current_pcb->mm->stack_start - PAGE_2M_SIZE), 0, PAGE_2M_SIZE);
-
 load_elf_failed:;
     if (buf != NULL)
         kfree(buf);
@@ -374,10 +364,11 @@ ul do_execve(struct pt_regs *regs, char *path, char *argv[], char *envp[])
         // 分配新的内存空间分布结构体
         struct mm_struct *new_mms = (struct mm_struct *)kmalloc(sizeof(struct mm_struct), 0);
         memset(new_mms, 0, sizeof(struct mm_struct));
+        mm_tlb_mm_init(new_mms);
         current_pcb->mm = new_mms;
 
         // 分配顶层页表, 并设置顶层页表的物理地址
-        new_mms->pgd = (pml4t_t *)virt_2_phys(kmalloc(PAGE_4K_SIZE, 0));
+        new_mms->pgd = (pml4t_t *)virt_2_phys(alloc_4k_frames(1, false));
 
         // 由于高2K部分为内核空间，在接下来需要覆盖其数据，因此不用清零
         memset(phys_2_virt(new_mms->pgd), 0, PAGE_4K_SIZE / 2);
@@ -453,6 +444,9 @@ ul do_execve(struct pt_regs *regs, char *path, char *argv[], char *envp[])
     }
     // kdebug("execve ok");
 
+    // 新的程序从初始的浮点上下文开始运行
+    fpu_reset_thread();
+
     regs->cs = USER_CS | 3;
     regs->ds = USER_DS | 3;
     regs->ss = USER_DS | 0x3;
@@ -480,6 +474,7 @@ ul initial_kernel_thread(ul arg)
     // kinfo("initial proc running...\targ:%#018lx", arg);
 
     ahci_init();
+    bcache_init();
     fat32_init();
     rootfs_umount();
 
@@ -493,11 +488,9 @@ ul initial_kernel_thread(ul arg)
         // ktest_start(ktest_test_bitree, 0),
         ktest_start(ktest_test_kfifo, 0),
         ktest_start(ktest_test_mutex, 0),
-<<<<<<< Updated upstream
+        ktest_start(ktest_test_slab, 0),
+        ktest_start(ktest_test_rbtree, 0),
         usb_pid,
-=======
-        ktest_start(ktest_test_rbtree,0),
->>>>>>> Stashed changes
     };
     kinfo("Waiting test thread exit...");
     // 等待测试进程退出
@@ -542,6 +535,7 @@ ul initial_kernel_thread(ul arg)
  */
 void process_exit_notify()
 {
+    process_reparent_children(current_pcb);
 
     wait_queue_wakeup(&current_pcb->parent_pcb->wait_child_proc_exit, PROC_INTERRUPTIBLE);
 }
@@ -655,9 +649,7 @@ void process_init()
         barrier();
         if (*tmp == 0)
         {
-            void *pdpt = kmalloc(PAGE_4K_SIZE, 0);
-            barrier();
-            memset(pdpt, 0, PAGE_4K_SIZE);
+            void *pdpt = alloc_4k_frames(1, true);
             barrier();
             set_pml4t(tmp, mk_pml4t(virt_2_phys(pdpt), PAGE_KERNEL_PGT));
         }
@@ -670,12 +662,12 @@ void process_init()
     kdebug("initial_tss[0].rsp1=%#018lx", initial_tss[0].rsp1);
     kdebug("initial_tss[0].ist1=%#018lx", initial_tss[0].ist1);
 */
-    // 初始化pid的写锁
-
-    spin_init(&process_global_pid_write_lock);
+    // 初始化pid分配器与进程树
+    process_pid_init();
 
     // 初始化进程的循环链表
     list_init(&initial_proc_union.pcb.list);
+    list_init(&initial_proc_union.pcb.rt_list);
     barrier();
     kernel_thread(initial_kernel_thread, 10, CLONE_FS | CLONE_SIGNAL); // 初始化内核线程
     barrier();
@@ -726,22 +718,20 @@ unsigned long do_fork(struct pt_regs *regs, unsigned long clone_flags, unsigned
     if (current_pcb->flags & PF_KTHREAD && stack_start != 0)
         tsk->flags |= PF_KFORK;
 
-    tsk->priority = 2;
+    // nice值、调度策略与cpu掩码继承自父进程，运行时间则重新开始统计
+    tsk->sum_exec_runtime = 0;
+    tsk->nvcsw = tsk->nivcsw = 0;
+    tsk->run_delay = tsk->nr_runs = 0;
     tsk->preempt_count = 0;
+    tsk->on_cpu = 0;
+    tsk->min_flt = 0;
+    tsk->maj_flt = 0;
 
-    // 增加全局的pid并赋值给新进程的pid
-    spin_lock(&process_global_pid_write_lock);
-    tsk->pid = process_global_pid++;
-    barrier();
-    // 加入到进程链表中
-    tsk->next_pcb = initial_proc_union.pcb.next_pcb;
-    barrier();
-    initial_proc_union.pcb.next_pcb = tsk;
-    barrier();
-    tsk->parent_pcb = current_pcb;
-    barrier();
-
-    spin_unlock(&process_global_pid_write_lock);
+    // pid在拷贝成功后才分配，此前不能被其他进程查找到
+    tsk->pid = -1;
+    tsk->pid_hash_next = NULL;
+    list_init(&tsk->children);
+    list_init(&tsk->sibling);
 
     tsk->cpu_id = proc_current_cpu_id;
     tsk->state = PROC_UNINTERRUPTIBLE;
@@ -750,6 +740,8 @@ unsigned long do_fork(struct pt_regs *regs, unsigned long clone_flags, unsigned
     wait_queue_init(&tsk->wait_child_proc_exit, NULL);
     barrier();
     list_init(&tsk->list);
+    RB_CLEAR_NODE(&tsk->run_node);
+    list_init(&tsk->rt_list);
 
     retval = -ENOMEM;
 
@@ -769,8 +761,10 @@ unsigned long do_fork(struct pt_regs *regs, unsigned long clone_flags, unsigned
     if (process_copy_thread(clone_flags, tsk, stack_start, stack_size, regs))
         goto copy_thread_failed;
 
-    // 拷贝成功
-    retval = tsk->pid;
+    // 分配pid，并加入进程树
+    retval = process_link_pcb(tsk);
+    if (retval < 0)
+        goto copy_pid_failed;
 
     tsk->flags &= ~PF_KFORK;
 
@@ -779,6 +773,7 @@ unsigned long do_fork(struct pt_regs *regs, unsigned long clone_flags, unsigned
 
     return retval;
 
+copy_pid_failed:;
 copy_thread_failed:;
     // 回收线程
     process_exit_thread(tsk);
@@ -795,25 +790,6 @@ copy_flags_failed:;
     return 0;
 }
 
-/**
- * @brief 根据pid获取进程的pcb
- *
- * @param pid
- * @return struct process_control_block*
- */
-struct process_control_block *process_get_pcb(long pid)
-{
-    struct process_control_block *pcb = initial_proc_union.pcb.next_pcb;
-
-    // 使用蛮力法搜索指定pid的pcb
-    // todo: 使用哈希表来管理pcb
-    for (; pcb != &initial_proc_union.pcb; pcb = pcb->next_pcb)
-    {
-        if (pcb->pid == pid)
-            return pcb;
-    }
-    return NULL;
-}
 /**
  * @brief 将进程加入到调度器的就绪队列中
  *
@@ -926,10 +902,12 @@ uint64_t process_copy_mm(uint64_t clone_flags, struct process_control_block *pcb
 
     memcpy(new_mms, current_pcb->mm, sizeof(struct mm_struct));
     new_mms->vmas = NULL;
+    new_mms->vma_tree = RB_ROOT;
+    mm_tlb_mm_init(new_mms);
     pcb->mm = new_mms;
 
     // 分配顶层页表, 并设置顶层页表的物理地址
-    new_mms->pgd = (pml4t_t *)virt_2_phys(kmalloc(PAGE_4K_SIZE, 0));
+    new_mms->pgd = (pml4t_t *)virt_2_phys(alloc_4k_frames(1, false));
     // 由于高2K部分为内核空间，在接下来需要覆盖其数据，因此不用清零
     memset(phys_2_virt(new_mms->pgd), 0, PAGE_4K_SIZE / 2);
 
@@ -950,6 +928,14 @@ uint64_t process_copy_mm(uint64_t clone_flags, struct process_control_block *pcb
             continue;
         }
 
+        // 以写时复制的方式共享父进程的页面，fork的开销只与页表的大小有关
+        if (mm_cow_copy_vma(new_mms, vma) == 0)
+        {
+            vma = vma->vm_next;
+            continue;
+        }
+
+        // 该vma不支持写时复制，直接拷贝内存
         int64_t vma_size = vma->vm_end - vma->vm_start;
         // kdebug("vma_size=%ld, vm_start=%#018lx", vma_size, vma->vm_start);
         if (vma_size > PAGE_2M_SIZE / 2)
@@ -974,13 +960,13 @@ uint64_t process_copy_mm(uint64_t clone_flags, struct process_control_block *pcb
         else
         {
             uint64_t map_size = PAGE_4K_ALIGN(vma_size);
-            uint64_t va = (uint64_t)kmalloc(map_size, 0);
+            uint64_t va = (uint64_t)alloc_4k_frames(map_size >> PAGE_4K_SHIFT, false);
 
             struct vm_area_struct *new_vma = NULL;
             int ret = mm_create_vma(new_mms, vma->vm_start, map_size, vma->vm_flags, vma->vm_ops, &new_vma);
             // 防止内存泄露
             if (unlikely(ret == -EEXIST))
-                kfree((void *)va);
+                free_4k_frames((void *)va, map_size >> PAGE_4K_SHIFT);
             else
                 mm_map_vma(new_vma, virt_2_phys(va), 0, map_size);
 
@@ -988,6 +974,8 @@ uint64_t process_copy_mm(uint64_t clone_flags, struct process_control_block *pcb
         }
         vma = vma->vm_next;
     }
+    // 父进程的页表项已被设置为只读
+    mm_tlb_flush_mm(current_pcb->mm);
 
     return retval;
 }
@@ -1024,32 +1012,24 @@ uint64_t process_exit_mm(struct process_control_block *pcb)
         struct vm_area_struct *cur_vma = vma;
         vma = cur_vma->vm_next;
 
-        uint64_t pa;
         // kdebug("vm start=%#018lx, sem=%d", cur_vma->vm_start, cur_vma->anon_vma->sem.counter);
-        mm_unmap_vma(pcb->mm, cur_vma, &pa);
-
-        uint64_t size = (cur_vma->vm_end - cur_vma->vm_start);
-
-        // 释放内存
-        switch (size)
-        {
-        case PAGE_4K_SIZE:
-            kfree(phys_2_virt(pa));
-            break;
-        default:
-            break;
-        }
+        // 取消映射并释放内存（2M页由anon_vma负责释放，4K页框在取消映射时逐个释放）
+        mm_unmap_vma(pcb->mm, cur_vma, NULL);
         vm_area_del(cur_vma);
         vm_area_free(cur_vma);
     }
 
     // 释放顶层页表
-    kfree(current_pgd);
+    if (is_4k_frame(current_pgd))
+        free_4k_frames(current_pgd, 1);
+    else
+        kfree(current_pgd);
     if (unlikely(pcb->mm->vmas != NULL))
     {
         kwarn("pcb.mm.vmas!=NULL");
     }
     // 释放内存空间分布结构体
+    mm_tlb_mm_release(pcb->mm);
     kfree(pcb->mm);
 
     return 0;
@@ -1142,6 +1122,7 @@ uint64_t process_copy_thread(uint64_t clone_flags, struct process_control_block
     thd->rsp = (uint64_t)child_regs;
     thd->fs = current_pcb->thread->fs;
     thd->gs = current_pcb->thread->gs;
+    fpu_copy_thread(pcb);
 
     // 根据是否为内核线程、是否在内核态fork，设置进程的开始执行的地址
     if (pcb->flags & PF_KFORK)
@@ -1161,6 +1142,7 @@ uint64_t process_copy_thread(uint64_t clone_flags, struct process_control_block
  */
 void process_exit_thread(struct process_control_block *pcb)
 {
+    fpu_exit_thread(pcb);
 }
 
 /**
@@ -34,14 +34,17 @@
 		.preempt_count = 0,               \
 		.signal = 0,                      \
 		.cpu_id = 0,                      \
+		.cpus_allowed = CPU_MASK_ALL,     \
 		.mm = &initial_mm,                \
 		.thread = &initial_thread,        \
 		.addr_limit = 0xffffffffffffffff, \
 		.pid = 0,                         \
-		.priority = 2,                    \
+		.nice = 0,                        \
 		.virtual_runtime = 0,             \
+		.policy = SCHED_NORMAL,           \
+		.rt_priority = 0,                 \
 		.fds = {0},                       \
-		.next_pcb = &proc,                \
+		.pid_hash_next = NULL,            \
 		.parent_pcb = &proc,              \
 		.exit_code = 0,                   \
 		.wait_child_proc_exit = 0         \
@@ -121,11 +124,49 @@ void process_init();
  */
 unsigned long do_fork(struct pt_regs *regs, unsigned long clone_flags, unsigned long stack_start, unsigned long stack_size);
 
+// 保护pid分配器、pid哈希表与进程树的锁
+extern spinlock_t process_tree_lock;
+
+/**
+ * @brief 初始化pid分配器（pid 0属于初始进程）
+ *
+ */
+void process_pid_init();
+
+/**
+ * @brief 为新的进程分配pid，将其加入pid哈希表，并加入父进程的子进程链表
+ *
+ * @param pcb 新进程的pcb（parent_pcb已经设置好）
+ * @return long 分配到的pid。pid耗尽时返回-EAGAIN
+ */
+long process_link_pcb(struct process_control_block *pcb);
+
+/**
+ * @brief 将进程从pid哈希表与父进程的子进程链表中删除，并回收其pid
+ *
+ * @param pcb 进程的pcb
+ */
+void process_unlink_pcb(struct process_control_block *pcb);
+
+/**
+ * @brief 将进程从pid哈希表与父进程的子进程链表中删除，并回收其pid（需要持有process_tree_lock）
+ *
+ * @param pcb 进程的pcb
+ */
+void __process_unlink_pcb(struct process_control_block *pcb);
+
+/**
+ * @brief 将退出的进程的所有子进程托付给初始进程
+ *
+ * @param pcb 退出的进程的pcb
+ */
+void process_reparent_children(struct process_control_block *pcb);
+
 /**
  * @brief 根据pid获取进程的pcb
  *
  * @param pid
- * @return struct process_control_block*
+ * @return struct process_control_block* 找不到时返回NULL
  */
 struct process_control_block *process_get_pcb(long pid);
 
@@ -193,16 +234,10 @@ int kernel_thread(unsigned long (*fn)(unsigned long), unsigned long arg, unsigne
  * @param next 下一个进程的pcb
  *
  */
-#define process_switch_mm(next_pcb)                                    \
-	do                                                                 \
-	{                                                                  \
-		asm volatile("movq %0, %%cr3	\n\t" ::"r"(next_pcb->mm->pgd) \
-					 : "memory");                                      \
-	} while (0)
-// flush_tlb();
+#define process_switch_mm(next_pcb) mm_switch_mm((next_pcb)->mm)
 
 // 获取当前cpu id
-#define proc_current_cpu_id (current_pcb->cpu_id)
+#define proc_current_cpu_id (this_cpu_read(cpu_id))
 
 extern unsigned long head_stack_start; // 导出内核层栈基地址（定义在head.S）
 extern ul _stack_start;
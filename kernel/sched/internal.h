@@ -0,0 +1,112 @@
+#pragma once
+
+#include "sched.h"
+
+// 就绪队列中正在排队的进程数量（count中包含了idle进程）
+#define __sched_nr_queued(queue) ((queue)->count - 1)
+// 就绪队列中正在排队的cfs进程数量
+#define __sched_nr_cfs_queued(queue) (__sched_nr_queued(queue) - (queue)->rt.nr_running)
+
+// 已经启用了调度器的cpu
+extern atomic_t __sched_online_mask;
+
+/**
+ * @brief 判断cpu是否已经启用了调度器
+ */
+static __always_inline bool __sched_cpu_online(int cpu)
+{
+    return (atomic_read(&__sched_online_mask) >> cpu) & 1;
+}
+
+/**
+ * @brief 判断进程是否允许在指定的cpu上运行
+ */
+static __always_inline bool __sched_cpu_allowed(struct process_control_block *pcb, int cpu)
+{
+    return (pcb->cpus_allowed >> cpu) & 1;
+}
+
+/**
+ * @brief 调度类：sched()按照优先级依次询问各个调度类，由它们管理各自的就绪队列
+ * 所有的操作都需要持有cpu的就绪队列的锁
+ *
+ */
+struct sched_class_t
+{
+    // 将被唤醒的进程加入就绪队列
+    void (*enqueue)(struct sched_queue_t *queue, struct process_control_block *pcb);
+    // 将排队中的进程移出就绪队列
+    void (*dequeue)(struct sched_queue_t *queue, struct process_control_block *pcb);
+    // 正在运行的进程被切换出去，但仍然处于就绪状态，将其放回就绪队列
+    void (*put_prev)(struct sched_queue_t *queue, struct process_control_block *pcb);
+    // 从就绪队列中取出下一个要运行的进程，没有可运行的进程时返回NULL
+    struct process_control_block *(*pick_next)(struct sched_queue_t *queue);
+    // 进程被选中运行（可能就是正在运行的进程）
+    void (*set_curr)(struct sched_queue_t *queue, struct process_control_block *pcb);
+    // 统计正在运行的进程（queue->curr）的运行时间
+    void (*update_curr)(struct sched_queue_t *queue);
+    // 时钟中断：统计运行时间，需要切换进程时为其设置PF_NEED_SCHED
+    void (*tick)(struct sched_queue_t *queue);
+    // 同一调度类中，新加入队列的进程是否应当抢占正在运行的进程
+    bool (*check_preempt)(struct sched_queue_t *queue, struct process_control_block *pcb);
+};
+
+extern struct sched_class_t sched_rt_class;
+extern struct sched_class_t sched_fair_class;
+
+/**
+ * @brief 判断进程是否为实时进程
+ */
+static __always_inline bool __sched_is_rt(struct process_control_block *pcb)
+{
+    return pcb->policy == SCHED_FIFO || pcb->policy == SCHED_RR;
+}
+
+/**
+ * @brief 获取进程所属的调度类
+ */
+static __always_inline struct sched_class_t *__sched_class_of(struct process_control_block *pcb)
+{
+    return __sched_is_rt(pcb) ? &sched_rt_class : &sched_fair_class;
+}
+
+/**
+ * @brief 检查实时进程带宽控制的周期是否已经结束，若结束则开始新的周期
+ *
+ * @param queue 就绪队列
+ * @return true 实时进程解除了限制，并且有实时进程正在排队
+ * @return false
+ */
+bool __sched_rt_refresh_period(struct sched_queue_t *queue);
+
+/**
+ * @brief 初始化实时进程的就绪队列
+ *
+ * @param queue 就绪队列
+ */
+void __sched_rt_init_queue(struct sched_queue_t *queue);
+
+/**
+ * @brief 记录进程加入就绪队列的时间，用于统计其等待运行的时间（需要持有队列的锁）
+ *
+ * @param queue 进程加入的就绪队列
+ * @param pcb 进程的pcb
+ * @param wakeup 进程是否由于被唤醒而加入队列
+ */
+void __sched_stat_enqueue(struct sched_queue_t *queue, struct process_control_block *pcb, bool wakeup);
+
+/**
+ * @brief 在上下文切换时更新统计信息（需要持有队列的锁）
+ *
+ * @param queue 当前cpu的就绪队列
+ * @param prev 被切换出去的进程
+ * @param next 即将运行的进程
+ */
+void __sched_stat_switch(struct sched_queue_t *queue, struct process_control_block *prev, struct process_control_block *next);
+
+/**
+ * @brief 在时钟中断时采样就绪队列的长度（需要持有队列的锁）
+ *
+ * @param queue 当前cpu的就绪队列
+ */
+void __sched_stat_tick(struct sched_queue_t *queue);
@@ -0,0 +1,196 @@
+#include "internal.h"
+
+uint64_t sched_rt_period_ns = SCHED_RT_DEFAULT_PERIOD_NS;
+uint64_t sched_rt_runtime_ns = SCHED_RT_DEFAULT_RUNTIME_NS;
+uint64_t sched_rr_timeslice_ns = SCHED_RR_DEFAULT_TIMESLICE_NS;
+
+// 进程在优先级链表数组中的下标（下标越小优先级越高）
+#define __sched_rt_index(pcb) (SCHED_RT_PRIO_MAX - (pcb)->rt_priority)
+
+/**
+ * @brief 判断SCHED_RR进程的时间片是否已经耗尽
+ */
+static __always_inline bool __sched_rr_expired(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    return pcb->policy == SCHED_RR && pcb->sum_exec_runtime - queue->slice_exec_start >= sched_rr_timeslice_ns;
+}
+
+/**
+ * @brief 将进程加入其优先级对应的链表
+ *
+ * @param queue 就绪队列
+ * @param pcb 进程的pcb
+ * @param head 是否插入到链表的头部（被抢占的进程应当最先恢复运行）
+ */
+static void __sched_rt_insert(struct sched_queue_t *queue, struct process_control_block *pcb, bool head)
+{
+    struct sched_rt_queue_t *rt = &queue->rt;
+    int idx = __sched_rt_index(pcb);
+
+    if (head)
+        list_add(&rt->queue[idx], &pcb->rt_list);
+    else
+        list_append(&rt->queue[idx], &pcb->rt_list);
+    rt->bitmap[idx >> 6] |= (1UL << (idx & 63));
+    ++rt->nr_running;
+    ++queue->count;
+}
+
+/**
+ * @brief 将进程从其优先级对应的链表中删除
+ *
+ * @param queue 就绪队列
+ * @param pcb 进程的pcb
+ */
+static void __sched_rt_remove(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    struct sched_rt_queue_t *rt = &queue->rt;
+    int idx = __sched_rt_index(pcb);
+
+    list_del(&pcb->rt_list);
+    list_init(&pcb->rt_list);
+    if (list_empty(&rt->queue[idx]))
+        rt->bitmap[idx >> 6] &= ~(1UL << (idx & 63));
+    --rt->nr_running;
+    --queue->count;
+}
+
+/**
+ * @brief 在位图中查找优先级最高的非空链表
+ *
+ * @param rt 实时进程的就绪队列
+ * @return int 链表的下标。没有排队的进程时返回-1
+ */
+static int __sched_rt_first_index(struct sched_rt_queue_t *rt)
+{
+    for (int i = 0; i < SCHED_RT_BITMAP_WORDS; ++i)
+    {
+        if (rt->bitmap[i])
+            return (i << 6) + __builtin_ctzl(rt->bitmap[i]);
+    }
+    return -1;
+}
+
+/**
+ * @brief 检查实时进程带宽控制的周期是否已经结束，若结束则开始新的周期
+ *
+ * @param queue 就绪队列
+ * @return true 实时进程解除了限制，并且有实时进程正在排队
+ * @return false
+ */
+bool __sched_rt_refresh_period(struct sched_queue_t *queue)
+{
+    struct sched_rt_queue_t *rt = &queue->rt;
+    uint64_t now = sched_clock();
+    if (now - rt->period_start < sched_rt_period_ns)
+        return false;
+
+    rt->period_start = now;
+    rt->rt_time = 0;
+    if (!rt->throttled)
+        return false;
+    rt->throttled = false;
+    return rt->nr_running > 0;
+}
+
+/**
+ * @brief 初始化实时进程的就绪队列
+ *
+ * @param queue 就绪队列
+ */
+void __sched_rt_init_queue(struct sched_queue_t *queue)
+{
+    struct sched_rt_queue_t *rt = &queue->rt;
+    for (int i = 0; i < SCHED_RT_NR_PRIO; ++i)
+        list_init(&rt->queue[i]);
+    for (int i = 0; i < SCHED_RT_BITMAP_WORDS; ++i)
+        rt->bitmap[i] = 0;
+    rt->nr_running = 0;
+    rt->rt_time = 0;
+    rt->period_start = 0;
+    rt->throttled = false;
+}
+
+/**
+ * @brief 统计正在运行的实时进程的运行时间，并累计到本周期的实时进程运行时间中
+ *
+ * @param queue 就绪队列
+ */
+static void __sched_rt_update_curr(struct sched_queue_t *queue)
+{
+    struct process_control_block *curr = queue->curr;
+    uint64_t now = sched_clock();
+    if (now <= curr->exec_start)
+        return;
+    uint64_t delta = now - curr->exec_start;
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta;
+
+    queue->rt.rt_time += delta;
+    // 实时进程在本周期内的运行时间耗尽，暂停运行实时进程，避免普通进程被饿死
+    if (sched_rt_runtime_ns < sched_rt_period_ns && queue->rt.rt_time >= sched_rt_runtime_ns)
+        queue->rt.throttled = true;
+}
+
+static void __sched_rt_enqueue(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_rt_insert(queue, pcb, false);
+}
+
+static void __sched_rt_dequeue(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_rt_remove(queue, pcb);
+}
+
+static void __sched_rt_put_prev(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    // 被抢占的进程回到同优先级链表的头部；时间片耗尽的SCHED_RR进程则排到末尾
+    __sched_rt_insert(queue, pcb, !__sched_rr_expired(queue, pcb));
+}
+
+static struct process_control_block *__sched_rt_pick_next(struct sched_queue_t *queue)
+{
+    __sched_rt_refresh_period(queue);
+    if (queue->rt.throttled)
+        return NULL;
+
+    int idx = __sched_rt_first_index(&queue->rt);
+    if (idx < 0)
+        return NULL;
+
+    struct process_control_block *pcb = container_of(list_next(&queue->rt.queue[idx]), struct process_control_block, rt_list);
+    __sched_rt_remove(queue, pcb);
+    return pcb;
+}
+
+static void __sched_rt_set_curr(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    pcb->exec_start = sched_clock();
+    // 继续运行的SCHED_RR进程只有在时间片耗尽后才获得新的时间片
+    if (pcb != queue->curr || __sched_rr_expired(queue, pcb))
+        queue->slice_exec_start = pcb->sum_exec_runtime;
+}
+
+static void __sched_rt_tick(struct sched_queue_t *queue)
+{
+    struct process_control_block *curr = queue->curr;
+    __sched_rt_update_curr(queue);
+    if (queue->rt.throttled || __sched_rr_expired(queue, curr))
+        curr->flags |= PF_NEED_SCHED;
+}
+
+static bool __sched_rt_check_preempt(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    return pcb->rt_priority > queue->curr->rt_priority;
+}
+
+struct sched_class_t sched_rt_class = {
+    .enqueue = __sched_rt_enqueue,
+    .dequeue = __sched_rt_dequeue,
+    .put_prev = __sched_rt_put_prev,
+    .pick_next = __sched_rt_pick_next,
+    .set_curr = __sched_rt_set_curr,
+    .update_curr = __sched_rt_update_curr,
+    .tick = __sched_rt_tick,
+    .check_preempt = __sched_rt_check_preempt,
+};
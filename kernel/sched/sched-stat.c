@@ -0,0 +1,217 @@
+/**
+ * @file sched-stat.c
+ * @brief 调度器的统计信息：上下文切换次数、等待运行时间的直方图、idle时间以及就绪队列长度
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "internal.h"
+#include <common/errno.h>
+#include <process/ptrace.h>
+#include <arch/x86_64/fpu.h>
+
+/**
+ * @brief 计算等待时间在直方图中对应的桶
+ *
+ * @param delay_ns 等待时间（纳秒）
+ * @return int 桶的下标
+ */
+static __always_inline int __sched_stat_bucket(uint64_t delay_ns)
+{
+    uint64_t us = delay_ns / 1000;
+    if (us == 0)
+        return 0;
+    int bucket = 64 - __builtin_clzl(us);
+    return bucket < SCHED_STAT_NR_BUCKETS ? bucket : SCHED_STAT_NR_BUCKETS - 1;
+}
+
+/**
+ * @brief 记录进程加入就绪队列的时间，用于统计其等待运行的时间（需要持有队列的锁）
+ *
+ * @param queue 进程加入的就绪队列
+ * @param pcb 进程的pcb
+ * @param wakeup 进程是否由于被唤醒而加入队列
+ */
+void __sched_stat_enqueue(struct sched_queue_t *queue, struct process_control_block *pcb, bool wakeup)
+{
+    pcb->last_queued = sched_clock();
+    if (wakeup)
+        ++queue->stat.nr_wakeups;
+}
+
+/**
+ * @brief 在上下文切换时更新统计信息（需要持有队列的锁）
+ *
+ * @param queue 当前cpu的就绪队列
+ * @param prev 被切换出去的进程
+ * @param next 即将运行的进程
+ */
+void __sched_stat_switch(struct sched_queue_t *queue, struct process_control_block *prev, struct process_control_block *next)
+{
+    struct sched_cpu_stat_t *stat = &queue->stat;
+    uint64_t now = sched_clock();
+
+    ++stat->nr_switches;
+    if (prev == queue->idle)
+    {
+        if (queue->idle_start != 0 && now > queue->idle_start)
+            stat->idle_time += now - queue->idle_start;
+    }
+    else if (prev->state == PROC_RUNNING) // 仍处于就绪状态，说明是被抢占的
+    {
+        ++prev->nivcsw;
+        ++stat->nr_involuntary;
+    }
+    else
+    {
+        ++prev->nvcsw;
+        ++stat->nr_voluntary;
+    }
+
+    if (next == queue->idle)
+    {
+        queue->idle_start = now;
+        return;
+    }
+
+    ++next->nr_runs;
+    if (next->last_queued == 0 || now < next->last_queued)
+        return;
+    uint64_t delay = now - next->last_queued;
+    next->run_delay += delay;
+    stat->run_delay += delay;
+    ++stat->nr_run_delay;
+    ++stat->run_delay_hist[__sched_stat_bucket(delay)];
+}
+
+/**
+ * @brief 在时钟中断时采样就绪队列的长度（需要持有队列的锁）
+ *
+ * @param queue 当前cpu的就绪队列
+ */
+void __sched_stat_tick(struct sched_queue_t *queue)
+{
+    uint64_t len = __sched_nr_queued(queue);
+    queue->stat.rq_len_sum += len;
+    ++queue->stat.rq_len_samples;
+    if (len > queue->stat.rq_len_max)
+        queue->stat.rq_len_max = len;
+}
+
+/**
+ * @brief 获取cpu的调度统计信息
+ *
+ * @param cpu cpu编号
+ * @param stat 返回的统计信息
+ * @return int 错误码
+ */
+static int __sched_stat_cpu(long cpu, struct sched_cpu_stat_t *stat)
+{
+    if (cpu < 0 || cpu >= MAX_CPU_NUM)
+        return -EINVAL;
+    if (!__sched_cpu_online(cpu))
+        return -ENODEV;
+
+    struct sched_queue_t *queue = cpu_rq(cpu);
+    uint64_t rflags;
+    spin_lock_irqsave(&queue->lock, rflags);
+    memcpy(stat, &queue->stat, sizeof(struct sched_cpu_stat_t));
+    // cpu正处于空闲状态，加上本次空闲已经经过的时间
+    uint64_t now = sched_clock();
+    if (queue->curr == queue->idle && queue->idle_start != 0 && now > queue->idle_start)
+        stat->idle_time += now - queue->idle_start;
+    spin_unlock_irqrestore(&queue->lock, rflags);
+    return 0;
+}
+
+/**
+ * @brief 获取cpu的浮点上下文切换统计信息
+ *
+ * @param cpu cpu编号
+ * @param stat 返回的统计信息
+ * @return int 错误码
+ */
+static int __sched_stat_fpu(long cpu, struct fpu_stat_t *stat)
+{
+    if (cpu < 0 || cpu >= MAX_CPU_NUM)
+        return -EINVAL;
+    if (!__sched_cpu_online(cpu))
+        return -ENODEV;
+    fpu_get_stat(cpu, stat);
+    return 0;
+}
+
+/**
+ * @brief 获取进程的调度统计信息
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @param stat 返回的统计信息
+ * @return int 错误码
+ */
+static int __sched_stat_process(long pid, struct sched_proc_stat_t *stat)
+{
+    struct process_control_block *pcb = (pid == 0) ? current_pcb : process_get_pcb(pid);
+    if (pcb == NULL)
+        return -ESRCH;
+
+    stat->nvcsw = pcb->nvcsw;
+    stat->nivcsw = pcb->nivcsw;
+    stat->run_delay = pcb->run_delay;
+    stat->nr_runs = pcb->nr_runs;
+    stat->sum_exec_runtime = pcb->sum_exec_runtime;
+    return 0;
+}
+
+/**
+ * @brief 获取调度器的统计信息
+ *
+ * @param r8 which 查询的对象（SCHED_STAT_CPU、SCHED_STAT_PROCESS或SCHED_STAT_FPU）
+ * @param r9 id cpu编号，或者进程的pid（为0时表示当前进程）
+ * @param r10 buf 返回的统计信息结构体的地址
+ * @return uint64_t 错误码
+ */
+uint64_t sys_sched_stat(struct pt_regs *regs)
+{
+    long id = (long)regs->r9;
+    void *buf = (void *)regs->r10;
+    if (buf == NULL)
+        return -EINVAL;
+
+    int retval;
+    uint64_t size;
+    union
+    {
+        struct sched_cpu_stat_t cpu;
+        struct sched_proc_stat_t proc;
+        struct fpu_stat_t fpu;
+    } stat;
+
+    switch (regs->r8)
+    {
+    case SCHED_STAT_CPU:
+        retval = __sched_stat_cpu(id, &stat.cpu);
+        size = sizeof(struct sched_cpu_stat_t);
+        break;
+    case SCHED_STAT_PROCESS:
+        retval = __sched_stat_process(id, &stat.proc);
+        size = sizeof(struct sched_proc_stat_t);
+        break;
+    case SCHED_STAT_FPU:
+        retval = __sched_stat_fpu(id, &stat.fpu);
+        size = sizeof(struct fpu_stat_t);
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (retval != 0)
+        return retval;
+
+    if (regs->cs == (USER_CS | 0x3))
+        copy_to_user(buf, &stat, size);
+    else
+        memcpy(buf, &stat, size);
+    return 0;
+}
@@ -1,140 +1,675 @@
 #include "sched.h"
+#include "internal.h"
 #include <common/kprint.h>
 #include <driver/video/video.h>
 #include <common/spinlock.h>
+#include <common/cpu.h>
+#include <smp/ipi.h>
+#include <driver/interrupt/apic/apic_timer.h>
+#include <common/errno.h>
+#include <common/sys/resource.h>
 
 
-struct sched_queue_t sched_cfs_ready_queue[MAX_CPU_NUM]; // 就绪队列
+// 已经启用了调度器的cpu
+atomic_t __sched_online_mask;
+
+uint64_t sched_cfs_latency_ns = SCHED_CFS_DEFAULT_LATENCY_NS;
+uint64_t sched_cfs_min_granularity_ns = SCHED_CFS_DEFAULT_MIN_GRANULARITY_NS;
+
+/**
+ * @brief nice值到权重的映射表（nice值每增加1，进程获得的cpu时间约减少10%）
+ *
+ */
+static const uint32_t __sched_prio_to_weight[40] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+/**
+ * @brief 获取进程的权重
+ */
+static __always_inline uint64_t __sched_weight(struct process_control_block *pcb)
+{
+    return __sched_prio_to_weight[pcb->nice - SCHED_NICE_MIN];
+}
 
 /**
- * @brief 从就绪队列中取出PCB
+ * @brief 获取调度器使用的时钟（基于TSC，单位：纳秒）
  *
- * @return struct process_control_block*
+ * @return uint64_t 纳秒数。TSC的频率尚未测定时返回0
  */
-struct process_control_block *sched_cfs_dequeue()
+uint64_t sched_clock()
 {
-    if (list_empty(&sched_cfs_ready_queue[proc_current_cpu_id].proc_queue.list))
+    if (unlikely(Cpu_tsc_freq == 0))
+        return 0;
+    uint64_t tsc = rdtsc();
+    // 分两部分计算，避免乘法溢出
+    return (tsc / Cpu_tsc_freq) * 1000000000UL + (tsc % Cpu_tsc_freq) * 1000000000UL / Cpu_tsc_freq;
+}
+
+/**
+ * @brief 计算cpu的负载：排队的进程数量，加上正在运行的非idle进程（未加锁，仅作为参考）
+ */
+static __always_inline long __sched_cpu_load(int cpu)
+{
+    struct sched_queue_t *queue = cpu_rq(cpu);
+    return __sched_nr_queued(queue) + (queue->curr != queue->idle);
+}
+
+/**
+ * @brief 按照cpu编号从小到大的顺序对两个就绪队列加锁，避免死锁（调用者需要已经关闭中断）
+ */
+static void __sched_double_lock(int cpu1, int cpu2)
+{
+    if (cpu1 == cpu2)
+        spin_lock(&cpu_rq(cpu1)->lock);
+    else if (cpu1 < cpu2)
     {
-        // kdebug("list empty, count=%d", sched_cfs_ready_queue[proc_current_cpu_id].count);
-        return &initial_proc_union.pcb;
+        spin_lock(&cpu_rq(cpu1)->lock);
+        spin_lock(&cpu_rq(cpu2)->lock);
     }
+    else
+    {
+        spin_lock(&cpu_rq(cpu2)->lock);
+        spin_lock(&cpu_rq(cpu1)->lock);
+    }
+}
 
-    struct process_control_block *proc = container_of(list_next(&sched_cfs_ready_queue[proc_current_cpu_id].proc_queue.list), struct process_control_block, list);
+/**
+ * @brief 释放__sched_double_lock()获得的锁
+ */
+static void __sched_double_unlock(int cpu1, int cpu2)
+{
+    spin_unlock(&cpu_rq(cpu1)->lock);
+    if (cpu1 != cpu2)
+        spin_unlock(&cpu_rq(cpu2)->lock);
+}
 
-    list_del(&proc->list);
-    --sched_cfs_ready_queue[proc_current_cpu_id].count;
-    return proc;
+/**
+ * @brief 获取就绪队列中虚拟运行时间最小的进程（不将其移出队列）
+ *
+ * @param queue 就绪队列
+ * @return struct process_control_block* 队列为空时返回NULL
+ */
+static __always_inline struct process_control_block *__sched_cfs_peek(struct sched_queue_t *queue)
+{
+    if (queue->rb_leftmost == NULL)
+        return NULL;
+    return rb_entry(queue->rb_leftmost, struct process_control_block, run_node);
 }
 
 /**
- * @brief 将PCB加入就绪队列
+ * @brief 将进程按照虚拟运行时间插入红黑树（虚拟运行时间相同的进程按照先来先服务的顺序排列）
  *
- * @param pcb
+ * @param queue 就绪队列
+ * @param pcb 进程的pcb
  */
-void sched_cfs_enqueue(struct process_control_block *pcb)
+static void __sched_cfs_insert(struct sched_queue_t *queue, struct process_control_block *pcb)
 {
-    if (pcb == initial_proc[proc_current_cpu_id])
-        return;
-    struct process_control_block *proc = container_of(list_next(&sched_cfs_ready_queue[proc_current_cpu_id].proc_queue.list), struct process_control_block, list);
-    if ((list_empty(&sched_cfs_ready_queue[proc_current_cpu_id].proc_queue.list)) == 0)
+    struct rb_node **link = &queue->tasks_timeline.rb_node;
+    struct rb_node *parent = NULL;
+    bool leftmost = true;
+
+    while (*link != NULL)
     {
-        while (proc->virtual_runtime < pcb->virtual_runtime)
+        parent = *link;
+        if (pcb->virtual_runtime < rb_entry(parent, struct process_control_block, run_node)->virtual_runtime)
+            link = &parent->rb_left;
+        else
         {
-            proc = container_of(list_next(&proc->list), struct process_control_block, list);
+            link = &parent->rb_right;
+            leftmost = false;
         }
     }
-    list_append(&proc->list, &pcb->list);
-    ++sched_cfs_ready_queue[proc_current_cpu_id].count;
+
+    rb_link_node(&pcb->run_node, parent, link);
+    rb_insert_color(&pcb->run_node, &queue->tasks_timeline, NULL);
+    if (leftmost)
+        queue->rb_leftmost = &pcb->run_node;
+    queue->load_weight += __sched_weight(pcb);
 }
 
 /**
- * @brief 包裹shced_cfs_enqueue(),将PCB加入就绪队列
- * 
- * @param pcb
+ * @brief 将进程从红黑树中删除
+ *
+ * @param queue 就绪队列
+ * @param pcb 进程的pcb
  */
-void sched_enqueue(struct process_control_block *pcb)
+static void __sched_cfs_erase(struct sched_queue_t *queue, struct process_control_block *pcb)
 {
-    sched_cfs_enqueue(pcb);
+    if (queue->rb_leftmost == &pcb->run_node)
+        queue->rb_leftmost = rb_next(&pcb->run_node);
+    rb_erase(&pcb->run_node, &queue->tasks_timeline, NULL);
+    RB_CLEAR_NODE(&pcb->run_node);
+    queue->load_weight -= __sched_weight(pcb);
 }
 
 /**
- * @brief 调度函数
+ * @brief 更新就绪队列的最小虚拟运行时间：取正在运行的进程与队列中最左进程的较小值，并保证其单调递增
  *
+ * @param queue 就绪队列
  */
-void sched_cfs()
+static void __sched_cfs_update_min_vruntime(struct sched_queue_t *queue)
 {
+    struct process_control_block *curr = queue->curr;
+    struct process_control_block *left = __sched_cfs_peek(queue);
+    int64_t vruntime;
 
-    cli();
+    // idle进程与实时进程的虚拟运行时间没有意义，不参与计算
+    if (curr != NULL && curr != queue->idle && !__sched_is_rt(curr) && curr->state == PROC_RUNNING)
+    {
+        vruntime = curr->virtual_runtime;
+        if (left != NULL && left->virtual_runtime < vruntime)
+            vruntime = left->virtual_runtime;
+    }
+    else if (left != NULL)
+        vruntime = left->virtual_runtime;
+    else
+        return;
 
-    current_pcb->flags &= ~PF_NEED_SCHED;
-    struct process_control_block *proc = sched_cfs_dequeue();
-    // kdebug("sched_cfs_ready_queue[proc_current_cpu_id].count = %d", sched_cfs_ready_queue[proc_current_cpu_id].count);
-    if (current_pcb->virtual_runtime >= proc->virtual_runtime || current_pcb->state != PROC_RUNNING) // 当前进程运行时间大于了下一进程的运行时间，进行切换
+    if (vruntime > queue->min_vruntime)
+        queue->min_vruntime = vruntime;
+}
+
+/**
+ * @brief 将进程插入就绪队列（需要持有队列的锁）
+ *
+ * @param queue 就绪队列
+ * @param pcb 进程的pcb
+ */
+static void __sched_cfs_enqueue_locked(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_cfs_update_min_vruntime(queue);
+    // 长时间睡眠的进程（或新创建的进程）的虚拟运行时间远小于队列中的其他进程，
+    // 将其放置在min_vruntime附近（最多获得半个调度周期的补偿），避免它在被唤醒后长时间独占cpu
+    int64_t min_vruntime = queue->min_vruntime - (int64_t)(sched_cfs_latency_ns / 2);
+    if (pcb->virtual_runtime < min_vruntime)
+        pcb->virtual_runtime = min_vruntime;
+
+    __sched_cfs_insert(queue, pcb);
+    ++queue->count;
+}
+
+/**
+ * @brief 将排队中的进程迁移到另一个cpu的就绪队列（需要持有两个队列的锁）
+ * 虚拟运行时间按照两个队列的min_vruntime进行换算，使进程在新的队列中保持相对的位置
+ *
+ * @param pcb 进程的pcb
+ * @param src 进程当前所在的cpu
+ * @param dst 目标cpu
+ */
+static void __sched_migrate_locked(struct process_control_block *pcb, int src, int dst)
+{
+    struct sched_queue_t *src_queue = cpu_rq(src);
+    struct sched_queue_t *dst_queue = cpu_rq(dst);
+
+    __sched_cfs_erase(src_queue, pcb);
+    --src_queue->count;
+
+    pcb->virtual_runtime = pcb->virtual_runtime - src_queue->min_vruntime + dst_queue->min_vruntime;
+    pcb->cpu_id = dst;
+    __sched_cfs_enqueue_locked(dst_queue, pcb);
+}
+
+/**
+ * @brief 负载均衡：从负载最高的cpu的就绪队列中窃取进程到当前cpu（调用者需要已经关闭中断）
+ *
+ * @param this_cpu 当前cpu
+ * @return int 迁移的进程数量
+ */
+static int __sched_load_balance(int this_cpu)
+{
+    int busiest = -1;
+    long max_load = 0;
+    for (int cpu = 0; cpu < MAX_CPU_NUM; ++cpu)
+    {
+        if (cpu == this_cpu || !__sched_cpu_online(cpu))
+            continue;
+        long load = __sched_cpu_load(cpu);
+        // 目前只迁移cfs进程
+        if (load > max_load && __sched_nr_cfs_queued(cpu_rq(cpu)) > 0)
+        {
+            max_load = load;
+            busiest = cpu;
+        }
+    }
+    // 负载的差距不足2时，迁移进程只会把不均衡转移到当前cpu上
+    if (busiest < 0 || max_load - __sched_cpu_load(this_cpu) < 2)
+        return 0;
+
+    __sched_double_lock(this_cpu, busiest);
+    struct sched_queue_t *queue = cpu_rq(busiest);
+    long nr_move = (__sched_cpu_load(busiest) - __sched_cpu_load(this_cpu)) / 2;
+    int moved = 0;
+
+    // 从虚拟运行时间最大的一端开始迁移：这些进程在原来的cpu上最晚才会被运行
+    struct rb_node *node = rb_last(&queue->tasks_timeline);
+    while (node != NULL && moved < nr_move)
+    {
+        struct process_control_block *pcb = rb_entry(node, struct process_control_block, run_node);
+        node = rb_prev(node);
+        // 刚被切换出去的进程的上下文可能尚未保存完毕，不能迁移
+        if (pcb == queue->prev || !__sched_cpu_allowed(pcb, this_cpu))
+            continue;
+        __sched_migrate_locked(pcb, busiest, this_cpu);
+        ++moved;
+    }
+
+    __sched_double_unlock(this_cpu, busiest);
+    return moved;
+}
+
+/**
+ * @brief 为进程选择一个默认的cpu：进程上一次运行的cpu、当前cpu，或者第一个允许运行的已启用的cpu
+ *
+ * @param pcb 进程的pcb
+ * @return int cpu编号
+ */
+static int __sched_default_cpu(struct process_control_block *pcb)
+{
+    if (__sched_cpu_online(pcb->cpu_id) && __sched_cpu_allowed(pcb, pcb->cpu_id))
+        return pcb->cpu_id;
+    if (__sched_cpu_allowed(pcb, proc_current_cpu_id))
+        return proc_current_cpu_id;
+    for (int cpu = 0; cpu < MAX_CPU_NUM; ++cpu)
     {
+        if (__sched_cpu_online(cpu) && __sched_cpu_allowed(pcb, cpu))
+            return cpu;
+    }
+    // 掩码中没有已经启用的cpu（sched_setaffinity()不允许出现这种情况）
+    return __sched_cpu_online(pcb->cpu_id) ? pcb->cpu_id : proc_current_cpu_id;
+}
 
-        if (current_pcb->state == PROC_RUNNING) // 本次切换由于时间片到期引发，则再次加入就绪队列，否则交由其它功能模块进行管理
-            sched_cfs_enqueue(current_pcb);
-        // kdebug("proc->pid=%d, count=%d", proc->pid, sched_cfs_ready_queue[proc_current_cpu_id].count);
-        if (sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies <= 0)
+/**
+ * @brief 为被唤醒的进程选择运行的cpu：优先选择进程上一次运行的cpu，其他cpu的负载更低时选择负载最低的cpu
+ *
+ * @param pcb 进程的pcb
+ * @return int cpu编号
+ */
+static int __sched_select_cpu(struct process_control_block *pcb)
+{
+    int best = __sched_default_cpu(pcb);
+    long best_load = __sched_cpu_load(best);
+
+    for (int cpu = 0; cpu < MAX_CPU_NUM && best_load > 0; ++cpu)
+    {
+        if (!__sched_cpu_online(cpu) || !__sched_cpu_allowed(pcb, cpu))
+            continue;
+        long load = __sched_cpu_load(cpu);
+        if (load < best_load)
         {
-            switch (proc->priority)
-            {
-            case 0:
-            case 1:
-                sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies = 4 / sched_cfs_ready_queue[proc_current_cpu_id].count;
-                break;
-            case 2:
-            default:
-                sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies = (4 / sched_cfs_ready_queue[proc_current_cpu_id].count) << 2;
-                break;
-            }
+            best = cpu;
+            best_load = load;
         }
+    }
+    return best;
+}
 
-        // if (proc->pid == 0)
-        // {
-        //     kdebug("switch to pid0, current pid%ld, vrt=%ld      pid0 vrt=%ld", current_pcb->pid, current_pcb->virtual_runtime, proc->virtual_runtime);
-        //     if(current_pcb->state != PROC_RUNNING)
-        //         kdebug("current_pcb->state!=PROC_RUNNING");
-        // }
-        
-        process_switch_mm(proc);
+/**
+ * @brief 通过IPI要求指定的cpu重新进行调度
+ *
+ * @param cpu 目标cpu
+ */
+static void __sched_kick_cpu(int cpu)
+{
+    ipi_send_IPI(DEST_PHYSICAL, IDLE, ICR_LEVEL_DE_ASSERT, EDGE_TRIGGER, SCHED_RESCHED_IPI_VECTOR, ICR_APIC_FIXED, ICR_No_Shorthand, cpu_core_info[cpu].apic_id);
+}
 
-        switch_proc(current_pcb, proc);
+/**
+ * @brief 对进程所在cpu的就绪队列加锁（调用者需要已经关闭中断）
+ * 进程的cpu_id只会在持有其所在cpu的就绪队列的锁时被修改，加锁后需要重新检查
+ *
+ * @param pcb 进程的pcb
+ * @return struct sched_queue_t* 已经加锁的就绪队列
+ */
+static struct sched_queue_t *__sched_task_queue_lock(struct process_control_block *pcb)
+{
+    struct sched_queue_t *queue;
+    while (1)
+    {
+        queue = cpu_rq(pcb->cpu_id);
+        spin_lock(&queue->lock);
+        if (likely(queue == cpu_rq(pcb->cpu_id)))
+            return queue;
+        spin_unlock(&queue->lock);
     }
-    else // 不进行切换
+}
+
+/**
+ * @brief 判断进程是否正在就绪队列中排队
+ */
+static __always_inline bool __sched_on_queue(struct process_control_block *pcb)
+{
+    return !RB_EMPTY_NODE(&pcb->run_node) || !list_empty(&pcb->rt_list);
+}
+
+/**
+ * @brief 判断加入就绪队列的进程是否应当抢占该cpu上正在运行的进程（需要持有队列的锁）
+ * 实时进程总是抢占cfs进程，同一调度类的进程之间由调度类决定
+ *
+ * @param queue 就绪队列
+ * @param pcb 加入队列的进程
+ */
+static bool __sched_should_preempt(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    struct process_control_block *curr = queue->curr;
+    if (curr == queue->idle)
+        return true;
+    if (__sched_is_rt(pcb) != __sched_is_rt(curr))
+        return __sched_is_rt(pcb);
+    return __sched_class_of(pcb)->check_preempt(queue, pcb);
+}
+
+/**
+ * @brief 为被唤醒的实时进程选择运行的cpu：优先选择进程上一次运行的cpu，
+ * 该cpu正在运行优先级不低于它的实时进程时，选择一个能够被它抢占的cpu（未加锁，仅作为参考）
+ *
+ * @param pcb 进程的pcb
+ * @return int cpu编号
+ */
+static int __sched_rt_select_cpu(struct process_control_block *pcb)
+{
+    int best = __sched_default_cpu(pcb);
+    struct process_control_block *curr = cpu_rq(best)->curr;
+    if (!__sched_is_rt(curr) || curr->rt_priority < pcb->rt_priority)
+        return best;
+
+    for (int cpu = 0; cpu < MAX_CPU_NUM; ++cpu)
+    {
+        if (!__sched_cpu_online(cpu) || !__sched_cpu_allowed(pcb, cpu))
+            continue;
+        curr = cpu_rq(cpu)->curr;
+        if (!__sched_is_rt(curr))
+            return cpu;
+    }
+    return best;
+}
+
+/**
+ * @brief 将被唤醒的PCB加入其调度类的就绪队列
+ * 进程可能被放入其他cpu的就绪队列中，并通过IPI通知该cpu重新进行调度
+ *
+ * @param pcb
+ */
+void sched_enqueue(struct process_control_block *pcb)
+{
+    uint64_t rflags;
+    local_irq_save(rflags);
+
+    int target = __sched_is_rt(pcb) ? __sched_rt_select_cpu(pcb) : __sched_select_cpu(pcb);
+    int cpu;
+    // 进程的cpu_id只会在持有其所在cpu的就绪队列的锁时被修改，加锁后需要重新检查
+    while (1)
     {
-        // kdebug("not switch.");
-        sched_cfs_enqueue(proc);
+        cpu = pcb->cpu_id;
+        __sched_double_lock(cpu, target);
+        if (likely(pcb->cpu_id == cpu))
+            break;
+        __sched_double_unlock(cpu, target);
+    }
 
-        if (sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies <= 0)
+    struct sched_queue_t *queue = cpu_rq(cpu);
+    bool kick = false;
+    // 进程正在运行（将由sched()根据其状态决定是否重新入队），或者已经位于就绪队列中
+    if (pcb == queue->idle || pcb == queue->curr || __sched_on_queue(pcb))
+        goto out;
+
+    // 刚被切换出去的进程的上下文可能尚未保存完毕，只能留在原来的cpu上运行
+    if (pcb == queue->prev)
+    {
+        // 进程不允许在原来的cpu上运行，等到其上下文保存完毕后，由sched()将其迁移到其他cpu
+        if (!__sched_cpu_allowed(pcb, cpu))
         {
-            switch (proc->priority)
-            {
-            case 0:
-            case 1:
-                sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies = 4 / sched_cfs_ready_queue[proc_current_cpu_id].count;
-                // sched_cfs_ready_queue.cpu_exec_proc_jiffies = 5;
-                break;
-            case 2:
-            default:
-                // sched_cfs_ready_queue.cpu_exec_proc_jiffies = 5;
-
-                sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies = (4 / sched_cfs_ready_queue[proc_current_cpu_id].count) << 2;
-                break;
-            }
+            queue->prev_migrate = true;
+            goto out;
         }
+        target = cpu;
+    }
+    if (target != cpu)
+    {
+        pcb->virtual_runtime = pcb->virtual_runtime - queue->min_vruntime + cpu_rq(target)->min_vruntime;
+        pcb->cpu_id = target;
     }
 
-    sti();
+    queue = cpu_rq(target);
+    __sched_class_of(pcb)->enqueue(queue, pcb);
+    __sched_stat_enqueue(queue, pcb, true);
+    if (__sched_should_preempt(queue, pcb))
+    {
+        // 当前cpu上的进程在中断返回时（或下一次检查时）立即进行调度，其他cpu则通过IPI通知
+        if (target == proc_current_cpu_id)
+            current_pcb->flags |= PF_NEED_SCHED;
+        else
+            kick = true;
+    }
+
+out:;
+    __sched_double_unlock(cpu, target);
+    local_irq_restore(rflags);
+    if (kick)
+        __sched_kick_cpu(target);
+}
+
+/**
+ * @brief 统计正在运行的进程自上一次统计以来的运行时间，并按照权重增加其虚拟运行时间
+ *
+ * @param queue 当前cpu的就绪队列
+ */
+static void __sched_fair_update_curr(struct sched_queue_t *queue)
+{
+    struct process_control_block *curr = queue->curr;
+    uint64_t now = sched_clock();
+    if (now <= curr->exec_start)
+        return;
+    uint64_t delta = now - curr->exec_start;
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta;
+    // 权重越大，虚拟运行时间增长得越慢
+    curr->virtual_runtime += delta * SCHED_NICE_0_WEIGHT / __sched_weight(curr);
+}
+
+/**
+ * @brief 计算进程在当前的调度周期中应得的时间片
+ * 调度周期为sched_cfs_latency_ns，进程较多时延长为每个进程至少能运行sched_cfs_min_granularity_ns
+ *
+ * @param queue 当前cpu的就绪队列
+ * @param pcb 正在运行的进程（不在队列的红黑树中）
+ * @return uint64_t 时间片（纳秒）
+ */
+static uint64_t __sched_cfs_slice(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    uint64_t nr_running = __sched_nr_cfs_queued(queue) + 1;
+    uint64_t period = sched_cfs_latency_ns;
+    if (nr_running * sched_cfs_min_granularity_ns > period)
+        period = nr_running * sched_cfs_min_granularity_ns;
+
+    uint64_t weight = __sched_weight(pcb);
+    uint64_t slice = period * weight / (queue->load_weight + weight);
+    return slice < sched_cfs_min_granularity_ns ? sched_cfs_min_granularity_ns : slice;
+}
+
+/**
+ * @brief 判断正在运行的cfs进程的时间片是否已经耗尽
+ */
+static __always_inline bool __sched_cfs_expired(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    return pcb->sum_exec_runtime - queue->slice_exec_start >= __sched_cfs_slice(queue, pcb);
+}
+
+static void __sched_fair_enqueue(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_cfs_enqueue_locked(queue, pcb);
+}
+
+static void __sched_fair_dequeue(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_cfs_erase(queue, pcb);
+    --queue->count;
+}
+
+static void __sched_fair_put_prev(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    __sched_cfs_enqueue_locked(queue, pcb);
+}
+
+static struct process_control_block *__sched_fair_pick_next(struct sched_queue_t *queue)
+{
+    __sched_cfs_update_min_vruntime(queue);
+    struct process_control_block *proc = __sched_cfs_peek(queue);
+    if (proc != NULL)
+        __sched_fair_dequeue(queue, proc);
+    return proc;
+}
+
+static void __sched_fair_set_curr(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    pcb->exec_start = sched_clock();
+    // 时间片已经耗尽，但没有更需要运行的进程时，继续运行当前进程并开始新的时间片
+    if (pcb != queue->curr || __sched_cfs_expired(queue, pcb))
+        queue->slice_exec_start = pcb->sum_exec_runtime;
+}
+
+static void __sched_fair_tick(struct sched_queue_t *queue)
+{
+    __sched_fair_update_curr(queue);
+    // 时间片耗尽，标记可调度
+    if (__sched_cfs_expired(queue, queue->curr))
+        queue->curr->flags |= PF_NEED_SCHED;
+}
+
+static bool __sched_fair_check_preempt(struct sched_queue_t *queue, struct process_control_block *pcb)
+{
+    return pcb->virtual_runtime < queue->curr->virtual_runtime;
 }
 
+struct sched_class_t sched_fair_class = {
+    .enqueue = __sched_fair_enqueue,
+    .dequeue = __sched_fair_dequeue,
+    .put_prev = __sched_fair_put_prev,
+    .pick_next = __sched_fair_pick_next,
+    .set_curr = __sched_fair_set_curr,
+    .update_curr = __sched_fair_update_curr,
+    .tick = __sched_fair_tick,
+    .check_preempt = __sched_fair_check_preempt,
+};
+
+// 按照优先级从高到低排列的调度类
+static struct sched_class_t *__sched_classes[] = {&sched_rt_class, &sched_fair_class};
+
 /**
- * @brief 包裹sched_cfs(),调度函数
- * 
+ * @brief 统计cpu上正在运行的进程的运行时间（需要持有队列的锁）
+ *
+ * @param queue 当前cpu的就绪队列
+ */
+static void __sched_update_curr(struct sched_queue_t *queue)
+{
+    struct process_control_block *curr = queue->curr;
+    if (curr == NULL || curr == queue->idle)
+        return;
+    __sched_class_of(curr)->update_curr(queue);
+}
+
+/**
+ * @brief 动态时钟：cpu即将运行idle进程时，停止周期性的时钟中断，只保留一次负载均衡的定时；
+ * 即将运行其他进程时，恢复周期性的时钟中断
+ *
+ * @param queue 当前cpu的就绪队列
+ * @param next 即将运行的进程
+ */
+static void __sched_tick_update(struct sched_queue_t *queue, struct process_control_block *next)
+{
+    if (next == queue->idle)
+    {
+        // 空闲的cpu只需要定期尝试从其他cpu窃取进程，被唤醒的进程会通过重新调度IPI通知它
+        // 有等待迁移的进程时，在下一个时钟周期就进行调度
+        apic_timer_oneshot(queue->prev_migrate ? 1 : SCHED_BALANCE_INTERVAL);
+        queue->tick_stopped = true;
+    }
+    else if (queue->tick_stopped)
+    {
+        apic_timer_periodic();
+        queue->tick_stopped = false;
+    }
+}
+
+/**
+ * @brief 调度函数：按照调度类的优先级（实时进程、cfs进程）选择下一个运行的进程
+ *
  */
 void sched()
 {
-    sched_cfs();
+
+    cli();
+
+    current_pcb->flags &= ~PF_NEED_SCHED;
+    int cpu = proc_current_cpu_id;
+    struct sched_queue_t *queue = cpu_rq(cpu);
+
+    // 周期性的负载均衡，以及当前cpu即将空闲时从其他cpu窃取进程
+    if (queue->need_balance || __sched_nr_queued(queue) == 0)
+    {
+        queue->need_balance = false;
+        __sched_load_balance(cpu);
+    }
+
+    spin_lock(&queue->lock);
+    // 能够进入这里，说明上一次被切换出去的进程的上下文已经保存完毕
+    struct process_control_block *migrate = queue->prev_migrate ? queue->prev : NULL;
+    queue->prev = NULL;
+    queue->prev_migrate = false;
+    if (unlikely(migrate != NULL))
+    {
+        // 将不允许在当前cpu上运行的进程放入其他cpu的就绪队列
+        spin_unlock(&queue->lock);
+        if (migrate->state == PROC_RUNNING)
+            sched_enqueue(migrate);
+        spin_lock(&queue->lock);
+    }
+
+    __sched_update_curr(queue);
+    bool migrate_curr = false;
+    // 仍处于就绪状态的进程先放回就绪队列，与其他进程一起参与选择；否则交由其它功能模块进行管理
+    if (current_pcb->state == PROC_RUNNING && current_pcb != queue->idle && !__sched_cpu_allowed(current_pcb, cpu))
+        migrate_curr = true;
+    else if (current_pcb->state == PROC_RUNNING && current_pcb != queue->idle)
+    {
+        __sched_class_of(current_pcb)->put_prev(queue, current_pcb);
+        __sched_stat_enqueue(queue, current_pcb, false);
+    }
+
+    struct process_control_block *proc = NULL;
+    for (int i = 0; i < sizeof(__sched_classes) / sizeof(__sched_classes[0]) && proc == NULL; ++i)
+        proc = __sched_classes[i]->pick_next(queue);
+    if (proc == NULL)
+        proc = queue->idle;
+    else
+        __sched_class_of(proc)->set_curr(queue, proc);
+    // 当前进程需要被迁移到其他cpu，在它的上下文保存完毕后（下一次调度时）进行
+    queue->prev_migrate = migrate_curr;
+    __sched_tick_update(queue, proc);
+
+    if (proc != current_pcb)
+    {
+        __sched_stat_switch(queue, current_pcb, proc);
+        queue->prev = current_pcb;
+        queue->curr = proc;
+        proc->on_cpu = 1;
+        spin_unlock(&queue->lock);
+
+        process_switch_mm(proc);
+
+        switch_proc(current_pcb, proc);
+    }
+    else // 不进行切换
+        spin_unlock(&queue->lock);
+
+    sti();
 }
 
 /**
@@ -143,23 +678,62 @@ void sched()
  */
 void sched_update_jiffies()
 {
-    
-    switch (current_pcb->priority)
+    struct sched_queue_t *queue = this_rq();
+
+    spin_lock(&queue->lock);
+    __sched_stat_tick(queue);
+    // idle进程在每次时钟中断时都尝试从其他cpu窃取进程
+    if (current_pcb == queue->idle)
     {
-    case 0:
-    case 1:
-        --sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies;
-        ++current_pcb->virtual_runtime;
-        break;
-    case 2:
-    default:
-        sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies -= 2;
-        current_pcb->virtual_runtime += 2;
-        break;
+        spin_unlock(&queue->lock);
+        current_pcb->flags |= PF_NEED_SCHED;
+        return;
     }
-    // 时间片耗尽，标记可调度
-    if (sched_cfs_ready_queue[proc_current_cpu_id].cpu_exec_proc_jiffies <= 0)
+
+    // 被限制运行的实时进程在新的周期开始时抢占cfs进程；有等待迁移的进程时也需要尽快进行调度
+    if (__sched_rt_refresh_period(queue) || queue->prev_migrate)
+        current_pcb->flags |= PF_NEED_SCHED;
+    __sched_class_of(current_pcb)->tick(queue);
+    spin_unlock(&queue->lock);
+
+    // 周期性的负载均衡
+    if (--queue->balance_ticks <= 0)
+    {
+        queue->balance_ticks = SCHED_BALANCE_INTERVAL;
+        queue->need_balance = true;
         current_pcb->flags |= PF_NEED_SCHED;
+    }
+}
+
+/**
+ * @brief 重新调度IPI的处理函数：标记当前进程需要被调度
+ *
+ */
+void sched_resched_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs)
+{
+    current_pcb->flags |= PF_NEED_SCHED;
+}
+
+/**
+ * @brief 初始化cpu的就绪队列（就绪队列位于该cpu的per-cpu区域中）
+ *
+ * @param queue 就绪队列
+ * @param idle 该cpu的idle进程
+ */
+static void __sched_init_queue(struct sched_queue_t *queue, struct process_control_block *idle)
+{
+    memset(queue, 0, sizeof(struct sched_queue_t));
+    queue->tasks_timeline = RB_ROOT;
+    queue->rb_leftmost = NULL;
+    queue->min_vruntime = 0;
+    queue->count = 1; // 因为存在IDLE进程，因此为1
+    queue->load_weight = 0;
+    queue->slice_exec_start = 0;
+    queue->balance_ticks = SCHED_BALANCE_INTERVAL;
+    queue->idle = idle;
+    queue->curr = idle;
+    __sched_rt_init_queue(queue);
+    spin_init(&queue->lock);
 }
 
 /**
@@ -168,13 +742,299 @@ void sched_update_jiffies()
  */
 void sched_init()
 {
-    memset(&sched_cfs_ready_queue, 0, sizeof(struct sched_queue_t) * MAX_CPU_NUM);
-    for (int i = 0; i < MAX_CPU_NUM; ++i)
+    __sched_init_queue(this_rq(), initial_proc[proc_current_cpu_id]);
+    // BSP
+    atomic_set(&__sched_online_mask, 1UL << proc_current_cpu_id);
+}
+
+/**
+ * @brief 在AP处理器上启用调度器（在AP的idle进程中调用）
+ *
+ */
+void sched_init_ap()
+{
+    __sched_init_queue(this_rq(), current_pcb);
+    atomic_set_mask(&__sched_online_mask, 1UL << proc_current_cpu_id);
+}
+
+/**
+ * @brief 设置进程的nice值，并按照新的权重调整其在就绪队列中的位置
+ *
+ * @param pcb 进程的pcb
+ * @param nice nice值（超出范围时会被截断到[-20, 19]）
+ */
+void sched_set_nice(struct process_control_block *pcb, long nice)
+{
+    if (nice < SCHED_NICE_MIN)
+        nice = SCHED_NICE_MIN;
+    if (nice > SCHED_NICE_MAX)
+        nice = SCHED_NICE_MAX;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    struct sched_queue_t *queue = __sched_task_queue_lock(pcb);
+
+    if (!RB_EMPTY_NODE(&pcb->run_node)) // 正在排队的进程，需要更新队列的权重之和
+    {
+        __sched_cfs_erase(queue, pcb);
+        pcb->nice = nice;
+        __sched_cfs_insert(queue, pcb);
+    }
+    else
     {
+        // 正在运行的进程，先按照原来的权重统计已经运行的时间
+        if (pcb == queue->curr)
+            __sched_update_curr(queue);
+        pcb->nice = nice;
+    }
 
-        list_init(&sched_cfs_ready_queue[i].proc_queue.list);
-        sched_cfs_ready_queue[i].count = 1; // 因为存在IDLE进程，因此为1
-        sched_cfs_ready_queue[i].cpu_exec_proc_jiffies = 5;
-        sched_cfs_ready_queue[i].proc_queue.virtual_runtime = 0x7fffffffffffffff;
+    spin_unlock(&queue->lock);
+    local_irq_restore(rflags);
+}
+
+/**
+ * @brief 设置进程的调度策略
+ *
+ * @param pcb 进程的pcb
+ * @param policy 调度策略（SCHED_NORMAL、SCHED_FIFO或SCHED_RR）
+ * @param rt_priority 实时优先级（实时进程为1~99，普通进程必须为0）
+ * @return int 错误码
+ */
+int sched_setscheduler(struct process_control_block *pcb, long policy, long rt_priority)
+{
+    if (policy == SCHED_NORMAL)
+    {
+        if (rt_priority != 0)
+            return -EINVAL;
+    }
+    else if (policy == SCHED_FIFO || policy == SCHED_RR)
+    {
+        if (rt_priority < SCHED_RT_PRIO_MIN || rt_priority > SCHED_RT_PRIO_MAX)
+            return -EINVAL;
+    }
+    else
+        return -EINVAL;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    struct sched_queue_t *queue = __sched_task_queue_lock(pcb);
+    int cpu = pcb->cpu_id;
+    bool kick = false;
+
+    if (pcb == queue->idle)
+    {
+        spin_unlock(&queue->lock);
+        local_irq_restore(rflags);
+        return -EPERM;
+    }
+
+    if (__sched_on_queue(pcb)) // 排队中的进程，从原来的调度类移动到新的调度类
+    {
+        __sched_class_of(pcb)->dequeue(queue, pcb);
+        pcb->policy = policy;
+        pcb->rt_priority = rt_priority;
+        __sched_class_of(pcb)->enqueue(queue, pcb);
+        kick = __sched_should_preempt(queue, pcb);
+    }
+    else
+    {
+        // 正在运行的进程，先按照原来的调度类统计已经运行的时间，然后重新进行调度
+        if (pcb == queue->curr)
+        {
+            __sched_update_curr(queue);
+            kick = true;
+        }
+        pcb->policy = policy;
+        pcb->rt_priority = rt_priority;
+    }
+
+    spin_unlock(&queue->lock);
+    if (kick)
+    {
+        if (cpu == proc_current_cpu_id)
+            current_pcb->flags |= PF_NEED_SCHED;
+        else
+            __sched_kick_cpu(cpu);
     }
-}
\ No newline at end of file
+    local_irq_restore(rflags);
+    return 0;
+}
+
+/**
+ * @brief 设置进程允许运行的cpu
+ * 进程当前所在的cpu不在掩码中时，会被迁移到掩码中的cpu上
+ *
+ * @param pcb 进程的pcb
+ * @param mask cpu掩码（第i位对应cpu i）
+ * @return int 错误码（掩码中没有已经启用的cpu时返回-EINVAL）
+ */
+int sched_setaffinity(struct process_control_block *pcb, uint64_t mask)
+{
+    mask &= CPU_MASK_ALL;
+    if ((mask & atomic_read(&__sched_online_mask)) == 0)
+        return -EINVAL;
+
+    uint64_t rflags;
+    local_irq_save(rflags);
+    struct sched_queue_t *queue = __sched_task_queue_lock(pcb);
+    int cpu = pcb->cpu_id;
+    bool kick = false, requeue = false;
+
+    // idle进程固定在其所属的cpu上
+    if (pcb == queue->idle)
+    {
+        spin_unlock(&queue->lock);
+        local_irq_restore(rflags);
+        return -EINVAL;
+    }
+
+    pcb->cpus_allowed = mask;
+    if (!__sched_cpu_allowed(pcb, cpu))
+    {
+        bool queued = __sched_on_queue(pcb);
+        if (queued)
+            __sched_class_of(pcb)->dequeue(queue, pcb);
+
+        if (pcb == queue->curr) // 正在运行的进程，由sched()在将其切换出去后进行迁移
+            kick = true;
+        else if (pcb == queue->prev) // 上下文可能尚未保存完毕，等到下一次调度时再迁移
+            queue->prev_migrate = true;
+        else // 排队中的进程立即放入其他cpu的就绪队列。睡眠中的进程在被唤醒时会选择允许的cpu
+            requeue = queued;
+    }
+
+    spin_unlock(&queue->lock);
+    if (requeue)
+        sched_enqueue(pcb);
+    if (kick)
+    {
+        if (cpu == proc_current_cpu_id)
+            current_pcb->flags |= PF_NEED_SCHED;
+        else
+            __sched_kick_cpu(cpu);
+    }
+    local_irq_restore(rflags);
+    return 0;
+}
+
+/**
+ * @brief 根据系统调用传入的pid查找进程
+ *
+ * @param who 进程的pid，为0时表示当前进程
+ * @return struct process_control_block* 找不到时返回NULL
+ */
+static struct process_control_block *__sched_find_process(long who)
+{
+    if (who == 0)
+        return current_pcb;
+    return process_get_pcb(who);
+}
+
+/**
+ * @brief 获取进程的nice值
+ *
+ * @param r8 which 查找的对象的类型（目前只支持PRIO_PROCESS）
+ * @param r9 who 进程的pid（为0时表示当前进程）
+ * @return uint64_t 20-nice（取值为1~40，避免与错误码冲突）。失败时返回错误码
+ */
+uint64_t sys_getpriority(struct pt_regs *regs)
+{
+    if (regs->r8 != PRIO_PROCESS)
+        return -EINVAL;
+    struct process_control_block *pcb = __sched_find_process((long)regs->r9);
+    if (pcb == NULL)
+        return -ESRCH;
+    return 20 - pcb->nice;
+}
+
+/**
+ * @brief 设置进程的nice值
+ *
+ * @param r8 which 查找的对象的类型（目前只支持PRIO_PROCESS）
+ * @param r9 who 进程的pid（为0时表示当前进程）
+ * @param r10 nice 新的nice值
+ * @return uint64_t 错误码
+ */
+uint64_t sys_setpriority(struct pt_regs *regs)
+{
+    if (regs->r8 != PRIO_PROCESS)
+        return -EINVAL;
+    struct process_control_block *pcb = __sched_find_process((long)regs->r9);
+    if (pcb == NULL)
+        return -ESRCH;
+    sched_set_nice(pcb, (long)regs->r10);
+    return 0;
+}
+
+/**
+ * @brief 设置进程的调度策略与实时优先级
+ *
+ * @param r8 pid 进程的pid（为0时表示当前进程）
+ * @param r9 policy 调度策略（SCHED_NORMAL、SCHED_FIFO或SCHED_RR）
+ * @param r10 rt_priority 实时优先级
+ * @return uint64_t 错误码
+ */
+uint64_t sys_sched_setscheduler(struct pt_regs *regs)
+{
+    struct process_control_block *pcb = __sched_find_process((long)regs->r8);
+    if (pcb == NULL)
+        return -ESRCH;
+    return sched_setscheduler(pcb, (long)regs->r9, (long)regs->r10);
+}
+
+/**
+ * @brief 获取进程的调度策略
+ *
+ * @param r8 pid 进程的pid（为0时表示当前进程）
+ * @return uint64_t 调度策略。失败时返回错误码
+ */
+uint64_t sys_sched_getscheduler(struct pt_regs *regs)
+{
+    struct process_control_block *pcb = __sched_find_process((long)regs->r8);
+    if (pcb == NULL)
+        return -ESRCH;
+    return pcb->policy;
+}
+
+/**
+ * @brief 获取进程的实时优先级
+ *
+ * @param r8 pid 进程的pid（为0时表示当前进程）
+ * @return uint64_t 实时优先级（普通进程为0）。失败时返回错误码
+ */
+uint64_t sys_sched_getparam(struct pt_regs *regs)
+{
+    struct process_control_block *pcb = __sched_find_process((long)regs->r8);
+    if (pcb == NULL)
+        return -ESRCH;
+    return pcb->rt_priority;
+}
+
+/**
+ * @brief 设置进程允许运行的cpu
+ *
+ * @param r8 pid 进程的pid（为0时表示当前进程）
+ * @param r9 mask cpu掩码（第i位对应cpu i）
+ * @return uint64_t 错误码
+ */
+uint64_t sys_sched_setaffinity(struct pt_regs *regs)
+{
+    struct process_control_block *pcb = __sched_find_process((long)regs->r8);
+    if (pcb == NULL)
+        return -ESRCH;
+    return sched_setaffinity(pcb, regs->r9);
+}
+
+/**
+ * @brief 获取进程允许运行的cpu
+ *
+ * @param r8 pid 进程的pid（为0时表示当前进程）
+ * @return uint64_t cpu掩码。失败时返回错误码
+ */
+uint64_t sys_sched_getaffinity(struct pt_regs *regs)
+{
+    struct process_control_block *pcb = __sched_find_process((long)regs->r8);
+    if (pcb == NULL)
+        return -ESRCH;
+    return pcb->cpus_allowed;
+}
@@ -1,51 +1,183 @@
 #pragma once
 
 #include <common/glib.h>
+#include <common/rbtree.h>
+#include <common/spinlock.h>
 #include <process/process.h>
+#include <arch/x86_64/percpu.h>
 
-// @todo: 用红黑树重写cfs的队列
+// nice值的范围
+#define SCHED_NICE_MIN (-20)
+#define SCHED_NICE_MAX 19
+// nice值为0的进程的权重
+#define SCHED_NICE_0_WEIGHT 1024
+
+// 默认的调度周期（纳秒）：就绪的进程数量不多时，每个进程在一个周期内至少运行一次
+#define SCHED_CFS_DEFAULT_LATENCY_NS 20000000UL
+// 默认的最小时间片（纳秒）
+#define SCHED_CFS_DEFAULT_MIN_GRANULARITY_NS 4000000UL
+// 实时优先级的范围（数值越大优先级越高）
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 99
+// 实时进程优先级链表的数量，以及索引它们的位图的长度（64位的字）
+#define SCHED_RT_NR_PRIO (SCHED_RT_PRIO_MAX + 1)
+#define SCHED_RT_BITMAP_WORDS ((SCHED_RT_NR_PRIO + 63) / 64)
+// 默认的实时进程带宽控制周期（纳秒）
+#define SCHED_RT_DEFAULT_PERIOD_NS 1000000000UL
+// 默认情况下，每个周期内实时进程最多运行的时间（纳秒），剩余的时间留给普通进程
+#define SCHED_RT_DEFAULT_RUNTIME_NS 950000000UL
+// 默认的SCHED_RR时间片（纳秒）
+#define SCHED_RR_DEFAULT_TIMESLICE_NS 100000000UL
+
+// 调度延迟直方图的桶数量：第0个桶统计小于1微秒的延迟，第i个桶统计[2^(i-1), 2^i)微秒的延迟，最后一个桶包含所有更大的延迟
+#define SCHED_STAT_NR_BUCKETS 20
+
+// 周期性负载均衡的间隔（时钟中断的次数）
+#define SCHED_BALANCE_INTERVAL 20
+// 要求目标cpu重新进行调度的IPI向量号
+#define SCHED_RESCHED_IPI_VECTOR 0xca
+
+/**
+ * @brief 每个cpu的调度统计信息
+ *
+ */
+struct sched_cpu_stat_t
+{
+    uint64_t nr_switches;    // 上下文切换的次数
+    uint64_t nr_voluntary;   // 其中由于进程主动让出cpu（睡眠、退出）引起的次数
+    uint64_t nr_involuntary; // 其中由于进程被抢占引起的次数
+    uint64_t nr_wakeups;     // 进程被唤醒并加入该cpu的就绪队列的次数
+    uint64_t idle_time;      // 运行idle进程的累计时间（纳秒）
+    uint64_t run_delay;      // 进程从加入就绪队列到开始运行的累计等待时间（纳秒）
+    uint64_t nr_run_delay;   // run_delay的采样次数
+    uint64_t run_delay_hist[SCHED_STAT_NR_BUCKETS]; // 等待时间的直方图（以微秒为单位的log2分桶）
+    uint64_t rq_len_sum;     // 每次时钟中断时采样的就绪队列长度之和
+    uint64_t rq_len_samples; // 就绪队列长度的采样次数
+    uint64_t rq_len_max;     // 采样到的就绪队列的最大长度
+};
+
+/**
+ * @brief 进程的调度统计信息
+ *
+ */
+struct sched_proc_stat_t
+{
+    uint64_t nvcsw;            // 主动让出cpu的次数
+    uint64_t nivcsw;           // 被抢占的次数
+    uint64_t run_delay;        // 在就绪队列中等待运行的累计时间（纳秒）
+    uint64_t nr_runs;          // 被调度运行的次数
+    uint64_t sum_exec_runtime; // 累计运行时间（纳秒）
+};
+
+// sys_sched_stat()查询的对象
+#define SCHED_STAT_CPU 0     // 查询指定cpu的统计信息（struct sched_cpu_stat_t）
+#define SCHED_STAT_PROCESS 1 // 查询指定进程的统计信息（struct sched_proc_stat_t）
+#define SCHED_STAT_FPU 2     // 查询指定cpu的浮点上下文切换统计信息（struct fpu_stat_t）
+
+/**
+ * @brief 实时进程的就绪队列：每个优先级对应一个先进先出的链表，位图记录了哪些链表非空
+ *
+ */
+struct sched_rt_queue_t
+{
+    uint64_t bitmap[SCHED_RT_BITMAP_WORDS]; // 第i位为1表示queue[i]非空
+    struct List queue[SCHED_RT_NR_PRIO];    // 下标为SCHED_RT_PRIO_MAX - rt_priority，下标越小优先级越高
+    long nr_running;                        // 队列中排队的实时进程数量
+    uint64_t rt_time;                       // 本周期内实时进程已经运行的时间（纳秒）
+    uint64_t period_start;                  // 本周期开始的时间戳（纳秒）
+    bool throttled;                         // 本周期的运行时间已经耗尽，实时进程暂停运行直到下一周期
+};
+
+/**
+ * @brief 每个cpu的就绪队列：cfs进程按照虚拟运行时间被组织在红黑树中，实时进程被组织在rt队列中
+ *
+ */
 struct sched_queue_t
 {
-    long count; // 当前队列中的数量
-    long cpu_exec_proc_jiffies; // 进程可执行的时间片数量
-    struct process_control_block proc_queue;
+    long count; // 当前队列中的数量（包括实时进程与idle进程）
+    uint64_t load_weight;          // 队列中排队的进程的权重之和
+    uint64_t slice_exec_start;     // 正在运行的进程在本次时间片开始时的累计运行时间（纳秒）
+    struct rb_root tasks_timeline; // 以虚拟运行时间为键的红黑树
+    struct rb_node *rb_leftmost;   // 缓存的最左结点（虚拟运行时间最小的进程）
+    int64_t min_vruntime;          // 队列的最小虚拟运行时间（单调递增），用于放置新唤醒的进程
+    struct process_control_block *curr; // cpu上正在运行的进程
+    struct process_control_block *idle; // cpu的idle进程
+    struct process_control_block *prev; // 最近一次被切换出去的进程（其上下文可能尚未保存完毕，不能被迁移）
+    bool prev_migrate;             // prev不允许在该cpu上运行，其上下文保存完毕后需要迁移到其他cpu
+    long balance_ticks;            // 距离下一次周期性负载均衡的时钟中断次数
+    bool need_balance;             // 下一次调度时是否进行负载均衡
+    bool tick_stopped;             // 是否已经停止了周期性的时钟中断（cpu空闲时）
+    struct sched_rt_queue_t rt;    // 实时进程的就绪队列
+    struct sched_cpu_stat_t stat;  // 调度统计信息
+    uint64_t idle_start;           // 最近一次开始运行idle进程的时间戳（纳秒）
+    spinlock_t lock;
 };
 
 
-extern struct sched_queue_t sched_cfs_ready_queue[MAX_CPU_NUM]; // 就绪队列
+// 就绪队列位于per-cpu区域中，紧跟在struct cpu_local_t之后（只能访问已经启用的cpu的就绪队列）
+#define cpu_rq(cpu) ((struct sched_queue_t *)(per_cpu_ptr(cpu) + 1))
+// 当前cpu的就绪队列
+#define this_rq() ((struct sched_queue_t *)(this_cpu_ptr() + 1))
+
+// 调度周期（纳秒）
+extern uint64_t sched_cfs_latency_ns;
+// 最小时间片（纳秒）
+extern uint64_t sched_cfs_min_granularity_ns;
+// 实时进程带宽控制的周期（纳秒）
+extern uint64_t sched_rt_period_ns;
+// 每个周期内实时进程最多运行的时间（纳秒），不小于sched_rt_period_ns时不进行限制
+extern uint64_t sched_rt_runtime_ns;
+// SCHED_RR的时间片（纳秒）
+extern uint64_t sched_rr_timeslice_ns;
 
 /**
- * @brief 调度函数
- * 
+ * @brief 获取调度器使用的时钟（基于TSC，单位：纳秒）
+ *
+ * @return uint64_t 纳秒数。TSC的频率尚未测定时返回0
  */
-void sched_cfs();
+uint64_t sched_clock();
 
 /**
- * @brief 包裹sched_cfs()，调度函数
- * 
+ * @brief 设置进程的nice值，并按照新的权重调整其在就绪队列中的位置
+ *
+ * @param pcb 进程的pcb
+ * @param nice nice值（超出范围时会被截断到[-20, 19]）
  */
-void sched();
+void sched_set_nice(struct process_control_block *pcb, long nice);
 
 /**
- * @brief 将PCB加入就绪队列
+ * @brief 设置进程的调度策略
  *
- * @param pcb
+ * @param pcb 进程的pcb
+ * @param policy 调度策略（SCHED_NORMAL、SCHED_FIFO或SCHED_RR）
+ * @param rt_priority 实时优先级（实时进程为1~99，普通进程必须为0）
+ * @return int 错误码
  */
-void sched_cfs_enqueue(struct process_control_block *pcb);
+int sched_setscheduler(struct process_control_block *pcb, long policy, long rt_priority);
 
 /**
- * @brief 包裹sched_enqueue(),将PCB加入就绪队列
+ * @brief 设置进程允许运行的cpu
+ * 进程当前所在的cpu不在掩码中时，会被迁移到掩码中的cpu上
+ *
+ * @param pcb 进程的pcb
+ * @param mask cpu掩码（第i位对应cpu i）
+ * @return int 错误码（掩码中没有已经启用的cpu时返回-EINVAL）
+ */
+int sched_setaffinity(struct process_control_block *pcb, uint64_t mask);
+
+/**
+ * @brief 调度函数：按照调度类的优先级（实时进程、cfs进程）选择下一个运行的进程
  * 
- * @param pcb
  */
-void sched_enqueue(struct process_control_block *pcb);
+void sched();
 
 /**
- * @brief 从就绪队列中取出PCB
- *
- * @return struct process_control_block*
+ * @brief 将被唤醒的PCB加入其调度类的就绪队列
+ * 进程可能被放入其他cpu的就绪队列中，并通过IPI通知该cpu重新进行调度
+ * 
+ * @param pcb
  */
-struct process_control_block *sched_cfs_dequeue();
+void sched_enqueue(struct process_control_block *pcb);
 
 /**
  * @brief 初始化进程调度器
@@ -53,9 +185,20 @@ struct process_control_block *sched_cfs_dequeue();
  */
 void sched_init();
 
+/**
+ * @brief 在AP处理器上启用调度器（在AP的idle进程中调用）
+ *
+ */
+void sched_init_ap();
+
 /**
  * @brief 当时钟中断到达时，更新时间片
  * 
  */
 void sched_update_jiffies();
 
+/**
+ * @brief 重新调度IPI的处理函数：标记当前进程需要被调度
+ *
+ */
+void sched_resched_ipi_handler(uint64_t irq_num, uint64_t param, struct pt_regs *regs);
@@ -1,6 +1,7 @@
 #include "smp.h"
 #include <common/kprint.h>
 #include <driver/interrupt/apic/apic.h>
+#include <driver/interrupt/apic/apic_timer.h>
 #include <exception/gate.h>
 #include <common/cpu.h>
 #include <mm/slab.h>
@@ -8,6 +9,8 @@
 #include <common/spinlock.h>
 
 #include <sched/sched.h>
+#include <arch/x86_64/fpu.h>
+#include <arch/x86_64/percpu.h>
 
 #include "ipi.h"
 
@@ -47,6 +50,10 @@ void smp_init()
 
     // 注册接收bsp处理器的hpet中断转发的处理函数
     ipi_regiserIPI(0xc8, NULL, &ipi_0xc8_handler, NULL, NULL, "IPI 0xc8");
+    // 注册跨核心刷新TLB的处理函数
+    ipi_regiserIPI(MM_TLB_SHOOTDOWN_IPI_VECTOR, NULL, &mm_tlb_shootdown_handler, NULL, NULL, "IPI TLB shootdown");
+    // 注册重新调度的处理函数（用于唤醒其他cpu上的进程）
+    ipi_regiserIPI(SCHED_RESCHED_IPI_VECTOR, NULL, &sched_resched_ipi_handler, NULL, NULL, "IPI reschedule");
     io_mfence();
     ipi_send_IPI(DEST_PHYSICAL, IDLE, ICR_LEVEL_DE_ASSERT, EDGE_TRIGGER, 0x00, ICR_INIT, ICR_ALL_EXCLUDE_Self, 0x00);
 
@@ -76,6 +83,15 @@ void smp_init()
         preempt_enable(); // 由于ap处理器的pcb与bsp的不同，因此ap处理器放锁时，bsp的自旋锁持有计数不会发生改变,需要手动恢复preempt count
         current_starting_cpu = proc_local_apic_structs[i]->ACPI_Processor_UID;
         io_mfence();
+        // AP在加载GS base之前不能使用自旋锁，因此由BSP为其分配per-cpu区域
+        if (cpu_local_alloc(current_starting_cpu) != 0)
+        {
+            kerror("Failed to allocate per-cpu area for processor %d.", current_starting_cpu);
+            --total_processor_num;
+            spin_unlock(&multi_core_starting_lock);
+            preempt_disable();
+            continue;
+        }
         // 为每个AP处理器分配栈空间
         cpu_core_info[current_starting_cpu].stack_start = (uint64_t)kmalloc(STACK_SIZE, 0) + STACK_SIZE;
         cpu_core_info[current_starting_cpu].ist_stack_start = (uint64_t)(kmalloc(STACK_SIZE, 0)) + STACK_SIZE;
@@ -89,6 +105,7 @@ void smp_init()
         ((struct process_control_block *)(cpu_core_info[current_starting_cpu].ist_stack_start - STACK_SIZE))->cpu_id = proc_local_apic_structs[i]->local_apic_id;
 
         cpu_core_info[current_starting_cpu].tss_vaddr = (uint64_t)&initial_tss[current_starting_cpu];
+        cpu_core_info[current_starting_cpu].apic_id = proc_local_apic_structs[i]->local_apic_id;
 
         memset(&initial_tss[current_starting_cpu], 0, sizeof(struct tss_struct));
 
@@ -117,7 +134,7 @@ void smp_init()
         io_mfence();
         *(ul *)(phys_2_virt(global_CR3) + i) = 0UL;
     }
-    kdebug("init proc's preempt_count=%ld", current_pcb->preempt_count);
+    kdebug("init proc's preempt_count=%ld", preempt_count());
     kinfo("Successfully cleaned page table remapping!\n");
 }
 
@@ -134,6 +151,8 @@ void smp_ap_start()
                          : "memory");
     __asm__ __volatile__("movq %0, %%rsp \n\t" ::"m"(cpu_core_info[current_starting_cpu].stack_start)
                          : "memory");
+    // 加载per-cpu区域，之后才能使用自旋锁
+    cpu_local_init_ap(current_starting_cpu);
 
     ksuccess("AP core %d successfully started!", current_starting_cpu);
     io_mfence();
@@ -151,20 +170,31 @@ void smp_ap_start()
 
     list_init(&current_pcb->list);
     current_pcb->addr_limit = KERNEL_BASE_LINEAR_ADDR;
-    current_pcb->priority = 2;
+    current_pcb->nice = 0;
     current_pcb->virtual_runtime = 0;
+    current_pcb->policy = SCHED_NORMAL;
+    current_pcb->cpus_allowed = CPU_MASK_ALL;
+    list_init(&current_pcb->rt_list);
+    list_init(&current_pcb->children);
+    list_init(&current_pcb->sibling);
 
     current_pcb->thread = (struct thread_struct *)(current_pcb + 1); // 将线程结构体放置在pcb后方
     current_pcb->thread->rbp = _stack_start;
     current_pcb->thread->rsp = _stack_start;
     current_pcb->thread->fs = KERNEL_DS;
     current_pcb->thread->gs = KERNEL_DS;
+    current_pcb->thread->fpu_state = NULL;
+    current_pcb->thread->fpu_cpu = -1;
     current_pcb->cpu_id = current_starting_cpu;
 
     initial_proc[proc_current_cpu_id] = current_pcb;
     barrier();
+    sched_init_ap();
+    mm_tlb_init_ap();
+    fpu_init_ap();
     load_TR(10 + current_starting_cpu * 2);
     current_pcb->preempt_count = 0;
+    this_cpu_write(preempt_count, 0);
 
     io_mfence();
     spin_unlock(&multi_core_starting_lock);
@@ -172,6 +202,9 @@ void smp_ap_start()
     io_mfence();
     sti();
 
+    // 启动当前核心的local apic定时器，使其能够进行抢占式调度与负载均衡
+    apic_timer_ap_core_init();
+
     while (1)
         hlt();
 
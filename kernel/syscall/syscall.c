@@ -9,8 +9,11 @@
 #include <common/string.h>
 #include <filesystem/fat32/fat32.h>
 #include <filesystem/VFS/VFS.h>
+#include <common/bcache.h>
 #include <process/process.h>
 #include <time/sleep.h>
+#include <common/sys/resource.h>
+#include <arch/x86_64/fpu.h>
 
 // 导出系统调用入口函数，定义在entry.S中
 extern void system_call(void);
@@ -18,6 +21,14 @@ extern void syscall_int(void);
 
 extern uint64_t sys_clock(struct pt_regs *regs);
 extern uint64_t sys_mstat(struct pt_regs *regs);
+extern uint64_t sys_getpriority(struct pt_regs *regs);
+extern uint64_t sys_setpriority(struct pt_regs *regs);
+extern uint64_t sys_sched_setscheduler(struct pt_regs *regs);
+extern uint64_t sys_sched_getscheduler(struct pt_regs *regs);
+extern uint64_t sys_sched_getparam(struct pt_regs *regs);
+extern uint64_t sys_sched_stat(struct pt_regs *regs);
+extern uint64_t sys_sched_setaffinity(struct pt_regs *regs);
+extern uint64_t sys_sched_getaffinity(struct pt_regs *regs);
 extern uint64_t sys_open(struct pt_regs *regs);
 extern uint64_t sys_rmdir(struct pt_regs *regs);
 
@@ -64,7 +75,7 @@ void syscall_init()
 {
     kinfo("Initializing syscall...");
 
-    set_system_trap_gate(0x80, 0, syscall_int); // 系统调用门
+    set_system_intr_gate(0x80, 0, syscall_int); // 系统调用门（通过中断门进入，在swapgs之后才开启中断）
 }
 
 /**
@@ -352,6 +363,10 @@ uint64_t sys_sbrk(struct pt_regs *regs)
  */
 uint64_t sys_reboot(struct pt_regs *regs)
 {
+    // 将缓冲区缓存中的脏数据写回磁盘，否则尚未被刷写线程写回的修改会丢失
+    if (bsync(NULL) != 0)
+        kwarn("reboot: failed to write back some dirty buffers");
+
     // 重启计算机
     io_out8(0x64, 0xfe);
 
@@ -499,58 +514,74 @@ uint64_t sys_execve(struct pt_regs *regs)
 }
 
 /**
- * @brief 等待进程退出
+ * @brief 等待子进程退出
  *
- * @param pid 目标进程id
+ * @param pid 目标进程id（为-1时等待任意一个子进程）
  * @param status 返回的状态信息
  * @param options 等待选项
  * @param rusage
- * @return uint64_t
+ * @return uint64_t 退出的子进程的pid
  */
 uint64_t sys_wait4(struct pt_regs *regs)
 {
-    uint64_t pid = regs->r8;
+    long pid = (long)regs->r8;
     int *status = (int *)regs->r9;
     int options = regs->r10;
     void *rusage = (void *)regs->r11;
 
-    struct process_control_block *proc = NULL;
-    struct process_control_block *child_proc = NULL;
+    // 暂时不支持options选项，该值目前必须为0
+    if (options != 0)
+        return -EINVAL;
 
-    // 查找pid为指定值的进程
-    // ps: 这里判断子进程的方法没有按照posix 2008来写。
-    // todo: 根据进程树判断是否为当前进程的子进程
-    for (proc = &initial_proc_union.pcb; proc->next_pcb != &initial_proc_union.pcb; proc = proc->next_pcb)
+    struct process_control_block *child_proc = NULL;
+    while (1)
     {
-        if (proc->next_pcb->pid == pid)
+        bool found = false;
+        // 只需要在当前进程的子进程链表中查找
+        spin_lock(&process_tree_lock);
+        struct List *node = list_next(&current_pcb->children);
+        for (; node != &current_pcb->children; node = list_next(node))
         {
-            child_proc = proc->next_pcb;
-            break;
+            struct process_control_block *proc = container_of(node, struct process_control_block, sibling);
+            if (pid != -1 && proc->pid != pid)
+                continue;
+            found = true;
+            if (proc->state == PROC_ZOMBIE)
+            {
+                child_proc = proc;
+                break;
+            }
         }
+        // 从进程树中删除已经退出的子进程，并回收其pid
+        if (child_proc != NULL)
+            __process_unlink_pcb(child_proc);
+        spin_unlock(&process_tree_lock);
+
+        if (!found)
+            return -ECHILD;
+        if (child_proc != NULL)
+            break;
+        // 子进程还没有退出，等待其退出
+        wait_queue_sleep_on_interriptible(&current_pcb->wait_child_proc_exit);
     }
 
-    if (child_proc == NULL)
-        return -ECHILD;
-
-    // 暂时不支持options选项，该值目前必须为0
-    if (options != 0)
-        return -EINVAL;
-
-    // 如果子进程没有退出，则等待其退出
-    while (child_proc->state != PROC_ZOMBIE)
-        wait_queue_sleep_on_interriptible(&current_pcb->wait_child_proc_exit);
+    // 子进程在唤醒父进程之后才切换出去，它所在的cpu可能仍在使用它的内核栈与页表，需要等待其切换完毕
+    while (child_proc->on_cpu)
+        pause();
 
     // 拷贝子进程的返回码
     if (likely(status != NULL))
         *status = child_proc->exit_code;
     // copy_to_user(status, (void*)child_proc->exit_code, sizeof(int));
-    proc->next_pcb = child_proc->next_pcb;
+    pid = child_proc->pid;
 
     // 释放子进程的页表
     process_exit_mm(child_proc);
+    // 释放子进程退出后在内核中使用SSE时重新分配的浮点上下文
+    fpu_exit_thread(child_proc);
     // 释放子进程的pcb
     kfree(child_proc);
-    return 0;
+    return pid;
 }
 
 /**
@@ -564,6 +595,32 @@ uint64_t sys_exit(struct pt_regs *regs)
     return process_do_exit(regs->r8);
 }
 
+/**
+ * @brief 获取进程的资源使用情况
+ *
+ * @param r8 who 统计的对象（目前只支持RUSAGE_SELF）
+ * @param r9 usage 返回的资源使用情况结构体的地址
+ * @return uint64_t 错误码
+ */
+uint64_t sys_getrusage(struct pt_regs *regs)
+{
+    int who = (int)regs->r8;
+    struct rusage *usage = (struct rusage *)regs->r9;
+    if (who != RUSAGE_SELF || usage == NULL)
+        return -EINVAL;
+
+    struct rusage ru = {0};
+    ru.ru_minflt = current_pcb->min_flt;
+    ru.ru_majflt = current_pcb->maj_flt;
+    ru.ru_nvcsw = current_pcb->nvcsw;
+    ru.ru_nivcsw = current_pcb->nivcsw;
+    if (regs->cs == (USER_CS | 0x3))
+        copy_to_user(usage, &ru, sizeof(struct rusage));
+    else
+        memcpy(usage, &ru, sizeof(struct rusage));
+    return 0;
+}
+
 uint64_t sys_nanosleep(struct pt_regs *regs)
 {
     const struct timespec *rqtp = (const struct timespec *)regs->r8;
@@ -611,5 +668,14 @@ system_call_t system_call_table[MAX_SYSTEM_CALL_NUM] =
         [20] = sys_pipe,
         [21] = sys_mstat,
         [22] = sys_rmdir,
-        [23 ... 254] = system_call_not_exists,
+        [23] = sys_getrusage,
+        [24] = sys_getpriority,
+        [25] = sys_setpriority,
+        [26] = sys_sched_setscheduler,
+        [27] = sys_sched_getscheduler,
+        [28] = sys_sched_getparam,
+        [29] = sys_sched_stat,
+        [30] = sys_sched_setaffinity,
+        [31] = sys_sched_getaffinity,
+        [32 ... 254] = system_call_not_exists,
         [255] = sys_ahci_end_req};
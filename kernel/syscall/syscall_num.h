@@ -34,6 +34,15 @@
 
 #define SYS_MSTAT 21    // 获取系统的内存状态信息
 #define SYS_RMDIR 22    // 删除文件夹
+#define SYS_GETRUSAGE 23 // 获取进程的资源使用情况
+#define SYS_GETPRIORITY 24 // 获取进程的nice值
+#define SYS_SETPRIORITY 25 // 设置进程的nice值
+#define SYS_SCHED_SETSCHEDULER 26 // 设置进程的调度策略
+#define SYS_SCHED_GETSCHEDULER 27 // 获取进程的调度策略
+#define SYS_SCHED_GETPARAM 28 // 获取进程的实时优先级
+#define SYS_SCHED_STAT 29 // 获取调度器的统计信息
+#define SYS_SCHED_SETAFFINITY 30 // 设置进程允许运行的cpu
+#define SYS_SCHED_GETAFFINITY 31 // 获取进程允许运行的cpu
 
 
 #define SYS_AHCI_END_REQ 255    // AHCI DMA请求结束end_request的系统调用
\ No newline at end of file
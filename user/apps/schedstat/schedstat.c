@@ -0,0 +1,96 @@
+#include <libc/stdio.h>
+#include <libc/stdlib.h>
+#include <libc/errno.h>
+#include <libc/sched.h>
+
+/**
+ * @brief 打印等待运行时间的直方图（只打印非空的桶）
+ *
+ * @param stat cpu的调度统计信息
+ */
+static void print_run_delay_hist(struct sched_cpu_stat_t *stat)
+{
+    for (int i = 0; i < SCHED_STAT_NR_BUCKETS; ++i)
+    {
+        if (stat->run_delay_hist[i] == 0)
+            continue;
+        if (i == 0)
+            printf("    [0, 1) us:\t%ld\n", stat->run_delay_hist[i]);
+        else if (i == SCHED_STAT_NR_BUCKETS - 1)
+            printf("    [%ld, ...) us:\t%ld\n", 1UL << (i - 1), stat->run_delay_hist[i]);
+        else
+            printf("    [%ld, %ld) us:\t%ld\n", 1UL << (i - 1), 1UL << i, stat->run_delay_hist[i]);
+    }
+}
+
+/**
+ * @brief 打印cpu的调度统计信息
+ *
+ * @param cpu cpu编号
+ * @param stat cpu的调度统计信息
+ */
+static void print_cpu_stat(int cpu, struct sched_cpu_stat_t *stat)
+{
+    printf("cpu%d:\n", cpu);
+    printf("  switches:\t%ld (voluntary: %ld, involuntary: %ld)\n", stat->nr_switches, stat->nr_voluntary, stat->nr_involuntary);
+    printf("  wakeups:\t%ld\n", stat->nr_wakeups);
+    printf("  idle:\t\t%ld ms\n", stat->idle_time / 1000000);
+
+    // 平均队列长度保留两位小数
+    uint64_t avg_len = stat->rq_len_samples ? stat->rq_len_sum * 100 / stat->rq_len_samples : 0;
+    printf("  runqueue:\tavg %ld.%ld%ld, max %ld\n", avg_len / 100, (avg_len / 10) % 10, avg_len % 10, stat->rq_len_max);
+
+    uint64_t avg_delay = stat->nr_run_delay ? stat->run_delay / stat->nr_run_delay / 1000 : 0;
+    printf("  run delay:\tavg %ld us over %ld runs\n", avg_delay, stat->nr_run_delay);
+    print_run_delay_hist(stat);
+
+    struct fpu_stat_t fpu;
+    if (sched_stat(SCHED_STAT_FPU, cpu, &fpu) == 0)
+    {
+        printf("  fpu:\t\t%ld saves / %ld switches, %ld restores (%ld skipped), %ld traps, %ld allocs\n", fpu.nr_saves, fpu.nr_switches,
+               fpu.nr_restores, fpu.nr_restore_skip, fpu.nr_traps, fpu.nr_allocs);
+    }
+}
+
+/**
+ * @brief 打印进程的调度统计信息
+ *
+ * @param pid 进程的pid
+ * @return int 错误码
+ */
+static int print_proc_stat(int pid)
+{
+    struct sched_proc_stat_t stat = {0};
+    int retval = sched_stat(SCHED_STAT_PROCESS, pid, &stat);
+    if (retval != 0)
+    {
+        printf("schedstat: cannot get statistics of pid %d, error=%d\n", pid, retval);
+        return retval;
+    }
+
+    printf("pid %d:\n", pid);
+    printf("  switches:\tvoluntary: %ld, involuntary: %ld\n", stat.nvcsw, stat.nivcsw);
+    printf("  runtime:\t%ld ms over %ld runs\n", stat.sum_exec_runtime / 1000000, stat.nr_runs);
+    printf("  run delay:\t%ld ms\n", stat.run_delay / 1000000);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sched_cpu_stat_t stat;
+    // 依次查询每个cpu，直到cpu编号超出内核支持的范围
+    for (int cpu = 0;; ++cpu)
+    {
+        int retval = sched_stat(SCHED_STAT_CPU, cpu, &stat);
+        if (retval == -ENODEV) // cpu未启用
+            continue;
+        if (retval != 0)
+            break;
+        print_cpu_stat(cpu, &stat);
+    }
+
+    // 由shell的exec命令启动时，argv中包含了"exec"与程序的路径，pid为最后一个参数
+    if (argc > 2)
+        return print_proc_stat(atoi(argv[argc - 1]));
+    return 0;
+}
@@ -513,6 +513,10 @@ int shell_cmd_free(int argc, char **argv)
     {
         printf("%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t\n", mst.total >> 20, mst.used >> 20, mst.free >> 20, mst.shared >> 20, mst.cache_used >> 20, mst.available >> 20);
     }
+    // 以2M页映射的用户内存，以及透明大页的合并、回退次数
+    printf("Huge:\t%ld\tpromoted=%ld\tfallback=%ld\n", mst.huge_mapped >> (argc == 1 ? 10 : 20), mst.thp_promoted, mst.thp_fallback);
+    // 块设备缓冲区缓存的大小、未写回的数据量，以及命中、未命中次数
+    printf("Bcache:\t%ld\tdirty=%ld\thits=%ld\tmisses=%ld\n", mst.bcache_used >> (argc == 1 ? 10 : 20), mst.bcache_dirty >> (argc == 1 ? 10 : 20), mst.bcache_hits, mst.bcache_misses);
 
 done:;
     if (argv != NULL)
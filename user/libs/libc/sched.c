@@ -0,0 +1,49 @@
+#include "sched.h"
+#include "errno.h"
+#include <libsystem/syscall.h>
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param)
+{
+    if (param == NULL)
+        return -EINVAL;
+    return syscall_invoke(SYS_SCHED_SETSCHEDULER, (uint64_t)pid, (uint64_t)policy, (uint64_t)param->sched_priority, 0, 0, 0, 0, 0);
+}
+
+int sched_getscheduler(pid_t pid)
+{
+    return syscall_invoke(SYS_SCHED_GETSCHEDULER, (uint64_t)pid, 0, 0, 0, 0, 0, 0, 0);
+}
+
+int sched_getparam(pid_t pid, struct sched_param *param)
+{
+    if (param == NULL)
+        return -EINVAL;
+    int ret = syscall_invoke(SYS_SCHED_GETPARAM, (uint64_t)pid, 0, 0, 0, 0, 0, 0, 0);
+    if (ret < 0)
+        return ret;
+    param->sched_priority = ret;
+    return 0;
+}
+
+int sched_stat(int which, int id, void *buf)
+{
+    return syscall_invoke(SYS_SCHED_STAT, (uint64_t)which, (uint64_t)id, (uint64_t)buf, 0, 0, 0, 0, 0);
+}
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask)
+{
+    if (mask == NULL || cpusetsize < sizeof(cpu_set_t))
+        return -EINVAL;
+    return syscall_invoke(SYS_SCHED_SETAFFINITY, (uint64_t)pid, mask->__bits[0], 0, 0, 0, 0, 0, 0);
+}
+
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask)
+{
+    if (mask == NULL || cpusetsize < sizeof(cpu_set_t))
+        return -EINVAL;
+    long ret = syscall_invoke(SYS_SCHED_GETAFFINITY, (uint64_t)pid, 0, 0, 0, 0, 0, 0, 0);
+    if (ret < 0)
+        return ret;
+    mask->__bits[0] = ret;
+    return 0;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <libc/stddef.h>
+#include <libc/sys/types.h>
+
+// 进程的调度策略
+#define SCHED_NORMAL 0 // 普通进程，由cfs调度
+#define SCHED_FIFO 1   // 实时进程，先进先出
+#define SCHED_RR 2     // 实时进程，相同优先级的进程按时间片轮转
+
+// cpu_set_t能够表示的cpu数量
+#define CPU_SETSIZE 64
+
+/**
+ * @brief cpu集合（第i位对应cpu i）
+ *
+ */
+typedef struct
+{
+    uint64_t __bits[CPU_SETSIZE / 64];
+} cpu_set_t;
+
+#define CPU_ZERO(set) ((set)->__bits[0] = 0)
+#define CPU_SET(cpu, set) ((set)->__bits[(cpu) / 64] |= (1UL << ((cpu) % 64)))
+#define CPU_CLR(cpu, set) ((set)->__bits[(cpu) / 64] &= ~(1UL << ((cpu) % 64)))
+#define CPU_ISSET(cpu, set) (((set)->__bits[(cpu) / 64] >> ((cpu) % 64)) & 1)
+
+/**
+ * @brief 调度参数
+ *
+ */
+struct sched_param
+{
+    int sched_priority; // 实时优先级（1~99，数值越大优先级越高），普通进程为0
+};
+
+// 调度延迟直方图的桶数量：第0个桶统计小于1微秒的延迟，第i个桶统计[2^(i-1), 2^i)微秒的延迟，最后一个桶包含所有更大的延迟
+#define SCHED_STAT_NR_BUCKETS 20
+
+// sched_stat()查询的对象
+#define SCHED_STAT_CPU 0     // 查询指定cpu的统计信息（struct sched_cpu_stat_t）
+#define SCHED_STAT_PROCESS 1 // 查询指定进程的统计信息（struct sched_proc_stat_t）
+#define SCHED_STAT_FPU 2     // 查询指定cpu的浮点上下文切换统计信息（struct fpu_stat_t）
+
+/**
+ * @brief 每个cpu的调度统计信息
+ *
+ */
+struct sched_cpu_stat_t
+{
+    uint64_t nr_switches;    // 上下文切换的次数
+    uint64_t nr_voluntary;   // 其中由于进程主动让出cpu（睡眠、退出）引起的次数
+    uint64_t nr_involuntary; // 其中由于进程被抢占引起的次数
+    uint64_t nr_wakeups;     // 进程被唤醒并加入该cpu的就绪队列的次数
+    uint64_t idle_time;      // 运行idle进程的累计时间（纳秒）
+    uint64_t run_delay;      // 进程从加入就绪队列到开始运行的累计等待时间（纳秒）
+    uint64_t nr_run_delay;   // run_delay的采样次数
+    uint64_t run_delay_hist[SCHED_STAT_NR_BUCKETS]; // 等待时间的直方图（以微秒为单位的log2分桶）
+    uint64_t rq_len_sum;     // 每次时钟中断时采样的就绪队列长度之和
+    uint64_t rq_len_samples; // 就绪队列长度的采样次数
+    uint64_t rq_len_max;     // 采样到的就绪队列的最大长度
+};
+
+/**
+ * @brief 进程的调度统计信息
+ *
+ */
+struct sched_proc_stat_t
+{
+    uint64_t nvcsw;            // 主动让出cpu的次数
+    uint64_t nivcsw;           // 被抢占的次数
+    uint64_t run_delay;        // 在就绪队列中等待运行的累计时间（纳秒）
+    uint64_t nr_runs;          // 被调度运行的次数
+    uint64_t sum_exec_runtime; // 累计运行时间（纳秒）
+};
+
+/**
+ * @brief 每个cpu的浮点上下文切换统计信息
+ *
+ */
+struct fpu_stat_t
+{
+    uint64_t nr_switches;     // 进程切换的次数
+    uint64_t nr_saves;        // 切换时需要保存浮点上下文的次数
+    uint64_t nr_restores;     // 恢复浮点上下文的次数
+    uint64_t nr_restore_skip; // 寄存器中仍然是该进程的上下文，因而不需要恢复的次数
+    uint64_t nr_traps;        // #NM异常的次数
+    uint64_t nr_allocs;       // 分配浮点上下文保存区域的次数
+};
+
+/**
+ * @brief 设置进程的调度策略与调度参数
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @param policy 调度策略
+ * @param param 调度参数
+ * @return int 错误码
+ */
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+
+/**
+ * @brief 获取进程的调度策略
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @return int 调度策略。失败时返回错误码
+ */
+int sched_getscheduler(pid_t pid);
+
+/**
+ * @brief 获取进程的调度参数
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @param param 返回的调度参数
+ * @return int 错误码
+ */
+int sched_getparam(pid_t pid, struct sched_param *param);
+
+/**
+ * @brief 获取调度器的统计信息
+ *
+ * @param which 查询的对象（SCHED_STAT_CPU、SCHED_STAT_PROCESS或SCHED_STAT_FPU）
+ * @param id cpu编号，或者进程的pid（为0时表示当前进程）
+ * @param buf 返回的统计信息（struct sched_cpu_stat_t、struct sched_proc_stat_t或struct fpu_stat_t）
+ * @return int 错误码。cpu不存在时返回-ENODEV
+ */
+int sched_stat(int which, int id, void *buf);
+
+/**
+ * @brief 设置进程允许运行的cpu
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @param cpusetsize mask的大小
+ * @param mask cpu集合
+ * @return int 错误码
+ */
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
+
+/**
+ * @brief 获取进程允许运行的cpu
+ *
+ * @param pid 进程的pid（为0时表示当前进程）
+ * @param cpusetsize mask的大小
+ * @param mask 返回的cpu集合
+ * @return int 错误码
+ */
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
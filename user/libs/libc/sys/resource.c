@@ -0,0 +1,19 @@
+#include "resource.h"
+#include <libsystem/syscall.h>
+
+int getrusage(int who, struct rusage *usage)
+{
+    return syscall_invoke(SYS_GETRUSAGE, (uint64_t)who, (uint64_t)usage, 0, 0, 0, 0, 0, 0);
+}
+
+int getpriority(int which, int who)
+{
+    // 内核返回20-nice，以免与错误码冲突
+    int ret = (int)syscall_invoke(SYS_GETPRIORITY, (uint64_t)which, (uint64_t)who, 0, 0, 0, 0, 0, 0);
+    return ret < 0 ? ret : 20 - ret;
+}
+
+int setpriority(int which, int who, int prio)
+{
+    return syscall_invoke(SYS_SETPRIORITY, (uint64_t)which, (uint64_t)who, (uint64_t)(long)prio, 0, 0, 0, 0, 0);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <libc/sys/types.h>
+
+#define RUSAGE_SELF 0 // 统计当前进程的资源使用情况
+
+#define PRIO_PROCESS 0 // getpriority/setpriority的对象为单个进程
+
+/**
+ * @brief 进程的资源使用情况
+ *
+ */
+struct rusage
+{
+    uint64_t ru_minflt; // 不需要进行I/O的缺页异常次数
+    uint64_t ru_majflt; // 需要从磁盘读取数据的缺页异常次数
+    uint64_t ru_nvcsw;  // 主动让出cpu的次数
+    uint64_t ru_nivcsw; // 被抢占的次数
+};
+
+/**
+ * @brief 获取进程的资源使用情况
+ *
+ * @param who 统计的对象（目前只支持RUSAGE_SELF）
+ * @param usage 返回的资源使用情况
+ * @return int 错误码
+ */
+int getrusage(int who, struct rusage *usage);
+
+/**
+ * @brief 获取进程的nice值
+ *
+ * @param which 查找的对象的类型（目前只支持PRIO_PROCESS）
+ * @param who 进程的pid（为0时表示当前进程）
+ * @return int nice值（-20~19）。失败时返回错误码
+ */
+int getpriority(int which, int who);
+
+/**
+ * @brief 设置进程的nice值
+ *
+ * @param which 查找的对象的类型（目前只支持PRIO_PROCESS）
+ * @param who 进程的pid（为0时表示当前进程）
+ * @param prio 新的nice值（超出范围时会被截断到-20~19）
+ * @return int 错误码
+ */
+int setpriority(int which, int who, int prio);
@@ -1,6 +1,9 @@
 #pragma once
 #include <libc/sys/types.h>
 
+// 与内核中buddy系统的阶数上限(MM_BUDDY_MAX_ORDER)保持一致
+#define MSTAT_BUDDY_MAX_ORDER 11
+
 /**
  * @brief 系统内存信息结构体（单位：字节）
  *
@@ -14,6 +17,16 @@ struct mstat_t
     uint64_t cache_used;     // 位于slab缓冲区中的已使用的内存大小
     uint64_t cache_free;     // 位于slab缓冲区中的空闲的内存大小
     uint64_t available; // 系统总空闲内存大小（包括kmalloc缓冲区）
+    uint64_t free_blocks[MSTAT_BUDDY_MAX_ORDER]; // 物理页分配器中每一阶的空闲块数量
+    uint64_t frame_total; // 4K页框分配器占用的内存大小
+    uint64_t frame_used;  // 4K页框分配器中已分配的内存大小
+    uint64_t huge_mapped;  // 用户地址空间中以2M页映射的内存大小
+    uint64_t thp_promoted; // 由4K页框合并为2M页的次数
+    uint64_t thp_fallback; // 满足2M对齐却只能使用4K页框映射的次数
+    uint64_t bcache_used;   // 块设备缓冲区缓存占用的内存大小
+    uint64_t bcache_dirty;  // 块设备缓冲区缓存中尚未写回的数据大小
+    uint64_t bcache_hits;   // 块设备缓冲区缓存的命中次数
+    uint64_t bcache_misses; // 块设备缓冲区缓存的未命中次数
 };
 
 int mkdir(const char *path, mode_t mode);